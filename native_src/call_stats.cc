@@ -0,0 +1,329 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/client/call_stats.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "api/peer_connection_interface.h"
+#include "api/scoped_refptr.h"
+#include "api/stats/rtc_stats_report.h"
+#include "api/stats/rtcstats_objects.h"
+#include "api/units/time_delta.h"
+#include "api/units/timestamp.h"
+#include "examples/peerconnection/client/peer_connection_client.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/thread.h"
+
+namespace {
+
+QualityLimitation ParseQualityLimitation(
+    const std::optional<std::string>& reason) {
+  if (!reason || *reason == "none")
+    return QualityLimitation::kNone;
+  if (*reason == "cpu")
+    return QualityLimitation::kCpu;
+  if (*reason == "bandwidth")
+    return QualityLimitation::kBandwidth;
+  return QualityLimitation::kOther;
+}
+
+absl::string_view QualityLimitationName(QualityLimitation limitation) {
+  switch (limitation) {
+    case QualityLimitation::kNone:
+      return "none";
+    case QualityLimitation::kCpu:
+      return "cpu";
+    case QualityLimitation::kBandwidth:
+      return "bandwidth";
+    case QualityLimitation::kOther:
+      return "other";
+  }
+  return "other";
+}
+
+// The growth of a cumulative counter, or 0 if it went back, which it does
+// when a stream is recreated with the same SSRC.
+template <typename T>
+T Growth(T now, T before) {
+  return now > before ? now - before : T{};
+}
+
+bool IsVideo(const std::optional<std::string>& kind) {
+  return kind && *kind == "video";
+}
+
+}  // namespace
+
+std::string FormatCallStats(const CallStatsSample& sample) {
+  std::string out;
+  absl::StrAppend(&out, "{\"time_ms\":", sample.time.ms(),
+                  ",\"interval_ms\":", sample.interval.ms());
+  if (sample.rtt_ms)
+    absl::StrAppend(&out, ",\"rtt_ms\":", *sample.rtt_ms);
+  if (sample.available_outgoing_bitrate_bps) {
+    absl::StrAppend(&out, ",\"available_outgoing_bitrate_bps\":",
+                    *sample.available_outgoing_bitrate_bps);
+  }
+  absl::StrAppend(&out, ",\"streams\":[");
+  for (size_t i = 0; i < sample.streams.size(); ++i) {
+    const CallStatsSample::Stream& stream = sample.streams[i];
+    absl::StrAppend(&out, i ? ",{" : "{", "\"ssrc\":", stream.ssrc,
+                    ",\"direction\":\"",
+                    stream.outbound ? "outbound" : "inbound",
+                    "\",\"kind\":\"", stream.video ? "video" : "audio",
+                    "\",\"bitrate_bps\":", stream.bitrate_bps,
+                    ",\"packets\":", stream.packets);
+    if (stream.video) {
+      absl::StrAppend(&out, ",\"frames\":", stream.frames,
+                      ",\"frame_time_ms\":", stream.frame_time_ms,
+                      ",\"width\":", stream.width,
+                      ",\"height\":", stream.height);
+    }
+    if (stream.outbound && stream.video) {
+      absl::StrAppend(&out, ",\"quality_limitation\":\"",
+                      QualityLimitationName(stream.quality_limitation), "\"");
+    }
+    if (!stream.outbound) {
+      absl::StrAppend(&out, ",\"packets_lost\":", stream.packets_lost,
+                      ",\"jitter_ms\":", stream.jitter_ms,
+                      ",\"jitter_buffer_delay_ms\":",
+                      stream.jitter_buffer_delay_ms);
+      if (stream.video)
+        absl::StrAppend(&out, ",\"frames_dropped\":", stream.frames_dropped);
+    }
+    out += '}';
+  }
+  out += "]}";
+  return out;
+}
+
+// static
+std::unique_ptr<FileCallStatsSink> FileCallStatsSink::Create(
+    const std::string& path) {
+  FILE* file = fopen(path.c_str(), "a");
+  if (!file) {
+    RTC_LOG(LS_ERROR) << "Failed to open " << path << " for call stats";
+    return nullptr;
+  }
+  return std::unique_ptr<FileCallStatsSink>(new FileCallStatsSink(file));
+}
+
+FileCallStatsSink::FileCallStatsSink(FILE* file) : file_(file) {}
+
+FileCallStatsSink::~FileCallStatsSink() {
+  fclose(file_);
+}
+
+void FileCallStatsSink::OnCallStats(const CallStatsSample& sample) {
+  std::string line = FormatCallStats(sample);
+  line += '\n';
+  fwrite(line.data(), 1, line.size(), file_);
+  fflush(file_);
+}
+
+SignalingCallStatsSink::SignalingCallStatsSink(
+    PeerConnectionClient* client,
+    webrtc::Thread* network_thread)
+    : client_(client), network_thread_(network_thread) {
+  RTC_DCHECK(client_);
+  RTC_DCHECK(network_thread_);
+}
+
+void SignalingCallStatsSink::OnCallStats(const CallStatsSample& sample) {
+  PeerConnectionClient* client = client_;
+  network_thread_->PostTask([client, report = FormatCallStats(sample)] {
+    if (client->is_connected() && !client->IsSendingMessage())
+      client->SendStats(report);
+  });
+}
+
+CallStatsCollector::CallStatsCollector(
+    webrtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection,
+    webrtc::Thread* signaling_thread,
+    webrtc::TimeDelta interval,
+    std::shared_ptr<CallStatsSink> sink)
+    : signaling_thread_(signaling_thread),
+      interval_(interval),
+      peer_connection_(std::move(peer_connection)),
+      sink_(std::move(sink)),
+      previous_time_(webrtc::Timestamp::MinusInfinity()) {
+  RTC_DCHECK(peer_connection_);
+  RTC_DCHECK(signaling_thread_);
+  RTC_DCHECK(sink_);
+  RTC_DCHECK_GT(interval_, webrtc::TimeDelta::Zero());
+}
+
+CallStatsCollector::~CallStatsCollector() = default;
+
+void CallStatsCollector::Start() {
+  webrtc::scoped_refptr<CallStatsCollector> self(this);
+  signaling_thread_->PostTask([self] { self->Sample(); });
+}
+
+void CallStatsCollector::Stop() {
+  // Synchronous, so that the call does not outlive its owner's reference.
+  auto stop = [this] {
+    peer_connection_ = nullptr;
+    sink_ = nullptr;
+  };
+  if (signaling_thread_->IsCurrent())
+    stop();
+  else
+    signaling_thread_->BlockingCall(stop);
+}
+
+void CallStatsCollector::Sample() {
+  RTC_DCHECK(signaling_thread_->IsCurrent());
+  if (!peer_connection_)
+    return;
+  peer_connection_->GetStats(this);
+  webrtc::scoped_refptr<CallStatsCollector> self(this);
+  signaling_thread_->PostDelayedTask([self] { self->Sample(); }, interval_);
+}
+
+void CallStatsCollector::OnStatsDelivered(
+    const webrtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
+  RTC_DCHECK(signaling_thread_->IsCurrent());
+  if (!peer_connection_)
+    return;
+
+  sample_.time = report->timestamp();
+  sample_.interval = previous_time_.IsFinite()
+                         ? sample_.time - previous_time_
+                         : webrtc::TimeDelta::Zero();
+  sample_.rtt_ms.reset();
+  sample_.available_outgoing_bitrate_bps.reset();
+  sample_.streams.clear();
+  current_.clear();
+
+  for (const webrtc::RTCIceCandidatePairStats* pair :
+       report->GetStatsOfType<webrtc::RTCIceCandidatePairStats>()) {
+    if (!pair->nominated.value_or(false) || !pair->state ||
+        *pair->state != "succeeded") {
+      continue;
+    }
+    if (pair->current_round_trip_time)
+      sample_.rtt_ms = *pair->current_round_trip_time * 1000;
+    if (pair->available_outgoing_bitrate) {
+      sample_.available_outgoing_bitrate_bps =
+          static_cast<int64_t>(*pair->available_outgoing_bitrate);
+    }
+    break;
+  }
+
+  for (const webrtc::RTCOutboundRtpStreamStats* rtp :
+       report->GetStatsOfType<webrtc::RTCOutboundRtpStreamStats>()) {
+    if (!rtp->ssrc)
+      continue;
+    StreamCounters counters = {};
+    counters.ssrc = *rtp->ssrc;
+    counters.outbound = true;
+    counters.bytes = rtp->bytes_sent.value_or(0);
+    counters.packets = rtp->packets_sent.value_or(0);
+    counters.frames = rtp->frames_encoded.value_or(0);
+    counters.frame_time_s = rtp->total_encode_time.value_or(0);
+
+    CallStatsSample::Stream stream;
+    stream.video = IsVideo(rtp->kind);
+    stream.width = static_cast<int>(rtp->frame_width.value_or(0));
+    stream.height = static_cast<int>(rtp->frame_height.value_or(0));
+    if (stream.video) {
+      stream.quality_limitation =
+          ParseQualityLimitation(rtp->quality_limitation_reason);
+    }
+    AddStream(counters, &stream);
+  }
+
+  for (const webrtc::RTCInboundRtpStreamStats* rtp :
+       report->GetStatsOfType<webrtc::RTCInboundRtpStreamStats>()) {
+    if (!rtp->ssrc)
+      continue;
+    StreamCounters counters = {};
+    counters.ssrc = *rtp->ssrc;
+    counters.outbound = false;
+    counters.bytes = rtp->bytes_received.value_or(0);
+    counters.packets = rtp->packets_received.value_or(0);
+    counters.frames = rtp->frames_decoded.value_or(0);
+    counters.frame_time_s = rtp->total_decode_time.value_or(0);
+    counters.packets_lost = rtp->packets_lost.value_or(0);
+    counters.jitter_buffer_delay_s = rtp->jitter_buffer_delay.value_or(0);
+    counters.jitter_buffer_emitted =
+        rtp->jitter_buffer_emitted_count.value_or(0);
+    counters.frames_dropped = rtp->frames_dropped.value_or(0);
+
+    CallStatsSample::Stream stream;
+    stream.video = IsVideo(rtp->kind);
+    stream.width = static_cast<int>(rtp->frame_width.value_or(0));
+    stream.height = static_cast<int>(rtp->frame_height.value_or(0));
+    stream.jitter_ms = rtp->jitter.value_or(0) * 1000;
+    AddStream(counters, &stream);
+  }
+
+  // The first report only provides the counters to compute changes from.
+  if (sample_.interval > webrtc::TimeDelta::Zero())
+    sink_->OnCallStats(sample_);
+
+  previous_.swap(current_);
+  previous_time_ = sample_.time;
+}
+
+void CallStatsCollector::AddStream(const StreamCounters& counters,
+                                   CallStatsSample::Stream* stream) {
+  current_.push_back(counters);
+  const StreamCounters* previous =
+      FindPrevious(counters.ssrc, counters.outbound);
+  if (!previous || sample_.interval <= webrtc::TimeDelta::Zero())
+    return;
+
+  stream->ssrc = counters.ssrc;
+  stream->outbound = counters.outbound;
+  stream->bitrate_bps = static_cast<int64_t>(
+      Growth(counters.bytes, previous->bytes) * 8 * 1000000 /
+      sample_.interval.us());
+  stream->packets = Growth(counters.packets, previous->packets);
+  stream->frames = Growth(counters.frames, previous->frames);
+  if (stream->frames) {
+    stream->frame_time_ms =
+        Growth(counters.frame_time_s, previous->frame_time_s) * 1000 /
+        stream->frames;
+  }
+  stream->packets_lost = counters.packets_lost - previous->packets_lost;
+  uint64_t emitted =
+      Growth(counters.jitter_buffer_emitted, previous->jitter_buffer_emitted);
+  if (emitted) {
+    stream->jitter_buffer_delay_ms =
+        Growth(counters.jitter_buffer_delay_s,
+               previous->jitter_buffer_delay_s) *
+        1000 / emitted;
+  }
+  stream->frames_dropped =
+      Growth(counters.frames_dropped, previous->frames_dropped);
+  sample_.streams.push_back(*stream);
+}
+
+const CallStatsCollector::StreamCounters* CallStatsCollector::FindPrevious(
+    uint32_t ssrc,
+    bool outbound) const {
+  // A call has a handful of streams, so a scan beats any map.
+  for (const StreamCounters& counters : previous_) {
+    if (counters.ssrc == ssrc && counters.outbound == outbound)
+      return &counters;
+  }
+  return nullptr;
+}
@@ -0,0 +1,173 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_CLIENT_CALL_STATS_H_
+#define EXAMPLES_PEERCONNECTION_CLIENT_CALL_STATS_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "api/peer_connection_interface.h"
+#include "api/scoped_refptr.h"
+#include "api/stats/rtc_stats_collector_callback.h"
+#include "api/stats/rtc_stats_report.h"
+#include "api/units/time_delta.h"
+#include "api/units/timestamp.h"
+#include "rtc_base/thread.h"
+
+class PeerConnectionClient;
+
+// What limits the resolution or frame rate of an outgoing video stream.
+enum class QualityLimitation {
+  kNone,
+  kCpu,
+  kBandwidth,
+  kOther,
+};
+
+// The media path of a call over one sampling interval.
+struct CallStatsSample {
+  // One RTP stream.  Counts and averages cover the interval.
+  struct Stream {
+    uint32_t ssrc = 0;
+    bool outbound = false;
+    bool video = false;
+    int64_t bitrate_bps = 0;
+    uint64_t packets = 0;
+    // Frames encoded or decoded, and the time that took per frame.
+    uint64_t frames = 0;
+    double frame_time_ms = 0;
+    int width = 0;
+    int height = 0;
+    // Outbound video only.
+    QualityLimitation quality_limitation = QualityLimitation::kNone;
+    // Inbound only.  The jitter buffer delay is the average of the samples
+    // that left it in the interval.
+    int64_t packets_lost = 0;
+    double jitter_ms = 0;
+    double jitter_buffer_delay_ms = 0;
+    uint64_t frames_dropped = 0;
+  };
+
+  webrtc::Timestamp time = webrtc::Timestamp::Zero();
+  webrtc::TimeDelta interval = webrtc::TimeDelta::Zero();
+  // Of the selected candidate pair.
+  std::optional<double> rtt_ms;
+  std::optional<int64_t> available_outgoing_bitrate_bps;
+  std::vector<Stream> streams;
+};
+
+// Returns `sample` as a single line of JSON, without a newline.
+std::string FormatCallStats(const CallStatsSample& sample);
+
+// Receives the samples of a CallStatsCollector on the signaling thread.
+class CallStatsSink {
+ public:
+  virtual ~CallStatsSink() {}
+
+  virtual void OnCallStats(const CallStatsSample& sample) = 0;
+};
+
+// Appends each sample to a file as a line of JSON.
+class FileCallStatsSink : public CallStatsSink {
+ public:
+  // Returns null if `path` cannot be opened for appending.
+  static std::unique_ptr<FileCallStatsSink> Create(const std::string& path);
+  ~FileCallStatsSink() override;
+
+  void OnCallStats(const CallStatsSample& sample) override;
+
+ private:
+  explicit FileCallStatsSink(FILE* file);
+
+  FILE* const file_;
+};
+
+// Uploads each sample to the signaling server as a /stats request, which
+// `client` sends on `network_thread`.  Samples are dropped while signaling
+// messages are waiting to go out, so that they never delay the call.  Both
+// must outlive the sink.
+class SignalingCallStatsSink : public CallStatsSink {
+ public:
+  SignalingCallStatsSink(PeerConnectionClient* client,
+                         webrtc::Thread* network_thread);
+
+  void OnCallStats(const CallStatsSample& sample) override;
+
+ private:
+  PeerConnectionClient* const client_;
+  webrtc::Thread* const network_thread_;
+};
+
+// Samples the statistics of a call every `interval` and hands the changes
+// since the previous sample to a sink.  Runs on the signaling thread of the
+// call.  The cumulative counters of each stream are kept by SSRC between
+// samples, so a sample looks nothing up by the string keys of the report.
+class CallStatsCollector : public webrtc::RTCStatsCollectorCallback {
+ public:
+  CallStatsCollector(
+      webrtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection,
+      webrtc::Thread* signaling_thread,
+      webrtc::TimeDelta interval,
+      std::shared_ptr<CallStatsSink> sink);
+
+  // May be called from any thread.  No more samples are delivered once
+  // Stop() has been called.
+  void Start();
+  void Stop();
+
+  // RTCStatsCollectorCallback implementation.
+  void OnStatsDelivered(
+      const webrtc::scoped_refptr<const webrtc::RTCStatsReport>& report)
+      override;
+
+ protected:
+  ~CallStatsCollector() override;
+
+  // The cumulative counters of a stream at the previous sample.
+  struct StreamCounters {
+    uint32_t ssrc;
+    bool outbound;
+    uint64_t bytes;
+    uint64_t packets;
+    uint64_t frames;
+    double frame_time_s;
+    int64_t packets_lost;
+    double jitter_buffer_delay_s;
+    uint64_t jitter_buffer_emitted;
+    uint64_t frames_dropped;
+  };
+
+  void Sample();
+
+  // Adds the change of `counters` since the previous sample to the sample
+  // as a stream, if the stream was seen before.
+  void AddStream(const StreamCounters& counters,
+                 CallStatsSample::Stream* stream);
+
+  const StreamCounters* FindPrevious(uint32_t ssrc, bool outbound) const;
+
+  webrtc::Thread* const signaling_thread_;
+  const webrtc::TimeDelta interval_;
+  // Signaling thread only.  Cleared by Stop().
+  webrtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection_;
+  std::shared_ptr<CallStatsSink> sink_;
+  webrtc::Timestamp previous_time_;
+  std::vector<StreamCounters> previous_;
+  std::vector<StreamCounters> current_;
+  // Reused for every sample.
+  CallStatsSample sample_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_CLIENT_CALL_STATS_H_
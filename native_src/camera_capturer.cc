@@ -0,0 +1,285 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/client/camera_capturer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "api/scoped_refptr.h"
+#include "api/video/i420_buffer.h"
+#include "api/video/nv12_buffer.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_frame_buffer.h"
+#include "api/video/video_rotation.h"
+#include "api/video/video_sink_interface.h"
+#include "api/video/video_source_interface.h"
+#include "common_video/libyuv/include/webrtc_libyuv.h"
+#include "modules/video_capture/video_capture.h"
+#include "modules/video_capture/video_capture_defines.h"
+#include "modules/video_capture/video_capture_factory.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/synchronization/mutex.h"
+#include "rtc_base/time_utils.h"
+#include "third_party/libyuv/include/libyuv/convert.h"
+#include "third_party/libyuv/include/libyuv/rotate.h"
+#include "third_party/libyuv/include/libyuv/scale.h"
+#include "third_party/libyuv/include/libyuv/scale_uv.h"
+
+namespace {
+
+// Frames the encoder and the local renderer may hold on to at once.  When
+// all are in use the new frame is dropped rather than allocating another.
+constexpr size_t kMaxBuffers = 16;
+
+// Offset of a crop of `cropped` out of `size`, centered and even so that
+// the chroma planes line up.
+int CropOffset(int size, int cropped) {
+  return ((size - cropped) / 2) & ~1;
+}
+
+}  // namespace
+
+std::unique_ptr<CameraCapturer> CameraCapturer::Create(size_t device_index,
+                                                       int max_width,
+                                                       int max_height,
+                                                       int max_fps) {
+  std::unique_ptr<webrtc::VideoCaptureModule::DeviceInfo> info(
+      webrtc::VideoCaptureFactory::CreateDeviceInfo());
+  if (!info || device_index >= info->NumberOfDevices())
+    return nullptr;
+
+  char name[256];
+  char unique_id[256];
+  if (info->GetDeviceName(static_cast<uint32_t>(device_index), name,
+                          sizeof(name), unique_id, sizeof(unique_id)) != 0) {
+    return nullptr;
+  }
+
+  std::unique_ptr<CameraCapturer> capturer(new CameraCapturer(
+      std::move(info), unique_id, max_width, max_height, max_fps));
+  if (!capturer->Start())
+    return nullptr;
+  RTC_LOG(LS_INFO) << "Capturing from " << name;
+  return capturer;
+}
+
+CameraCapturer::CameraCapturer(
+    std::unique_ptr<webrtc::VideoCaptureModule::DeviceInfo> info,
+    const std::string& unique_id,
+    int max_width,
+    int max_height,
+    int max_fps)
+    : info_(std::move(info)),
+      unique_id_(unique_id),
+      max_width_(max_width),
+      max_height_(max_height),
+      max_fps_(max_fps),
+      decode_pool_(/*zero_initialize=*/false, kMaxBuffers),
+      pool_(/*zero_initialize=*/false, kMaxBuffers) {
+  RTC_DCHECK(info_);
+  RTC_DCHECK_GT(max_width_, 0);
+  RTC_DCHECK_GT(max_height_, 0);
+  RTC_DCHECK_GT(max_fps_, 0);
+  // The camera mode is picked from a discrete set, so the adapter takes
+  // care of whatever the mode overshoots.
+  adapter_.OnOutputFormatRequest(std::nullopt, max_width_ * max_height_,
+                                 max_fps_);
+}
+
+CameraCapturer::~CameraCapturer() {
+  if (module_) {
+    module_->StopCapture();
+    module_->DeRegisterCaptureDataCallback();
+  }
+}
+
+void CameraCapturer::AddOrUpdateSink(
+    webrtc::VideoSinkInterface<webrtc::VideoFrame>* sink,
+    const webrtc::VideoSinkWants& wants) {
+  broadcaster_.AddOrUpdateSink(sink, wants);
+  UpdateCapability();
+}
+
+void CameraCapturer::RemoveSink(
+    webrtc::VideoSinkInterface<webrtc::VideoFrame>* sink) {
+  broadcaster_.RemoveSink(sink);
+  UpdateCapability();
+}
+
+bool CameraCapturer::Start() {
+  module_ = webrtc::VideoCaptureFactory::Create(unique_id_.c_str());
+  if (!module_)
+    return false;
+  module_->RegisterCaptureDataCallback(
+      static_cast<webrtc::RawVideoSinkInterface*>(this));
+  return UpdateCapability();
+}
+
+bool CameraCapturer::UpdateCapability() {
+  webrtc::VideoSinkWants wants = broadcaster_.wants();
+  adapter_.OnSinkWants(wants);
+
+  // Ask for no more than the sinks want.  Of the modes that are at least
+  // that large the camera picks the smallest, uncompressed ones first and
+  // NV12 above all.
+  webrtc::VideoCaptureCapability requested;
+  requested.width = max_width_;
+  requested.height = max_height_;
+  requested.maxFPS = std::min(max_fps_, wants.max_framerate_fps);
+  requested.videoType = webrtc::VideoType::kNV12;
+  int pixels = wants.target_pixel_count.value_or(wants.max_pixel_count);
+  if (pixels < max_width_ * max_height_) {
+    double scale = std::sqrt(static_cast<double>(pixels) /
+                             (max_width_ * max_height_));
+    requested.width = std::max(1, static_cast<int>(max_width_ * scale));
+    requested.height = std::max(1, static_cast<int>(max_height_ * scale));
+  }
+
+  webrtc::VideoCaptureCapability best;
+  if (info_->GetBestMatchedCapability(unique_id_.c_str(), requested, best) <
+      0) {
+    RTC_LOG(LS_WARNING) << "No capture mode for " << requested.width << "x"
+                        << requested.height << "@" << requested.maxFPS;
+    return false;
+  }
+
+  webrtc::MutexLock lock(&capability_lock_);
+  if (module_->CaptureStarted() && best.width == capability_.width &&
+      best.height == capability_.height &&
+      best.maxFPS == capability_.maxFPS &&
+      best.videoType == capability_.videoType) {
+    return true;
+  }
+
+  // Restarting the camera costs a few frames, but only happens when the
+  // wants cross from one of its modes into another.
+  module_->StopCapture();
+  if (module_->StartCapture(best) != 0) {
+    RTC_LOG(LS_WARNING) << "Failed to capture " << best.width << "x"
+                        << best.height << "@" << best.maxFPS;
+    if (capability_.width > 0)
+      module_->StartCapture(capability_);
+    return false;
+  }
+  capability_ = best;
+  RTC_LOG(LS_INFO) << "Capturing " << best.width << "x" << best.height << "@"
+                   << best.maxFPS << " in format "
+                   << static_cast<int>(best.videoType);
+  return true;
+}
+
+int32_t CameraCapturer::OnRawFrame(
+    uint8_t* data,
+    size_t length,
+    const webrtc::VideoCaptureCapability& capability,
+    webrtc::VideoRotation rotation,
+    int64_t /*capture_time_ms*/) {
+  int64_t time_us = webrtc::TimeMicros();
+  int crop_width;
+  int crop_height;
+  int out_width;
+  int out_height;
+  // Dropping frames here is how the frame rate the sinks want is met.
+  if (!adapter_.AdaptFrameResolution(
+          capability.width, std::abs(capability.height),
+          time_us * webrtc::kNumNanosecsPerMicrosec, &crop_width,
+          &crop_height, &out_width, &out_height)) {
+    return 0;
+  }
+
+  webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer = Convert(
+      data, length, capability, crop_width, crop_height, out_width,
+      out_height);
+  if (!buffer)
+    return -1;
+
+  broadcaster_.OnFrame(webrtc::VideoFrame::Builder()
+                           .set_video_frame_buffer(buffer)
+                           .set_rotation(rotation)
+                           .set_timestamp_us(time_us)
+                           .build());
+  return 0;
+}
+
+webrtc::scoped_refptr<webrtc::VideoFrameBuffer> CameraCapturer::Convert(
+    const uint8_t* data,
+    size_t length,
+    const webrtc::VideoCaptureCapability& capability,
+    int crop_width,
+    int crop_height,
+    int out_width,
+    int out_height) {
+  const int width = capability.width;
+  const int height = std::abs(capability.height);
+  const int crop_x = CropOffset(width, crop_width);
+  const int crop_y = CropOffset(height, crop_height);
+
+  // NV12 is what the encoders take, so it is only cropped and scaled, in
+  // one pass per plane.  Bottom-up frames take the libyuv path below.
+  if (capability.videoType == webrtc::VideoType::kNV12 &&
+      capability.height > 0) {
+    const int uv_stride = (width + 1) / 2 * 2;
+    if (length < static_cast<size_t>(width * height +
+                                     uv_stride * ((height + 1) / 2))) {
+      return nullptr;
+    }
+    webrtc::scoped_refptr<webrtc::NV12Buffer> buffer =
+        pool_.CreateNV12Buffer(out_width, out_height);
+    if (!buffer)
+      return nullptr;
+    libyuv::ScalePlane(data + crop_y * width + crop_x, width, crop_width,
+                       crop_height, buffer->MutableDataY(), buffer->StrideY(),
+                       out_width, out_height, libyuv::kFilterBox);
+    libyuv::UVScale(
+        data + width * height + crop_y / 2 * uv_stride + crop_x, uv_stride,
+        (crop_width + 1) / 2, (crop_height + 1) / 2, buffer->MutableDataUV(),
+        buffer->StrideUV(), (out_width + 1) / 2, (out_height + 1) / 2,
+        libyuv::kFilterBox);
+    return buffer;
+  }
+
+  // Everything else, MJPEG included, is decoded and cropped straight into a
+  // pooled I420 buffer, and scaled only if the camera mode is larger than
+  // the sinks want.
+  bool scale = crop_width != out_width || crop_height != out_height;
+  webrtc::scoped_refptr<webrtc::I420Buffer> buffer =
+      scale ? decode_pool_.CreateI420Buffer(crop_width, crop_height)
+            : pool_.CreateI420Buffer(crop_width, crop_height);
+  if (!buffer)
+    return nullptr;
+  if (libyuv::ConvertToI420(
+          data, length, buffer->MutableDataY(), buffer->StrideY(),
+          buffer->MutableDataU(), buffer->StrideU(), buffer->MutableDataV(),
+          buffer->StrideV(), crop_x, crop_y, width, capability.height,
+          crop_width, crop_height, libyuv::kRotate0,
+          webrtc::ConvertVideoType(capability.videoType)) < 0) {
+    RTC_LOG(LS_WARNING) << "Failed to convert a frame in format "
+                        << static_cast<int>(capability.videoType);
+    return nullptr;
+  }
+  if (!scale)
+    return buffer;
+
+  webrtc::scoped_refptr<webrtc::I420Buffer> scaled =
+      pool_.CreateI420Buffer(out_width, out_height);
+  if (!scaled)
+    return nullptr;
+  scaled->ScaleFrom(*buffer);
+  return scaled;
+}
@@ -0,0 +1,109 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_CLIENT_CAMERA_CAPTURER_H_
+#define EXAMPLES_PEERCONNECTION_CLIENT_CAMERA_CAPTURER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "api/scoped_refptr.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_rotation.h"
+#include "api/video/video_sink_interface.h"
+#include "api/video/video_source_interface.h"
+#include "common_video/include/video_frame_buffer_pool.h"
+#include "media/base/video_adapter.h"
+#include "media/base/video_broadcaster.h"
+#include "modules/video_capture/raw_video_sink_interface.h"
+#include "modules/video_capture/video_capture.h"
+#include "modules/video_capture/video_capture_defines.h"
+#include "rtc_base/synchronization/mutex.h"
+#include "rtc_base/thread_annotations.h"
+
+// Captures from a camera in the camera's own format.  The raw frames are
+// converted once, straight into pooled buffers: NV12 is kept as NV12, and
+// MJPEG, YUY2 and the like are decoded into I420 while cropping to the
+// aspect ratio the sinks want.  The camera runs in the mode that best
+// matches what the sinks ask for, so that when the encoder adapts down the
+// camera delivers smaller frames instead of the frames being scaled.
+class CameraCapturer : public webrtc::VideoSourceInterface<webrtc::VideoFrame>,
+                       public webrtc::RawVideoSinkInterface {
+ public:
+  // Opens camera `device_index` and starts capturing in the mode that is
+  // closest to `max_width` x `max_height` at `max_fps`.  Frames are never
+  // larger or more frequent than that.  Returns null if the camera can't be
+  // opened.
+  static std::unique_ptr<CameraCapturer> Create(size_t device_index,
+                                                int max_width,
+                                                int max_height,
+                                                int max_fps);
+
+  CameraCapturer(const CameraCapturer&) = delete;
+  CameraCapturer& operator=(const CameraCapturer&) = delete;
+  ~CameraCapturer() override;
+
+  // VideoSourceInterface implementation.
+  void AddOrUpdateSink(webrtc::VideoSinkInterface<webrtc::VideoFrame>* sink,
+                       const webrtc::VideoSinkWants& wants) override;
+  void RemoveSink(
+      webrtc::VideoSinkInterface<webrtc::VideoFrame>* sink) override;
+
+  // RawVideoSinkInterface implementation.  Called on the capture thread.
+  int32_t OnRawFrame(uint8_t* data,
+                     size_t length,
+                     const webrtc::VideoCaptureCapability& capability,
+                     webrtc::VideoRotation rotation,
+                     int64_t capture_time_ms) override;
+
+ private:
+  CameraCapturer(std::unique_ptr<webrtc::VideoCaptureModule::DeviceInfo> info,
+                 const std::string& unique_id,
+                 int max_width,
+                 int max_height,
+                 int max_fps);
+
+  bool Start();
+  // Moves the camera to the mode that best matches the wants of the sinks.
+  // Returns false if it isn't capturing in that mode.
+  bool UpdateCapability();
+  // The frame cropped and scaled into a pooled buffer, or null if it
+  // couldn't be converted.  Capture thread only.
+  webrtc::scoped_refptr<webrtc::VideoFrameBuffer> Convert(
+      const uint8_t* data,
+      size_t length,
+      const webrtc::VideoCaptureCapability& capability,
+      int crop_width,
+      int crop_height,
+      int out_width,
+      int out_height);
+
+  const std::unique_ptr<webrtc::VideoCaptureModule::DeviceInfo> info_;
+  const std::string unique_id_;
+  const int max_width_;
+  const int max_height_;
+  const int max_fps_;
+  webrtc::scoped_refptr<webrtc::VideoCaptureModule> module_;
+
+  webrtc::Mutex capability_lock_;
+  webrtc::VideoCaptureCapability capability_
+      RTC_GUARDED_BY(capability_lock_);
+
+  webrtc::VideoBroadcaster broadcaster_;
+  webrtc::VideoAdapter adapter_;
+  // Buffers of frames decoded at the camera's size before scaling, and of
+  // the frames handed to the sinks.  Capture thread only.
+  webrtc::VideoFrameBufferPool decode_pool_;
+  webrtc::VideoFrameBufferPool pool_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_CLIENT_CAMERA_CAPTURER_H_
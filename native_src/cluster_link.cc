@@ -0,0 +1,529 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/server/cluster_link.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "examples/peerconnection/server/data_socket.h"
+#include "examples/peerconnection/server/event_loop.h"
+#include "examples/peerconnection/server/http_request_parser.h"
+#include "examples/peerconnection/server/server_log.h"
+#include "rtc_base/checks.h"
+
+#if defined(WEBRTC_POSIX)
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>  // IWYU pragma: keep
+#endif
+
+#if defined(MSG_NOSIGNAL)
+static const int kSendFlags = MSG_NOSIGNAL;
+#else
+static const int kSendFlags = 0;
+#endif
+
+// A node whose link stays down is retried this often.
+static const int kReconnectDelayMs = 1000;
+
+// A node that does not keep up with reading loses its link, and with it the
+// presence of this node's peers, rather than buffering without bound.
+static const size_t kMaxLinkBacklog = 16 * 1024 * 1024;
+
+namespace {
+
+bool IsBlockingError() {
+#if defined(WIN32)
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+bool IsConnectInProgress() {
+#if defined(WIN32)
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  return errno == EINPROGRESS;
+#endif
+}
+
+int ParseInt(absl::string_view value, int fallback) {
+  int result;
+  return absl::SimpleAtoi(value, &result) ? result : fallback;
+}
+
+// Room names are whatever the peers put in their /sign_in query, which may
+// hold characters that end or corrupt a request line.  They are sent
+// percent-encoded, '%' included, and decoded again on arrival.
+std::string EscapeQueryValue(absl::string_view value) {
+  static const char kHexDigits[] = "0123456789ABCDEF";
+  std::string escaped;
+  escaped.reserve(value.size());
+  for (char c : value) {
+    if (absl::ascii_isalnum(c) || c == '-' || c == '.' || c == '_' ||
+        c == '~') {
+      escaped += c;
+    } else {
+      unsigned char byte = static_cast<unsigned char>(c);
+      escaped += '%';
+      escaped += kHexDigits[byte >> 4];
+      escaped += kHexDigits[byte & 0xf];
+    }
+  }
+  return escaped;
+}
+
+int HexValue(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+std::string UnescapeQueryValue(absl::string_view value) {
+  std::string unescaped;
+  unescaped.reserve(value.size());
+  for (size_t i = 0; i < value.size(); ++i) {
+    if (value[i] == '%' && i + 2 < value.size()) {
+      int high = HexValue(value[i + 1]);
+      int low = HexValue(value[i + 2]);
+      if (high >= 0 && low >= 0) {
+        unescaped += static_cast<char>(high << 4 | low);
+        i += 2;
+        continue;
+      }
+    }
+    unescaped += value[i];
+  }
+  return unescaped;
+}
+
+}  // namespace
+
+ClusterLink::ClusterLink(int node_index, const std::vector<Node>& nodes)
+    : node_index_(node_index),
+      nodes_(nodes),
+      observer_(nullptr),
+      node_sockets_(nodes.size(), nullptr),
+      wakeup_pending_(false),
+      quit_(false) {
+  RTC_DCHECK_GE(node_index_, 0);
+  RTC_DCHECK_LT(static_cast<size_t>(node_index_), nodes_.size());
+  for (size_t i = 0; i < nodes_.size(); ++i)
+    peers_.push_back(std::make_unique<Peer>());
+}
+
+ClusterLink::~ClusterLink() {
+  Shutdown();
+}
+
+bool ClusterLink::Init() {
+  for (int node = 0; node < num_nodes(); ++node) {
+    if (node == node_index_)
+      continue;
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(nodes_[node].host.c_str(), nullptr, &hints, &result) !=
+            0 ||
+        !result) {
+      printf("Failed to resolve cluster node %s\n", nodes_[node].host.c_str());
+      return false;
+    }
+    Peer* peer = peers_[node].get();
+    memcpy(&peer->address, result->ai_addr, sizeof(peer->address));
+    peer->address.sin_port = htons(nodes_[node].port);
+    freeaddrinfo(result);
+  }
+
+  event_loop_ = EventLoop::Create();
+  if (!event_loop_) {
+    printf("Failed to create the cluster event loop\n");
+    return false;
+  }
+
+  if (!listener_.Create() || !listener_.Listen(nodes_[node_index_].port,
+                                               /*reuse_port=*/false)) {
+    printf("Failed to listen on cluster port %i\n", nodes_[node_index_].port);
+    return false;
+  }
+
+  if (!wakeup_.Create()) {
+    printf("Failed to create wakeup socket\n");
+    return false;
+  }
+
+  return event_loop_->Add(&listener_) && event_loop_->Add(&wakeup_);
+}
+
+void ClusterLink::Run() {
+  std::vector<EventLoop::Event> ready;
+  while (!quit_) {
+    ready.clear();
+    if (!event_loop_->Wait(ConnectPeers(), &ready)) {
+      SERVER_LOG(LS_ERROR, "wait failed\n");
+      break;
+    }
+
+    for (const EventLoop::Event& event : ready) {
+      if (event.socket == &listener_) {
+        AcceptConnection();
+      } else if (event.socket == &wakeup_) {
+        wakeup_.Drain();
+        wakeup_pending_ = false;
+        SendPendingRecords();
+      } else {
+        int node = 0;
+        while (node < num_nodes() && peers_[node].get() != event.socket)
+          ++node;
+        if (node < num_nodes()) {
+          OnPeerEvent(node, event);
+          continue;
+        }
+        DataSocket* s = static_cast<DataSocket*>(event.socket);
+        // An earlier event of this round may have closed the connection.
+        if (incoming_.find(s) == incoming_.end())
+          continue;
+        if (event.writable && !s->OnWritable()) {
+          CloseIncoming(s);
+          continue;
+        }
+        if (event.readable)
+          OnIncomingReadable(s);
+      }
+      if (quit_)
+        break;
+    }
+  }
+
+  Shutdown();
+}
+
+void ClusterLink::Quit() {
+  quit_ = true;
+  if (wakeup_.valid())
+    wakeup_.Signal();
+}
+
+void ClusterLink::SendMemberChanged(int node,
+                                    int id,
+                                    const std::string& room,
+                                    const SharedPayload& entry,
+                                    bool connected) {
+  RTC_DCHECK(entry);
+  Record record;
+  record.node = node;
+  record.head = absl::StrCat(
+      "POST /cluster/presence?id=", id, "&connected=", connected ? 1 : 0,
+      "&room=", EscapeQueryValue(room),
+      " HTTP/1.1\r\nContent-Type: text/plain\r\nContent-Length: ",
+      entry->size(), "\r\n\r\n");
+  record.body = entry;
+  Post(std::move(record));
+}
+
+void ClusterLink::SendMessage(int from_id,
+                              int to_id,
+                              absl::string_view content_type,
+                              const SharedPayload& data) {
+  RTC_DCHECK(data);
+  RTC_DCHECK(!content_type.empty());
+  Record record;
+  record.node = NodeOfMember(to_id);
+  RTC_DCHECK_NE(record.node, node_index_);
+  record.head = absl::StrCat("POST /cluster/message?from=", from_id,
+                             "&to=", to_id, " HTTP/1.1\r\nContent-Type: ",
+                             content_type, "\r\nContent-Length: ", data->size(),
+                             "\r\n\r\n");
+  record.body = data;
+  Post(std::move(record));
+}
+
+void ClusterLink::Post(Record record) {
+  records_.Push(std::move(record));
+  if (!wakeup_pending_.exchange(true))
+    wakeup_.Signal();
+}
+
+void ClusterLink::SendPendingRecords() {
+  Record record;
+  while (records_.Pop(&record)) {
+    if (record.node != -1) {
+      Append(peers_[record.node].get(), record);
+      continue;
+    }
+    for (int node = 0; node < num_nodes(); ++node) {
+      if (node != node_index_)
+        Append(peers_[node].get(), record);
+    }
+  }
+
+  for (int node = 0; node < num_nodes(); ++node) {
+    if (node != node_index_ && peers_[node]->state == Peer::CONNECTED)
+      FlushPeer(node);
+  }
+}
+
+void ClusterLink::Append(Peer* peer, const Record& record) {
+  // Presence is sent in full once the link is up again, and messages for
+  // an unreachable node are lost like those for a peer that is gone.
+  if (peer->state == Peer::DISCONNECTED)
+    return;
+  peer->output += record.head;
+  peer->output += *record.body;
+}
+
+int ClusterLink::ConnectPeers() {
+  TimeoutQueue::Clock::time_point now = TimeoutQueue::Clock::now();
+  int timeout = -1;
+  for (int node = 0; node < num_nodes(); ++node) {
+    Peer* peer = peers_[node].get();
+    if (node == node_index_ || peer->state != Peer::DISCONNECTED)
+      continue;
+    if (peer->retry_at <= now && StartConnect(node))
+      continue;
+    if (peer->retry_at <= now)
+      peer->retry_at = now + std::chrono::milliseconds(kReconnectDelayMs);
+    int wait = static_cast<int>(
+        std::chrono::ceil<std::chrono::milliseconds>(peer->retry_at - now)
+            .count());
+    if (timeout == -1 || wait < timeout)
+      timeout = wait;
+  }
+  return timeout;
+}
+
+bool ClusterLink::StartConnect(int node) {
+  Peer* peer = peers_[node].get();
+  RTC_DCHECK_EQ(peer->state, Peer::DISCONNECTED);
+  if (!peer->Create() || !peer->SetNonBlocking()) {
+    peer->Close();
+    return false;
+  }
+  if (connect(peer->socket(), reinterpret_cast<const sockaddr*>(&peer->address),
+              sizeof(peer->address)) == SOCKET_ERROR &&
+      !IsConnectInProgress()) {
+    peer->Close();
+    return false;
+  }
+  if (!event_loop_->Add(peer) || !event_loop_->SetWriteInterest(peer, true)) {
+    event_loop_->Remove(peer);
+    peer->Close();
+    return false;
+  }
+  peer->state = Peer::CONNECTING;
+  peer->output = absl::StrCat("GET /cluster/hello?node=", node_index_,
+                              "&nodes=", num_nodes(), " HTTP/1.1\r\n\r\n");
+  peer->output_sent = 0;
+  return true;
+}
+
+void ClusterLink::OnPeerEvent(int node, const EventLoop::Event& event) {
+  Peer* peer = peers_[node].get();
+  if (peer->state == Peer::CONNECTING) {
+    int error = 0;
+    socklen_t size = sizeof(error);
+    if (getsockopt(peer->socket(), SOL_SOCKET, SO_ERROR,
+                   reinterpret_cast<char*>(&error), &size) != 0 ||
+        error != 0) {
+      DisconnectPeer(node);
+      return;
+    }
+    SERVER_LOG(LS_INFO, "Connected to cluster node %d\n", node);
+    peer->state = Peer::CONNECTED;
+    if (observer_)
+      observer_->OnClusterNodeUp(node);
+    FlushPeer(node);
+    return;
+  }
+
+  if (event.readable) {
+    // Only empty responses come back.
+    char buffer[4096];
+    int bytes = recv(peer->socket(), buffer, sizeof(buffer), 0);
+    if (bytes == 0 || (bytes == SOCKET_ERROR && !IsBlockingError())) {
+      SERVER_LOG(LS_WARNING, "Lost the link to cluster node %d\n", node);
+      DisconnectPeer(node);
+      return;
+    }
+  }
+  if (event.writable)
+    FlushPeer(node);
+}
+
+void ClusterLink::FlushPeer(int node) {
+  Peer* peer = peers_[node].get();
+  RTC_DCHECK_EQ(peer->state, Peer::CONNECTED);
+  while (peer->output_sent < peer->output.size()) {
+    int bytes = send(peer->socket(), peer->output.data() + peer->output_sent,
+                     static_cast<int>(peer->output.size() - peer->output_sent),
+                     kSendFlags);
+    if (bytes == SOCKET_ERROR) {
+      if (!IsBlockingError()) {
+        DisconnectPeer(node);
+      } else if (peer->output.size() - peer->output_sent > kMaxLinkBacklog) {
+        SERVER_LOG(LS_WARNING,
+                   "Cluster node %d does not keep up, disconnecting\n", node);
+        DisconnectPeer(node);
+      } else {
+        event_loop_->SetWriteInterest(peer, true);
+      }
+      return;
+    }
+    peer->output_sent += bytes;
+  }
+  peer->output.clear();
+  peer->output_sent = 0;
+  event_loop_->SetWriteInterest(peer, false);
+}
+
+void ClusterLink::DisconnectPeer(int node) {
+  Peer* peer = peers_[node].get();
+  if (peer->state == Peer::DISCONNECTED)
+    return;
+  event_loop_->Remove(peer);
+  peer->Close();
+  peer->state = Peer::DISCONNECTED;
+  peer->output.clear();
+  peer->output_sent = 0;
+  peer->retry_at = TimeoutQueue::Clock::now() +
+                   std::chrono::milliseconds(kReconnectDelayMs);
+}
+
+void ClusterLink::AcceptConnection() {
+  DataSocket* s = listener_.Accept();
+  if (!s)
+    return;
+  if (!event_loop_->Add(s)) {
+    delete s;
+    return;
+  }
+  s->set_event_loop(event_loop_.get());
+  incoming_[s] = -1;
+}
+
+void ClusterLink::OnIncomingReadable(DataSocket* s) {
+  bool socket_done = true;
+  if (!s->OnDataAvailable(&socket_done) || !s->request_received()) {
+    // A link that sent something other than a request is not one of ours.
+    if (socket_done ||
+        s->request().status() == HttpRequestParser::PARSE_ERROR) {
+      CloseIncoming(s);
+    }
+    return;
+  }
+
+  while (s->request_received()) {
+    if (!HandleIncomingRequest(s)) {
+      CloseIncoming(s);
+      return;
+    }
+    s->Clear();
+  }
+}
+
+bool ClusterLink::HandleIncomingRequest(DataSocket* s) {
+  const HttpRequestParser& request = s->request();
+  int from = incoming_[s];
+
+  if (s->PathEquals("/cluster/hello")) {
+    int node = ParseInt(request.GetQueryParameter("node"), -1);
+    if (node < 0 || node >= num_nodes() || node == node_index_ ||
+        ParseInt(request.GetQueryParameter("nodes"), 0) != num_nodes()) {
+      SERVER_LOG(LS_WARNING,
+                 "Rejecting a cluster link from a node of another cluster\n");
+      return false;
+    }
+    DataSocket* old = node_sockets_[node];
+    if (old && old != s) {
+      // The node reconnected.  What it told us before may be stale, and it
+      // is about to send its peers again.
+      node_sockets_[node] = nullptr;
+      CloseIncoming(old);
+      if (observer_)
+        observer_->OnClusterNodeDown(node);
+    }
+    incoming_[s] = node;
+    node_sockets_[node] = s;
+  } else if (from == -1 || s->method() != DataSocket::POST) {
+    return false;
+  } else if (s->PathEquals("/cluster/presence")) {
+    int id = ParseInt(request.GetQueryParameter("id"), -1);
+    if (id > 0 && observer_) {
+      observer_->OnClusterMemberChanged(
+          id, UnescapeQueryValue(request.GetQueryParameter("room")),
+          std::make_shared<const std::string>(s->data()),
+          request.GetQueryParameter("connected") == "1");
+    }
+  } else if (s->PathEquals("/cluster/message")) {
+    int from_id = ParseInt(request.GetQueryParameter("from"), -1);
+    int to_id = ParseInt(request.GetQueryParameter("to"), -1);
+    if (from_id > 0 && to_id > 0 && observer_) {
+      observer_->OnClusterMessage(
+          from_id, to_id, std::string(s->content_type()),
+          std::make_shared<const std::string>(s->data()));
+    }
+  } else {
+    return false;
+  }
+
+  return s->Send("200 OK", false, "", "", "");
+}
+
+void ClusterLink::CloseIncoming(DataSocket* s) {
+  std::unordered_map<DataSocket*, int>::iterator found = incoming_.find(s);
+  RTC_DCHECK(found != incoming_.end());
+  int node = found->second;
+  incoming_.erase(found);
+  s->set_event_loop(nullptr);
+  event_loop_->Remove(s);
+  delete s;
+
+  if (node != -1 && node_sockets_[node] == s) {
+    SERVER_LOG(LS_INFO, "Cluster node %d went away\n", node);
+    node_sockets_[node] = nullptr;
+    if (observer_)
+      observer_->OnClusterNodeDown(node);
+  }
+}
+
+void ClusterLink::Shutdown() {
+  if (!event_loop_)
+    return;
+  for (int node = 0; node < num_nodes(); ++node) {
+    if (node != node_index_)
+      DisconnectPeer(node);
+  }
+  for (const auto& incoming : incoming_) {
+    event_loop_->Remove(incoming.first);
+    delete incoming.first;
+  }
+  incoming_.clear();
+  if (listener_.valid()) {
+    event_loop_->Remove(&listener_);
+    listener_.Close();
+  }
+}
@@ -0,0 +1,172 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_SERVER_CLUSTER_LINK_H_
+#define EXAMPLES_PEERCONNECTION_SERVER_CLUSTER_LINK_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "examples/peerconnection/server/data_socket.h"
+#include "examples/peerconnection/server/event_loop.h"
+#include "examples/peerconnection/server/mpsc_queue.h"
+#include "examples/peerconnection/server/peer_channel.h"
+#include "examples/peerconnection/server/timeout_queue.h"
+
+#if defined(WEBRTC_POSIX)
+#include <netinet/in.h>
+#endif
+
+// Connects the servers ("nodes") of a cluster so that peers signed in to
+// different nodes can see and message each other.  Each node opens one
+// connection to the cluster port of every other node and sends its presence
+// changes, and the messages for peers on that node, over it as pipelined
+// HTTP requests:
+//
+//   GET /cluster/hello?node=<index>&nodes=<count>
+//   POST /cluster/presence?id=<id>&connected=<0|1>&room=<room>
+//   POST /cluster/message?from=<id>&to=<id>
+//
+// The hello comes first on every connection.  Presence requests carry the
+// peer's entry and message requests the message, with its content type, as
+// their body.  Responses carry nothing and are dropped.  Member ids are
+// striped over the nodes, so the node of a peer follows from its id.
+class ClusterLink {
+ public:
+  struct Node {
+    std::string host;
+    unsigned short port;
+  };
+
+  // Receives what the other nodes send.  Called on the link's thread.
+  class Observer {
+   public:
+    virtual void OnClusterMemberChanged(int id,
+                                        const std::string& room,
+                                        const SharedPayload& entry,
+                                        bool connected) = 0;
+    virtual void OnClusterMessage(int from_id,
+                                  int to_id,
+                                  const std::string& content_type,
+                                  const SharedPayload& data) = 0;
+    // The link to `node` has been established, and the node has to be told
+    // about every local peer.
+    virtual void OnClusterNodeUp(int node) = 0;
+    // The link from `node` was lost, so its peers are gone.
+    virtual void OnClusterNodeDown(int node) = 0;
+
+   protected:
+    virtual ~Observer() {}
+  };
+
+  // `nodes` lists every node of the cluster, this one at `node_index`.
+  ClusterLink(int node_index, const std::vector<Node>& nodes);
+  ~ClusterLink();
+
+  int node_index() const { return node_index_; }
+  int num_nodes() const { return static_cast<int>(peers_.size()); }
+
+  // Returns the node that hands out the member id `id`.
+  int NodeOfMember(int id) const { return (id - 1) % num_nodes(); }
+
+  void set_observer(Observer* observer) { observer_ = observer; }
+
+  // Resolves the other nodes and listens on this node's cluster port.
+  bool Init();
+
+  // Runs the link's event loop until Quit() is called.
+  void Run();
+
+  // Stops Run().  May be called from any thread.
+  void Quit();
+
+  // Sends a presence change of a local peer to `node`, or to every other
+  // node if `node` is -1.  May be called from any thread.
+  void SendMemberChanged(int node,
+                         int id,
+                         const std::string& room,
+                         const SharedPayload& entry,
+                         bool connected);
+
+  // Sends a message to the peer `to_id` of another node.  May be called from
+  // any thread.
+  void SendMessage(int from_id,
+                   int to_id,
+                   absl::string_view content_type,
+                   const SharedPayload& data);
+
+ protected:
+  // A request for other nodes, queued by the workers.
+  struct Record {
+    // The receiving node, or -1 for every other node.
+    int node;
+    std::string head;
+    SharedPayload body;
+  };
+
+  // The connection this node opens to another node.
+  struct Peer : public SocketBase {
+    enum State { DISCONNECTED, CONNECTING, CONNECTED };
+
+    Peer() : state(DISCONNECTED), output_sent(0) {}
+
+    State state;
+    struct sockaddr_in address;
+    // Requests that the socket has not taken yet.  The first `output_sent`
+    // bytes have been written already.
+    std::string output;
+    size_t output_sent;
+    TimeoutQueue::Clock::time_point retry_at;
+  };
+
+  void Post(Record record);
+  void SendPendingRecords();
+  void Append(Peer* peer, const Record& record);
+
+  // Retries the connections whose retry time has come, and returns the
+  // number of milliseconds until the next retry is due, or -1.
+  int ConnectPeers();
+  bool StartConnect(int node);
+  void OnPeerEvent(int node, const EventLoop::Event& event);
+  void FlushPeer(int node);
+  void DisconnectPeer(int node);
+
+  void AcceptConnection();
+  void OnIncomingReadable(DataSocket* s);
+  // Returns false if the connection has to be closed.
+  bool HandleIncomingRequest(DataSocket* s);
+  void CloseIncoming(DataSocket* s);
+
+  void Shutdown();
+
+  const int node_index_;
+  const std::vector<Node> nodes_;
+  Observer* observer_;
+  std::unique_ptr<EventLoop> event_loop_;
+  ListeningSocket listener_;
+  SignalSocket wakeup_;
+  // Indexed by node; the entry of this node is unused.
+  std::vector<std::unique_ptr<Peer>> peers_;
+  // Connections accepted from other nodes, mapped to the node that said
+  // hello on them, or -1 before that.
+  std::unordered_map<DataSocket*, int> incoming_;
+  // The current connection from each node.
+  std::vector<DataSocket*> node_sockets_;
+  MpscQueue<Record> records_;
+  std::atomic<bool> wakeup_pending_;
+  std::atomic<bool> quit_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_SERVER_CLUSTER_LINK_H_
@@ -0,0 +1,217 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/client/codec_factory.h"
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "api/environment/environment.h"
+#include "api/video_codecs/sdp_video_format.h"
+#include "api/video_codecs/video_decoder.h"
+#include "api/video_codecs/video_decoder_factory.h"
+#include "api/video_codecs/video_decoder_factory_template.h"
+#include "api/video_codecs/video_decoder_factory_template_dav1d_adapter.h"
+#include "api/video_codecs/video_decoder_factory_template_libvpx_vp8_adapter.h"
+#include "api/video_codecs/video_decoder_factory_template_libvpx_vp9_adapter.h"
+#include "api/video_codecs/video_decoder_factory_template_open_h264_adapter.h"
+#include "api/video_codecs/video_decoder_software_fallback_wrapper.h"
+#include "api/video_codecs/video_encoder.h"
+#include "api/video_codecs/video_encoder_factory.h"
+#include "api/video_codecs/video_encoder_factory_template.h"
+#include "api/video_codecs/video_encoder_factory_template_libaom_av1_adapter.h"
+#include "api/video_codecs/video_encoder_factory_template_libvpx_vp8_adapter.h"
+#include "api/video_codecs/video_encoder_factory_template_libvpx_vp9_adapter.h"
+#include "api/video_codecs/video_encoder_factory_template_open_h264_adapter.h"
+#include "api/video_codecs/video_encoder_software_fallback_wrapper.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+
+namespace {
+
+// Hardware formats first, then the software formats of other codecs.
+std::vector<webrtc::SdpVideoFormat> MergeFormats(
+    std::vector<webrtc::SdpVideoFormat> hardware,
+    const std::vector<webrtc::SdpVideoFormat>& software) {
+  std::vector<webrtc::SdpVideoFormat> formats = std::move(hardware);
+  for (const webrtc::SdpVideoFormat& format : software) {
+    if (!format.IsCodecInList(formats))
+      formats.push_back(format);
+  }
+  return formats;
+}
+
+}  // namespace
+
+//
+// HardwarePreferringVideoEncoderFactory
+//
+
+HardwarePreferringVideoEncoderFactory::HardwarePreferringVideoEncoderFactory(
+    std::unique_ptr<webrtc::VideoEncoderFactory> hardware,
+    std::unique_ptr<webrtc::VideoEncoderFactory> software)
+    : hardware_(std::move(hardware)), software_(std::move(software)) {
+  RTC_DCHECK(software_);
+}
+
+HardwarePreferringVideoEncoderFactory::
+    ~HardwarePreferringVideoEncoderFactory() {}
+
+std::vector<webrtc::SdpVideoFormat>
+HardwarePreferringVideoEncoderFactory::GetSupportedFormats() const {
+  return MergeFormats(hardware_ ? hardware_->GetSupportedFormats()
+                                : std::vector<webrtc::SdpVideoFormat>(),
+                      software_->GetSupportedFormats());
+}
+
+webrtc::VideoEncoderFactory::CodecSupport
+HardwarePreferringVideoEncoderFactory::QueryCodecSupport(
+    const webrtc::SdpVideoFormat& format,
+    std::optional<std::string> scalability_mode) const {
+  if (hardware_) {
+    CodecSupport support =
+        hardware_->QueryCodecSupport(format, scalability_mode);
+    if (support.is_supported)
+      return support;
+  }
+  return software_->QueryCodecSupport(format, scalability_mode);
+}
+
+std::unique_ptr<webrtc::VideoEncoder>
+HardwarePreferringVideoEncoderFactory::Create(
+    const webrtc::Environment& env,
+    const webrtc::SdpVideoFormat& format) {
+  std::unique_ptr<webrtc::VideoEncoder> hardware;
+  if (hardware_ && format.IsCodecInList(hardware_->GetSupportedFormats()))
+    hardware = hardware_->Create(env, format);
+  std::unique_ptr<webrtc::VideoEncoder> software;
+  if (format.IsCodecInList(software_->GetSupportedFormats()))
+    software = software_->Create(env, format);
+
+  if (hardware && software) {
+    RTC_LOG(LS_INFO) << "Encoding " << format.ToString() << " with "
+                     << hardware->GetEncoderInfo().implementation_name
+                     << ", falling back to "
+                     << software->GetEncoderInfo().implementation_name;
+    return webrtc::CreateVideoEncoderSoftwareFallbackWrapper(
+        env, std::move(software), std::move(hardware),
+        /*prefer_temporal_support=*/false);
+  }
+
+  std::unique_ptr<webrtc::VideoEncoder> encoder =
+      hardware ? std::move(hardware) : std::move(software);
+  if (encoder) {
+    RTC_LOG(LS_INFO) << "Encoding " << format.ToString() << " with "
+                     << encoder->GetEncoderInfo().implementation_name;
+  } else {
+    RTC_LOG(LS_WARNING) << "No encoder for " << format.ToString();
+  }
+  return encoder;
+}
+
+//
+// HardwarePreferringVideoDecoderFactory
+//
+
+HardwarePreferringVideoDecoderFactory::HardwarePreferringVideoDecoderFactory(
+    std::unique_ptr<webrtc::VideoDecoderFactory> hardware,
+    std::unique_ptr<webrtc::VideoDecoderFactory> software)
+    : hardware_(std::move(hardware)), software_(std::move(software)) {
+  RTC_DCHECK(software_);
+}
+
+HardwarePreferringVideoDecoderFactory::
+    ~HardwarePreferringVideoDecoderFactory() {}
+
+std::vector<webrtc::SdpVideoFormat>
+HardwarePreferringVideoDecoderFactory::GetSupportedFormats() const {
+  return MergeFormats(hardware_ ? hardware_->GetSupportedFormats()
+                                : std::vector<webrtc::SdpVideoFormat>(),
+                      software_->GetSupportedFormats());
+}
+
+webrtc::VideoDecoderFactory::CodecSupport
+HardwarePreferringVideoDecoderFactory::QueryCodecSupport(
+    const webrtc::SdpVideoFormat& format,
+    bool reference_scaling) const {
+  if (hardware_) {
+    CodecSupport support =
+        hardware_->QueryCodecSupport(format, reference_scaling);
+    if (support.is_supported)
+      return support;
+  }
+  return software_->QueryCodecSupport(format, reference_scaling);
+}
+
+std::unique_ptr<webrtc::VideoDecoder>
+HardwarePreferringVideoDecoderFactory::Create(
+    const webrtc::Environment& env,
+    const webrtc::SdpVideoFormat& format) {
+  std::unique_ptr<webrtc::VideoDecoder> hardware;
+  if (hardware_ && format.IsCodecInList(hardware_->GetSupportedFormats()))
+    hardware = hardware_->Create(env, format);
+  std::unique_ptr<webrtc::VideoDecoder> software;
+  if (format.IsCodecInList(software_->GetSupportedFormats()))
+    software = software_->Create(env, format);
+
+  if (hardware && software) {
+    RTC_LOG(LS_INFO) << "Decoding " << format.ToString() << " with "
+                     << hardware->GetDecoderInfo().implementation_name
+                     << ", falling back to "
+                     << software->GetDecoderInfo().implementation_name;
+    return webrtc::CreateVideoDecoderSoftwareFallbackWrapper(
+        env, std::move(software), std::move(hardware));
+  }
+
+  std::unique_ptr<webrtc::VideoDecoder> decoder =
+      hardware ? std::move(hardware) : std::move(software);
+  if (decoder) {
+    RTC_LOG(LS_INFO) << "Decoding " << format.ToString() << " with "
+                     << decoder->GetDecoderInfo().implementation_name;
+  } else {
+    RTC_LOG(LS_WARNING) << "No decoder for " << format.ToString();
+  }
+  return decoder;
+}
+
+std::unique_ptr<webrtc::VideoEncoderFactory> CreateVideoEncoderFactory() {
+  std::unique_ptr<webrtc::VideoEncoderFactory> hardware;
+#if defined(WEBRTC_USE_HARDWARE_VIDEO_CODECS)
+  hardware = CreatePlatformHardwareVideoEncoderFactory();
+#endif
+  if (!hardware)
+    RTC_LOG(LS_INFO) << "No hardware video encoders, encoding in software";
+  return std::make_unique<HardwarePreferringVideoEncoderFactory>(
+      std::move(hardware),
+      std::make_unique<webrtc::VideoEncoderFactoryTemplate<
+          webrtc::LibvpxVp8EncoderTemplateAdapter,
+          webrtc::LibvpxVp9EncoderTemplateAdapter,
+          webrtc::OpenH264EncoderTemplateAdapter,
+          webrtc::LibaomAv1EncoderTemplateAdapter>>());
+}
+
+std::unique_ptr<webrtc::VideoDecoderFactory> CreateVideoDecoderFactory() {
+  std::unique_ptr<webrtc::VideoDecoderFactory> hardware;
+#if defined(WEBRTC_USE_HARDWARE_VIDEO_CODECS)
+  hardware = CreatePlatformHardwareVideoDecoderFactory();
+#endif
+  if (!hardware)
+    RTC_LOG(LS_INFO) << "No hardware video decoders, decoding in software";
+  return std::make_unique<HardwarePreferringVideoDecoderFactory>(
+      std::move(hardware),
+      std::make_unique<webrtc::VideoDecoderFactoryTemplate<
+          webrtc::LibvpxVp8DecoderTemplateAdapter,
+          webrtc::LibvpxVp9DecoderTemplateAdapter,
+          webrtc::OpenH264DecoderTemplateAdapter,
+          webrtc::Dav1dDecoderTemplateAdapter>>());
+}
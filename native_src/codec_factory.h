@@ -0,0 +1,91 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_CLIENT_CODEC_FACTORY_H_
+#define EXAMPLES_PEERCONNECTION_CLIENT_CODEC_FACTORY_H_
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "api/environment/environment.h"
+#include "api/video_codecs/sdp_video_format.h"
+#include "api/video_codecs/video_decoder.h"
+#include "api/video_codecs/video_decoder_factory.h"
+#include "api/video_codecs/video_encoder.h"
+#include "api/video_codecs/video_encoder_factory.h"
+
+// Encoder factory that prefers the codecs of a hardware factory and falls
+// back to those of a software factory.  Formats of both are offered, the
+// hardware ones first so that they win the negotiation.  A hardware encoder
+// is wrapped so that it is replaced by its software counterpart at runtime
+// if it fails, and the chosen implementation is logged.  Frames, including
+// native texture buffers, reach the hardware encoder unchanged.
+class HardwarePreferringVideoEncoderFactory
+    : public webrtc::VideoEncoderFactory {
+ public:
+  // `hardware` may be null.
+  HardwarePreferringVideoEncoderFactory(
+      std::unique_ptr<webrtc::VideoEncoderFactory> hardware,
+      std::unique_ptr<webrtc::VideoEncoderFactory> software);
+  ~HardwarePreferringVideoEncoderFactory() override;
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+  CodecSupport QueryCodecSupport(
+      const webrtc::SdpVideoFormat& format,
+      std::optional<std::string> scalability_mode) const override;
+  std::unique_ptr<webrtc::VideoEncoder> Create(
+      const webrtc::Environment& env,
+      const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  const std::unique_ptr<webrtc::VideoEncoderFactory> hardware_;
+  const std::unique_ptr<webrtc::VideoEncoderFactory> software_;
+};
+
+// The decoding counterpart of HardwarePreferringVideoEncoderFactory.
+class HardwarePreferringVideoDecoderFactory
+    : public webrtc::VideoDecoderFactory {
+ public:
+  // `hardware` may be null.
+  HardwarePreferringVideoDecoderFactory(
+      std::unique_ptr<webrtc::VideoDecoderFactory> hardware,
+      std::unique_ptr<webrtc::VideoDecoderFactory> software);
+  ~HardwarePreferringVideoDecoderFactory() override;
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+  CodecSupport QueryCodecSupport(const webrtc::SdpVideoFormat& format,
+                                 bool reference_scaling) const override;
+  std::unique_ptr<webrtc::VideoDecoder> Create(
+      const webrtc::Environment& env,
+      const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  const std::unique_ptr<webrtc::VideoDecoderFactory> hardware_;
+  const std::unique_ptr<webrtc::VideoDecoderFactory> software_;
+};
+
+#if defined(WEBRTC_USE_HARDWARE_VIDEO_CODECS)
+// Provided by the platform code linked into the client, e.g. Media
+// Foundation on Windows or VA-API on Linux.  May return null when the
+// machine has no usable hardware codec.
+std::unique_ptr<webrtc::VideoEncoderFactory>
+CreatePlatformHardwareVideoEncoderFactory();
+std::unique_ptr<webrtc::VideoDecoderFactory>
+CreatePlatformHardwareVideoDecoderFactory();
+#endif  // WEBRTC_USE_HARDWARE_VIDEO_CODECS
+
+// The software VP8, VP9, H.264 and AV1 codecs, behind the hardware codecs of
+// the platform if the client was built with any.
+std::unique_ptr<webrtc::VideoEncoderFactory> CreateVideoEncoderFactory();
+std::unique_ptr<webrtc::VideoDecoderFactory> CreateVideoDecoderFactory();
+
+#endif  // EXAMPLES_PEERCONNECTION_CLIENT_CODEC_FACTORY_H_
@@ -10,6 +10,7 @@
 
 #include "examples/peerconnection/client/conductor.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <memory>
 #include <optional>
@@ -18,64 +19,96 @@
 #include <vector>
 
 #include "absl/base/nullability.h"
-#include "absl/memory/memory.h"
+#include "absl/strings/string_view.h"
 #include "api/audio_codecs/builtin_audio_decoder_factory.h"
 #include "api/audio_codecs/builtin_audio_encoder_factory.h"
 #include "api/audio_options.h"
+#include "api/candidate.h"
 #include "api/create_modular_peer_connection_factory.h"
 #include "api/enable_media.h"
 #include "api/environment/environment.h"
 #include "api/jsep.h"
 #include "api/make_ref_counted.h"
+#include "api/media_types.h"
 #include "api/media_stream_interface.h"
 #include "api/peer_connection_interface.h"
 #include "api/rtc_error.h"
+#include "api/rtp_parameters.h"
 #include "api/rtp_receiver_interface.h"
 #include "api/rtp_sender_interface.h"
+#include "api/rtp_transceiver_interface.h"
 #include "api/scoped_refptr.h"
 #include "api/task_queue/task_queue_factory.h"
 #include "api/test/create_frame_generator.h"
+#include "api/units/time_delta.h"
+#include "api/units/timestamp.h"
 #include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
 #include "api/video/video_source_interface.h"
-#include "api/video_codecs/video_decoder_factory_template.h"
-#include "api/video_codecs/video_decoder_factory_template_dav1d_adapter.h"
-#include "api/video_codecs/video_decoder_factory_template_libvpx_vp8_adapter.h"
-#include "api/video_codecs/video_decoder_factory_template_libvpx_vp9_adapter.h"
-#include "api/video_codecs/video_decoder_factory_template_open_h264_adapter.h"
-#include "api/video_codecs/video_encoder_factory_template.h"
-#include "api/video_codecs/video_encoder_factory_template_libaom_av1_adapter.h"
-#include "api/video_codecs/video_encoder_factory_template_libvpx_vp8_adapter.h"
-#include "api/video_codecs/video_encoder_factory_template_libvpx_vp9_adapter.h"
-#include "api/video_codecs/video_encoder_factory_template_open_h264_adapter.h"
+#include "examples/peerconnection/client/call_stats.h"
+#include "examples/peerconnection/client/camera_capturer.h"
+#include "examples/peerconnection/client/codec_factory.h"
 #include "examples/peerconnection/client/defaults.h"
 #include "examples/peerconnection/client/main_wnd.h"
 #include "examples/peerconnection/client/peer_connection_client.h"
-#include "json/reader.h"
-#include "json/value.h"
-#include "json/writer.h"
+#include "examples/peerconnection/client/signaling_codec.h"
 #include "modules/video_capture/video_capture.h"
 #include "modules/video_capture/video_capture_factory.h"
 #include "pc/video_track_source.h"
 #include "rtc_base/checks.h"
 #include "rtc_base/logging.h"
-#include "rtc_base/strings/json.h"
 #include "rtc_base/thread.h"
 #include "system_wrappers/include/clock.h"
 #include "test/frame_generator_capturer.h"
-#include "test/platform_video_capturer.h"
-#include "test/test_video_capturer.h"
 
 namespace {
-using webrtc::test::TestVideoCapturer;
+// Messages that may wait for the connection to the server.  A call only
+// needs a few dozen, so a peer that has this many queued is gone.
+constexpr size_t kMaxPendingMessages = 256;
+
+// Candidates are gathered in bursts, one per interface and server.  A batch
+// is sent once no candidate has been gathered for `kCandidateQuietPeriod`,
+// but its first candidate waits no longer than `kMaxCandidateDelay`.
+constexpr webrtc::TimeDelta kCandidateQuietPeriod =
+    webrtc::TimeDelta::Millis(10);
+constexpr webrtc::TimeDelta kMaxCandidateDelay = webrtc::TimeDelta::Millis(50);
+
+// Candidates that a spare PeerConnection gathers before its call, one per
+// interface and server it would gather for anyway.
+constexpr int kIceCandidatePoolSize = 4;
+
+// The simulcast layers, lowest first, with their bitrate caps at the largest
+// capture size.
+struct SimulcastLayer {
+  const char* rid;
+  double scale_resolution_down_by;
+  int max_bitrate_bps;
+};
+constexpr SimulcastLayer kSimulcastLayers[Conductor::kVideoLayers] = {
+    {"q", 4.0, 150000},
+    {"h", 2.0, 500000},
+    {"f", 1.0, 2500000},
+};
 
-// Names used for a IceCandidate JSON object.
-const char kCandidateSdpMidName[] = "sdpMid";
-const char kCandidateSdpMlineIndexName[] = "sdpMLineIndex";
-const char kCandidateSdpName[] = "candidate";
+// The SVC scalability mode with `spatial_layers` spatial and three temporal
+// layers.
+std::string SvcMode(size_t spatial_layers) {
+  return "L" + std::to_string(spatial_layers) + "T3";
+}
 
-// Names used for a SessionDescription JSON object.
-const char kSessionDescriptionTypeName[] = "type";
-const char kSessionDescriptionSdpName[] = "sdp";
+// Whether `encoding` is an SVC one and, if so, how many spatial layers it
+// has.
+std::optional<size_t> SpatialLayers(
+    const webrtc::RtpEncodingParameters& encoding) {
+  if (!encoding.scalability_mode || encoding.scalability_mode->size() < 2 ||
+      (*encoding.scalability_mode)[0] != 'L') {
+    return std::nullopt;
+  }
+  char layers = (*encoding.scalability_mode)[1];
+  if (layers < '1' || layers > '9')
+    return std::nullopt;
+  return static_cast<size_t>(layers - '0');
+}
 
 class DummySetSessionDescriptionObserver
     : public webrtc::SetSessionDescriptionObserver {
@@ -90,45 +123,49 @@ class DummySetSessionDescriptionObserver
   }
 };
 
-std::unique_ptr<TestVideoCapturer> CreateCapturer(
-    webrtc::TaskQueueFactory& task_queue_factory) {
-  const size_t kWidth = 640;
-  const size_t kHeight = 480;
-  const size_t kFps = 30;
+// The largest and most frequent frames sent.  The camera is run in the mode
+// that best matches what the encoder asks for below these.
+constexpr int kMaxWidth = 1280;
+constexpr int kMaxHeight = 720;
+constexpr int kMaxFps = 30;
+
+std::unique_ptr<webrtc::VideoSourceInterface<webrtc::VideoFrame>>
+CreateCapturer(webrtc::TaskQueueFactory& task_queue_factory) {
   std::unique_ptr<webrtc::VideoCaptureModule::DeviceInfo> info(
       webrtc::VideoCaptureFactory::CreateDeviceInfo());
-  if (!info) {
-    return nullptr;
-  }
-  int num_devices = info->NumberOfDevices();
-  for (int i = 0; i < num_devices; ++i) {
-    std::unique_ptr<TestVideoCapturer> capturer =
-        webrtc::test::CreateVideoCapturer(kWidth, kHeight, kFps, i);
+  size_t num_devices = info ? info->NumberOfDevices() : 0;
+  for (size_t i = 0; i < num_devices; ++i) {
+    std::unique_ptr<CameraCapturer> capturer =
+        CameraCapturer::Create(i, kMaxWidth, kMaxHeight, kMaxFps);
     if (capturer) {
       return capturer;
     }
   }
   auto frame_generator = webrtc::test::CreateSquareFrameGenerator(
-      kWidth, kHeight, std::nullopt, std::nullopt);
-  return std::make_unique<webrtc::test::FrameGeneratorCapturer>(
-      webrtc::Clock::GetRealTimeClock(), std::move(frame_generator), kFps,
+      kMaxWidth, kMaxHeight, std::nullopt, std::nullopt);
+  auto capturer = std::make_unique<webrtc::test::FrameGeneratorCapturer>(
+      webrtc::Clock::GetRealTimeClock(), std::move(frame_generator), kMaxFps,
       task_queue_factory);
+  capturer->Start();
+  return capturer;
 }
+
 class CapturerTrackSource : public webrtc::VideoTrackSource {
  public:
   static webrtc::scoped_refptr<CapturerTrackSource> Create(
       webrtc::TaskQueueFactory& task_queue_factory) {
-    std::unique_ptr<TestVideoCapturer> capturer =
-        CreateCapturer(task_queue_factory);
+    std::unique_ptr<webrtc::VideoSourceInterface<webrtc::VideoFrame>>
+        capturer = CreateCapturer(task_queue_factory);
     if (capturer) {
-      capturer->Start();
       return webrtc::make_ref_counted<CapturerTrackSource>(std::move(capturer));
     }
     return nullptr;
   }
 
  protected:
-  explicit CapturerTrackSource(std::unique_ptr<TestVideoCapturer> capturer)
+  explicit CapturerTrackSource(
+      std::unique_ptr<webrtc::VideoSourceInterface<webrtc::VideoFrame>>
+          capturer)
       : VideoTrackSource(/*remote=*/false), capturer_(std::move(capturer)) {}
 
  private:
@@ -136,19 +173,67 @@ class CapturerTrackSource : public webrtc::VideoTrackSource {
     return capturer_.get();
   }
 
-  std::unique_ptr<TestVideoCapturer> capturer_;
+  std::unique_ptr<webrtc::VideoSourceInterface<webrtc::VideoFrame>> capturer_;
 };
 
 }  // namespace
 
+class Conductor::FirstFrameTimer
+    : public webrtc::VideoSinkInterface<webrtc::VideoFrame> {
+ public:
+  FirstFrameTimer(webrtc::Clock& clock,
+                  webrtc::Timestamp call_start_time,
+                  absl::string_view call_setup)
+      : clock_(clock),
+        call_start_time_(call_start_time),
+        call_setup_(call_setup),
+        reported_(false) {}
+
+  // Called on the decoding thread for every frame.
+  void OnFrame(const webrtc::VideoFrame& frame) override {
+    if (reported_)
+      return;
+    reported_ = true;
+    RTC_LOG(LS_INFO) << "First remote video frame "
+                     << (clock_.CurrentTime() - call_start_time_).ms()
+                     << " ms after the call started, " << call_setup_;
+  }
+
+ private:
+  webrtc::Clock& clock_;
+  const webrtc::Timestamp call_start_time_;
+  const absl::string_view call_setup_;
+  bool reported_;
+};
+
 Conductor::Conductor(const webrtc::Environment& env,
                      PeerConnectionClient* absl_nonnull client,
                      MainWindow* absl_nonnull main_wnd)
     : peer_id_(-1),
       loopback_(false),
+      video_send_mode_(VideoSendMode::kSingle),
+      prewarm_(false),
+      prewarm_connection_(false),
+      shared_media_(false),
+      call_start_time_(webrtc::Timestamp::Zero()),
+      call_stats_interval_(webrtc::TimeDelta::Zero()),
+      peer_compact_supported_(false),
+      first_candidate_time_(webrtc::Timestamp::Zero()),
+      last_candidate_time_(webrtc::Timestamp::Zero()),
+      candidate_timer_running_(false),
+      first_candidate_sent_(false),
       env_(env),
+      signaling_thread_(nullptr),
       client_(client),
-      main_wnd_(main_wnd) {
+      main_wnd_(main_wnd),
+      network_thread_(webrtc::Thread::Current()),
+      pending_messages_(kMaxPendingMessages),
+      flush_pending_(false),
+      peer_name_(GetPeerName()) {
+  RTC_DCHECK(network_thread_);
+  // Calls survive the loss of the server for as long as it keeps the
+  // session, see OnSessionResumed().
+  client_->EnableSessionResume(true);
   client_->RegisterObserver(this);
   main_wnd->RegisterObserver(this);
 }
@@ -162,48 +247,139 @@ bool Conductor::connection_active() const {
 }
 
 void Conductor::Close() {
+  // Lets DeletePeerConnection() release what was prewarmed.
+  prewarm_ = false;
+  prewarm_connection_ = false;
   client_->SignOut();
   DeletePeerConnection();
 }
 
-bool Conductor::InitializePeerConnection() {
-  RTC_DCHECK(!peer_connection_factory_);
-  RTC_DCHECK(!peer_connection_);
+void Conductor::SetVideoSendMode(VideoSendMode mode) {
+  video_send_mode_ = mode;
+  // The spare connection has its video encodings already.
+  if (spare_connection_) {
+    spare_connection_ = nullptr;
+    CreateSpareConnection();
+  }
+}
 
-  if (!signaling_thread_) {
-    signaling_thread_ = webrtc::Thread::CreateWithSocketServer();
-    signaling_thread_->Start();
+bool Conductor::Prewarm(bool create_peer_connection) {
+  if (!peer_connection_factory_ && !CreatePeerConnectionFactory())
+    return false;
+  prewarm_ = true;
+  prewarm_connection_ = create_peer_connection;
+  CreateLocalTracks();
+  if (prewarm_connection_ && !spare_connection_ && !peer_connection_)
+    CreateSpareConnection();
+  return true;
+}
+
+bool Conductor::SetVideoLayerActive(size_t layer, bool active) {
+  if (!video_sender_ || layer >= kVideoLayers)
+    return false;
+  webrtc::RtpParameters parameters = video_sender_->GetParameters();
+  if (parameters.encodings.empty())
+    return false;
+
+  webrtc::RtpEncodingParameters& first = parameters.encodings[0];
+  if (std::optional<size_t> spatial_layers = SpatialLayers(first)) {
+    size_t layers = first.active ? *spatial_layers : 0;
+    layers = active ? std::max(layers, layer + 1) : std::min(layers, layer);
+    first.active = layers > 0;
+    if (layers > 0)
+      first.scalability_mode = SvcMode(layers);
+  } else {
+    if (layer >= parameters.encodings.size())
+      return false;
+    parameters.encodings[layer].active = active;
   }
+  return SetVideoParameters(parameters);
+}
 
-  webrtc::PeerConnectionFactoryDependencies deps;
-  deps.signaling_thread = signaling_thread_.get();
-  deps.env = env_,
-  deps.audio_encoder_factory = webrtc::CreateBuiltinAudioEncoderFactory();
-  deps.audio_decoder_factory = webrtc::CreateBuiltinAudioDecoderFactory();
-  deps.video_encoder_factory =
-      std::make_unique<webrtc::VideoEncoderFactoryTemplate<
-          webrtc::LibvpxVp8EncoderTemplateAdapter,
-          webrtc::LibvpxVp9EncoderTemplateAdapter,
-          webrtc::OpenH264EncoderTemplateAdapter,
-          webrtc::LibaomAv1EncoderTemplateAdapter>>();
-  deps.video_decoder_factory =
-      std::make_unique<webrtc::VideoDecoderFactoryTemplate<
-          webrtc::LibvpxVp8DecoderTemplateAdapter,
-          webrtc::LibvpxVp9DecoderTemplateAdapter,
-          webrtc::OpenH264DecoderTemplateAdapter,
-          webrtc::Dav1dDecoderTemplateAdapter>>();
-  webrtc::EnableMedia(deps);
-  peer_connection_factory_ =
-      webrtc::CreateModularPeerConnectionFactory(std::move(deps));
+bool Conductor::SetVideoLayerLimits(size_t layer,
+                                    std::optional<int> max_bitrate_bps,
+                                    std::optional<double> max_framerate) {
+  if (!video_sender_)
+    return false;
+  webrtc::RtpParameters parameters = video_sender_->GetParameters();
+  if (layer >= parameters.encodings.size())
+    return false;
+  parameters.encodings[layer].max_bitrate_bps = max_bitrate_bps;
+  parameters.encodings[layer].max_framerate = max_framerate;
+  return SetVideoParameters(parameters);
+}
+
+void Conductor::SetCallStatsSink(std::shared_ptr<CallStatsSink> sink,
+                                 webrtc::TimeDelta interval) {
+  RTC_DCHECK(!sink || interval > webrtc::TimeDelta::Zero());
+  call_stats_sink_ = std::move(sink);
+  call_stats_interval_ = interval;
+}
+
+void Conductor::StartCallStats() {
+  RTC_DCHECK(peer_connection_);
+  StopCallStats();
+  if (!call_stats_sink_)
+    return;
+  call_stats_ = webrtc::make_ref_counted<CallStatsCollector>(
+      peer_connection_, signaling_thread_, call_stats_interval_,
+      call_stats_sink_);
+  call_stats_->Start();
+}
+
+void Conductor::StopCallStats() {
+  if (!call_stats_)
+    return;
+  call_stats_->Stop();
+  call_stats_ = nullptr;
+}
+
+bool Conductor::SetVideoParameters(const webrtc::RtpParameters& parameters) {
+  webrtc::RTCError error = video_sender_->SetParameters(parameters);
+  if (!error.ok()) {
+    RTC_LOG(LS_WARNING) << "Failed to set the video parameters: "
+                        << error.message();
+    return false;
+  }
+  return true;
+}
+
+void Conductor::SetPeerName(const std::string& name) {
+  peer_name_ = name;
+}
+
+void Conductor::SetSharedMedia(
+    webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory,
+    webrtc::Thread* absl_nonnull signaling_thread,
+    webrtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track,
+    webrtc::scoped_refptr<webrtc::VideoTrackInterface> video_track) {
+  RTC_DCHECK(factory);
+  RTC_DCHECK(!peer_connection_factory_);
+  shared_media_ = true;
+  peer_connection_factory_ = std::move(factory);
+  signaling_thread_ = signaling_thread;
+  audio_track_ = std::move(audio_track);
+  video_track_ = std::move(video_track);
+}
+
+bool Conductor::InitializePeerConnection() {
+  RTC_DCHECK(!peer_connection_);
 
-  if (!peer_connection_factory_) {
+  call_start_time_ = env_.clock().CurrentTime();
+  call_setup_ = spare_connection_          ? "prewarmed connection"
+                : peer_connection_factory_ ? "prewarmed factory"
+                                           : "cold start";
+  if (!peer_connection_factory_ && !CreatePeerConnectionFactory()) {
     main_wnd_->MessageBox("Error", "Failed to initialize PeerConnectionFactory",
                           true);
     DeletePeerConnection();
     return false;
   }
 
-  if (!CreatePeerConnection()) {
+  if (spare_connection_) {
+    peer_connection_ = std::move(spare_connection_);
+    StartCallStats();
+  } else if (!CreatePeerConnection()) {
     main_wnd_->MessageBox("Error", "CreatePeerConnection failed", true);
     DeletePeerConnection();
   }
@@ -213,10 +389,33 @@ bool Conductor::InitializePeerConnection() {
   return peer_connection_ != nullptr;
 }
 
+bool Conductor::CreatePeerConnectionFactory() {
+  RTC_DCHECK(!peer_connection_factory_);
+
+  if (!signaling_thread_) {
+    owned_signaling_thread_ = webrtc::Thread::CreateWithSocketServer();
+    owned_signaling_thread_->Start();
+    signaling_thread_ = owned_signaling_thread_.get();
+  }
+
+  webrtc::PeerConnectionFactoryDependencies deps;
+  deps.signaling_thread = signaling_thread_;
+  deps.env = env_,
+  deps.audio_encoder_factory = webrtc::CreateBuiltinAudioEncoderFactory();
+  deps.audio_decoder_factory = webrtc::CreateBuiltinAudioDecoderFactory();
+  deps.video_encoder_factory = CreateVideoEncoderFactory();
+  deps.video_decoder_factory = CreateVideoDecoderFactory();
+  webrtc::EnableMedia(deps);
+  peer_connection_factory_ =
+      webrtc::CreateModularPeerConnectionFactory(std::move(deps));
+  return peer_connection_factory_ != nullptr;
+}
+
 bool Conductor::ReinitializePeerConnectionForLoopback() {
   loopback_ = true;
   std::vector<webrtc::scoped_refptr<webrtc::RtpSenderInterface>> senders =
       peer_connection_->GetSenders();
+  StopCallStats();
   peer_connection_ = nullptr;
   // Loopback is only possible if encryption is disabled.
   webrtc::PeerConnectionFactoryInterface::Options options;
@@ -224,7 +423,15 @@ bool Conductor::ReinitializePeerConnectionForLoopback() {
   peer_connection_factory_->SetOptions(options);
   if (CreatePeerConnection()) {
     for (const auto& sender : senders) {
-      peer_connection_->AddTrack(sender->track(), sender->stream_ids());
+      if (sender->media_type() == webrtc::MediaType::VIDEO) {
+        video_sender_ = AddVideoTrack(
+            peer_connection_.get(),
+            webrtc::scoped_refptr<webrtc::VideoTrackInterface>(
+                static_cast<webrtc::VideoTrackInterface*>(
+                    sender->track().get())));
+      } else {
+        peer_connection_->AddTrack(sender->track(), sender->stream_ids());
+      }
     }
     peer_connection_->CreateOffer(
         this, webrtc::PeerConnectionInterface::RTCOfferAnswerOptions());
@@ -235,32 +442,81 @@ bool Conductor::ReinitializePeerConnectionForLoopback() {
 }
 
 bool Conductor::CreatePeerConnection() {
-  RTC_DCHECK(peer_connection_factory_);
   RTC_DCHECK(!peer_connection_);
+  peer_connection_ = NewPeerConnection(/*pre_gather=*/false);
+  if (peer_connection_)
+    StartCallStats();
+  return peer_connection_ != nullptr;
+}
+
+webrtc::scoped_refptr<webrtc::PeerConnectionInterface>
+Conductor::NewPeerConnection(bool pre_gather) {
+  RTC_DCHECK(peer_connection_factory_);
 
   webrtc::PeerConnectionInterface::RTCConfiguration config;
   config.sdp_semantics = webrtc::SdpSemantics::kUnifiedPlan;
   webrtc::PeerConnectionInterface::IceServer server;
   server.uri = GetPeerConnectionString();
   config.servers.push_back(server);
+  // Both peers restart ICE when both resumed their session; the one with
+  // the higher id gives way, see OnMessageFromPeer().
+  config.enable_implicit_rollback = true;
+  // Gathering starts right away, before there is a local description.
+  if (pre_gather)
+    config.ice_candidate_pool_size = kIceCandidatePoolSize;
 
   webrtc::PeerConnectionDependencies pc_dependencies(this);
   auto error_or_peer_connection =
       peer_connection_factory_->CreatePeerConnectionOrError(
           config, std::move(pc_dependencies));
-  if (error_or_peer_connection.ok()) {
-    peer_connection_ = std::move(error_or_peer_connection.value());
+  if (!error_or_peer_connection.ok()) {
+    RTC_LOG(LS_ERROR) << "Failed to create a PeerConnection: "
+                      << error_or_peer_connection.error().message();
+    return nullptr;
   }
-  return peer_connection_ != nullptr;
+  return error_or_peer_connection.MoveValue();
+}
+
+void Conductor::CreateSpareConnection() {
+  RTC_DCHECK(peer_connection_factory_);
+  RTC_DCHECK(!spare_connection_);
+  spare_connection_ = NewPeerConnection(/*pre_gather=*/true);
+  if (spare_connection_)
+    AddLocalTracks(spare_connection_.get());
 }
 
 void Conductor::DeletePeerConnection() {
   main_wnd_->StopLocalRenderer();
   main_wnd_->StopRemoteRenderer();
+  video_sender_ = nullptr;
+  StopCallStats();
+  if (remote_video_track_) {
+    remote_video_track_->RemoveSink(first_frame_timer_.get());
+    remote_video_track_ = nullptr;
+  }
+  first_frame_timer_ = nullptr;
   peer_connection_ = nullptr;
-  peer_connection_factory_ = nullptr;
+  if (!prewarm_) {
+    spare_connection_ = nullptr;
+    if (!shared_media_) {
+      audio_track_ = nullptr;
+      video_track_ = nullptr;
+      peer_connection_factory_ = nullptr;
+    }
+  } else if (prewarm_connection_ && !spare_connection_ &&
+             peer_connection_factory_) {
+    // Ready for the next call.
+    CreateSpareConnection();
+  }
   peer_id_ = -1;
   loopback_ = false;
+  peer_compact_supported_ = false;
+  // Whatever the call still had to say goes nowhere now.
+  pending_messages_.Clear();
+  if (signaling_thread_) {
+    webrtc::scoped_refptr<Conductor> self(this);
+    signaling_thread_->PostTask([self] { self->ResetCandidates(); });
+  }
 }
 
 void Conductor::EnsureStreamingUI() {
@@ -300,13 +556,37 @@ void Conductor::OnIceCandidate(const webrtc::IceCandidate* candidate) {
     return;
   }
 
-  Json::Value jmessage;
-  jmessage[kCandidateSdpMidName] = candidate->sdp_mid();
-  jmessage[kCandidateSdpMlineIndexName] = candidate->sdp_mline_index();
-  jmessage[kCandidateSdpName] = candidate->ToString();
+  // The first local or STUN candidate lets the peer start its checks, so
+  // it goes out at once; the rest are sent in batches.
+  const webrtc::Candidate& value = candidate->candidate();
+  if (!first_candidate_sent_ && (value.is_local() || value.is_stun())) {
+    first_candidate_sent_ = true;
+    SendMessage(outgoing_codec_.EncodeCandidate(
+        SignalingEncoding(), candidate->sdp_mid(),
+        candidate->sdp_mline_index(), candidate->ToString()));
+    return;
+  }
 
-  Json::StreamWriterBuilder factory;
-  SendMessage(Json::writeString(factory, jmessage));
+  webrtc::Timestamp now = env_.clock().CurrentTime();
+  if (pending_candidates_.empty())
+    first_candidate_time_ = now;
+  last_candidate_time_ = now;
+  pending_candidates_.push_back({candidate->sdp_mid(),
+                                 candidate->sdp_mline_index(),
+                                 candidate->ToString()});
+  if (!candidate_timer_running_) {
+    candidate_timer_running_ = true;
+    webrtc::scoped_refptr<Conductor> self(this);
+    signaling_thread_->PostDelayedTask([self] { self->OnCandidateTimer(); },
+                                       kCandidateQuietPeriod);
+  }
+}
+
+void Conductor::OnIceGatheringChange(
+    webrtc::PeerConnectionInterface::IceGatheringState new_state) {
+  // No more candidates will come, so there is nothing left to wait for.
+  if (new_state == webrtc::PeerConnectionInterface::kIceGatheringComplete)
+    FlushCandidates();
 }
 
 //
@@ -346,7 +626,7 @@ void Conductor::OnPeerDisconnected(int id) {
   }
 }
 
-void Conductor::OnMessageFromPeer(int peer_id, const std::string& message) {
+void Conductor::OnMessageFromPeer(int peer_id, absl::string_view message) {
   RTC_DCHECK(peer_id_ == peer_id || peer_id_ == -1);
   RTC_DCHECK(!message.empty());
 
@@ -367,22 +647,16 @@ void Conductor::OnMessageFromPeer(int peer_id, const std::string& message) {
     return;
   }
 
-  Json::CharReaderBuilder factory;
-  std::unique_ptr<Json::CharReader> reader =
-      absl::WrapUnique(factory.newCharReader());
-  Json::Value jmessage;
-  if (!reader->parse(message.data(), message.data() + message.length(),
-                     &jmessage, nullptr)) {
+  SignalingMessage& decoded = incoming_message_;
+  if (!incoming_codec_.Decode(message, &decoded)) {
     RTC_LOG(LS_WARNING) << "Received unknown message. " << message;
     return;
   }
-  std::string type_str;
-  std::string json_object;
+  if (decoded.compact_supported)
+    peer_compact_supported_ = true;
 
-  webrtc::GetStringFromJsonObject(jmessage, kSessionDescriptionTypeName,
-                                  &type_str);
-  if (!type_str.empty()) {
-    if (type_str == "offer-loopback") {
+  if (decoded.kind == SignalingMessage::SESSION_DESCRIPTION) {
+    if (decoded.type == "offer-loopback") {
       // This is a loopback call.
       // Recreate the peerconnection with DTLS disabled.
       if (!ReinitializePeerConnectionForLoopback()) {
@@ -393,22 +667,29 @@ void Conductor::OnMessageFromPeer(int peer_id, const std::string& message) {
       return;
     }
     std::optional<webrtc::SdpType> type_maybe =
-        webrtc::SdpTypeFromString(type_str);
+        webrtc::SdpTypeFromString(decoded.type);
     if (!type_maybe) {
-      RTC_LOG(LS_ERROR) << "Unknown SDP type: " << type_str;
+      RTC_LOG(LS_ERROR) << "Unknown SDP type: " << decoded.type;
       return;
     }
     webrtc::SdpType type = *type_maybe;
-    std::string sdp;
-    if (!webrtc::GetStringFromJsonObject(jmessage, kSessionDescriptionSdpName,
-                                         &sdp)) {
+    if (type == webrtc::SdpType::kOffer && client_->id() < peer_id_ &&
+        peer_connection_->signaling_state() ==
+            webrtc::PeerConnectionInterface::kHaveLocalOffer) {
+      // Both of us sent an offer.  The peer with the higher id takes the
+      // offer of the other one, dropping its own.
+      RTC_LOG(LS_INFO) << "Ignoring the offer that collided with ours";
+      return;
+    }
+    if (decoded.sdp.empty()) {
       RTC_LOG(LS_WARNING)
           << "Can't parse received session description message.";
       return;
     }
     webrtc::SdpParseError error;
     std::unique_ptr<webrtc::SessionDescriptionInterface> session_description =
-        webrtc::CreateSessionDescription(type, sdp, &error);
+        webrtc::CreateSessionDescription(type, std::string(decoded.sdp),
+                                         &error);
     if (!session_description) {
       RTC_LOG(LS_WARNING)
           << "Can't parse received session description message. "
@@ -424,38 +705,42 @@ void Conductor::OnMessageFromPeer(int peer_id, const std::string& message) {
       peer_connection_->CreateAnswer(
           this, webrtc::PeerConnectionInterface::RTCOfferAnswerOptions());
     }
-  } else {
-    std::string sdp_mid;
-    int sdp_mlineindex = 0;
-    std::string sdp;
-    if (!webrtc::GetStringFromJsonObject(jmessage, kCandidateSdpMidName,
-                                         &sdp_mid) ||
-        !webrtc::GetIntFromJsonObject(jmessage, kCandidateSdpMlineIndexName,
-                                      &sdp_mlineindex) ||
-        !webrtc::GetStringFromJsonObject(jmessage, kCandidateSdpName, &sdp)) {
-      RTC_LOG(LS_WARNING) << "Can't parse received message.";
-      return;
-    }
-    webrtc::SdpParseError error;
-    std::unique_ptr<webrtc::IceCandidate> candidate(
-        webrtc::CreateIceCandidate(sdp_mid, sdp_mlineindex, sdp, &error));
-    if (!candidate) {
-      RTC_LOG(LS_WARNING) << "Can't parse received candidate message. "
-                             "SdpParseError was: "
-                          << error.description;
-      return;
-    }
-    if (!peer_connection_->AddIceCandidate(candidate.get())) {
-      RTC_LOG(LS_WARNING) << "Failed to apply the received candidate";
-      return;
+  } else if (decoded.kind == SignalingMessage::CANDIDATES) {
+    std::vector<std::unique_ptr<webrtc::IceCandidate>> candidates;
+    candidates.reserve(decoded.candidates.size());
+    for (const SignalingCandidate& received : decoded.candidates) {
+      webrtc::SdpParseError error;
+      std::unique_ptr<webrtc::IceCandidate> candidate(
+          webrtc::CreateIceCandidate(std::string(received.sdp_mid),
+                                     received.sdp_mline_index,
+                                     std::string(received.candidate), &error));
+      if (!candidate) {
+        RTC_LOG(LS_WARNING) << "Can't parse received candidate message. "
+                               "SdpParseError was: "
+                            << error.description;
+        continue;
+      }
+      candidates.push_back(std::move(candidate));
     }
-    RTC_LOG(LS_INFO) << " Received candidate :" << message;
+    // Apply the whole batch in one visit to the signaling thread instead of
+    // one per candidate.
+    signaling_thread_->BlockingCall([this, &candidates] {
+      for (const std::unique_ptr<webrtc::IceCandidate>& candidate :
+           candidates) {
+        if (!peer_connection_->AddIceCandidate(candidate.get()))
+          RTC_LOG(LS_WARNING) << "Failed to apply the received candidate";
+      }
+    });
+    RTC_LOG(LS_INFO) << " Received " << candidates.size()
+                     << " candidates :" << message;
+  } else {
+    RTC_LOG(LS_WARNING) << "Can't parse received message.";
   }
 }
 
 void Conductor::OnMessageSent(int err) {
-  // Process the next pending message if any.
-  main_wnd_->QueueUIThreadCallback(SEND_MESSAGE_TO_PEER, nullptr);
+  // Process the next pending messages if any.
+  FlushPendingMessages();
 }
 
 void Conductor::OnServerConnectionFailure() {
@@ -463,6 +748,21 @@ void Conductor::OnServerConnectionFailure() {
                         true);
 }
 
+void Conductor::OnSessionResumed() {
+  RTC_LOG(LS_INFO) << __FUNCTION__;
+  // Messages signaled while the server was out of reach go out now.
+  FlushPendingMessages();
+  if (!peer_connection_ || loopback_)
+    return;
+
+  // Whatever cut us off from the server may have broken the media path too,
+  // e.g. a change of network.  Gather new candidates on the existing
+  // connection rather than starting the call over.
+  webrtc::PeerConnectionInterface::RTCOfferAnswerOptions options;
+  options.ice_restart = true;
+  peer_connection_->CreateOffer(this, options);
+}
+
 //
 // MainWndCallback implementation.
 //
@@ -471,7 +771,7 @@ void Conductor::StartLogin(const std::string& server, int port) {
   if (client_->is_connected())
     return;
   server_ = server;
-  client_->Connect(server, port, GetPeerName());
+  client_->Connect(server, port, peer_name_);
 }
 
 void Conductor::DisconnectFromServer() {
@@ -498,41 +798,116 @@ void Conductor::ConnectToPeer(int peer_id) {
   }
 }
 
-void Conductor::AddTracks() {
-  if (!peer_connection_->GetSenders().empty()) {
-    return;  // Already added tracks.
+void Conductor::CreateLocalTracks() {
+  RTC_DCHECK(peer_connection_factory_);
+  if (shared_media_)
+    return;
+  if (!audio_track_) {
+    audio_track_ = peer_connection_factory_->CreateAudioTrack(
+        kAudioLabel,
+        peer_connection_factory_->CreateAudioSource(webrtc::AudioOptions())
+            .get());
   }
-
-  webrtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track(
-      peer_connection_factory_->CreateAudioTrack(
-          kAudioLabel,
-          peer_connection_factory_->CreateAudioSource(webrtc::AudioOptions())
-              .get()));
-  auto result_or_error = peer_connection_->AddTrack(audio_track, {kStreamId});
-  if (!result_or_error.ok()) {
-    RTC_LOG(LS_ERROR) << "Failed to add audio track to PeerConnection: "
-                      << result_or_error.error().message();
+  if (!video_track_) {
+    webrtc::scoped_refptr<CapturerTrackSource> video_device =
+        CapturerTrackSource::Create(env_.task_queue_factory());
+    if (video_device) {
+      video_track_ = peer_connection_factory_->CreateVideoTrack(video_device,
+                                                                kVideoLabel);
+    } else {
+      RTC_LOG(LS_ERROR) << "OpenVideoCaptureDevice failed";
+    }
   }
+}
 
-  webrtc::scoped_refptr<CapturerTrackSource> video_device =
-      CapturerTrackSource::Create(env_.task_queue_factory());
-  if (video_device) {
-    webrtc::scoped_refptr<webrtc::VideoTrackInterface> video_track_(
-        peer_connection_factory_->CreateVideoTrack(video_device, kVideoLabel));
-    main_wnd_->StartLocalRenderer(video_track_.get());
-
-    result_or_error = peer_connection_->AddTrack(video_track_, {kStreamId});
+webrtc::scoped_refptr<webrtc::RtpSenderInterface> Conductor::AddLocalTracks(
+    webrtc::PeerConnectionInterface* peer_connection) {
+  CreateLocalTracks();
+  if (audio_track_) {
+    auto result_or_error =
+        peer_connection->AddTrack(audio_track_, {kStreamId});
     if (!result_or_error.ok()) {
-      RTC_LOG(LS_ERROR) << "Failed to add video track to PeerConnection: "
+      RTC_LOG(LS_ERROR) << "Failed to add audio track to PeerConnection: "
                         << result_or_error.error().message();
     }
+  }
+  if (!video_track_)
+    return nullptr;
+  return AddVideoTrack(peer_connection, video_track_);
+}
+
+void Conductor::AddTracks() {
+  if (peer_connection_->GetSenders().empty()) {
+    video_sender_ = AddLocalTracks(peer_connection_.get());
   } else {
-    RTC_LOG(LS_ERROR) << "OpenVideoCaptureDevice failed";
+    // A spare connection comes with its tracks.
+    for (const auto& sender : peer_connection_->GetSenders()) {
+      if (sender->media_type() == webrtc::MediaType::VIDEO)
+        video_sender_ = sender;
+    }
   }
 
+  if (video_track_)
+    main_wnd_->StartLocalRenderer(video_track_.get());
   main_wnd_->SwitchToStreamingUI();
 }
 
+webrtc::scoped_refptr<webrtc::RtpSenderInterface> Conductor::AddVideoTrack(
+    webrtc::PeerConnectionInterface* peer_connection,
+    webrtc::scoped_refptr<webrtc::VideoTrackInterface> track) {
+  webrtc::RtpTransceiverInit init;
+  init.stream_ids = {kStreamId};
+  // With more than one layer the rate allocator switches off those at the
+  // top that the estimated bandwidth can't carry, and brings them back once
+  // it can.
+  switch (video_send_mode_) {
+    case VideoSendMode::kSingle:
+      break;
+    case VideoSendMode::kSimulcast:
+      for (const SimulcastLayer& layer : kSimulcastLayers) {
+        webrtc::RtpEncodingParameters encoding;
+        encoding.rid = layer.rid;
+        encoding.scale_resolution_down_by = layer.scale_resolution_down_by;
+        encoding.max_bitrate_bps = layer.max_bitrate_bps;
+        init.send_encodings.push_back(encoding);
+      }
+      break;
+    case VideoSendMode::kSvc: {
+      webrtc::RtpEncodingParameters encoding;
+      encoding.scalability_mode = SvcMode(kVideoLayers);
+      init.send_encodings.push_back(encoding);
+      break;
+    }
+  }
+
+  auto result_or_error = peer_connection->AddTransceiver(track, init);
+  if (!result_or_error.ok()) {
+    RTC_LOG(LS_ERROR) << "Failed to add video track to PeerConnection: "
+                      << result_or_error.error().message();
+    return nullptr;
+  }
+  webrtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver =
+      result_or_error.MoveValue();
+
+  if (video_send_mode_ == VideoSendMode::kSvc) {
+    // Only VP9 and AV1 have spatial layers, so they go first.
+    std::vector<webrtc::RtpCodecCapability> codecs =
+        peer_connection_factory_
+            ->GetRtpReceiverCapabilities(webrtc::MediaType::VIDEO)
+            .codecs;
+    std::stable_partition(codecs.begin(), codecs.end(),
+                          [](const webrtc::RtpCodecCapability& codec) {
+                            return codec.name == "VP9" || codec.name == "AV1";
+                          });
+    webrtc::RTCError error = transceiver->SetCodecPreferences(codecs);
+    if (!error.ok()) {
+      RTC_LOG(LS_WARNING) << "Failed to prefer the SVC codecs: "
+                          << error.message();
+    }
+  }
+  return transceiver->sender();
+}
+
 void Conductor::DisconnectFromCurrentPeer() {
   RTC_LOG(LS_INFO) << __FUNCTION__;
   if (peer_connection_) {
@@ -561,38 +936,18 @@ void Conductor::UIThreadCallback(int msg_id, void* data) {
       }
       break;
 
-    case SEND_MESSAGE_TO_PEER: {
-      RTC_LOG(LS_INFO) << "SEND_MESSAGE_TO_PEER";
-      std::string* msg = reinterpret_cast<std::string*>(data);
-      if (msg) {
-        // For convenience, we always run the message through the queue.
-        // This way we can be sure that messages are sent to the server
-        // in the same order they were signaled without much hassle.
-        pending_messages_.push_back(msg);
-      }
-
-      if (!pending_messages_.empty() && !client_->IsSendingMessage()) {
-        msg = pending_messages_.front();
-        pending_messages_.pop_front();
-
-        if (!client_->SendToPeer(peer_id_, *msg) && peer_id_ != -1) {
-          RTC_LOG(LS_ERROR) << "SendToPeer failed";
-          DisconnectFromServer();
-        }
-        delete msg;
-      }
-
-      if (!peer_connection_)
-        peer_id_ = -1;
-
-      break;
-    }
-
     case NEW_TRACK_ADDED: {
       auto* track = reinterpret_cast<webrtc::MediaStreamTrackInterface*>(data);
       if (track->kind() == webrtc::MediaStreamTrackInterface::kVideoKind) {
         auto* video_track = static_cast<webrtc::VideoTrackInterface*>(track);
         main_wnd_->StartRemoteRenderer(video_track);
+        if (!remote_video_track_) {
+          remote_video_track_ = video_track;
+          first_frame_timer_ = std::make_unique<FirstFrameTimer>(
+              env_.clock(), call_start_time_, call_setup_);
+          remote_video_track_->AddOrUpdateSink(first_frame_timer_.get(),
+                                               webrtc::VideoSinkWants());
+        }
       }
       track->Release();
       break;
@@ -629,20 +984,111 @@ void Conductor::OnSuccess(webrtc::SessionDescriptionInterface* desc) {
     return;
   }
 
-  Json::Value jmessage;
-  jmessage[kSessionDescriptionTypeName] =
-      webrtc::SdpTypeToString(desc->GetType());
-  jmessage[kSessionDescriptionSdpName] = sdp;
-
-  Json::StreamWriterBuilder factory;
-  SendMessage(Json::writeString(factory, jmessage));
+  SendMessage(outgoing_codec_.EncodeSessionDescription(
+      SignalingEncoding(), webrtc::SdpTypeToString(desc->GetType()), sdp));
 }
 
 void Conductor::OnFailure(webrtc::RTCError error) {
   RTC_LOG(LS_ERROR) << ToString(error.type()) << ": " << error.message();
 }
 
-void Conductor::SendMessage(const std::string& json_object) {
-  std::string* msg = new std::string(json_object);
-  main_wnd_->QueueUIThreadCallback(SEND_MESSAGE_TO_PEER, msg);
+SignalingCodec::Encoding Conductor::SignalingEncoding() const {
+  return peer_compact_supported_ ? SignalingCodec::COMPACT
+                                 : SignalingCodec::JSON;
+}
+
+void Conductor::SendMessage(absl::string_view message) {
+  RTC_DCHECK(signaling_thread_->IsCurrent());
+  webrtc::scoped_refptr<Conductor> self(this);
+  if (!pending_messages_.Push(message)) {
+    RTC_LOG(LS_ERROR) << "Too many messages for the peer, disconnecting";
+    network_thread_->PostTask([self] { self->DisconnectFromServer(); });
+    return;
+  }
+  // Only the first message after the ring was drained needs a task.
+  if (!flush_pending_.exchange(true)) {
+    network_thread_->PostTask([self] {
+      self->flush_pending_ = false;
+      self->FlushPendingMessages();
+    });
+  }
+}
+
+void Conductor::OnCandidateTimer() {
+  RTC_DCHECK(signaling_thread_->IsCurrent());
+  candidate_timer_running_ = false;
+  if (pending_candidates_.empty())
+    return;
+
+  webrtc::Timestamp now = env_.clock().CurrentTime();
+  webrtc::Timestamp deadline =
+      std::min(last_candidate_time_ + kCandidateQuietPeriod,
+               first_candidate_time_ + kMaxCandidateDelay);
+  if (now < deadline) {
+    // More candidates arrived since the timer was started.
+    candidate_timer_running_ = true;
+    webrtc::scoped_refptr<Conductor> self(this);
+    signaling_thread_->PostDelayedTask([self] { self->OnCandidateTimer(); },
+                                       deadline - now);
+    return;
+  }
+  FlushCandidates();
+}
+
+void Conductor::FlushCandidates() {
+  RTC_DCHECK(signaling_thread_->IsCurrent());
+  if (pending_candidates_.empty())
+    return;
+
+  if (pending_candidates_.size() == 1 || !peer_compact_supported_) {
+    // Peers that haven't announced the codec only know single candidates.
+    for (const PendingCandidate& candidate : pending_candidates_) {
+      SendMessage(outgoing_codec_.EncodeCandidate(
+          SignalingEncoding(), candidate.sdp_mid, candidate.sdp_mline_index,
+          candidate.candidate));
+    }
+  } else {
+    candidate_batch_.clear();
+    for (const PendingCandidate& candidate : pending_candidates_) {
+      candidate_batch_.emplace_back(candidate.sdp_mid,
+                                    candidate.sdp_mline_index,
+                                    candidate.candidate);
+    }
+    SendMessage(outgoing_codec_.EncodeCandidates(SignalingEncoding(),
+                                                 candidate_batch_));
+  }
+  pending_candidates_.clear();
+}
+
+void Conductor::ResetCandidates() {
+  RTC_DCHECK(signaling_thread_->IsCurrent());
+  // A timer that is still running finds nothing to send.
+  pending_candidates_.clear();
+  first_candidate_sent_ = false;
+}
+
+void Conductor::FlushPendingMessages() {
+  RTC_DCHECK(network_thread_->IsCurrent());
+  // The messages go out in the order they were signaled, as many at once
+  // as the client pipelines on its connection.
+  while (!client_->IsSendingMessage()) {
+    const std::string* message = pending_messages_.Front();
+    if (!message)
+      break;
+    if (!client_->SendToPeer(peer_id_, *message)) {
+      if (peer_id_ == -1) {
+        RTC_LOG(LS_INFO) << "Dropping a message for a call that ended";
+        pending_messages_.Pop();
+        continue;
+      }
+      // The message stays first in line; disconnecting clears the ring.
+      RTC_LOG(LS_ERROR) << "SendToPeer failed";
+      DisconnectFromServer();
+      break;
+    }
+    pending_messages_.Pop();
+  }
+
+  if (!peer_connection_)
+    peer_id_ = -1;
 }
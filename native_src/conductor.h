@@ -11,22 +11,32 @@
 #ifndef EXAMPLES_PEERCONNECTION_CLIENT_CONDUCTOR_H_
 #define EXAMPLES_PEERCONNECTION_CLIENT_CONDUCTOR_H_
 
-#include <deque>
+#include <atomic>
+#include <cstddef>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
 #include "absl/base/nullability.h"
+#include "absl/strings/string_view.h"
 #include "api/data_channel_interface.h"
 #include "api/environment/environment.h"
 #include "api/jsep.h"
 #include "api/media_stream_interface.h"
 #include "api/peer_connection_interface.h"
 #include "api/rtc_error.h"
+#include "api/rtp_parameters.h"
 #include "api/rtp_receiver_interface.h"
+#include "api/rtp_sender_interface.h"
 #include "api/scoped_refptr.h"
+#include "api/units/time_delta.h"
+#include "api/units/timestamp.h"
+#include "examples/peerconnection/client/call_stats.h"
 #include "examples/peerconnection/client/main_wnd.h"
+#include "examples/peerconnection/client/message_ring.h"
 #include "examples/peerconnection/client/peer_connection_client.h"
+#include "examples/peerconnection/client/signaling_codec.h"
 #include "rtc_base/thread.h"
 
 namespace webrtc {
@@ -41,7 +51,6 @@ class Conductor : public webrtc::PeerConnectionObserver,
   enum CallbackID {
     MEDIA_CHANNELS_INITIALIZED = 1,
     PEER_CONNECTION_CLOSED,
-    SEND_MESSAGE_TO_PEER,
     NEW_TRACK_ADDED,
     TRACK_REMOVED,
   };
@@ -50,18 +59,109 @@ class Conductor : public webrtc::PeerConnectionObserver,
             PeerConnectionClient* absl_nonnull client,
             MainWindow* absl_nonnull main_wnd);
 
+  // How the video of a call is encoded.
+  enum class VideoSendMode {
+    // A single encoding.
+    kSingle,
+    // Three encodings at a quarter, half and full resolution, for a
+    // forwarder that hands each receiver the one its link can take.
+    kSimulcast,
+    // One VP9 or AV1 encoding with three spatial and three temporal layers
+    // (L3T3), which a forwarder can thin out without re-encoding.
+    kSvc,
+  };
+
+  // The layers of simulcast and SVC, numbered from the lowest resolution.
+  static constexpr size_t kVideoLayers = 3;
+
   bool connection_active() const;
 
   void Close() override;
 
+  // Takes effect when the next call starts.
+  void SetVideoSendMode(VideoSendMode mode);
+
+  // Starts or stops sending a layer of the current call.  The spatial layers
+  // of SVC build on those below them, so stopping one stops those above it
+  // and starting one starts those below it.  Returns false if there is no
+  // such layer.
+  bool SetVideoLayerActive(size_t layer, bool active);
+
+  // Caps the bitrate and frame rate of a simulcast layer, or of the whole
+  // stream when sending a single encoding or SVC, where `layer` must be 0.
+  // Unset values remove the cap.  Returns false if there is no such layer or
+  // the limits are rejected.
+  bool SetVideoLayerLimits(size_t layer,
+                           std::optional<int> max_bitrate_bps,
+                           std::optional<double> max_framerate);
+
+  // Samples the statistics of each call every `interval` and hands them to
+  // `sink` on the signaling thread, e.g. a FileCallStatsSink, or a
+  // SignalingCallStatsSink to upload them over the client.  A null sink
+  // stops sampling.  Takes effect when the next call starts.
+  void SetCallStatsSink(std::shared_ptr<CallStatsSink> sink,
+                        webrtc::TimeDelta interval);
+
+  // Builds the PeerConnectionFactory and opens the capture device now,
+  // rather than when the first call starts, and keeps them for all calls
+  // until Close().  With `create_peer_connection`, the PeerConnection of
+  // the next call is created ahead of it too, with its tracks added and its
+  // ICE candidates gathered, so that an offer can be answered right away;
+  // another one is created whenever a call ends.  Returns false if the
+  // factory could not be built.
+  bool Prewarm(bool create_peer_connection);
+
+  // The name that StartLogin() signs in with, GetPeerName() by default.
+  void SetPeerName(const std::string& name);
+
+  // Makes calls use `factory`, whose signaling thread is `signaling_thread`,
+  // and send `audio_track` and `video_track`, either of which may be null to
+  // send none, rather than building a factory and opening a capture device
+  // of their own.  All of them may be shared with other conductors, and are
+  // kept until the Conductor goes away.  Loopback calls change the options
+  // of the factory, so they should not be made on a shared one.  Must be
+  // called before the first call.
+  void SetSharedMedia(
+      webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory,
+      webrtc::Thread* absl_nonnull signaling_thread,
+      webrtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track,
+      webrtc::scoped_refptr<webrtc::VideoTrackInterface> video_track);
+
  protected:
+  // Logs the time from the start of a call to its first remote video frame.
+  class FirstFrameTimer;
+
   ~Conductor();
   bool InitializePeerConnection();
   bool ReinitializePeerConnectionForLoopback();
+  bool CreatePeerConnectionFactory();
   bool CreatePeerConnection();
+  // Returns a PeerConnection from `peer_connection_factory_`, which gathers
+  // ICE candidates before it is used if `pre_gather` is set.
+  webrtc::scoped_refptr<webrtc::PeerConnectionInterface> NewPeerConnection(
+      bool pre_gather);
+  // Creates `spare_connection_` with the local tracks added.
+  void CreateSpareConnection();
   void DeletePeerConnection();
   void EnsureStreamingUI();
+  // Creates the local tracks that don't exist yet.
+  void CreateLocalTracks();
+  // Adds the local tracks to `peer_connection` and returns the video
+  // sender, if there is video.
+  webrtc::scoped_refptr<webrtc::RtpSenderInterface> AddLocalTracks(
+      webrtc::PeerConnectionInterface* peer_connection);
   void AddTracks();
+  // Adds `track` with the encodings of `video_send_mode_` and returns its
+  // sender, or null on failure.
+  webrtc::scoped_refptr<webrtc::RtpSenderInterface> AddVideoTrack(
+      webrtc::PeerConnectionInterface* peer_connection,
+      webrtc::scoped_refptr<webrtc::VideoTrackInterface> track);
+  // Applies changed parameters to `video_sender_`.
+  bool SetVideoParameters(const webrtc::RtpParameters& parameters);
+  // Starts sampling the statistics of `peer_connection_` if a sink is set,
+  // and stops sampling them.
+  void StartCallStats();
+  void StopCallStats();
 
   //
   // PeerConnectionObserver implementation.
@@ -81,7 +181,7 @@ class Conductor : public webrtc::PeerConnectionObserver,
   void OnIceConnectionChange(
       webrtc::PeerConnectionInterface::IceConnectionState new_state) override {}
   void OnIceGatheringChange(
-      webrtc::PeerConnectionInterface::IceGatheringState new_state) override {}
+      webrtc::PeerConnectionInterface::IceGatheringState new_state) override;
   void OnIceCandidate(const webrtc::IceCandidate* candidate) override;
   void OnIceConnectionReceivingChange(bool receiving) override {}
 
@@ -97,12 +197,14 @@ class Conductor : public webrtc::PeerConnectionObserver,
 
   void OnPeerDisconnected(int id) override;
 
-  void OnMessageFromPeer(int peer_id, const std::string& message) override;
+  void OnMessageFromPeer(int peer_id, absl::string_view message) override;
 
   void OnMessageSent(int err) override;
 
   void OnServerConnectionFailure() override;
 
+  void OnSessionResumed() override;
+
   //
   // MainWndCallback implementation.
   //
@@ -122,20 +224,102 @@ class Conductor : public webrtc::PeerConnectionObserver,
   void OnFailure(webrtc::RTCError error) override;
 
  protected:
-  // Send a message to the remote peer.
-  void SendMessage(const std::string& json_object);
+  // The encoding of the messages for the remote peer: compact once it has
+  // said that it understands it, JSON until then.
+  SignalingCodec::Encoding SignalingEncoding() const;
+
+  // Send a message to the remote peer.  Called on the signaling thread;
+  // the message is handed to the client on `network_thread_`.
+  void SendMessage(absl::string_view message);
+
+  // Sends the queued messages for as long as the client takes more.  Runs
+  // on `network_thread_`.
+  void FlushPendingMessages();
+
+  // Sends the batched candidates once no more have been gathered for a
+  // moment, or once the first of them has waited long enough.  Runs on the
+  // signaling thread.
+  void OnCandidateTimer();
+
+  // Sends the batched candidates, as one message if the peer understands
+  // batches.  Runs on the signaling thread.
+  void FlushCandidates();
+
+  // Forgets the candidates of the previous call.  Runs on the signaling
+  // thread.
+  void ResetCandidates();
+
+  // A gathered candidate that waits for the others of its batch.
+  struct PendingCandidate {
+    std::string sdp_mid;
+    int sdp_mline_index;
+    std::string candidate;
+  };
 
   int peer_id_;
   bool loopback_;
+  VideoSendMode video_send_mode_;
+  // Set by Prewarm() until Close(): the factory and the local tracks stay
+  // between calls, and with `prewarm_connection_` so does a spare
+  // PeerConnection for the next call.
+  bool prewarm_;
+  bool prewarm_connection_;
+  // Set by SetSharedMedia(): the factory and the local tracks are never
+  // replaced.
+  bool shared_media_;
+  webrtc::scoped_refptr<webrtc::PeerConnectionInterface> spare_connection_;
+  webrtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track_;
+  webrtc::scoped_refptr<webrtc::VideoTrackInterface> video_track_;
+  // When the current call started, and what it found ready for it.
+  webrtc::Timestamp call_start_time_;
+  absl::string_view call_setup_;
+  webrtc::scoped_refptr<webrtc::VideoTrackInterface> remote_video_track_;
+  std::unique_ptr<FirstFrameTimer> first_frame_timer_;
+  // The sender of the local video of the current call.
+  webrtc::scoped_refptr<webrtc::RtpSenderInterface> video_sender_;
+  // Where and how often the statistics of calls go, and the collector of
+  // the current call.
+  std::shared_ptr<CallStatsSink> call_stats_sink_;
+  webrtc::TimeDelta call_stats_interval_;
+  webrtc::scoped_refptr<CallStatsCollector> call_stats_;
+  // Decodes on the main thread, where the messages arrive.
+  SignalingCodec incoming_codec_;
+  // Reused for every message, which keeps the memory of its candidates.
+  SignalingMessage incoming_message_;
+  // Encodes on the signaling thread, where the local descriptions and
+  // candidates are reported.
+  SignalingCodec outgoing_codec_;
+  // Set on the main thread and read on the signaling thread.  Peers that
+  // understand the compact encoding understand batches of candidates too.
+  std::atomic<bool> peer_compact_supported_;
+  // The candidates of the current batch, when the first and the last of
+  // them were gathered, and whether the timer for the batch runs.  Signaling
+  // thread only.
+  std::vector<PendingCandidate> pending_candidates_;
+  std::vector<SignalingCandidate> candidate_batch_;
+  webrtc::Timestamp first_candidate_time_;
+  webrtc::Timestamp last_candidate_time_;
+  bool candidate_timer_running_;
+  // Whether a host or server reflexive candidate went out already; the
+  // first one is not batched.  Signaling thread only.
+  bool first_candidate_sent_;
   const webrtc::Environment env_;
-  std::unique_ptr<webrtc::Thread> signaling_thread_;
+  // Either `owned_signaling_thread_` or the thread of a shared factory.
+  std::unique_ptr<webrtc::Thread> owned_signaling_thread_;
+  webrtc::Thread* signaling_thread_;
   webrtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection_;
   webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>
       peer_connection_factory_;
   PeerConnectionClient* client_;
   MainWindow* main_wnd_;
-  std::deque<std::string*> pending_messages_;
+  // The thread that runs `client_`, on which the Conductor is created.
+  webrtc::Thread* const network_thread_;
+  // Messages from the signaling thread to `network_thread_`.
+  MessageRing pending_messages_;
+  // Set while a task to flush `pending_messages_` is posted.
+  std::atomic<bool> flush_pending_;
   std::string server_;
+  std::string peer_name_;
 };
 
 #endif  // EXAMPLES_PEERCONNECTION_CLIENT_CONDUCTOR_H_
@@ -0,0 +1,458 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/client/d3d11_renderer.h"
+
+#include <d3d11.h>
+#include <d3dcompiler.h>
+#include <dxgi.h>
+#include <windows.h>
+#include <wrl/client.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+
+#include "api/scoped_refptr.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_frame_buffer.h"
+#include "api/video/video_rotation.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+
+#pragma comment(lib, "d3d11.lib")
+#pragma comment(lib, "d3dcompiler.lib")
+
+using Microsoft::WRL::ComPtr;
+
+namespace {
+
+// Distance of the thumbnail from the corner of the window, in the units of
+// the remote video.
+const int kThumbnailMargin = 10;
+// Windows smaller than this in either direction get no thumbnail.
+const int kMinSizeForThumbnail = 200;
+
+// The remote video and the thumbnail are drawn as a triangle strip of four
+// vertices each.
+const int kQuadVertices = 4;
+const int kMaxVertices = 2 * kQuadVertices;
+
+// The pixel shaders convert with the BT.601 limited range matrix, the same
+// as libyuv::I420ToARGB() on the GDI path.
+const char kShaderSource[] = R"(
+struct Vertex {
+  float2 position : POSITION;
+  float2 uv : TEXCOORD;
+};
+
+struct Pixel {
+  float4 position : SV_POSITION;
+  float2 uv : TEXCOORD;
+};
+
+Texture2D plane0 : register(t0);
+Texture2D plane1 : register(t1);
+Texture2D plane2 : register(t2);
+SamplerState bilinear : register(s0);
+
+Pixel VertexMain(Vertex input) {
+  Pixel output;
+  output.position = float4(input.position, 0.0, 1.0);
+  output.uv = input.uv;
+  return output;
+}
+
+float4 ToRgb(float y, float u, float v) {
+  y = 1.164 * (y - 0.0625);
+  u -= 0.5;
+  v -= 0.5;
+  return float4(saturate(float3(y + 1.596 * v,
+                                y - 0.391 * u - 0.813 * v,
+                                y + 2.018 * u)), 1.0);
+}
+
+float4 I420Main(Pixel input) : SV_TARGET {
+  return ToRgb(plane0.Sample(bilinear, input.uv).r,
+               plane1.Sample(bilinear, input.uv).r,
+               plane2.Sample(bilinear, input.uv).r);
+}
+
+float4 Nv12Main(Pixel input) : SV_TARGET {
+  float2 uv = plane1.Sample(bilinear, input.uv).rg;
+  return ToRgb(plane0.Sample(bilinear, input.uv).r, uv.x, uv.y);
+}
+)";
+
+ComPtr<ID3DBlob> CompileShader(const char* entry_point, const char* target) {
+  ComPtr<ID3DBlob> code;
+  ComPtr<ID3DBlob> errors;
+  HRESULT hr = D3DCompile(kShaderSource, sizeof(kShaderSource) - 1, nullptr,
+                          nullptr, nullptr, entry_point, target,
+                          D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &code, &errors);
+  if (FAILED(hr)) {
+    RTC_LOG(LS_ERROR) << "Failed to compile " << entry_point << ": "
+                      << (errors ? static_cast<const char*>(
+                                       errors->GetBufferPointer())
+                                 : "");
+    return nullptr;
+  }
+  return code;
+}
+
+bool IsRotatedSideways(webrtc::VideoRotation rotation) {
+  return rotation == webrtc::kVideoRotation_90 ||
+         rotation == webrtc::kVideoRotation_270;
+}
+
+}  // namespace
+
+// static
+std::unique_ptr<D3D11Renderer> D3D11Renderer::Create(HWND wnd) {
+  std::unique_ptr<D3D11Renderer> renderer(new D3D11Renderer(wnd));
+  if (!renderer->Initialize()) {
+    RTC_LOG(LS_WARNING) << "Direct3D 11 is not available, drawing with GDI";
+    return nullptr;
+  }
+  return renderer;
+}
+
+D3D11Renderer::D3D11Renderer(HWND wnd)
+    : wnd_(wnd), target_width_(0), target_height_(0) {}
+
+D3D11Renderer::~D3D11Renderer() {}
+
+bool D3D11Renderer::Initialize() {
+  // A single buffer that is copied to the window keeps the window usable
+  // for GDI, which still draws the other screens of the UI.
+  DXGI_SWAP_CHAIN_DESC desc = {};
+  desc.BufferDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+  desc.SampleDesc.Count = 1;
+  desc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+  desc.BufferCount = 1;
+  desc.OutputWindow = wnd_;
+  desc.Windowed = TRUE;
+  desc.SwapEffect = DXGI_SWAP_EFFECT_DISCARD;
+
+  const D3D_FEATURE_LEVEL kFeatureLevels[] = {
+      D3D_FEATURE_LEVEL_11_0,
+      D3D_FEATURE_LEVEL_10_1,
+      D3D_FEATURE_LEVEL_10_0,
+  };
+  HRESULT hr = D3D11CreateDeviceAndSwapChain(
+      nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr,
+      D3D11_CREATE_DEVICE_BGRA_SUPPORT, kFeatureLevels,
+      static_cast<UINT>(std::size(kFeatureLevels)), D3D11_SDK_VERSION, &desc,
+      &swap_chain_, &device_, nullptr, &context_);
+  if (FAILED(hr))
+    return false;
+
+  // The window is not meant to go full screen.
+  ComPtr<IDXGIFactory> factory;
+  if (SUCCEEDED(swap_chain_->GetParent(IID_PPV_ARGS(&factory))))
+    factory->MakeWindowAssociation(wnd_, DXGI_MWA_NO_ALT_ENTER);
+
+  ComPtr<ID3DBlob> vertex_code = CompileShader("VertexMain", "vs_4_0");
+  ComPtr<ID3DBlob> i420_code = CompileShader("I420Main", "ps_4_0");
+  ComPtr<ID3DBlob> nv12_code = CompileShader("Nv12Main", "ps_4_0");
+  if (!vertex_code || !i420_code || !nv12_code)
+    return false;
+
+  if (FAILED(device_->CreateVertexShader(vertex_code->GetBufferPointer(),
+                                         vertex_code->GetBufferSize(), nullptr,
+                                         &vertex_shader_)) ||
+      FAILED(device_->CreatePixelShader(i420_code->GetBufferPointer(),
+                                        i420_code->GetBufferSize(), nullptr,
+                                        &i420_shader_)) ||
+      FAILED(device_->CreatePixelShader(nv12_code->GetBufferPointer(),
+                                        nv12_code->GetBufferSize(), nullptr,
+                                        &nv12_shader_))) {
+    return false;
+  }
+
+  const D3D11_INPUT_ELEMENT_DESC kLayout[] = {
+      {"POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, offsetof(Vertex, x),
+       D3D11_INPUT_PER_VERTEX_DATA, 0},
+      {"TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, offsetof(Vertex, u),
+       D3D11_INPUT_PER_VERTEX_DATA, 0},
+  };
+  if (FAILED(device_->CreateInputLayout(
+          kLayout, static_cast<UINT>(std::size(kLayout)),
+          vertex_code->GetBufferPointer(), vertex_code->GetBufferSize(),
+          &input_layout_))) {
+    return false;
+  }
+
+  D3D11_BUFFER_DESC vertices_desc = {};
+  vertices_desc.ByteWidth = sizeof(Vertex) * kMaxVertices;
+  vertices_desc.Usage = D3D11_USAGE_DYNAMIC;
+  vertices_desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+  vertices_desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+  if (FAILED(device_->CreateBuffer(&vertices_desc, nullptr, &vertices_)))
+    return false;
+
+  D3D11_SAMPLER_DESC sampler_desc = {};
+  sampler_desc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+  sampler_desc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+  sampler_desc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+  sampler_desc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+  sampler_desc.MaxLOD = D3D11_FLOAT32_MAX;
+  return SUCCEEDED(device_->CreateSamplerState(&sampler_desc, &sampler_));
+}
+
+bool D3D11Renderer::Render(const webrtc::VideoFrame& remote,
+                           const webrtc::VideoFrame* thumbnail,
+                           RECT* thumbnail_rect) {
+  RTC_DCHECK(thumbnail_rect);
+  ::SetRectEmpty(thumbnail_rect);
+  RECT rc;
+  ::GetClientRect(wnd_, &rc);
+  int width = rc.right - rc.left;
+  int height = rc.bottom - rc.top;
+  if (width <= 0 || height <= 0)
+    return true;  // Minimized, there is nothing to draw into.
+  if (!ResizeTarget(width, height))
+    return false;
+
+  if (!Upload(remote.video_frame_buffer().get(), &remote_))
+    return false;
+  bool sideways = IsRotatedSideways(remote.rotation());
+  float video_width = sideways ? remote_.height : remote_.width;
+  float video_height = sideways ? remote_.width : remote_.height;
+  float scale = std::min(width / video_width, height / video_height);
+
+  Vertex quads[kMaxVertices] = {};
+  float left = (width - video_width * scale) / 2;
+  float top = (height - video_height * scale) / 2;
+  SetQuad(left, top, width - left, height - top, remote.rotation(), quads);
+
+  bool draw_thumbnail = thumbnail && width > kMinSizeForThumbnail &&
+                        height > kMinSizeForThumbnail;
+  if (draw_thumbnail) {
+    if (!Upload(thumbnail->video_frame_buffer().get(), &thumbnail_))
+      return false;
+    sideways = IsRotatedSideways(thumbnail->rotation());
+    float thumb_width =
+        (sideways ? thumbnail_.height : thumbnail_.width) / 4 * scale;
+    float thumb_height =
+        (sideways ? thumbnail_.width : thumbnail_.height) / 4 * scale;
+    float right = width - kThumbnailMargin * scale;
+    float bottom = height - kThumbnailMargin * scale;
+    SetQuad(right - thumb_width, bottom - thumb_height, right, bottom,
+            thumbnail->rotation(), quads + kQuadVertices);
+    ::SetRect(thumbnail_rect, static_cast<int>(right - thumb_width),
+              static_cast<int>(bottom - thumb_height),
+              static_cast<int>(std::ceil(right)),
+              static_cast<int>(std::ceil(bottom)));
+  }
+
+  D3D11_MAPPED_SUBRESOURCE mapped;
+  if (FAILED(context_->Map(vertices_.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0,
+                           &mapped))) {
+    return false;
+  }
+  memcpy(mapped.pData, quads, sizeof(quads));
+  context_->Unmap(vertices_.Get(), 0);
+
+  ID3D11RenderTargetView* targets[] = {target_.Get()};
+  context_->OMSetRenderTargets(1, targets, nullptr);
+  D3D11_VIEWPORT viewport = {0, 0, static_cast<float>(width),
+                             static_cast<float>(height), 0, 1};
+  context_->RSSetViewports(1, &viewport);
+  const float kBlack[] = {0, 0, 0, 1};
+  context_->ClearRenderTargetView(target_.Get(), kBlack);
+
+  ID3D11Buffer* buffers[] = {vertices_.Get()};
+  UINT stride = sizeof(Vertex);
+  UINT offset = 0;
+  context_->IASetInputLayout(input_layout_.Get());
+  context_->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+  context_->IASetVertexBuffers(0, 1, buffers, &stride, &offset);
+  context_->VSSetShader(vertex_shader_.Get(), nullptr, 0);
+  ID3D11SamplerState* samplers[] = {sampler_.Get()};
+  context_->PSSetSamplers(0, 1, samplers);
+
+  Draw(remote_, 0);
+  if (draw_thumbnail)
+    Draw(thumbnail_, kQuadVertices);
+
+  // Don't wait for the vertical blank; the UI thread also runs the
+  // signaling.
+  HRESULT hr = swap_chain_->Present(0, 0);
+  if (FAILED(hr)) {
+    RTC_LOG(LS_ERROR) << "Present failed: " << hr;
+    return false;
+  }
+  return true;
+}
+
+bool D3D11Renderer::ResizeTarget(int width, int height) {
+  if (target_ && width == target_width_ && height == target_height_)
+    return true;
+
+  // The buffers can only be resized once nothing refers to them.
+  context_->OMSetRenderTargets(0, nullptr, nullptr);
+  target_.Reset();
+  if (FAILED(swap_chain_->ResizeBuffers(0, width, height, DXGI_FORMAT_UNKNOWN,
+                                        0))) {
+    return false;
+  }
+  ComPtr<ID3D11Texture2D> back_buffer;
+  if (FAILED(swap_chain_->GetBuffer(0, IID_PPV_ARGS(&back_buffer))) ||
+      FAILED(device_->CreateRenderTargetView(back_buffer.Get(), nullptr,
+                                             &target_))) {
+    return false;
+  }
+  target_width_ = width;
+  target_height_ = height;
+  return true;
+}
+
+bool D3D11Renderer::Upload(webrtc::VideoFrameBuffer* buffer, Video* video) {
+  RTC_DCHECK(buffer);
+  if (buffer->type() == webrtc::VideoFrameBuffer::Type::kNV12) {
+    const webrtc::NV12BufferInterface* nv12 = buffer->GetNV12();
+    return CreatePlanes(nv12->width(), nv12->height(), true, video) &&
+           UploadPlane(video->planes[0].Get(), nv12->DataY(), nv12->StrideY(),
+                       nv12->width(), nv12->height()) &&
+           UploadPlane(video->planes[1].Get(), nv12->DataUV(),
+                       nv12->StrideUV(), 2 * nv12->ChromaWidth(),
+                       nv12->ChromaHeight());
+  }
+
+  // Free for I420 buffers; anything else is converted once.
+  webrtc::scoped_refptr<webrtc::I420BufferInterface> i420 = buffer->ToI420();
+  if (!i420)
+    return false;
+  return CreatePlanes(i420->width(), i420->height(), false, video) &&
+         UploadPlane(video->planes[0].Get(), i420->DataY(), i420->StrideY(),
+                     i420->width(), i420->height()) &&
+         UploadPlane(video->planes[1].Get(), i420->DataU(), i420->StrideU(),
+                     i420->ChromaWidth(), i420->ChromaHeight()) &&
+         UploadPlane(video->planes[2].Get(), i420->DataV(), i420->StrideV(),
+                     i420->ChromaWidth(), i420->ChromaHeight());
+}
+
+bool D3D11Renderer::CreatePlanes(int width,
+                                 int height,
+                                 bool nv12,
+                                 Video* video) {
+  if (video->planes[0] && width == video->width && height == video->height &&
+      nv12 == video->nv12) {
+    return true;
+  }
+
+  *video = Video();
+  int chroma_width = (width + 1) / 2;
+  int chroma_height = (height + 1) / 2;
+  bool ok = CreatePlane(width, height, DXGI_FORMAT_R8_UNORM, 0, video);
+  if (nv12) {
+    ok = ok && CreatePlane(chroma_width, chroma_height,
+                           DXGI_FORMAT_R8G8_UNORM, 1, video);
+  } else {
+    ok = ok &&
+         CreatePlane(chroma_width, chroma_height, DXGI_FORMAT_R8_UNORM, 1,
+                     video) &&
+         CreatePlane(chroma_width, chroma_height, DXGI_FORMAT_R8_UNORM, 2,
+                     video);
+  }
+  if (!ok) {
+    *video = Video();
+    return false;
+  }
+  video->width = width;
+  video->height = height;
+  video->nv12 = nv12;
+  return true;
+}
+
+bool D3D11Renderer::CreatePlane(int width,
+                                int height,
+                                DXGI_FORMAT format,
+                                int index,
+                                Video* video) {
+  D3D11_TEXTURE2D_DESC desc = {};
+  desc.Width = width;
+  desc.Height = height;
+  desc.MipLevels = 1;
+  desc.ArraySize = 1;
+  desc.Format = format;
+  desc.SampleDesc.Count = 1;
+  desc.Usage = D3D11_USAGE_DYNAMIC;
+  desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+  desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+  return SUCCEEDED(
+             device_->CreateTexture2D(&desc, nullptr, &video->planes[index])) &&
+         SUCCEEDED(device_->CreateShaderResourceView(
+             video->planes[index].Get(), nullptr, &video->views[index]));
+}
+
+bool D3D11Renderer::UploadPlane(ID3D11Texture2D* plane,
+                                const uint8_t* data,
+                                int stride,
+                                int row_size,
+                                int rows) {
+  D3D11_MAPPED_SUBRESOURCE mapped;
+  if (FAILED(context_->Map(plane, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+    return false;
+  uint8_t* destination = static_cast<uint8_t*>(mapped.pData);
+  if (mapped.RowPitch == static_cast<UINT>(stride) && stride == row_size) {
+    memcpy(destination, data, static_cast<size_t>(row_size) * rows);
+  } else {
+    for (int row = 0; row < rows; ++row) {
+      memcpy(destination + row * mapped.RowPitch, data + row * stride,
+             row_size);
+    }
+  }
+  context_->Unmap(plane, 0);
+  return true;
+}
+
+void D3D11Renderer::SetQuad(float left,
+                            float top,
+                            float right,
+                            float bottom,
+                            webrtc::VideoRotation rotation,
+                            Vertex* quad) const {
+  // The corners of the frame, clockwise from the top left.  The corner of
+  // the window that shows corner i of the frame is `turns` further along.
+  static const float kCorners[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+  int turns = static_cast<int>(rotation) / 90;
+
+  float x0 = 2 * left / target_width_ - 1;
+  float x1 = 2 * right / target_width_ - 1;
+  float y0 = 1 - 2 * top / target_height_;
+  float y1 = 1 - 2 * bottom / target_height_;
+  // Top left, top right, bottom left and bottom right, in strip order, and
+  // their position in the clockwise order of kCorners.
+  const float kPositions[4][2] = {{x0, y0}, {x1, y0}, {x0, y1}, {x1, y1}};
+  const int kClockwise[4] = {0, 1, 3, 2};
+  for (int i = 0; i < kQuadVertices; ++i) {
+    const float* corner = kCorners[(kClockwise[i] - turns + 4) % 4];
+    quad[i].x = kPositions[i][0];
+    quad[i].y = kPositions[i][1];
+    quad[i].u = corner[0];
+    quad[i].v = corner[1];
+  }
+}
+
+void D3D11Renderer::Draw(const Video& video, int first_vertex) {
+  ID3D11ShaderResourceView* views[] = {video.views[0].Get(),
+                                       video.views[1].Get(),
+                                       video.views[2].Get()};
+  context_->PSSetShader(video.nv12 ? nv12_shader_.Get() : i420_shader_.Get(),
+                        nullptr, 0);
+  context_->PSSetShaderResources(0, video.nv12 ? 2 : 3, views);
+  context_->Draw(kQuadVertices, first_vertex);
+}
@@ -0,0 +1,111 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_CLIENT_D3D11_RENDERER_H_
+#define EXAMPLES_PEERCONNECTION_CLIENT_D3D11_RENDERER_H_
+
+#include <d3d11.h>
+#include <dxgi.h>
+#include <windows.h>
+#include <wrl/client.h>
+
+#include <cstdint>
+#include <memory>
+
+#include "api/video/video_frame.h"
+#include "api/video/video_frame_buffer.h"
+#include "api/video/video_rotation.h"
+
+// Draws video into a window with Direct3D 11.  The planes of I420 and NV12
+// frames are uploaded as they are, and the color conversion, rotation and
+// scaling happen in the shaders, so that the CPU only copies 1.5 bytes per
+// pixel instead of converting every frame to ARGB.  Used on the UI thread
+// only.
+class D3D11Renderer {
+ public:
+  // Returns null if Direct3D 11 can't be used for `wnd`.
+  static std::unique_ptr<D3D11Renderer> Create(HWND wnd);
+
+  D3D11Renderer(const D3D11Renderer&) = delete;
+  D3D11Renderer& operator=(const D3D11Renderer&) = delete;
+  ~D3D11Renderer();
+
+  // Draws `remote` as large as the window allows without distorting it, and
+  // `thumbnail`, if given, at a quarter of that scale in the bottom right
+  // corner, the way the GDI path of MainWnd lays them out.  Sets
+  // `thumbnail_rect` to where the thumbnail went, or empties it.  Returns
+  // false if the frame could not be presented, e.g. because the device was
+  // lost, in which case the renderer can't be used any more.
+  bool Render(const webrtc::VideoFrame& remote,
+              const webrtc::VideoFrame* thumbnail,
+              RECT* thumbnail_rect);
+
+ private:
+  // The textures that hold the planes of one video: Y, U and V for I420,
+  // Y and interleaved UV for NV12.
+  struct Video {
+    Video() : width(0), height(0), nv12(false) {}
+
+    Microsoft::WRL::ComPtr<ID3D11Texture2D> planes[3];
+    Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> views[3];
+    int width;
+    int height;
+    bool nv12;
+  };
+
+  struct Vertex {
+    float x;
+    float y;
+    float u;
+    float v;
+  };
+
+  explicit D3D11Renderer(HWND wnd);
+
+  bool Initialize();
+  // Resizes the back buffer to the client area of the window.
+  bool ResizeTarget(int width, int height);
+  bool Upload(webrtc::VideoFrameBuffer* buffer, Video* video);
+  bool CreatePlanes(int width, int height, bool nv12, Video* video);
+  bool CreatePlane(int width, int height, DXGI_FORMAT format, int index,
+                   Video* video);
+  bool UploadPlane(ID3D11Texture2D* plane,
+                   const uint8_t* data,
+                   int stride,
+                   int row_size,
+                   int rows);
+  // Fills the four vertices of a triangle strip that covers the given
+  // rectangle of the window with the frame rotated by `rotation`.
+  void SetQuad(float left,
+               float top,
+               float right,
+               float bottom,
+               webrtc::VideoRotation rotation,
+               Vertex* quad) const;
+  void Draw(const Video& video, int first_vertex);
+
+  const HWND wnd_;
+  Microsoft::WRL::ComPtr<ID3D11Device> device_;
+  Microsoft::WRL::ComPtr<ID3D11DeviceContext> context_;
+  Microsoft::WRL::ComPtr<IDXGISwapChain> swap_chain_;
+  Microsoft::WRL::ComPtr<ID3D11RenderTargetView> target_;
+  Microsoft::WRL::ComPtr<ID3D11VertexShader> vertex_shader_;
+  Microsoft::WRL::ComPtr<ID3D11PixelShader> i420_shader_;
+  Microsoft::WRL::ComPtr<ID3D11PixelShader> nv12_shader_;
+  Microsoft::WRL::ComPtr<ID3D11InputLayout> input_layout_;
+  Microsoft::WRL::ComPtr<ID3D11Buffer> vertices_;
+  Microsoft::WRL::ComPtr<ID3D11SamplerState> sampler_;
+  int target_width_;
+  int target_height_;
+  Video remote_;
+  Video thumbnail_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_CLIENT_D3D11_RENDERER_H_
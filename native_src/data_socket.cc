@@ -10,25 +10,99 @@
 
 #include "examples/peerconnection/server/data_socket.h"
 
-#include <cctype>
+#include <algorithm>
+#include <chrono>
+#include <climits>
 #include <cstdio>
-#include <cstdlib>
-#include <cstring>
+#include <iterator>
 #include <string>
 
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "examples/peerconnection/server/event_loop.h"
+#include "examples/peerconnection/server/server_log.h"
+#include "examples/peerconnection/server/server_metrics.h"
+#include "examples/peerconnection/server/websocket.h"
 #include "rtc_base/checks.h"
 #include "rtc_base/ip_address.h"
 #include "rtc_base/net_helpers.h"
 
 #if defined(WEBRTC_POSIX)
 #include <asm-generic/socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
 #include <unistd.h>  // IWYU pragma: keep
 #endif
 
-static const char kHeaderTerminator[] = "\r\n\r\n";
-static const int kHeaderTerminatorLength = sizeof(kHeaderTerminator) - 1;
+// Headers that are the same for every response.  They follow the status line.
+static const char kResponseServerHeaders[] =
+    "\r\n"
+    "Server: PeerConnectionTestServer/0.1\r\n"
+    "Cache-Control: no-cache\r\n";
+
+// Maximum number of buffers passed to a single vectored send.
+static const size_t kMaxSendParts = 8;
+
+#if defined(MSG_NOSIGNAL)
+// Report a closed connection as an error instead of raising SIGPIPE.
+static const int kSendFlags = MSG_NOSIGNAL;
+#else
+static const int kSendFlags = 0;
+#endif
+
+namespace {
+
+// True if the last socket operation failed only because it would block.
+bool IsBlockingError() {
+#if defined(WIN32)
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+// True if the last socket operation was interrupted and should be retried.
+bool IsInterruptedError() {
+#if defined(WIN32)
+  return WSAGetLastError() == WSAEINTR;
+#else
+  return errno == EINTR;
+#endif
+}
+
+// Writes as much of `parts` as the socket accepts without blocking.
+// Returns the number of bytes written, or -1 on error.
+long SendVectored(NativeSocket socket,
+                  const absl::string_view* parts,
+                  size_t count) {
+  RTC_DCHECK_LE(count, kMaxSendParts);
+#if defined(WIN32)
+  WSABUF buffers[kMaxSendParts];
+  for (size_t i = 0; i < count; ++i) {
+    buffers[i].buf = const_cast<char*>(parts[i].data());
+    buffers[i].len = static_cast<ULONG>(parts[i].size());
+  }
+  DWORD sent = 0;
+  if (WSASend(socket, buffers, static_cast<DWORD>(count), &sent, 0, nullptr,
+              nullptr) == SOCKET_ERROR) {
+    return -1;
+  }
+  return static_cast<long>(sent);
+#else
+  struct iovec buffers[kMaxSendParts];
+  for (size_t i = 0; i < count; ++i) {
+    buffers[i].iov_base = const_cast<char*>(parts[i].data());
+    buffers[i].iov_len = parts[i].size();
+  }
+  struct msghdr message = {};
+  message.msg_iov = buffers;
+  message.msg_iovlen = count;
+  return static_cast<long>(sendmsg(socket, &message, kSendFlags));
+#endif
+}
+
+}  // namespace
 
 // static
 const char DataSocket::kCrossOriginAllowHeaders[] =
@@ -71,204 +145,356 @@ void SocketBase::Close() {
   }
 }
 
+bool SocketBase::SetNonBlocking() {
+  RTC_DCHECK(valid());
+#if defined(WIN32)
+  u_long enabled = 1;
+  return ioctlsocket(socket_, FIONBIO, &enabled) == 0;
+#else
+  int flags = fcntl(socket_, F_GETFL, 0);
+  return flags != -1 && fcntl(socket_, F_SETFL, flags | O_NONBLOCK) != -1;
+#endif
+}
+
 //
 // DataSocket
 //
 
-std::string DataSocket::request_arguments() const {
-  size_t args = request_path_.find('?');
-  if (args != std::string::npos)
-    return request_path_.substr(args + 1);
-  return "";
+bool DataSocket::PathEquals(absl::string_view path) const {
+  return parser_.path() == path;
 }
 
-bool DataSocket::PathEquals(const char* path) const {
-  RTC_DCHECK(path);
-  size_t args = request_path_.find('?');
-  if (args != std::string::npos)
-    return request_path_.substr(0, args).compare(path) == 0;
-  return request_path_.compare(path) == 0;
+void DataSocket::set_event_loop(EventLoop* event_loop) {
+  event_loop_ = event_loop;
+  if (event_loop_ && has_pending_output())
+    UpdateWriteInterest(true);
 }
 
 bool DataSocket::OnDataAvailable(bool* close_socket) {
   RTC_DCHECK(valid());
-  char buffer[0xfff] = {0};
-  int bytes = recv(socket_, buffer, sizeof(buffer), 0);
+  if (websocket_)
+    return OnWebSocketData(close_socket);
+
+  // A request that is complete but not answered yet is still being handled;
+  // data after it belongs to the next request.
+  bool handled = request_received();
+  if (handled && response_sent_ && keep_alive()) {
+    Clear();
+    handled = false;
+  }
+
+  size_t available = 0;
+  char* buffer = parser_.PrepareRead(&available);
+  int bytes = recv(socket_, buffer,
+                   static_cast<int>(std::min<size_t>(available, INT_MAX)), 0);
+  if (bytes == SOCKET_ERROR && IsBlockingError()) {
+    // Spurious wakeup; only a pipelined request may need handling.
+    *close_socket = false;
+    return !handled && request_received();
+  }
   if (bytes == SOCKET_ERROR || bytes == 0) {
     *close_socket = true;
     return false;
   }
 
   *close_socket = false;
+  if (metrics_)
+    metrics_->bytes_received.Add(bytes);
+
+  // Data behind a request that is still being handled is only buffered.
+  std::chrono::steady_clock::time_point parse_start;
+  if (metrics_ && !handled)
+    parse_start = std::chrono::steady_clock::now();
+  HttpRequestParser::Status status = parser_.OnRead(bytes);
+  if (handled) {
+    // A client that keeps sending without waiting for the answer would
+    // otherwise grow the buffer without limit.
+    if (parser_.unparsed_data().size() > HttpRequestParser::kMaxUnparsedSize) {
+      SERVER_LOG(LS_WARNING, "Too much data behind an unanswered request\n");
+      *close_socket = true;
+    }
+    return false;
+  }
+  OnParsed(parse_start, status);
+  // The end of a malformed request can't be found, so nothing else on the
+  // connection can be understood either.
+  *close_socket = status == HttpRequestParser::PARSE_ERROR;
+  return !*close_socket;
+}
 
-  bool ret = true;
-  if (headers_received()) {
-    if (method_ != POST) {
-      // unexpectedly received data.
-      ret = false;
-    } else {
-      data_.append(buffer, bytes);
+bool DataSocket::OnWritable() {
+  RTC_DCHECK(valid());
+  while (has_pending_output()) {
+    absl::string_view output(pending_output_);
+    output.remove_prefix(pending_output_sent_);
+    int bytes = send(socket_, output.data(), static_cast<int>(output.size()),
+                     kSendFlags);
+    if (bytes == SOCKET_ERROR) {
+      if (IsInterruptedError())
+        continue;
+      return IsBlockingError();
     }
-  } else {
-    request_headers_.append(buffer, bytes);
-    size_t found = request_headers_.find(kHeaderTerminator);
-    if (found != std::string::npos) {
-      data_ = request_headers_.substr(found + kHeaderTerminatorLength);
-      request_headers_.resize(found + kHeaderTerminatorLength);
-      ret = ParseHeaders();
+    if (metrics_)
+      metrics_->bytes_sent.Add(bytes);
+    pending_output_sent_ += bytes;
+    if (pending_output_sent_ == pending_output_.size()) {
+      pending_output_.clear();
+      pending_output_sent_ = 0;
     }
   }
-  return ret;
+  UpdateWriteInterest(false);
+  return true;
 }
 
-bool DataSocket::Send(const std::string& data) const {
-  return send(socket_, data.data(), static_cast<int>(data.length()), 0) !=
-         SOCKET_ERROR;
+bool DataSocket::Send(absl::string_view data) {
+  return SendParts(&data, 1);
 }
 
 bool DataSocket::Send(const std::string& status,
                       bool connection_close,
-                      const std::string& content_type,
+                      absl::string_view content_type,
                       const std::string& extra_headers,
-                      const std::string& data) const {
+                      absl::string_view data) {
   RTC_DCHECK(valid());
   RTC_DCHECK(!status.empty());
-  std::string buffer("HTTP/1.1 " + status + "\r\n");
+  response_headers_.assign("HTTP/1.1 ");
+  response_headers_ += status;
+  response_headers_ += kResponseServerHeaders;
+
+  connection_close_ = connection_close || !parser_.keep_alive();
+  if (connection_close_)
+    response_headers_ += "Connection: close\r\n";
+
+  if (!content_type.empty()) {
+    response_headers_ += "Content-Type: ";
+    response_headers_ += content_type;
+    response_headers_ += "\r\n";
+  }
 
-  buffer +=
-      "Server: PeerConnectionTestServer/0.1\r\n"
-      "Cache-Control: no-cache\r\n";
+  absl::StrAppend(&response_headers_, "Content-Length: ", data.size(), "\r\n");
 
-  if (connection_close)
-    buffer += "Connection: close\r\n";
+  // Extra headers are assumed to have a separator per header.
+  response_headers_ += extra_headers;
 
-  if (!content_type.empty())
-    buffer += "Content-Type: " + content_type + "\r\n";
+  const absl::string_view parts[] = {
+      response_headers_,
+      kCrossOriginAllowHeaders,
+      "\r\n",
+      data,
+  };
+  response_sent_ = true;
+  return SendParts(parts, std::size(parts));
+}
 
-  buffer += "Content-Length: " + absl::StrCat(data.size()) + "\r\n";
+bool DataSocket::SendParts(const absl::string_view* parts, size_t count) {
+  RTC_DCHECK(valid());
+  RTC_DCHECK_LE(count, kMaxSendParts);
 
-  if (!extra_headers.empty()) {
-    buffer += extra_headers;
-    // Extra headers are assumed to have a separator per header.
+  // Keep the output in order if earlier data is still waiting.
+  if (has_pending_output()) {
+    for (size_t i = 0; i < count; ++i)
+      pending_output_.append(parts[i].data(), parts[i].size());
+    return true;
   }
 
-  buffer += kCrossOriginAllowHeaders;
-
-  buffer += "\r\n";
-  buffer += data;
+  // Work on a copy, skipping empty parts, so that partial writes can advance
+  // through it.
+  absl::string_view remaining[kMaxSendParts];
+  absl::string_view* end = remaining;
+  for (size_t i = 0; i < count; ++i) {
+    if (!parts[i].empty())
+      *end++ = parts[i];
+  }
+  absl::string_view* next = remaining;
+
+  while (next != end) {
+    long sent = SendVectored(socket_, next, end - next);
+    if (sent < 0) {
+      if (IsInterruptedError())
+        continue;
+      if (!IsBlockingError())
+        return false;
+      break;
+    }
+    // Skip what was written, which may end in the middle of a part.
+    size_t written = static_cast<size_t>(sent);
+    if (metrics_)
+      metrics_->bytes_sent.Add(written);
+    while (next != end && written >= next->size()) {
+      written -= next->size();
+      ++next;
+    }
+    if (next != end)
+      next->remove_prefix(written);
+  }
 
-  return Send(buffer);
+  if (next != end) {
+    for (; next != end; ++next)
+      pending_output_.append(next->data(), next->size());
+    UpdateWriteInterest(true);
+  }
+  return true;
 }
 
-void DataSocket::Clear() {
-  method_ = INVALID;
-  content_length_ = 0;
-  content_type_.clear();
-  request_path_.clear();
-  request_headers_.clear();
-  data_.clear();
+bool DataSocket::AcceptWebSocket() {
+  RTC_DCHECK(request_received());
+  RTC_DCHECK(!websocket_);
+  absl::string_view key = parser_.GetHeader("Sec-WebSocket-Key");
+  if (method() != GET || key.empty() ||
+      !parser_.HeaderHasToken("Upgrade", "websocket") ||
+      !parser_.HeaderHasToken("Connection", "upgrade") ||
+      parser_.GetHeader("Sec-WebSocket-Version") != "13") {
+    Send("400 Bad Request", true, "text/plain",
+         "Sec-WebSocket-Version: 13\r\n", "Expected a WebSocket handshake.");
+    return false;
+  }
+
+  response_headers_.assign(
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Upgrade: websocket\r\n"
+      "Connection: Upgrade\r\n"
+      "Sec-WebSocket-Accept: ");
+  response_headers_ += ComputeWebSocketAccept(key);
+  response_headers_ += "\r\n\r\n";
+  // Keep frames that were sent right behind the handshake.
+  websocket_input_.assign(parser_.unparsed_data());
+  websocket_ = true;
+  response_sent_ = true;
+  return Send(absl::string_view(response_headers_));
 }
 
-bool DataSocket::ParseHeaders() {
-  RTC_DCHECK(!request_headers_.empty());
-  RTC_DCHECK_EQ(method_, INVALID);
-  size_t i = request_headers_.find("\r\n");
-  if (i == std::string::npos)
+bool DataSocket::SendWebSocketMessage(absl::string_view prefix,
+                                      absl::string_view data) {
+  RTC_DCHECK(websocket_);
+  if (websocket_close_sent_)
     return false;
+  return SendWebSocketFrame(kWebSocketBinary, prefix, data);
+}
 
-  if (!ParseMethodAndPath(request_headers_.data(), i))
+bool DataSocket::OnWebSocketData(bool* close_socket) {
+  char buffer[1024];
+  int bytes = recv(socket_, buffer, sizeof(buffer), 0);
+  if (bytes == SOCKET_ERROR && IsBlockingError()) {
+    *close_socket = false;
+    return false;
+  }
+  if (bytes == SOCKET_ERROR || bytes == 0) {
+    *close_socket = true;
     return false;
-
-  RTC_DCHECK_NE(method_, INVALID);
-  RTC_DCHECK(!request_path_.empty());
-
-  if (method_ == POST) {
-    const char* headers = request_headers_.data() + i + 2;
-    size_t len = request_headers_.length() - i - 2;
-    if (!ParseContentLengthAndType(headers, len))
-      return false;
   }
 
-  return true;
-}
-
-bool DataSocket::ParseMethodAndPath(const char* begin, size_t len) {
-  struct {
-    const char* method_name;
-    size_t method_name_len;
-    RequestMethod id;
-  } supported_methods[] = {
-      {"GET", 3, GET},
-      {"POST", 4, POST},
-      {"OPTIONS", 7, OPTIONS},
-  };
-
-  const char* path = nullptr;
-  for (const auto& method : supported_methods) {
-    if (len > method.method_name_len &&
-        isspace(begin[method.method_name_len]) &&
-        strncmp(begin, method.method_name, method.method_name_len) == 0) {
-      method_ = method.id;
-      path = begin + method.method_name_len;
+  *close_socket = false;
+  if (metrics_)
+    metrics_->bytes_received.Add(bytes);
+  websocket_input_.append(buffer, bytes);
+
+  // Clients only send control frames, so no frame is ever big.
+  WebSocketFrame frame;
+  size_t consumed = 0;
+  while (!*close_socket) {
+    absl::string_view input(websocket_input_);
+    long size = ParseWebSocketFrame(input.substr(consumed),
+                                    kMaxWebSocketControlPayload, &frame);
+    if (size == 0)
+      break;
+    if (size < 0) {
+      SendWebSocketClose(kWebSocketProtocolError);
+      *close_socket = true;
       break;
     }
+    consumed += size;
+
+    switch (frame.opcode) {
+      case kWebSocketPing:
+        SendWebSocketFrame(kWebSocketPong, frame.payload, "");
+        break;
+      case kWebSocketPong:
+        break;
+      case kWebSocketClose:
+        // Complete the closing handshake by echoing the status code.
+        if (!websocket_close_sent_) {
+          websocket_close_sent_ = true;
+          SendWebSocketFrame(kWebSocketClose,
+                             absl::string_view(frame.payload).substr(0, 2), "");
+        }
+        *close_socket = true;
+        break;
+      default:
+        // Peers post their messages over HTTP; the WebSocket only carries
+        // messages to them.
+        SendWebSocketClose(kWebSocketUnsupportedData);
+        *close_socket = true;
+        break;
+    }
   }
+  websocket_input_.erase(0, consumed);
+  return false;
+}
 
-  const char* end = begin + len;
-  if (!path || path >= end)
-    return false;
-
-  ++path;
-  begin = path;
-  while (!isspace(*path) && path < end)
-    ++path;
+bool DataSocket::SendWebSocketFrame(WebSocketOpcode opcode,
+                                    absl::string_view prefix,
+                                    absl::string_view data) {
+  char header[kMaxWebSocketFrameHeaderSize];
+  size_t header_size =
+      BuildWebSocketFrameHeader(opcode, prefix.size() + data.size(), header);
+  const absl::string_view parts[] = {
+      absl::string_view(header, header_size),
+      prefix,
+      data,
+  };
+  return SendParts(parts, std::size(parts));
+}
 
-  request_path_.assign(begin, path - begin);
+void DataSocket::SendWebSocketClose(WebSocketCloseCode code) {
+  if (websocket_close_sent_)
+    return;
+  websocket_close_sent_ = true;
+  const char payload[] = {
+      static_cast<char>(code >> 8),
+      static_cast<char>(code & 0xFF),
+  };
+  SendWebSocketFrame(kWebSocketClose,
+                     absl::string_view(payload, sizeof(payload)), "");
+}
 
-  return true;
+void DataSocket::UpdateWriteInterest(bool enabled) {
+  if (event_loop_)
+    event_loop_->SetWriteInterest(this, enabled);
 }
 
-bool DataSocket::ParseContentLengthAndType(const char* headers, size_t length) {
-  RTC_DCHECK_EQ(content_length_, 0);
-  RTC_DCHECK(content_type_.empty());
-
-  const char* end = headers + length;
-  while (headers && headers < end) {
-    if (!isspace(headers[0])) {
-      static constexpr absl::string_view kContentLength = "Content-Length:";
-      static constexpr absl::string_view kContentType = "Content-Type:";
-      if (absl::string_view(headers, end - headers)
-              .starts_with(kContentLength)) {
-        headers += kContentLength.size();
-        while (headers[0] == ' ')
-          ++headers;
-        content_length_ = atoi(headers);
-      } else if (absl::string_view(headers, end - headers)
-                     .starts_with(kContentType)) {
-        headers += kContentType.size();
-        while (headers[0] == ' ')
-          ++headers;
-        const char* type_end = strstr(headers, "\r\n");
-        if (type_end == nullptr)
-          type_end = end;
-        content_type_.assign(headers, type_end);
-      }
-    } else {
-      ++headers;
-    }
-    headers = strstr(headers, "\r\n");
-    if (headers)
-      headers += 2;
+void DataSocket::OnParsed(std::chrono::steady_clock::time_point start,
+                          HttpRequestParser::Status status) {
+  if (!metrics_)
+    return;
+  parse_time_ += std::chrono::steady_clock::now() - start;
+  if (status == HttpRequestParser::INCOMPLETE)
+    return;
+  if (status == HttpRequestParser::COMPLETE) {
+    metrics_->requests.Add(1);
+    metrics_->request_parse_ns.Record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(parse_time_)
+            .count()));
   }
+  parse_time_ = std::chrono::steady_clock::duration::zero();
+}
 
-  return !content_type_.empty() && content_length_ != 0;
+void DataSocket::Clear() {
+  response_sent_ = false;
+  connection_close_ = false;
+  parse_time_ = std::chrono::steady_clock::duration::zero();
+  // Pipelined requests are parsed right away.
+  std::chrono::steady_clock::time_point parse_start;
+  if (metrics_)
+    parse_start = std::chrono::steady_clock::now();
+  HttpRequestParser::Status status = parser_.NextRequest();
+  OnParsed(parse_start, status);
 }
 
 //
 // ListeningSocket
 //
 
-bool ListeningSocket::Listen(unsigned short port) {
+bool ListeningSocket::Listen(unsigned short port, bool reuse_port) {
   RTC_DCHECK(valid());
   int enabled = 1;
   if (setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR,
@@ -277,6 +503,19 @@ bool ListeningSocket::Listen(unsigned short port) {
     printf("setsockopt failed\n");
     return false;
   }
+  if (reuse_port) {
+#if defined(SO_REUSEPORT)
+    if (setsockopt(socket_, SOL_SOCKET, SO_REUSEPORT,
+                   reinterpret_cast<const char*>(&enabled),
+                   sizeof(enabled)) != 0) {
+      printf("setsockopt(SO_REUSEPORT) failed\n");
+      return false;
+    }
+#else
+    printf("SO_REUSEPORT is not supported on this platform\n");
+    return false;
+#endif
+  }
   struct sockaddr_in addr = {0};
   addr.sin_family = AF_INET;
   addr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -286,7 +525,7 @@ bool ListeningSocket::Listen(unsigned short port) {
     printf("bind failed\n");
     return false;
   }
-  return listen(socket_, 5) != SOCKET_ERROR;
+  return listen(socket_, SOMAXCONN) != SOCKET_ERROR;
 }
 
 DataSocket* ListeningSocket::Accept() const {
@@ -298,5 +537,51 @@ DataSocket* ListeningSocket::Accept() const {
   if (client == INVALID_SOCKET)
     return nullptr;
 
-  return new DataSocket(client);
+  DataSocket* data_socket = new DataSocket(client);
+  if (!data_socket->SetNonBlocking()) {
+    delete data_socket;
+    return nullptr;
+  }
+  return data_socket;
+}
+
+//
+// SignalSocket
+//
+
+bool SignalSocket::Create() {
+  RTC_DCHECK(!valid());
+  socket_ = ::socket(AF_INET, SOCK_DGRAM, 0);
+  if (!valid())
+    return false;
+
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  socklen_t size = sizeof(addr);
+  if (bind(socket_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) ==
+          SOCKET_ERROR ||
+      getsockname(socket_, reinterpret_cast<sockaddr*>(&addr), &size) ==
+          SOCKET_ERROR ||
+      connect(socket_, reinterpret_cast<const sockaddr*>(&addr), size) ==
+          SOCKET_ERROR ||
+      !SetNonBlocking()) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void SignalSocket::Signal() const {
+  RTC_DCHECK(valid());
+  char signal = 0;
+  send(socket_, &signal, sizeof(signal), 0);
+}
+
+void SignalSocket::Drain() const {
+  RTC_DCHECK(valid());
+  char buffer[64];
+  while (recv(socket_, buffer, sizeof(buffer), 0) > 0) {
+  }
 }
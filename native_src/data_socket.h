@@ -11,9 +11,13 @@
 #ifndef EXAMPLES_PEERCONNECTION_SERVER_DATA_SOCKET_H_
 #define EXAMPLES_PEERCONNECTION_SERVER_DATA_SOCKET_H_
 
+#include <chrono>
 #include <cstddef>
 #include <string>
 
+#include "absl/strings/string_view.h"
+#include "examples/peerconnection/server/http_request_parser.h"
+#include "examples/peerconnection/server/websocket.h"
 
 #ifdef WIN32
 #include <winsock2.h>
@@ -32,6 +36,9 @@ typedef int NativeSocket;
 #endif
 #endif
 
+class EventLoop;
+struct ServerMetrics;
+
 class SocketBase {
  public:
   SocketBase() : socket_(INVALID_SOCKET) {}
@@ -46,6 +53,9 @@ class SocketBase {
   bool Create();
   void Close();
 
+  // Puts the socket in non-blocking mode.
+  bool SetNonBlocking();
+
  protected:
   NativeSocket socket_;
 };
@@ -53,89 +63,170 @@ class SocketBase {
 // Represents an HTTP server socket.
 class DataSocket : public SocketBase {
  public:
-  enum RequestMethod {
-    INVALID,
-    GET,
-    POST,
-    OPTIONS,
-  };
+  typedef HttpRequestParser::Method RequestMethod;
+  static constexpr RequestMethod INVALID = HttpRequestParser::INVALID;
+  static constexpr RequestMethod GET = HttpRequestParser::GET;
+  static constexpr RequestMethod POST = HttpRequestParser::POST;
+  static constexpr RequestMethod OPTIONS = HttpRequestParser::OPTIONS;
 
   explicit DataSocket(NativeSocket socket)
-      : SocketBase(socket), method_(INVALID), content_length_(0) {}
+      : SocketBase(socket),
+        response_sent_(false),
+        connection_close_(false),
+        websocket_(false),
+        websocket_close_sent_(false),
+        pending_output_sent_(0),
+        event_loop_(nullptr),
+        metrics_(nullptr),
+        parse_time_(0) {}
 
   ~DataSocket() {}
 
   static const char kCrossOriginAllowHeaders[];
 
-  bool headers_received() const { return method_ != INVALID; }
+  bool headers_received() const { return parser_.headers_received(); }
+
+  RequestMethod method() const { return parser_.method(); }
 
-  RequestMethod method() const { return method_; }
+  // The views returned below point into the receive buffer and are only
+  // valid until Clear() is called.
+  absl::string_view request_path() const { return parser_.target(); }
+  absl::string_view request_arguments() const { return parser_.query(); }
 
-  const std::string& request_path() const { return request_path_; }
-  std::string request_arguments() const;
+  absl::string_view data() const { return parser_.body(); }
 
-  const std::string& data() const { return data_; }
+  absl::string_view content_type() const { return parser_.content_type(); }
 
-  const std::string& content_type() const { return content_type_; }
+  size_t content_length() const { return parser_.content_length(); }
 
-  size_t content_length() const { return content_length_; }
+  const HttpRequestParser& request() const { return parser_; }
 
   bool request_received() const {
-    return headers_received() && (method_ != POST || data_received());
+    return parser_.status() == HttpRequestParser::COMPLETE;
   }
 
-  bool data_received() const {
-    return method_ != POST || data_.length() >= content_length_;
-  }
+  // True once an HTTP response has been sent for the current request.
+  bool response_sent() const { return response_sent_; }
+
+  // True if the connection stays open for more requests after the current
+  // one has been answered.
+  bool keep_alive() const { return parser_.keep_alive() && !connection_close_; }
+
+  // True once the connection has been upgraded to a WebSocket.
+  bool is_websocket() const { return websocket_; }
 
   // Checks if the request path (minus arguments) matches a given path.
-  bool PathEquals(const char* path) const;
+  bool PathEquals(absl::string_view path) const;
 
-  // Called when we have received some data from clients.
-  // Returns false if an error occurred.
+  // Sets the loop that is watching this socket, or nullptr while the socket
+  // is not watched.  Used to wait for writability when output is buffered.
+  void set_event_loop(EventLoop* event_loop);
+
+  // Sets where the traffic of the socket and the time spent parsing its
+  // requests are counted, or nullptr to not count them.  Must be the
+  // metrics of the thread that is handling the socket.
+  void set_metrics(ServerMetrics* metrics) { metrics_ = metrics; }
+
+  // True if some previously sent data could not be written yet.
+  bool has_pending_output() const { return !pending_output_.empty(); }
+
+  // Number of bytes that were sent but not written yet.
+  size_t pending_output_size() const {
+    return pending_output_.size() - pending_output_sent_;
+  }
+
+  // Called when we have received some data from clients.  If the current
+  // request has been answered and the connection is kept alive, moves on to
+  // the next request first.  On a WebSocket, control frames are answered
+  // here and there are never requests to handle.
+  // Returns false if an error occurred, or if there is nothing new to handle
+  // in which case `close_socket` is false.  A malformed request sets
+  // `close_socket`, and request() tells it apart from a closed connection.
+  // So does more than HttpRequestParser::kMaxUnparsedSize bytes received
+  // behind a request that has not been answered.
   bool OnDataAvailable(bool* close_socket);
 
-  // Send a raw buffer of bytes.
-  bool Send(const std::string& data) const;
+  // Called when the socket can accept more data.  Writes as much of the
+  // pending output as possible.  Returns false if an error occurred.
+  bool OnWritable();
+
+  // Send a raw buffer of bytes.  Whatever the socket does not accept right
+  // away is buffered and written from OnWritable().
+  bool Send(absl::string_view data);
 
   // Send an HTTP response.  The `status` should start with a valid HTTP
   // response code, followed by a string.  E.g. "200 OK".
-  // If `connection_close` is set to true, an extra "Connection: close" HTTP
-  // header will be included.  `content_type` is the mime content type, not
+  // If `connection_close` is set to true, or the client did not ask for a
+  // persistent connection, an extra "Connection: close" HTTP header will be
+  // included.  `content_type` is the mime content type, not
   // including the "Content-Type: " string.
   // `extra_headers` should be either empty or a list of headers where each
   // header terminates with "\r\n".
   // `data` is the body of the message.  It's length will be specified via
   // a "Content-Length" header.
+  // The headers and `data` are written with a single vectored send, without
+  // copying `data` unless the socket cannot take all of it at once.
   bool Send(const std::string& status,
             bool connection_close,
-            const std::string& content_type,
+            absl::string_view content_type,
             const std::string& extra_headers,
-            const std::string& data) const;
+            absl::string_view data);
 
-  // Clears all held state and prepares the socket for receiving a new request.
+  // Answers the current request, which should be a WebSocket handshake, and
+  // switches the connection to WebSocket framing.  If the request is not a
+  // valid handshake, an error response is sent and false is returned.
+  bool AcceptWebSocket();
+
+  // Sends `prefix` followed by `data` as one binary WebSocket message,
+  // without copying `data` unless the socket cannot take all of it at once.
+  bool SendWebSocketMessage(absl::string_view prefix, absl::string_view data);
+
+  // Starts the closing handshake of a WebSocket, unless it has been started
+  // already.  No more messages are sent afterwards.
+  void SendWebSocketClose(WebSocketCloseCode code);
+
+  // Clears the state of the current request and prepares the socket for
+  // receiving a new one.  Pipelined data received after the current request
+  // is kept and parsed.
   void Clear();
 
  protected:
-  // A fairly relaxed HTTP header parser.  Parses the method, path and
-  // content length (POST only) of a request.
-  // Returns true if a valid request was received and no errors occurred.
-  bool ParseHeaders();
+  // Writes `parts` in order with as few system calls as possible.
+  bool SendParts(const absl::string_view* parts, size_t count);
 
-  // Figures out whether the request is a GET or POST and what path is
-  // being requested.
-  bool ParseMethodAndPath(const char* begin, size_t len);
+  void UpdateWriteInterest(bool enabled);
 
-  // Determines the length of the body and it's mime type.
-  bool ParseContentLengthAndType(const char* headers, size_t length);
+  // Adds the time since `start` to the parsing time of the current request
+  // and records it once the request is complete.
+  void OnParsed(std::chrono::steady_clock::time_point start,
+                HttpRequestParser::Status status);
+
+  // Handles the frames received on a WebSocket.
+  bool OnWebSocketData(bool* close_socket);
+
+  bool SendWebSocketFrame(WebSocketOpcode opcode,
+                          absl::string_view prefix,
+                          absl::string_view data);
 
  protected:
-  RequestMethod method_;
-  size_t content_length_;
-  std::string content_type_;
-  std::string request_path_;
-  std::string request_headers_;
-  std::string data_;
+  HttpRequestParser parser_;
+  bool response_sent_;
+  // Set if the response told the client to close the connection.
+  bool connection_close_;
+  bool websocket_;
+  bool websocket_close_sent_;
+  // Frames received on the WebSocket that are not complete yet.
+  std::string websocket_input_;
+  // Reused for the headers of each response to avoid reallocating.
+  std::string response_headers_;
+  // Data that has been sent but not yet accepted by the socket.  The first
+  // `pending_output_sent_` bytes have already been written.
+  std::string pending_output_;
+  size_t pending_output_sent_;
+  EventLoop* event_loop_;
+  ServerMetrics* metrics_;
+  // Time spent parsing the current request so far.
+  std::chrono::steady_clock::duration parse_time_;
 };
 
 // The server socket.  Accepts connections and generates DataSocket instances
@@ -144,8 +235,27 @@ class ListeningSocket : public SocketBase {
  public:
   ListeningSocket() {}
 
-  bool Listen(unsigned short port);
+  // If `reuse_port` is set, other sockets may listen on the same port and
+  // the kernel distributes incoming connections between them.  Returns false
+  // if that is not supported on this platform.
+  bool Listen(unsigned short port, bool reuse_port);
   DataSocket* Accept() const;
 };
 
+// A socket that other threads can write to in order to wake up an event loop
+// that is watching it.
+class SignalSocket : public SocketBase {
+ public:
+  SignalSocket() {}
+
+  // Creates a non-blocking datagram socket that is connected to itself.
+  bool Create();
+
+  // Makes the socket readable.  May be called from any thread.
+  void Signal() const;
+
+  // Reads all pending signals.
+  void Drain() const;
+};
+
 #endif  // EXAMPLES_PEERCONNECTION_SERVER_DATA_SOCKET_H_
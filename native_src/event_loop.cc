@@ -0,0 +1,276 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/server/event_loop.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "examples/peerconnection/server/data_socket.h"
+#include "rtc_base/checks.h"
+
+#if defined(WEBRTC_LINUX) || defined(WEBRTC_ANDROID)
+#define USE_EPOLL 1
+#include <sys/epoll.h>
+#include <unistd.h>
+#elif defined(WEBRTC_MAC) || defined(__FreeBSD__) || defined(__OpenBSD__) || \
+    defined(__NetBSD__)
+#define USE_KQUEUE 1
+#include <sys/event.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#elif !defined(WIN32)
+#include <poll.h>
+#endif
+
+namespace {
+
+// Maximum number of events fetched from the kernel per Wait() call.  Any
+// remaining ready sockets are reported on the next call.
+const int kMaxEventsPerWait = 256;
+
+#if defined(USE_EPOLL)
+
+class EpollEventLoop : public EventLoop {
+ public:
+  EpollEventLoop() : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)) {}
+  ~EpollEventLoop() override {
+    if (epoll_fd_ != -1)
+      close(epoll_fd_);
+  }
+
+  bool valid() const { return epoll_fd_ != -1; }
+
+  bool Add(SocketBase* socket) override {
+    RTC_DCHECK(socket && socket->valid());
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = socket;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, socket->socket(), &event) == 0;
+  }
+
+  void Remove(SocketBase* socket) override {
+    RTC_DCHECK(socket && socket->valid());
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, socket->socket(), nullptr);
+  }
+
+  bool SetWriteInterest(SocketBase* socket, bool enabled) override {
+    RTC_DCHECK(socket && socket->valid());
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    if (enabled)
+      event.events |= EPOLLOUT;
+    event.data.ptr = socket;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, socket->socket(), &event) == 0;
+  }
+
+  bool Wait(int timeout_ms, std::vector<Event>* ready) override {
+    RTC_DCHECK(ready);
+    struct epoll_event events[kMaxEventsPerWait];
+    int count = epoll_wait(epoll_fd_, events, kMaxEventsPerWait, timeout_ms);
+    if (count < 0)
+      return errno == EINTR;
+    for (int i = 0; i < count; ++i) {
+      Event event;
+      event.socket = static_cast<SocketBase*>(events[i].data.ptr);
+      event.readable = (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR));
+      event.writable = (events[i].events & EPOLLOUT);
+      ready->push_back(event);
+    }
+    return true;
+  }
+
+ private:
+  const int epoll_fd_;
+};
+
+#elif defined(USE_KQUEUE)
+
+class KqueueEventLoop : public EventLoop {
+ public:
+  KqueueEventLoop() : kqueue_fd_(kqueue()) {}
+  ~KqueueEventLoop() override {
+    if (kqueue_fd_ != -1)
+      close(kqueue_fd_);
+  }
+
+  bool valid() const { return kqueue_fd_ != -1; }
+
+  bool Add(SocketBase* socket) override {
+    RTC_DCHECK(socket && socket->valid());
+    struct kevent change;
+    EV_SET(&change, socket->socket(), EVFILT_READ, EV_ADD, 0, 0, socket);
+    return kevent(kqueue_fd_, &change, 1, nullptr, 0, nullptr) == 0;
+  }
+
+  void Remove(SocketBase* socket) override {
+    RTC_DCHECK(socket && socket->valid());
+    struct kevent changes[2];
+    EV_SET(&changes[0], socket->socket(), EVFILT_READ, EV_DELETE, 0, 0,
+           nullptr);
+    EV_SET(&changes[1], socket->socket(), EVFILT_WRITE, EV_DELETE, 0, 0,
+           nullptr);
+    // Deleting the write filter fails harmlessly if it was never added.
+    for (struct kevent& change : changes)
+      kevent(kqueue_fd_, &change, 1, nullptr, 0, nullptr);
+  }
+
+  bool SetWriteInterest(SocketBase* socket, bool enabled) override {
+    RTC_DCHECK(socket && socket->valid());
+    struct kevent change;
+    EV_SET(&change, socket->socket(), EVFILT_WRITE,
+           enabled ? EV_ADD : EV_DELETE, 0, 0, socket);
+    return kevent(kqueue_fd_, &change, 1, nullptr, 0, nullptr) == 0 ||
+           !enabled;
+  }
+
+  bool Wait(int timeout_ms, std::vector<Event>* ready) override {
+    RTC_DCHECK(ready);
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000;
+    struct kevent events[kMaxEventsPerWait];
+    int count = kevent(kqueue_fd_, nullptr, 0, events, kMaxEventsPerWait,
+                       timeout_ms < 0 ? nullptr : &timeout);
+    if (count < 0)
+      return errno == EINTR;
+    size_t first = ready->size();
+    for (int i = 0; i < count; ++i) {
+      SocketBase* socket = static_cast<SocketBase*>(events[i].udata);
+      bool writable = events[i].filter == EVFILT_WRITE;
+      // kqueue reports each filter separately.  Merge them so that every
+      // socket is reported once; write interest is rare, so a linear search
+      // is fine.
+      Event* existing = nullptr;
+      for (size_t j = first; j < ready->size() && !existing; ++j) {
+        if ((*ready)[j].socket == socket)
+          existing = &(*ready)[j];
+      }
+      if (!existing) {
+        Event event = {socket, false, false};
+        ready->push_back(event);
+        existing = &ready->back();
+      }
+      if (writable) {
+        existing->writable = true;
+      } else {
+        existing->readable = true;
+      }
+    }
+    return true;
+  }
+
+ private:
+  const int kqueue_fd_;
+};
+
+#else
+
+// Portable fallback.  The kernel still scans every descriptor, but unlike
+// select() there is no FD_SETSIZE ceiling and registration is O(1).
+class PollEventLoop : public EventLoop {
+ public:
+  PollEventLoop() {}
+
+  bool valid() const { return true; }
+
+  bool Add(SocketBase* socket) override {
+    RTC_DCHECK(socket && socket->valid());
+    RTC_DCHECK(index_.find(socket) == index_.end());
+    struct pollfd fd = {0};
+    fd.fd = socket->socket();
+    fd.events = POLLIN;
+    index_[socket] = fds_.size();
+    fds_.push_back(fd);
+    sockets_.push_back(socket);
+    return true;
+  }
+
+  void Remove(SocketBase* socket) override {
+    std::unordered_map<SocketBase*, size_t>::iterator found =
+        index_.find(socket);
+    if (found == index_.end())
+      return;
+    // Swap with the last entry so that removal is O(1).
+    size_t i = found->second;
+    index_.erase(found);
+    if (i != fds_.size() - 1) {
+      fds_[i] = fds_.back();
+      sockets_[i] = sockets_.back();
+      index_[sockets_[i]] = i;
+    }
+    fds_.pop_back();
+    sockets_.pop_back();
+  }
+
+  bool SetWriteInterest(SocketBase* socket, bool enabled) override {
+    std::unordered_map<SocketBase*, size_t>::iterator found =
+        index_.find(socket);
+    if (found == index_.end())
+      return false;
+    fds_[found->second].events = POLLIN | (enabled ? POLLOUT : 0);
+    return true;
+  }
+
+  bool Wait(int timeout_ms, std::vector<Event>* ready) override {
+    RTC_DCHECK(ready);
+#if defined(WIN32)
+    int count = WSAPoll(fds_.data(), static_cast<ULONG>(fds_.size()),
+                        timeout_ms);
+#else
+    int count = poll(fds_.data(), fds_.size(), timeout_ms);
+#endif
+    if (count == SOCKET_ERROR) {
+#if defined(WIN32)
+      return false;
+#else
+      return errno == EINTR;
+#endif
+    }
+    for (size_t i = 0; i < fds_.size() && count > 0; ++i) {
+      if (fds_[i].revents != 0) {
+        Event event;
+        event.socket = sockets_[i];
+        event.readable = (fds_[i].revents & (POLLIN | POLLHUP | POLLERR));
+        event.writable = (fds_[i].revents & POLLOUT);
+        ready->push_back(event);
+        --count;
+      }
+    }
+    return true;
+  }
+
+ private:
+  std::vector<struct pollfd> fds_;
+  std::vector<SocketBase*> sockets_;
+  std::unordered_map<SocketBase*, size_t> index_;
+};
+
+#endif
+
+}  // namespace
+
+// static
+std::unique_ptr<EventLoop> EventLoop::Create() {
+#if defined(USE_EPOLL)
+  std::unique_ptr<EpollEventLoop> loop(new EpollEventLoop());
+#elif defined(USE_KQUEUE)
+  std::unique_ptr<KqueueEventLoop> loop(new KqueueEventLoop());
+#else
+  std::unique_ptr<PollEventLoop> loop(new PollEventLoop());
+#endif
+  if (!loop->valid())
+    return nullptr;
+  return loop;
+}
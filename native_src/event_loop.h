@@ -0,0 +1,57 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_SERVER_EVENT_LOOP_H_
+#define EXAMPLES_PEERCONNECTION_SERVER_EVENT_LOOP_H_
+
+#include <memory>
+#include <vector>
+
+#include "examples/peerconnection/server/data_socket.h"
+
+// Readiness notification backend for the server sockets.  Sockets are
+// registered once and Wait() only reports the ones that are ready, so the
+// cost of a wakeup is proportional to the number of active sockets rather
+// than to the number of open connections.
+class EventLoop {
+ public:
+  struct Event {
+    SocketBase* socket;
+    // Data (or a connection, or an error) is available.
+    bool readable;
+    // Buffered output can be written.  Only reported while write interest
+    // is enabled, see SetWriteInterest().
+    bool writable;
+  };
+
+  virtual ~EventLoop() {}
+
+  // Creates the best backend available on the current platform: epoll on
+  // Linux, kqueue on Mac and the BSDs, and poll() (WSAPoll() on Windows)
+  // everywhere else.  Returns nullptr if the backend could not be set up.
+  static std::unique_ptr<EventLoop> Create();
+
+  // Starts watching `socket` for readability (or incoming connections for a
+  // ListeningSocket).  The socket must stay alive until Remove() is called.
+  virtual bool Add(SocketBase* socket) = 0;
+
+  // Stops watching `socket`.  Must be called before the socket is closed.
+  virtual void Remove(SocketBase* socket) = 0;
+
+  // Enables or disables writability notifications for a registered socket.
+  virtual bool SetWriteInterest(SocketBase* socket, bool enabled) = 0;
+
+  // Waits up to `timeout_ms` milliseconds (-1 waits forever) for registered
+  // sockets to become ready and appends one event per ready socket to
+  // `ready`.  Returns false if an error occurred.
+  virtual bool Wait(int timeout_ms, std::vector<Event>* ready) = 0;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_SERVER_EVENT_LOOP_H_
@@ -0,0 +1,207 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/client/headless_client.h"
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "api/audio/create_audio_device_module.h"
+#include "api/audio_codecs/builtin_audio_decoder_factory.h"
+#include "api/audio_codecs/builtin_audio_encoder_factory.h"
+#include "api/audio_options.h"
+#include "api/create_modular_peer_connection_factory.h"
+#include "api/enable_media.h"
+#include "api/environment/environment.h"
+#include "api/make_ref_counted.h"
+#include "api/media_stream_interface.h"
+#include "api/peer_connection_interface.h"
+#include "api/scoped_refptr.h"
+#include "api/test/create_frame_generator.h"
+#include "api/units/time_delta.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_source_interface.h"
+#include "examples/peerconnection/client/codec_factory.h"
+#include "examples/peerconnection/client/conductor.h"
+#include "examples/peerconnection/client/defaults.h"
+#include "examples/peerconnection/client/headless_main_wnd.h"
+#include "examples/peerconnection/client/peer_connection_client.h"
+#include "modules/audio_device/include/audio_device.h"
+#include "pc/video_track_source.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/thread.h"
+#include "test/frame_generator_capturer.h"
+
+namespace {
+
+class GeneratorTrackSource : public webrtc::VideoTrackSource {
+ protected:
+  explicit GeneratorTrackSource(
+      std::unique_ptr<webrtc::test::FrameGeneratorCapturer> capturer)
+      : VideoTrackSource(/*remote=*/false), capturer_(std::move(capturer)) {}
+
+ private:
+  webrtc::VideoSourceInterface<webrtc::VideoFrame>* source() override {
+    return capturer_.get();
+  }
+
+  std::unique_ptr<webrtc::test::FrameGeneratorCapturer> capturer_;
+};
+
+}  // namespace
+
+HeadlessClient::Options::Options()
+    : signaling_connection_threads(1),
+      send_audio(true),
+      send_video(true),
+      video_width(640),
+      video_height(360),
+      video_fps(30),
+      video_send_mode(Conductor::VideoSendMode::kSingle),
+      call_stats_interval(webrtc::TimeDelta::Seconds(1)) {}
+
+HeadlessClient::SessionConfig::SessionConfig()
+    : port(kDefaultServerPort), remote_video_sink(nullptr) {}
+
+HeadlessClient::HeadlessClient(const webrtc::Environment& env,
+                               const Options& options)
+    : env_(env), options_(options), next_session_id_(0) {
+  RTC_DCHECK_GT(options_.signaling_connection_threads, 0);
+}
+
+HeadlessClient::~HeadlessClient() {
+  while (!sessions_.empty()) {
+    CloseSession(std::move(sessions_.begin()->second));
+    sessions_.erase(sessions_.begin());
+  }
+  // Waits for the sessions to be destroyed, after which the tracks and the
+  // factory go away here, and the threads they ran on after them.
+  for (const auto& thread : connection_threads_)
+    thread->BlockingCall([] {});
+  audio_track_ = nullptr;
+  video_track_ = nullptr;
+  factory_ = nullptr;
+}
+
+bool HeadlessClient::Init() {
+  RTC_DCHECK(!factory_);
+
+  signaling_thread_ = webrtc::Thread::CreateWithSocketServer();
+  signaling_thread_->SetName("headless_signaling", nullptr);
+  signaling_thread_->Start();
+  for (int i = 0; i < options_.signaling_connection_threads; ++i) {
+    connection_threads_.push_back(webrtc::Thread::CreateWithSocketServer());
+    connection_threads_.back()->SetName("headless_connection", nullptr);
+    connection_threads_.back()->Start();
+  }
+
+  // There is no sound card to play or record on.
+  webrtc::PeerConnectionFactoryDependencies deps;
+  deps.signaling_thread = signaling_thread_.get();
+  deps.env = env_;
+  deps.adm = webrtc::CreateAudioDeviceModule(
+      env_, webrtc::AudioDeviceModule::kDummyAudio);
+  deps.audio_encoder_factory = webrtc::CreateBuiltinAudioEncoderFactory();
+  deps.audio_decoder_factory = webrtc::CreateBuiltinAudioDecoderFactory();
+  deps.video_encoder_factory = CreateVideoEncoderFactory();
+  deps.video_decoder_factory = CreateVideoDecoderFactory();
+  webrtc::EnableMedia(deps);
+  factory_ = webrtc::CreateModularPeerConnectionFactory(std::move(deps));
+  if (!factory_) {
+    RTC_LOG(LS_ERROR) << "Failed to create the PeerConnectionFactory";
+    return false;
+  }
+
+  if (options_.send_audio) {
+    audio_track_ = factory_->CreateAudioTrack(
+        kAudioLabel,
+        factory_->CreateAudioSource(webrtc::AudioOptions()).get());
+  }
+  if (options_.send_video) {
+    // Every call encodes the same frames, which are generated only once.
+    auto capturer = std::make_unique<webrtc::test::FrameGeneratorCapturer>(
+        &env_.clock(),
+        webrtc::test::CreateSquareFrameGenerator(
+            options_.video_width, options_.video_height, std::nullopt,
+            std::nullopt),
+        options_.video_fps, env_.task_queue_factory());
+    capturer->Start();
+    video_track_ = factory_->CreateVideoTrack(
+        webrtc::make_ref_counted<GeneratorTrackSource>(std::move(capturer)),
+        kVideoLabel);
+  }
+  return true;
+}
+
+int HeadlessClient::AddSession(const SessionConfig& config) {
+  RTC_DCHECK(factory_);
+
+  int id = next_session_id_++;
+  auto session = std::make_unique<Session>();
+  session->thread =
+      connection_threads_[id % connection_threads_.size()].get();
+  // The client and the Conductor take the thread they are created on as
+  // theirs.
+  session->thread->BlockingCall([this, &config, &session] {
+    session->client = std::make_unique<PeerConnectionClient>();
+    session->main_wnd = std::make_unique<HeadlessMainWnd>(config.call_peer);
+    session->main_wnd->set_remote_video_sink(config.remote_video_sink);
+    session->conductor = webrtc::make_ref_counted<Conductor>(
+        env_, session->client.get(), session->main_wnd.get());
+    session->conductor->SetSharedMedia(factory_, signaling_thread_.get(),
+                                       audio_track_, video_track_);
+    session->conductor->SetVideoSendMode(options_.video_send_mode);
+    if (options_.call_stats_sink) {
+      session->conductor->SetCallStatsSink(options_.call_stats_sink,
+                                           options_.call_stats_interval);
+    }
+    if (!config.name.empty())
+      session->conductor->SetPeerName(config.name);
+    session->conductor->StartLogin(config.server, config.port);
+  });
+  sessions_[id] = std::move(session);
+  return id;
+}
+
+bool HeadlessClient::RemoveSession(int id) {
+  auto it = sessions_.find(id);
+  if (it == sessions_.end())
+    return false;
+  CloseSession(std::move(it->second));
+  sessions_.erase(it);
+  return true;
+}
+
+size_t HeadlessClient::CountActiveCalls() {
+  size_t active_calls = 0;
+  for (const auto& [id, session] : sessions_) {
+    if (session->thread->BlockingCall(
+            [&session] { return session->conductor->connection_active(); })) {
+      ++active_calls;
+    }
+  }
+  return active_calls;
+}
+
+void HeadlessClient::CloseSession(std::unique_ptr<Session> session) {
+  webrtc::Thread* thread = session->thread;
+  thread->BlockingCall([&session] { session->conductor->Close(); });
+  // Tasks that the call posted to the thread before it was closed may still
+  // use the client and the window, so they go after them.
+  thread->PostTask([session = std::move(session)] {
+    session->conductor = nullptr;
+    session->main_wnd = nullptr;
+    session->client = nullptr;
+  });
+}
@@ -0,0 +1,123 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_CLIENT_HEADLESS_CLIENT_H_
+#define EXAMPLES_PEERCONNECTION_CLIENT_HEADLESS_CLIENT_H_
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "api/environment/environment.h"
+#include "api/media_stream_interface.h"
+#include "api/peer_connection_interface.h"
+#include "api/scoped_refptr.h"
+#include "api/units/time_delta.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "examples/peerconnection/client/call_stats.h"
+#include "examples/peerconnection/client/conductor.h"
+#include "rtc_base/thread.h"
+
+class HeadlessMainWnd;
+class PeerConnectionClient;
+
+// Runs many sessions of the client in one process, without windows, e.g.
+// for recording bots or media relays.  Each session signs in to a server
+// with a PeerConnectionClient and makes or takes one call at a time with a
+// Conductor, as the windowed client does.  All calls share one
+// PeerConnectionFactory, with its signaling, worker and network threads,
+// and the local media, which is generated rather than captured.  The
+// signaling connections of the sessions are spread over a few threads of
+// their own.  Created and used on one thread.
+class HeadlessClient {
+ public:
+  struct Options {
+    Options();
+
+    // Threads that run the signaling connections and the Conductors.
+    int signaling_connection_threads;
+    // Sends no audio, or no video, if unset.  The video is generated at the
+    // given size and rate, once for all calls.
+    bool send_audio;
+    bool send_video;
+    int video_width;
+    int video_height;
+    int video_fps;
+    Conductor::VideoSendMode video_send_mode;
+    // Where the statistics of all calls go every `call_stats_interval`, if
+    // anywhere.
+    std::shared_ptr<CallStatsSink> call_stats_sink;
+    webrtc::TimeDelta call_stats_interval;
+  };
+
+  struct SessionConfig {
+    SessionConfig();
+
+    std::string server;
+    int port;
+    // The name to sign in with.
+    std::string name;
+    // Calls the peer of this name once it shows up, if set, and otherwise
+    // waits to be called.
+    std::string call_peer;
+    // Receives the remote video of the calls, if set.  Must outlive the
+    // session.
+    webrtc::VideoSinkInterface<webrtc::VideoFrame>* remote_video_sink;
+  };
+
+  HeadlessClient(const webrtc::Environment& env, const Options& options);
+  HeadlessClient(const HeadlessClient&) = delete;
+  HeadlessClient& operator=(const HeadlessClient&) = delete;
+  // Signs out the sessions that are left.
+  ~HeadlessClient();
+
+  // Starts the threads and builds the factory and the local media.
+  // Returns false if the factory could not be built.
+  bool Init();
+
+  // Starts signing a new session in.  Returns the id of the session, or -1
+  // if it could not be started.
+  int AddSession(const SessionConfig& config);
+
+  // Hangs up the call of a session, if any, and signs it out.  Returns
+  // false if there is no such session.
+  bool RemoveSession(int id);
+
+  size_t session_count() const { return sessions_.size(); }
+
+  // The sessions with a call, counted on their threads.
+  size_t CountActiveCalls();
+
+ private:
+  // Everything of a session lives on its thread.
+  struct Session {
+    webrtc::Thread* thread;
+    std::unique_ptr<PeerConnectionClient> client;
+    std::unique_ptr<HeadlessMainWnd> main_wnd;
+    webrtc::scoped_refptr<Conductor> conductor;
+  };
+
+  void CloseSession(std::unique_ptr<Session> session);
+
+  const webrtc::Environment env_;
+  const Options options_;
+  std::unique_ptr<webrtc::Thread> signaling_thread_;
+  std::vector<std::unique_ptr<webrtc::Thread>> connection_threads_;
+  webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory_;
+  webrtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track_;
+  webrtc::scoped_refptr<webrtc::VideoTrackInterface> video_track_;
+  std::map<int, std::unique_ptr<Session>> sessions_;
+  int next_session_id_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_CLIENT_HEADLESS_CLIENT_H_
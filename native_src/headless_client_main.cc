@@ -0,0 +1,127 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+// Signs many sessions in to a peerconnection_server from one process and
+// reports how many of them are in a call.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "api/environment/environment.h"
+#include "api/environment/environment_factory.h"
+#include "api/units/time_delta.h"
+#include "examples/peerconnection/client/call_stats.h"
+#include "examples/peerconnection/client/defaults.h"
+#include "examples/peerconnection/client/headless_client.h"
+#include "rtc_base/thread.h"
+
+ABSL_FLAG(std::string, server, "localhost", "The server to connect to.");
+ABSL_FLAG(int,
+          port,
+          kDefaultServerPort,
+          "The port on which the server is listening.");
+ABSL_FLAG(int, sessions, 1, "Number of sessions to sign in.");
+ABSL_FLAG(std::string,
+          name_prefix,
+          "headless",
+          "Sessions sign in as this name followed by their number.");
+ABSL_FLAG(std::string,
+          call_peer,
+          "",
+          "Each session calls the peer of this name once it is signed in.  "
+          "Empty waits to be called.");
+ABSL_FLAG(int,
+          threads,
+          1,
+          "Number of threads that run the signaling connections.");
+ABSL_FLAG(bool, audio, true, "Send audio.");
+ABSL_FLAG(bool, video, true, "Send generated video.");
+ABSL_FLAG(int, width, 640, "Width of the generated video.");
+ABSL_FLAG(int, height, 360, "Height of the generated video.");
+ABSL_FLAG(int, fps, 30, "Frame rate of the generated video.");
+ABSL_FLAG(std::string,
+          stats_file,
+          "",
+          "File that the statistics of the calls are appended to every "
+          "second, as lines of JSON.  Empty samples none.");
+ABSL_FLAG(int,
+          duration,
+          0,
+          "Seconds to run for.  0 runs until the process is killed.");
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(
+      "Example usage: ./peerconnection_headless --sessions=100 "
+      "--call_peer=relay --video=false\n");
+  absl::ParseCommandLine(argc, argv);
+
+  const int num_sessions = std::max(absl::GetFlag(FLAGS_sessions), 1);
+  const int port = absl::GetFlag(FLAGS_port);
+  if (port < 1 || port > 65535) {
+    fprintf(stderr, "%i is not a valid port\n", port);
+    return 1;
+  }
+
+  HeadlessClient::Options options;
+  options.signaling_connection_threads =
+      std::max(absl::GetFlag(FLAGS_threads), 1);
+  options.send_audio = absl::GetFlag(FLAGS_audio);
+  options.send_video = absl::GetFlag(FLAGS_video);
+  options.video_width = absl::GetFlag(FLAGS_width);
+  options.video_height = absl::GetFlag(FLAGS_height);
+  options.video_fps = absl::GetFlag(FLAGS_fps);
+  if (options.video_width <= 0 || options.video_height <= 0 ||
+      options.video_fps <= 0) {
+    fprintf(stderr, "--width, --height and --fps must be positive\n");
+    return 1;
+  }
+  const std::string stats_file = absl::GetFlag(FLAGS_stats_file);
+  if (!stats_file.empty()) {
+    options.call_stats_sink = FileCallStatsSink::Create(stats_file);
+    if (!options.call_stats_sink) {
+      fprintf(stderr, "Failed to open %s\n", stats_file.c_str());
+      return 1;
+    }
+  }
+
+  webrtc::AutoThread main_thread;
+  const webrtc::Environment env = webrtc::CreateEnvironment();
+  HeadlessClient client(env, options);
+  if (!client.Init()) {
+    fprintf(stderr, "Failed to create the PeerConnectionFactory\n");
+    return 1;
+  }
+
+  HeadlessClient::SessionConfig config;
+  config.server = absl::GetFlag(FLAGS_server);
+  config.port = port;
+  config.call_peer = absl::GetFlag(FLAGS_call_peer);
+  const std::string name_prefix = absl::GetFlag(FLAGS_name_prefix);
+  for (int i = 0; i < num_sessions; ++i) {
+    config.name = name_prefix + std::to_string(i);
+    client.AddSession(config);
+  }
+
+  const int duration = absl::GetFlag(FLAGS_duration);
+  for (int second = 1; duration <= 0 || second <= duration; ++second) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    printf("%i s: %zu of %zu sessions in a call\n", second,
+           client.CountActiveCalls(), client.session_count());
+    fflush(stdout);
+  }
+  return 0;
+}
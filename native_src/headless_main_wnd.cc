@@ -0,0 +1,109 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/client/headless_main_wnd.h"
+
+#include <string>
+
+#include "api/media_stream_interface.h"
+#include "api/task_queue/pending_task_safety_flag.h"
+#include "api/video/video_source_interface.h"
+#include "examples/peerconnection/client/main_wnd.h"
+#include "examples/peerconnection/client/peer_connection_client.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/thread.h"
+
+HeadlessMainWnd::HeadlessMainWnd(const std::string& call_peer)
+    : ui_thread_(webrtc::Thread::Current()),
+      call_peer_(call_peer),
+      callback_(nullptr),
+      ui_(CONNECT_TO_SERVER),
+      called_(false),
+      remote_video_sink_(nullptr) {
+  RTC_DCHECK(ui_thread_);
+}
+
+HeadlessMainWnd::~HeadlessMainWnd() {
+  RTC_DCHECK(ui_thread_->IsCurrent());
+  StopRemoteRenderer();
+}
+
+void HeadlessMainWnd::RegisterObserver(MainWndCallback* callback) {
+  callback_ = callback;
+}
+
+bool HeadlessMainWnd::IsWindow() {
+  return true;
+}
+
+void HeadlessMainWnd::MessageBox(const char* caption,
+                                 const char* text,
+                                 bool is_error) {
+  if (is_error) {
+    RTC_LOG(LS_ERROR) << caption << ": " << text;
+  } else {
+    RTC_LOG(LS_INFO) << caption << ": " << text;
+  }
+}
+
+MainWindow::UI HeadlessMainWnd::current_ui() {
+  return ui_;
+}
+
+void HeadlessMainWnd::SwitchToConnectUI() {
+  ui_ = CONNECT_TO_SERVER;
+}
+
+void HeadlessMainWnd::SwitchToPeerList(const Peers& peers) {
+  ui_ = LIST_PEERS;
+  if (called_ || call_peer_.empty() || !callback_)
+    return;
+  for (const auto& peer : peers) {
+    if (peer.second == call_peer_) {
+      called_ = true;
+      callback_->ConnectToPeer(peer.first);
+      return;
+    }
+  }
+}
+
+void HeadlessMainWnd::SwitchToStreamingUI() {
+  ui_ = STREAMING;
+}
+
+void HeadlessMainWnd::StartLocalRenderer(
+    webrtc::VideoTrackInterface* local_video) {}
+
+void HeadlessMainWnd::StopLocalRenderer() {}
+
+void HeadlessMainWnd::StartRemoteRenderer(
+    webrtc::VideoTrackInterface* remote_video) {
+  StopRemoteRenderer();
+  if (!remote_video_sink_)
+    return;
+  remote_video_ = remote_video;
+  remote_video_->AddOrUpdateSink(remote_video_sink_,
+                                 webrtc::VideoSinkWants());
+}
+
+void HeadlessMainWnd::StopRemoteRenderer() {
+  if (remote_video_) {
+    remote_video_->RemoveSink(remote_video_sink_);
+    remote_video_ = nullptr;
+  }
+}
+
+void HeadlessMainWnd::QueueUIThreadCallback(int msg_id, void* data) {
+  MainWndCallback* callback = callback_;
+  ui_thread_->PostTask(webrtc::SafeTask(
+      safety_.flag(),
+      [callback, msg_id, data] { callback->UIThreadCallback(msg_id, data); }));
+}
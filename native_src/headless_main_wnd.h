@@ -0,0 +1,75 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_CLIENT_HEADLESS_MAIN_WND_H_
+#define EXAMPLES_PEERCONNECTION_CLIENT_HEADLESS_MAIN_WND_H_
+
+#include <string>
+
+#include "api/media_stream_interface.h"
+#include "api/scoped_refptr.h"
+#include "api/task_queue/pending_task_safety_flag.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "examples/peerconnection/client/main_wnd.h"
+#include "examples/peerconnection/client/peer_connection_client.h"
+#include "rtc_base/thread.h"
+
+// A main window without a window, for running calls on a server.  Nothing
+// is rendered: the remote video goes to a sink, if one is set, and the
+// local video nowhere.  The "UI thread" is the thread that the window is
+// created on, which runs the client and the Conductor, and callbacks are
+// posted to it.  Message boxes go to the log.
+class HeadlessMainWnd : public MainWindow {
+ public:
+  // Once signed in, calls the first peer that is named `call_peer`, if it
+  // is not empty, and otherwise waits to be called.
+  explicit HeadlessMainWnd(const std::string& call_peer);
+  ~HeadlessMainWnd() override;
+
+  // Receives the frames of the remote video of each call from the decoding
+  // thread, e.g. to record them.  Must outlive the window, and be set
+  // before the first call.
+  void set_remote_video_sink(
+      webrtc::VideoSinkInterface<webrtc::VideoFrame>* sink) {
+    remote_video_sink_ = sink;
+  }
+
+  // MainWindow implementation.
+  void RegisterObserver(MainWndCallback* callback) override;
+  bool IsWindow() override;
+  void MessageBox(const char* caption,
+                  const char* text,
+                  bool is_error) override;
+  UI current_ui() override;
+  void SwitchToConnectUI() override;
+  void SwitchToPeerList(const Peers& peers) override;
+  void SwitchToStreamingUI() override;
+  void StartLocalRenderer(webrtc::VideoTrackInterface* local_video) override;
+  void StopLocalRenderer() override;
+  void StartRemoteRenderer(webrtc::VideoTrackInterface* remote_video) override;
+  void StopRemoteRenderer() override;
+  void QueueUIThreadCallback(int msg_id, void* data) override;
+
+ private:
+  webrtc::Thread* const ui_thread_;
+  const std::string call_peer_;
+  MainWndCallback* callback_;
+  UI ui_;
+  // Set once `call_peer_` was called, so that it isn't called again when
+  // the call ends.
+  bool called_;
+  webrtc::VideoSinkInterface<webrtc::VideoFrame>* remote_video_sink_;
+  webrtc::scoped_refptr<webrtc::VideoTrackInterface> remote_video_;
+  // Drops the callbacks that are still queued when the window goes away.
+  webrtc::ScopedTaskSafety safety_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_CLIENT_HEADLESS_MAIN_WND_H_
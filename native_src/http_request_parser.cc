@@ -0,0 +1,399 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/server/http_request_parser.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "absl/strings/match.h"
+#include "absl/strings/string_view.h"
+#include "rtc_base/checks.h"
+
+namespace {
+
+// Size of the first allocation, and the least amount of free space offered
+// to PrepareRead() callers.
+const size_t kMinReadSize = 4096;
+
+// Buffers that grew beyond this size to hold a large request are released
+// when the parser is reset, instead of being kept for the next request.
+const size_t kMaxRetainedCapacity = 64 * 1024;
+
+absl::string_view TrimWhitespace(absl::string_view value) {
+  while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+    value.remove_prefix(1);
+  while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+    value.remove_suffix(1);
+  return value;
+}
+
+// True if the comma separated list in `value` contains `token`.
+bool HasToken(absl::string_view value, absl::string_view token) {
+  while (!value.empty()) {
+    size_t comma = value.find(',');
+    if (absl::EqualsIgnoreCase(TrimWhitespace(value.substr(0, comma)), token))
+      return true;
+    if (comma == absl::string_view::npos)
+      break;
+    value.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+// Parses a non-negative decimal number that consists of digits only.
+bool ParseLength(absl::string_view value, size_t max, size_t* length) {
+  if (value.empty())
+    return false;
+  size_t result = 0;
+  for (char c : value) {
+    if (c < '0' || c > '9')
+      return false;
+    result = result * 10 + (c - '0');
+    if (result > max)
+      return false;
+  }
+  *length = result;
+  return true;
+}
+
+}  // namespace
+
+HttpRequestParser::HttpRequestParser()
+    : capacity_(0),
+      size_(0),
+      scanned_(0),
+      line_start_(0),
+      state_(REQUEST_LINE),
+      method_(INVALID),
+      content_length_(0),
+      has_content_length_(false),
+      body_offset_(0) {}
+
+HttpRequestParser::~HttpRequestParser() {}
+
+char* HttpRequestParser::PrepareRead(size_t* available) {
+  RTC_DCHECK(available);
+  size_t wanted = kMinReadSize;
+  if (state_ == FAILED) {
+    // Nothing after the error is parsed, so it is read into the same space
+    // over and over rather than buffered.
+    size_ = scanned_;
+  } else if (state_ == BODY) {
+    // Make room for the whole body at once instead of growing repeatedly.
+    size_t body_end = body_offset_ + content_length_;
+    if (body_end > size_)
+      wanted = std::max(wanted, body_end - size_);
+  }
+  Reserve(wanted);
+  *available = capacity_ - size_;
+  return buffer_.get() + size_;
+}
+
+HttpRequestParser::Status HttpRequestParser::OnRead(size_t bytes) {
+  RTC_DCHECK_LE(bytes, capacity_ - size_);
+  size_ += bytes;
+  return Parse();
+}
+
+HttpRequestParser::Status HttpRequestParser::NextRequest() {
+  size_t consumed = state_ == DONE ? scanned_ : size_;
+  size_t remaining = size_ - consumed;
+  if (capacity_ > kMaxRetainedCapacity && remaining <= kMinReadSize) {
+    // Give the memory of a large request back.
+    std::unique_ptr<char[]> buffer;
+    if (remaining) {
+      buffer.reset(new char[kMinReadSize]);
+      memcpy(buffer.get(), buffer_.get() + consumed, remaining);
+    }
+    buffer_ = std::move(buffer);
+    capacity_ = remaining ? kMinReadSize : 0;
+  } else if (remaining) {
+    memmove(buffer_.get(), buffer_.get() + consumed, remaining);
+  }
+  size_ = remaining;
+  ResetRequest();
+  return Parse();
+}
+
+void HttpRequestParser::Reset() {
+  if (capacity_ > kMaxRetainedCapacity) {
+    buffer_.reset();
+    capacity_ = 0;
+  }
+  size_ = 0;
+  ResetRequest();
+}
+
+void HttpRequestParser::ResetRequest() {
+  scanned_ = 0;
+  line_start_ = 0;
+  state_ = REQUEST_LINE;
+  method_ = INVALID;
+  target_ = Range();
+  version_ = Range();
+  content_type_ = Range();
+  content_length_ = 0;
+  has_content_length_ = false;
+  body_offset_ = 0;
+  headers_.clear();
+}
+
+HttpRequestParser::Status HttpRequestParser::status() const {
+  switch (state_) {
+    case DONE:
+      return COMPLETE;
+    case FAILED:
+      return PARSE_ERROR;
+    default:
+      return INCOMPLETE;
+  }
+}
+
+absl::string_view HttpRequestParser::path() const {
+  absl::string_view target = this->target();
+  return target.substr(0, target.find('?'));
+}
+
+absl::string_view HttpRequestParser::query() const {
+  absl::string_view target = this->target();
+  size_t args = target.find('?');
+  if (args == absl::string_view::npos)
+    return absl::string_view();
+  return target.substr(args + 1);
+}
+
+absl::string_view HttpRequestParser::GetQueryParameter(
+    absl::string_view name) const {
+  absl::string_view args = query();
+  while (!args.empty()) {
+    size_t end = args.find('&');
+    absl::string_view param = args.substr(0, end);
+    if (param.size() > name.size() && param[name.size()] == '=' &&
+        param.starts_with(name)) {
+      return param.substr(name.size() + 1);
+    }
+    if (end == absl::string_view::npos)
+      break;
+    args.remove_prefix(end + 1);
+  }
+  return absl::string_view();
+}
+
+bool HttpRequestParser::keep_alive() const {
+  if (http_version() == "HTTP/1.1")
+    return !HeaderHasToken("Connection", "close");
+  return HeaderHasToken("Connection", "keep-alive");
+}
+
+absl::string_view HttpRequestParser::body() const {
+  if (state_ != DONE || method_ != POST)
+    return absl::string_view();
+  return absl::string_view(buffer_.get() + body_offset_, content_length_);
+}
+
+absl::string_view HttpRequestParser::GetHeader(absl::string_view name) const {
+  for (const std::pair<Range, Range>& header : headers_) {
+    if (absl::EqualsIgnoreCase(View(header.first), name))
+      return View(header.second);
+  }
+  return absl::string_view();
+}
+
+bool HttpRequestParser::HeaderHasToken(absl::string_view name,
+                                       absl::string_view token) const {
+  for (const std::pair<Range, Range>& header : headers_) {
+    if (absl::EqualsIgnoreCase(View(header.first), name) &&
+        HasToken(View(header.second), token)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+absl::string_view HttpRequestParser::unparsed_data() const {
+  if (state_ != DONE || scanned_ == size_)
+    return absl::string_view();
+  return absl::string_view(buffer_.get() + scanned_, size_ - scanned_);
+}
+
+HttpRequestParser::Status HttpRequestParser::Parse() {
+  while (state_ == REQUEST_LINE || state_ == HEADERS) {
+    const char* data = buffer_.get();
+    // memchr() is vectorized by the C library, so this is the fastest way
+    // to find the end of the line without examining any byte twice.
+    const char* newline = static_cast<const char*>(
+        memchr(data + scanned_, '\n', size_ - scanned_));
+    if (!newline) {
+      scanned_ = size_;
+      return size_ > kMaxHeaderSize ? Fail() : INCOMPLETE;
+    }
+
+    scanned_ = newline - data + 1;
+    if (scanned_ > kMaxHeaderSize)
+      return Fail();
+
+    size_t line_end = newline - data;
+    if (line_end > line_start_ && data[line_end - 1] == '\r')
+      --line_end;
+    size_t offset = line_start_;
+    absl::string_view line(data + offset, line_end - offset);
+    line_start_ = scanned_;
+
+    bool ok = state_ == REQUEST_LINE ? ParseRequestLine(line, offset)
+                                     : ParseHeaderLine(line, offset);
+    if (!ok)
+      return Fail();
+  }
+
+  if (state_ == BODY) {
+    if (size_ - body_offset_ < content_length_) {
+      scanned_ = size_;
+      return INCOMPLETE;
+    }
+    scanned_ = body_offset_ + content_length_;
+    state_ = DONE;
+  }
+
+  return status();
+}
+
+bool HttpRequestParser::ParseRequestLine(absl::string_view line,
+                                         size_t offset) {
+  // Be lenient and skip empty lines in front of the request.
+  if (line.empty())
+    return true;
+
+  static const struct {
+    absl::string_view name;
+    Method id;
+  } kSupportedMethods[] = {
+      {"GET", GET},
+      {"POST", POST},
+      {"OPTIONS", OPTIONS},
+  };
+
+  size_t method_end = line.find(' ');
+  if (method_end == absl::string_view::npos)
+    return false;
+  absl::string_view method = line.substr(0, method_end);
+  for (const auto& supported : kSupportedMethods) {
+    if (method == supported.name) {
+      method_ = supported.id;
+      break;
+    }
+  }
+  if (method_ == INVALID)
+    return false;
+
+  absl::string_view rest = TrimWhitespace(line.substr(method_end + 1));
+  size_t target_end = rest.find(' ');
+  absl::string_view target = rest.substr(0, target_end);
+  if (target.empty())
+    return false;
+  target_ = RangeOf(target, line, offset);
+
+  // The version is optional, as for the simple requests of HTTP/0.9.
+  if (target_end != absl::string_view::npos)
+    version_ = RangeOf(TrimWhitespace(rest.substr(target_end)), line, offset);
+
+  state_ = HEADERS;
+  return true;
+}
+
+bool HttpRequestParser::ParseHeaderLine(absl::string_view line,
+                                        size_t offset) {
+  if (line.empty())
+    return OnHeadersComplete();
+
+  // Ignore continuation lines and lines that aren't headers.
+  size_t colon = line.find(':');
+  if (line.front() == ' ' || line.front() == '\t' ||
+      colon == absl::string_view::npos) {
+    return true;
+  }
+
+  if (headers_.size() >= kMaxHeaders)
+    return false;
+
+  absl::string_view name = TrimWhitespace(line.substr(0, colon));
+  absl::string_view value = TrimWhitespace(line.substr(colon + 1));
+
+  if (absl::EqualsIgnoreCase(name, "Content-Length")) {
+    size_t length = 0;
+    if (!ParseLength(value, kMaxContentLength, &length))
+      return false;
+    // Conflicting lengths would make the end of the request ambiguous.
+    if (has_content_length_ && length != content_length_)
+      return false;
+    content_length_ = length;
+    has_content_length_ = true;
+  } else if (absl::EqualsIgnoreCase(name, "Content-Type")) {
+    content_type_ = RangeOf(value, line, offset);
+  }
+
+  headers_.push_back(std::make_pair(RangeOf(name, line, offset),
+                                    RangeOf(value, line, offset)));
+  return true;
+}
+
+bool HttpRequestParser::OnHeadersComplete() {
+  body_offset_ = scanned_;
+  if (method_ != POST) {
+    // Only POST requests carry a body.
+    content_length_ = 0;
+    state_ = DONE;
+    return true;
+  }
+
+  // The peers always post typed, non-empty messages.
+  if (content_type_.length == 0 || content_length_ == 0)
+    return false;
+
+  state_ = BODY;
+  return true;
+}
+
+HttpRequestParser::Status HttpRequestParser::Fail() {
+  state_ = FAILED;
+  return PARSE_ERROR;
+}
+
+void HttpRequestParser::Reserve(size_t size) {
+  if (capacity_ - size_ >= size)
+    return;
+  size_t capacity =
+      std::max(std::max(capacity_ * 2, kMinReadSize), size_ + size);
+  std::unique_ptr<char[]> buffer(new char[capacity]);
+  if (size_)
+    memcpy(buffer.get(), buffer_.get(), size_);
+  buffer_ = std::move(buffer);
+  capacity_ = capacity;
+}
+
+absl::string_view HttpRequestParser::View(const Range& range) const {
+  if (!range.length)
+    return absl::string_view();
+  return absl::string_view(buffer_.get() + range.offset, range.length);
+}
+
+HttpRequestParser::Range HttpRequestParser::RangeOf(absl::string_view part,
+                                                    absl::string_view line,
+                                                    size_t offset) const {
+  RTC_DCHECK(part.empty() || (part.data() >= line.data() &&
+                              part.data() + part.size() <=
+                                  line.data() + line.size()));
+  Range range;
+  if (!part.empty()) {
+    range.offset = offset + (part.data() - line.data());
+    range.length = part.size();
+  }
+  return range;
+}
@@ -0,0 +1,166 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_SERVER_HTTP_REQUEST_PARSER_H_
+#define EXAMPLES_PEERCONNECTION_SERVER_HTTP_REQUEST_PARSER_H_
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+// Incremental parser for the HTTP/1.x requests received by the server.
+// Data is received straight into the parser's buffer (see PrepareRead()) and
+// every byte is examined only once: the parser remembers how far it got and
+// continues from there when more data arrives.  The request line, headers
+// and body are exposed as views into the buffer that stay valid until the
+// next call to NextRequest() or Reset().
+class HttpRequestParser {
+ public:
+  enum Method {
+    INVALID,
+    GET,
+    POST,
+    OPTIONS,
+  };
+
+  enum Status {
+    INCOMPLETE,
+    COMPLETE,
+    PARSE_ERROR,
+  };
+
+  // Requests with larger headers or bodies are rejected.
+  static const size_t kMaxHeaderSize = 16 * 1024;
+  static const size_t kMaxContentLength = 16 * 1024 * 1024;
+  static const size_t kMaxHeaders = 64;
+  // At most this much data is expected after a complete request that has
+  // not been answered yet, e.g. a hanging get: room for one more request.
+  static const size_t kMaxUnparsedSize = kMaxHeaderSize + kMaxContentLength;
+
+  HttpRequestParser();
+  HttpRequestParser(const HttpRequestParser&) = delete;
+  HttpRequestParser& operator=(const HttpRequestParser&) = delete;
+  ~HttpRequestParser();
+
+  // Returns a buffer to receive data into and sets `available` to its size,
+  // which is never zero.  Call OnRead() with the number of bytes written.
+  // Once a request failed to parse, what follows it is dropped.
+  char* PrepareRead(size_t* available);
+
+  // Parses `bytes` newly received bytes.  Data that arrives after a complete
+  // request is kept, but not parsed, until NextRequest() is called.
+  Status OnRead(size_t bytes);
+
+  // Discards the current request and starts parsing the data received after
+  // it, which may already hold one or more pipelined requests.  A request
+  // that is incomplete or failed to parse is discarded with all data.
+  Status NextRequest();
+
+  // Discards all data and prepares for a new request.
+  void Reset();
+
+  Status status() const;
+
+  bool headers_received() const { return method_ != INVALID; }
+
+  Method method() const { return method_; }
+
+  // The request target, e.g. "/wait?peer_id=1".
+  absl::string_view target() const { return View(target_); }
+
+  // The target without the query string, e.g. "/wait".
+  absl::string_view path() const;
+
+  // The query string without the '?', e.g. "peer_id=1".
+  absl::string_view query() const;
+
+  // Returns the value of the first parameter named `name` in the query
+  // string, or an empty view if there is none.
+  absl::string_view GetQueryParameter(absl::string_view name) const;
+
+  absl::string_view http_version() const { return View(version_); }
+
+  // True if the client wants to send more requests on the same connection:
+  // the default for HTTP/1.1, and opt-in with "Connection: keep-alive" for
+  // older versions.
+  bool keep_alive() const;
+
+  absl::string_view content_type() const { return View(content_type_); }
+
+  size_t content_length() const { return content_length_; }
+
+  // The body of a complete POST request.
+  absl::string_view body() const;
+
+  // Returns the value of the first header named `name` (compared case
+  // insensitively), or an empty view if there is none.
+  absl::string_view GetHeader(absl::string_view name) const;
+
+  // True if a header named `name` holds a comma separated list that contains
+  // `token`, both compared case insensitively.
+  bool HeaderHasToken(absl::string_view name, absl::string_view token) const;
+
+  // The data received after the current, complete request.
+  absl::string_view unparsed_data() const;
+
+ private:
+  enum State {
+    REQUEST_LINE,
+    HEADERS,
+    BODY,
+    DONE,
+    FAILED,
+  };
+
+  // A range of the current request, relative to its first byte.  Offsets
+  // are used instead of views because the buffer may move while growing.
+  struct Range {
+    Range() : offset(0), length(0) {}
+    size_t offset;
+    size_t length;
+  };
+
+  Status Parse();
+  void ResetRequest();
+  bool ParseRequestLine(absl::string_view line, size_t offset);
+  bool ParseHeaderLine(absl::string_view line, size_t offset);
+  bool OnHeadersComplete();
+  Status Fail();
+
+  // Makes sure that at least `size` bytes can be appended to the buffer.
+  void Reserve(size_t size);
+
+  absl::string_view View(const Range& range) const;
+  Range RangeOf(absl::string_view part, absl::string_view line,
+                size_t offset) const;
+
+  std::unique_ptr<char[]> buffer_;
+  size_t capacity_;
+  // Number of bytes received into `buffer_`.
+  size_t size_;
+  // Number of bytes that have been examined.
+  size_t scanned_;
+  // Start of the line that is currently being received.
+  size_t line_start_;
+  State state_;
+  Method method_;
+  Range target_;
+  Range version_;
+  Range content_type_;
+  size_t content_length_;
+  bool has_content_length_;
+  size_t body_offset_;
+  std::vector<std::pair<Range, Range>> headers_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_SERVER_HTTP_REQUEST_PARSER_H_
@@ -0,0 +1,115 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+// Parses the requests that the server is sent most, as they arrive from the
+// network, and reports how many of each the parser gets through a second.
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/strings/str_cat.h"
+#include "examples/peerconnection/server/http_request_parser.h"
+#include "rtc_base/checks.h"
+
+ABSL_FLAG(int, iterations, 200000, "Times to parse each kind of request.");
+ABSL_FLAG(int, description_bytes, 4000, "Size of a description message.");
+
+namespace {
+
+// The payload of a TCP segment on Ethernet.
+constexpr size_t kSegmentSize = 1460;
+
+// Parses `requests` in reads of at most `read_size` and returns how many were
+// parsed.
+int Parse(HttpRequestParser* parser,
+          const std::string& requests,
+          size_t read_size) {
+  int parsed = 0;
+  size_t offset = 0;
+  while (offset < requests.size()) {
+    size_t available = 0;
+    char* buffer = parser->PrepareRead(&available);
+    size_t bytes = std::min({available, read_size, requests.size() - offset});
+    memcpy(buffer, requests.data() + offset, bytes);
+    offset += bytes;
+    HttpRequestParser::Status status = parser->OnRead(bytes);
+    while (status == HttpRequestParser::COMPLETE) {
+      ++parsed;
+      status = parser->NextRequest();
+    }
+    RTC_CHECK(status != HttpRequestParser::PARSE_ERROR);
+  }
+  return parsed;
+}
+
+void Run(const char* name,
+         const std::string& requests,
+         int count,
+         size_t read_size,
+         int iterations) {
+  HttpRequestParser parser;
+  int parsed = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    parsed += Parse(&parser, requests, read_size);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  RTC_CHECK_EQ(parsed, count * iterations);
+  printf("%-24s %10.0f requests/s, %7.1f MB/s\n", name,
+         parsed / elapsed.count(),
+         requests.size() * iterations / elapsed.count() / 1e6);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(
+      "Example usage: ./http_request_parser_benchmark --iterations=100000\n");
+  absl::ParseCommandLine(argc, argv);
+
+  const int iterations = std::max(absl::GetFlag(FLAGS_iterations), 1);
+  const int description_bytes =
+      std::max(absl::GetFlag(FLAGS_description_bytes), 0);
+
+  const std::string sign_in =
+      "GET /sign_in?alice HTTP/1.1\r\n"
+      "Host: localhost:8888\r\n"
+      "Connection: keep-alive\r\n"
+      "\r\n";
+  const std::string wait =
+      "GET /wait?peer_id=17 HTTP/1.1\r\n"
+      "Host: localhost:8888\r\n"
+      "Connection: keep-alive\r\n"
+      "\r\n";
+  const std::string message = absl::StrCat(
+      "POST /message?peer_id=17&to=42 HTTP/1.1\r\n"
+      "Host: localhost:8888\r\n"
+      "Content-Type: text/plain\r\n"
+      "Content-Length: ",
+      description_bytes, "\r\n\r\n", std::string(description_bytes, 'x'));
+  std::string pipelined;
+  for (int i = 0; i < 8; ++i)
+    pipelined += wait;
+
+  Run("sign_in", sign_in, 1, sign_in.size(), iterations);
+  Run("wait", wait, 1, wait.size(), iterations);
+  Run("message, one read", message, 1, message.size(), iterations);
+  Run("message, in segments", message, 1, kSegmentSize, iterations);
+  Run("8 pipelined waits", pipelined, 8, pipelined.size(), iterations);
+  Run("wait, a byte at a time", wait, 1, 1, std::max(iterations / 10, 1));
+  return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+// Feeds arbitrary data to HttpRequestParser as a client could send it, in
+// reads of every size, and checks what the parser makes of it.  Built for
+// libFuzzer when the compiler has it, and otherwise with
+// standalone_fuzzer_main.cc.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "absl/strings/string_view.h"
+#include "examples/peerconnection/server/http_request_parser.h"
+#include "rtc_base/checks.h"
+
+namespace {
+
+// Reads are at most this large, so that inputs of a few kilobytes still
+// split requests at many points.
+constexpr size_t kMaxReadSize = 256;
+
+bool Contains(absl::string_view outer, absl::string_view inner) {
+  return inner.empty() || (inner.data() >= outer.data() &&
+                           inner.data() + inner.size() <=
+                               outer.data() + outer.size());
+}
+
+void CheckRequest(const HttpRequestParser& parser) {
+  RTC_CHECK(parser.headers_received());
+  RTC_CHECK(parser.method() != HttpRequestParser::INVALID);
+  absl::string_view target = parser.target();
+  RTC_CHECK(Contains(target, parser.path()));
+  RTC_CHECK(Contains(target, parser.query()));
+  RTC_CHECK(Contains(target, parser.GetQueryParameter("peer_id")));
+  RTC_CHECK(parser.content_length() <= HttpRequestParser::kMaxContentLength);
+  if (parser.method() == HttpRequestParser::POST) {
+    RTC_CHECK_EQ(parser.body().size(), parser.content_length());
+    RTC_CHECK(!parser.content_type().empty());
+  } else {
+    RTC_CHECK(parser.body().empty());
+  }
+  parser.http_version();
+  parser.keep_alive();
+  parser.GetHeader("Content-Type");
+  parser.HeaderHasToken("Connection", "upgrade");
+  parser.unparsed_data();
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  HttpRequestParser parser;
+  // The buffer a failed parser handed out, which it must keep reusing.
+  char* failed_buffer = nullptr;
+  size_t failed_available = 0;
+  size_t offset = 0;
+  while (offset < size) {
+    // Each read is preceded by a byte that sets its size.
+    size_t read_size = 1 + data[offset++] % kMaxReadSize;
+    size_t available = 0;
+    char* buffer = parser.PrepareRead(&available);
+    RTC_CHECK_GT(available, 0);
+    if (failed_buffer) {
+      RTC_CHECK(buffer == failed_buffer);
+      RTC_CHECK_EQ(available, failed_available);
+    }
+    size_t bytes = std::min({read_size, available, size - offset});
+    if (!bytes)
+      break;
+    memcpy(buffer, data + offset, bytes);
+    offset += bytes;
+
+    HttpRequestParser::Status status = parser.OnRead(bytes);
+    while (status == HttpRequestParser::COMPLETE) {
+      CheckRequest(parser);
+      status = parser.NextRequest();
+    }
+    if (status == HttpRequestParser::PARSE_ERROR && !failed_buffer)
+      failed_buffer = parser.PrepareRead(&failed_available);
+  }
+  return 0;
+}
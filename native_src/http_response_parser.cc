@@ -0,0 +1,365 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/client/http_response_parser.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "absl/strings/match.h"
+#include "absl/strings/string_view.h"
+#include "rtc_base/checks.h"
+
+namespace {
+
+// Size of the first allocation, and the least amount of free space offered
+// to PrepareRead() callers.
+const size_t kMinReadSize = 4096;
+
+// Buffers that grew beyond this size to hold a large response are released
+// once they are no longer needed, instead of being kept for the next one.
+const size_t kMaxRetainedCapacity = 64 * 1024;
+
+absl::string_view TrimWhitespace(absl::string_view value) {
+  while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+    value.remove_prefix(1);
+  while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+    value.remove_suffix(1);
+  return value;
+}
+
+// True if the comma separated list in `value` contains `token`.
+bool HasToken(absl::string_view value, absl::string_view token) {
+  while (!value.empty()) {
+    size_t comma = value.find(',');
+    if (absl::EqualsIgnoreCase(TrimWhitespace(value.substr(0, comma)), token))
+      return true;
+    if (comma == absl::string_view::npos)
+      break;
+    value.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+// Parses a non-negative decimal number that consists of digits only.
+bool ParseNumber(absl::string_view value, size_t max, size_t* number) {
+  if (value.empty())
+    return false;
+  size_t result = 0;
+  for (char c : value) {
+    if (c < '0' || c > '9')
+      return false;
+    result = result * 10 + (c - '0');
+    if (result > max)
+      return false;
+  }
+  *number = result;
+  return true;
+}
+
+}  // namespace
+
+HttpResponseParser::HttpResponseParser()
+    : capacity_(0),
+      size_(0),
+      scanned_(0),
+      line_start_(0),
+      state_(STATUS_LINE),
+      status_code_(0),
+      content_length_(0),
+      has_content_length_(false),
+      body_offset_(0) {}
+
+HttpResponseParser::~HttpResponseParser() {}
+
+char* HttpResponseParser::PrepareRead(size_t* available) {
+  RTC_DCHECK(available);
+  size_t wanted = kMinReadSize;
+  if (state_ == BODY) {
+    // Make room for the whole body at once instead of growing repeatedly.
+    size_t body_end = body_offset_ + content_length_;
+    if (body_end > size_)
+      wanted = std::max(wanted, body_end - size_);
+  }
+  Reserve(wanted);
+  *available = capacity_ - size_;
+  return buffer_.get() + size_;
+}
+
+HttpResponseParser::Status HttpResponseParser::OnRead(size_t bytes) {
+  RTC_DCHECK_LE(bytes, capacity_ - size_);
+  size_ += bytes;
+  return Parse();
+}
+
+HttpResponseParser::Status HttpResponseParser::NextResponse() {
+  RTC_DCHECK_NE(state_, RAW);
+  Discard(state_ == DONE ? scanned_ : size_);
+  ResetResponse();
+  return Parse();
+}
+
+void HttpResponseParser::SwitchProtocols() {
+  RTC_DCHECK_EQ(state_, DONE);
+  Discard(scanned_);
+  ResetResponse();
+  state_ = RAW;
+}
+
+void HttpResponseParser::Reset() {
+  if (capacity_ > kMaxRetainedCapacity) {
+    buffer_.reset();
+    capacity_ = 0;
+  }
+  size_ = 0;
+  ResetResponse();
+}
+
+void HttpResponseParser::ResetResponse() {
+  scanned_ = 0;
+  line_start_ = 0;
+  state_ = STATUS_LINE;
+  status_code_ = 0;
+  version_ = Range();
+  content_type_ = Range();
+  content_length_ = 0;
+  has_content_length_ = false;
+  body_offset_ = 0;
+  headers_.clear();
+}
+
+void HttpResponseParser::Discard(size_t consumed) {
+  RTC_DCHECK_LE(consumed, size_);
+  size_t remaining = size_ - consumed;
+  if (capacity_ > kMaxRetainedCapacity && remaining <= kMinReadSize) {
+    // Give the memory of a large response back.
+    std::unique_ptr<char[]> buffer;
+    if (remaining) {
+      buffer.reset(new char[kMinReadSize]);
+      memcpy(buffer.get(), buffer_.get() + consumed, remaining);
+    }
+    buffer_ = std::move(buffer);
+    capacity_ = remaining ? kMinReadSize : 0;
+  } else if (remaining && consumed) {
+    memmove(buffer_.get(), buffer_.get() + consumed, remaining);
+  }
+  size_ = remaining;
+}
+
+HttpResponseParser::Status HttpResponseParser::status() const {
+  switch (state_) {
+    case DONE:
+      return COMPLETE;
+    case FAILED:
+      return PARSE_ERROR;
+    default:
+      return INCOMPLETE;
+  }
+}
+
+bool HttpResponseParser::keep_alive() const {
+  if (http_version() == "HTTP/1.1")
+    return !HeaderHasToken("Connection", "close");
+  return HeaderHasToken("Connection", "keep-alive");
+}
+
+absl::string_view HttpResponseParser::body() const {
+  if (state_ != DONE || !content_length_)
+    return absl::string_view();
+  return absl::string_view(buffer_.get() + body_offset_, content_length_);
+}
+
+absl::string_view HttpResponseParser::GetHeader(absl::string_view name) const {
+  for (const std::pair<Range, Range>& header : headers_) {
+    if (absl::EqualsIgnoreCase(View(header.first), name))
+      return View(header.second);
+  }
+  return absl::string_view();
+}
+
+bool HttpResponseParser::HeaderHasToken(absl::string_view name,
+                                        absl::string_view token) const {
+  for (const std::pair<Range, Range>& header : headers_) {
+    if (absl::EqualsIgnoreCase(View(header.first), name) &&
+        HasToken(View(header.second), token)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+absl::string_view HttpResponseParser::raw_data() const {
+  if (state_ != RAW || !size_)
+    return absl::string_view();
+  return absl::string_view(buffer_.get(), size_);
+}
+
+void HttpResponseParser::ConsumeRawData(size_t bytes) {
+  RTC_DCHECK_EQ(state_, RAW);
+  if (bytes)
+    Discard(bytes);
+}
+
+HttpResponseParser::Status HttpResponseParser::Parse() {
+  while (state_ == STATUS_LINE || state_ == HEADERS) {
+    const char* data = buffer_.get();
+    const char* newline = static_cast<const char*>(
+        memchr(data + scanned_, '\n', size_ - scanned_));
+    if (!newline) {
+      scanned_ = size_;
+      return size_ > kMaxHeaderSize ? Fail() : INCOMPLETE;
+    }
+
+    scanned_ = newline - data + 1;
+    if (scanned_ > kMaxHeaderSize)
+      return Fail();
+
+    size_t line_end = newline - data;
+    if (line_end > line_start_ && data[line_end - 1] == '\r')
+      --line_end;
+    size_t offset = line_start_;
+    absl::string_view line(data + offset, line_end - offset);
+    line_start_ = scanned_;
+
+    bool ok = state_ == STATUS_LINE ? ParseStatusLine(line, offset)
+                                    : ParseHeaderLine(line, offset);
+    if (!ok)
+      return Fail();
+  }
+
+  if (state_ == BODY) {
+    if (size_ - body_offset_ < content_length_) {
+      scanned_ = size_;
+      return INCOMPLETE;
+    }
+    scanned_ = body_offset_ + content_length_;
+    state_ = DONE;
+  }
+
+  return status();
+}
+
+bool HttpResponseParser::ParseStatusLine(absl::string_view line,
+                                         size_t offset) {
+  // Be lenient and skip empty lines in front of the response.
+  if (line.empty())
+    return true;
+
+  // E.g. "HTTP/1.1 200 OK"; the reason phrase is of no interest.
+  size_t version_end = line.find(' ');
+  if (version_end == absl::string_view::npos ||
+      !absl::StartsWith(line, "HTTP/")) {
+    return false;
+  }
+  version_ = RangeOf(line.substr(0, version_end), line, offset);
+
+  absl::string_view rest = TrimWhitespace(line.substr(version_end + 1));
+  size_t code = 0;
+  if (rest.size() < 3 || !ParseNumber(rest.substr(0, 3), 999, &code) ||
+      (rest.size() > 3 && rest[3] != ' ')) {
+    return false;
+  }
+  status_code_ = static_cast<int>(code);
+
+  state_ = HEADERS;
+  return true;
+}
+
+bool HttpResponseParser::ParseHeaderLine(absl::string_view line,
+                                         size_t offset) {
+  if (line.empty())
+    return OnHeadersComplete();
+
+  // Ignore continuation lines and lines that aren't headers.
+  size_t colon = line.find(':');
+  if (line.front() == ' ' || line.front() == '\t' ||
+      colon == absl::string_view::npos) {
+    return true;
+  }
+
+  if (headers_.size() >= kMaxHeaders)
+    return false;
+
+  absl::string_view name = TrimWhitespace(line.substr(0, colon));
+  absl::string_view value = TrimWhitespace(line.substr(colon + 1));
+
+  if (absl::EqualsIgnoreCase(name, "Content-Length")) {
+    size_t length = 0;
+    if (!ParseNumber(value, kMaxContentLength, &length))
+      return false;
+    // Conflicting lengths would make the end of the response ambiguous.
+    if (has_content_length_ && length != content_length_)
+      return false;
+    content_length_ = length;
+    has_content_length_ = true;
+  } else if (absl::EqualsIgnoreCase(name, "Content-Type")) {
+    content_type_ = RangeOf(value, line, offset);
+  }
+
+  headers_.push_back(std::make_pair(RangeOf(name, line, offset),
+                                    RangeOf(value, line, offset)));
+  return true;
+}
+
+bool HttpResponseParser::OnHeadersComplete() {
+  body_offset_ = scanned_;
+  if ((status_code_ >= 100 && status_code_ < 200) || status_code_ == 204 ||
+      status_code_ == 304) {
+    // These never carry a body.
+    content_length_ = 0;
+    state_ = DONE;
+    return true;
+  }
+
+  // The server sizes every other response, so that the connection can be
+  // kept open after it.
+  if (!has_content_length_)
+    return false;
+
+  state_ = BODY;
+  return true;
+}
+
+HttpResponseParser::Status HttpResponseParser::Fail() {
+  state_ = FAILED;
+  return PARSE_ERROR;
+}
+
+void HttpResponseParser::Reserve(size_t size) {
+  if (capacity_ - size_ >= size)
+    return;
+  size_t capacity =
+      std::max(std::max(capacity_ * 2, kMinReadSize), size_ + size);
+  std::unique_ptr<char[]> buffer(new char[capacity]);
+  if (size_)
+    memcpy(buffer.get(), buffer_.get(), size_);
+  buffer_ = std::move(buffer);
+  capacity_ = capacity;
+}
+
+absl::string_view HttpResponseParser::View(const Range& range) const {
+  if (!range.length)
+    return absl::string_view();
+  return absl::string_view(buffer_.get() + range.offset, range.length);
+}
+
+HttpResponseParser::Range HttpResponseParser::RangeOf(absl::string_view part,
+                                                      absl::string_view line,
+                                                      size_t offset) const {
+  RTC_DCHECK(part.empty() || (part.data() >= line.data() &&
+                              part.data() + part.size() <=
+                                  line.data() + line.size()));
+  Range range;
+  if (!part.empty()) {
+    range.offset = offset + (part.data() - line.data());
+    range.length = part.size();
+  }
+  return range;
+}
@@ -0,0 +1,153 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_CLIENT_HTTP_RESPONSE_PARSER_H_
+#define EXAMPLES_PEERCONNECTION_CLIENT_HTTP_RESPONSE_PARSER_H_
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+// Incremental parser for the HTTP/1.x responses of the signaling server, the
+// counterpart of the server's HttpRequestParser.  Data is received straight
+// into the parser's buffer (see PrepareRead()), which is reused from one
+// response to the next, and every byte is examined only once.  The status
+// line, headers and body are exposed as views into the buffer that stay
+// valid until the next call to NextResponse(), SwitchProtocols() or Reset().
+class HttpResponseParser {
+ public:
+  enum Status {
+    INCOMPLETE,
+    COMPLETE,
+    PARSE_ERROR,
+  };
+
+  // Responses with larger headers or bodies are rejected.
+  static const size_t kMaxHeaderSize = 16 * 1024;
+  static const size_t kMaxContentLength = 16 * 1024 * 1024;
+  static const size_t kMaxHeaders = 64;
+
+  HttpResponseParser();
+  HttpResponseParser(const HttpResponseParser&) = delete;
+  HttpResponseParser& operator=(const HttpResponseParser&) = delete;
+  ~HttpResponseParser();
+
+  // Returns a buffer to receive data into and sets `available` to its size,
+  // which is never zero.  Call OnRead() with the number of bytes written.
+  char* PrepareRead(size_t* available);
+
+  // Parses `bytes` newly received bytes.  Data that arrives after a complete
+  // response is kept, but not parsed, until NextResponse() is called.
+  Status OnRead(size_t bytes);
+
+  // Discards the current response and starts parsing the data received
+  // after it, which may already hold one or more pipelined responses.
+  Status NextResponse();
+
+  // Discards the current, complete response and stops parsing HTTP, as for
+  // a connection that was upgraded to another protocol.  The data received
+  // after the response, and all data received later, is then available from
+  // raw_data() until it is consumed.
+  void SwitchProtocols();
+
+  // Discards all data and prepares for a new response on a new connection.
+  void Reset();
+
+  // Stays INCOMPLETE after SwitchProtocols().
+  Status status() const;
+
+  // The status code of the response, e.g. 200, once the status line has
+  // been received.
+  int status_code() const { return status_code_; }
+
+  absl::string_view http_version() const { return View(version_); }
+
+  // True if the server keeps the connection open after the response: the
+  // default for HTTP/1.1, and opt-in with "Connection: keep-alive" for older
+  // versions.
+  bool keep_alive() const;
+
+  absl::string_view content_type() const { return View(content_type_); }
+
+  size_t content_length() const { return content_length_; }
+
+  // The body of a complete response.
+  absl::string_view body() const;
+
+  // Returns the value of the first header named `name` (compared case
+  // insensitively), or an empty view if there is none.
+  absl::string_view GetHeader(absl::string_view name) const;
+
+  // True if a header named `name` holds a comma separated list that contains
+  // `token`, both compared case insensitively.
+  bool HeaderHasToken(absl::string_view name, absl::string_view token) const;
+
+  // The data received after SwitchProtocols() that has not been consumed.
+  absl::string_view raw_data() const;
+
+  // Drops the first `bytes` of raw_data().
+  void ConsumeRawData(size_t bytes);
+
+ private:
+  enum State {
+    STATUS_LINE,
+    HEADERS,
+    BODY,
+    DONE,
+    FAILED,
+    RAW,
+  };
+
+  // A range of the current response, relative to its first byte.  Offsets
+  // are used instead of views because the buffer may move while growing.
+  struct Range {
+    Range() : offset(0), length(0) {}
+    size_t offset;
+    size_t length;
+  };
+
+  Status Parse();
+  void ResetResponse();
+  // Moves the data from `consumed` on to the front of the buffer.
+  void Discard(size_t consumed);
+  bool ParseStatusLine(absl::string_view line, size_t offset);
+  bool ParseHeaderLine(absl::string_view line, size_t offset);
+  bool OnHeadersComplete();
+  Status Fail();
+
+  // Makes sure that at least `size` bytes can be appended to the buffer.
+  void Reserve(size_t size);
+
+  absl::string_view View(const Range& range) const;
+  Range RangeOf(absl::string_view part, absl::string_view line,
+                size_t offset) const;
+
+  std::unique_ptr<char[]> buffer_;
+  size_t capacity_;
+  // Number of bytes received into `buffer_`.
+  size_t size_;
+  // Number of bytes that have been examined.
+  size_t scanned_;
+  // Start of the line that is currently being received.
+  size_t line_start_;
+  State state_;
+  int status_code_;
+  Range version_;
+  Range content_type_;
+  size_t content_length_;
+  bool has_content_length_;
+  size_t body_offset_;
+  std::vector<std::pair<Range, Range>> headers_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_CLIENT_HTTP_RESPONSE_PARSER_H_
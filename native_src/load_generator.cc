@@ -0,0 +1,681 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/server/load_generator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "examples/peerconnection/client/http_response_parser.h"
+#include "examples/peerconnection/server/data_socket.h"
+#include "examples/peerconnection/server/event_loop.h"
+#include "rtc_base/checks.h"
+
+#if defined(WEBRTC_POSIX)
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>  // IWYU pragma: keep
+#else
+#include <ws2tcpip.h>
+#endif
+
+#if defined(MSG_NOSIGNAL)
+static const int kSendFlags = MSG_NOSIGNAL;
+#else
+static const int kSendFlags = 0;
+#endif
+
+// Content type of /wait responses that carry several messages at once, see
+// peer_channel.cc.
+static const char kBatchContentType[] = "application/x-peerconnection-batch";
+
+namespace {
+
+// How long a member whose sign in was refused waits before trying again,
+// and how long one that lost its hanging GET waits before the next.
+constexpr std::chrono::seconds kSignInRetryDelay(1);
+constexpr std::chrono::milliseconds kWaitRetryDelay(100);
+
+bool IsBlockingError() {
+#if defined(WIN32)
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+bool IsConnectPending() {
+#if defined(WIN32)
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  return errno == EINPROGRESS;
+#endif
+}
+
+// Calls `on_record` with the sender and data of each message of a /wait
+// response, which carries one message, or several in the batch format.
+template <typename OnRecord>
+bool ForEachMessage(const HttpResponseParser& response, OnRecord on_record) {
+  absl::string_view body = response.body();
+  if (response.content_type() != kBatchContentType) {
+    int peer_id = 0;
+    if (!absl::SimpleAtoi(response.GetHeader("Pragma"), &peer_id))
+      return false;
+    on_record(peer_id, body);
+    return true;
+  }
+  while (!body.empty()) {
+    size_t comma = body.find(',');
+    size_t eol = body.find('\n');
+    int peer_id = 0;
+    size_t size = 0;
+    if (comma == absl::string_view::npos || eol == absl::string_view::npos ||
+        comma > eol || !absl::SimpleAtoi(body.substr(0, comma), &peer_id) ||
+        !absl::SimpleAtoi(body.substr(comma + 1, eol - comma - 1), &size) ||
+        size > body.size() - eol - 1) {
+      return false;
+    }
+    on_record(peer_id, body.substr(eol + 1, size));
+    body.remove_prefix(eol + 1 + size);
+  }
+  return true;
+}
+
+}  // namespace
+
+//
+// LoadGenerator::Options
+//
+
+LoadGenerator::Options::Options()
+    : server("localhost"),
+      port(8888),
+      members(1000),
+      rooms(0),
+      sign_ins_per_second(500),
+      message_interval(std::chrono::milliseconds(100)),
+      description_size(4000),
+      candidate_size(250),
+      candidates_per_call(10),
+      churn_per_second(0) {}
+
+//
+// LoadGenerator::Report
+//
+
+LoadGenerator::Report::Report()
+    : seconds(0),
+      relays(0),
+      messages_sent(0),
+      send_errors(0),
+      notifications(0),
+      sign_ins(0),
+      sign_in_failures(0),
+      sign_outs(0),
+      peak_connections(0) {}
+
+//
+// LoadGenerator::Connection
+//
+
+LoadGenerator::Connection::Connection(Member* member, bool hanging)
+    : member(member),
+      hanging(hanging),
+      state(CLOSED),
+      written(0),
+      write_interest(false),
+      pending(0) {}
+
+bool LoadGenerator::Connection::Connect(const sockaddr_in& address) {
+  RTC_DCHECK_EQ(state, CLOSED);
+  if (!Create() || !SetNonBlocking()) {
+    Close();
+    return false;
+  }
+  if (connect(socket_, reinterpret_cast<const sockaddr*>(&address),
+              sizeof(address)) == SOCKET_ERROR &&
+      !IsConnectPending()) {
+    Close();
+    return false;
+  }
+  state = CONNECTING;
+  return true;
+}
+
+bool LoadGenerator::Connection::FinishConnect() {
+  int error = 0;
+  socklen_t size = sizeof(error);
+  if (getsockopt(socket_, SOL_SOCKET, SO_ERROR,
+                 reinterpret_cast<char*>(&error), &size) == SOCKET_ERROR ||
+      error != 0) {
+    return false;
+  }
+  state = OPEN;
+  return true;
+}
+
+//
+// LoadGenerator::Member
+//
+
+LoadGenerator::Member::Member(int index)
+    : index(index),
+      id(-1),
+      partner(index ^ 1),
+      state(SIGNED_OUT),
+      generation(0),
+      step(0),
+      control(this, false),
+      wait(this, true) {}
+
+//
+// LoadGenerator
+//
+
+LoadGenerator::LoadGenerator(const Options& options)
+    : options_(options),
+      epoch_(Clock::now()),
+      host_header_(absl::StrCat("Host: ", options.server, ":", options.port,
+                                "\r\n")),
+      address_(),
+      random_(1),
+      signed_in_(0),
+      open_connections_(0),
+      peak_connections_(0),
+      connection_limit_(0),
+      measuring_(false),
+      measure_start_us_(0) {
+  RTC_DCHECK_GT(options_.members, 0);
+  for (int i = 0; i < options_.members; ++i)
+    members_.push_back(std::make_unique<Member>(i));
+  // The last member of an odd number has no partner but itself.
+  if (options_.members % 2)
+    members_.back()->partner = options_.members - 1;
+  padding_.assign(std::max(options_.description_size, options_.candidate_size),
+                  'a');
+}
+
+LoadGenerator::~LoadGenerator() {
+  for (const auto& member : members_) {
+    CloseConnection(&member->control);
+    CloseConnection(&member->wait);
+  }
+}
+
+bool LoadGenerator::Init() {
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* result = nullptr;
+  if (getaddrinfo(options_.server.c_str(), nullptr, &hints, &result) != 0 ||
+      !result) {
+    printf("Failed to resolve %s\n", options_.server.c_str());
+    return false;
+  }
+  memcpy(&address_, result->ai_addr, sizeof(address_));
+  freeaddrinfo(result);
+  address_.sin_port = htons(static_cast<uint16_t>(options_.port));
+
+  loop_ = EventLoop::Create();
+  if (!loop_) {
+    printf("Failed to create the event loop\n");
+    return false;
+  }
+  return true;
+}
+
+bool LoadGenerator::SignInAll(Clock::duration timeout) {
+  Clock::time_point now = Clock::now();
+  int rate = std::max(options_.sign_ins_per_second, 1);
+  for (int i = 0; i < options_.members; ++i) {
+    Schedule(now + std::chrono::microseconds(int64_t{i} * 1000000 / rate),
+             Timer::SIGN_IN, members_[i].get());
+  }
+  Run(now + timeout, [this] { return signed_in_ == options_.members; });
+  return signed_in_ == options_.members;
+}
+
+LoadGenerator::Report LoadGenerator::Measure(Clock::duration duration) {
+  report_ = Report();
+  measuring_ = true;
+  measure_start_us_ = SinceEpochUs();
+  Clock::time_point start = Clock::now();
+  if (options_.churn_per_second > 0)
+    Schedule(start, Timer::CHURN, nullptr);
+  Run(start + duration, [] { return false; });
+  measuring_ = false;
+  report_.peak_connections = peak_connections_;
+  report_.seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  std::sort(report_.latencies_us.begin(), report_.latencies_us.end());
+  return report_;
+}
+
+template <typename Done>
+void LoadGenerator::Run(Clock::time_point deadline, Done done) {
+  std::vector<EventLoop::Event> ready;
+  while (!done()) {
+    Clock::time_point now = Clock::now();
+    if (now >= deadline)
+      break;
+    Clock::time_point wake = deadline;
+    if (!timers_.empty())
+      wake = std::min(wake, timers_.begin()->first);
+    int timeout_ms = static_cast<int>(
+        std::chrono::ceil<std::chrono::milliseconds>(wake - now).count());
+    ready.clear();
+    if (!loop_->Wait(std::max(timeout_ms, 0), &ready)) {
+      printf("Waiting for the connections failed\n");
+      return;
+    }
+    for (const EventLoop::Event& event : ready) {
+      OnEvent(static_cast<Connection*>(event.socket), event.readable,
+              event.writable);
+    }
+    RunTimers(Clock::now());
+  }
+}
+
+void LoadGenerator::RunTimers(Clock::time_point now) {
+  while (!timers_.empty() && timers_.begin()->first <= now) {
+    Timer timer = timers_.begin()->second;
+    timers_.erase(timers_.begin());
+    if (timer.kind == Timer::CHURN) {
+      Churn();
+      Schedule(now + std::chrono::duration_cast<Clock::duration>(
+                         std::chrono::duration<double>(
+                             1 / options_.churn_per_second)),
+               Timer::CHURN, nullptr);
+      continue;
+    }
+    Member* member = members_[timer.member].get();
+    if (timer.generation != member->generation)
+      continue;  // Signed out since.
+    switch (timer.kind) {
+      case Timer::SIGN_IN:
+        SignIn(member);
+        break;
+      case Timer::SEND:
+        SendMessage(member);
+        break;
+      case Timer::WAIT:
+        Wait(member);
+        break;
+      case Timer::CHURN:
+        break;
+    }
+  }
+}
+
+void LoadGenerator::Schedule(Clock::time_point when,
+                             Timer::Kind kind,
+                             Member* member) {
+  Timer timer;
+  timer.kind = kind;
+  timer.member = member ? member->index : -1;
+  timer.generation = member ? member->generation : 0;
+  timers_.emplace(when, timer);
+}
+
+void LoadGenerator::SignIn(Member* member) {
+  if (member->state != Member::SIGNED_OUT)
+    return;
+  member->state = Member::SIGNING_IN;
+  member->step = 0;
+  std::string request = absl::StrCat("GET /sign_in?load_", member->index);
+  if (options_.rooms > 0)
+    absl::StrAppend(&request, "&room=r", member->index / 2 % options_.rooms);
+  absl::StrAppend(&request, " HTTP/1.1\r\n", host_header_, "\r\n");
+  if (!Request(&member->control, request)) {
+    report_.sign_in_failures++;
+    member->state = Member::SIGNED_OUT;
+    Schedule(Clock::now() + kSignInRetryDelay, Timer::SIGN_IN, member);
+  }
+}
+
+void LoadGenerator::SignOut(Member* member) {
+  RTC_DCHECK_EQ(member->state, Member::SIGNED_IN);
+  CloseConnection(&member->wait);
+  member->state = Member::SIGNING_OUT;
+  member->generation++;
+  signed_in_--;
+  if (!Request(&member->control,
+               absl::StrCat("GET /sign_out?peer_id=", member->id,
+                            " HTTP/1.1\r\n", host_header_, "\r\n"))) {
+    CloseConnection(&member->control);
+    member->state = Member::SIGNED_OUT;
+    Schedule(Clock::now(), Timer::SIGN_IN, member);
+  }
+}
+
+void LoadGenerator::SendMessage(Member* member) {
+  RTC_DCHECK_EQ(member->state, Member::SIGNED_IN);
+  Member* partner = members_[member->partner].get();
+  if (partner->state != Member::SIGNED_IN) {
+    Schedule(Clock::now() + options_.message_interval, Timer::SEND, member);
+    return;
+  }
+
+  // The description of a call, then its candidates.
+  size_t size = member->step == 0 ? options_.description_size
+                                  : options_.candidate_size;
+  member->step = (member->step + 1) % (options_.candidates_per_call + 1);
+  std::string body = absl::StrCat(SinceEpochUs(), " ");
+  if (body.size() < size)
+    body.append(padding_, 0, size - body.size());
+
+  std::string request = absl::StrCat(
+      "POST /message?peer_id=", member->id, "&to=", partner->id,
+      " HTTP/1.1\r\n", host_header_, "Content-Length: ", body.size(),
+      "\r\nContent-Type: text/plain\r\n\r\n");
+  request += body;
+  if (!Request(&member->control, request)) {
+    report_.send_errors++;
+    Schedule(Clock::now() + options_.message_interval, Timer::SEND, member);
+  }
+}
+
+void LoadGenerator::Wait(Member* member) {
+  if (member->state != Member::SIGNED_IN)
+    return;
+  if (!Request(&member->wait,
+               absl::StrCat("GET /wait?peer_id=", member->id,
+                            "&batch=1 HTTP/1.1\r\n", host_header_, "\r\n"))) {
+    Schedule(Clock::now() + kWaitRetryDelay, Timer::WAIT, member);
+  }
+}
+
+void LoadGenerator::Churn() {
+  // A few tries find a signed in member unless nearly all are signed out.
+  std::uniform_int_distribution<int> pick(0, options_.members - 1);
+  for (int i = 0; i < 8; ++i) {
+    Member* member = members_[pick(random_)].get();
+    if (member->state == Member::SIGNED_IN) {
+      SignOut(member);
+      return;
+    }
+  }
+}
+
+bool LoadGenerator::Request(Connection* connection,
+                            const std::string& request) {
+  connection->output += request;
+  connection->pending++;
+  if (connection->state == Connection::CLOSED)
+    return Open(connection);
+  if (connection->state == Connection::OPEN && !Flush(connection)) {
+    CloseConnection(connection);
+    return false;
+  }
+  return true;
+}
+
+bool LoadGenerator::Open(Connection* connection) {
+  if (!connection->Connect(address_)) {
+    CloseConnection(connection);
+    return false;
+  }
+  if (!loop_->Add(connection)) {
+    connection->Close();
+    connection->state = Connection::CLOSED;
+    CloseConnection(connection);
+    return false;
+  }
+  open_connections_++;
+  peak_connections_ = std::max(peak_connections_, open_connections_);
+  // Writable once connected.
+  SetWriteInterest(connection, true);
+  return true;
+}
+
+void LoadGenerator::CloseConnection(Connection* connection) {
+  if (connection->state != Connection::CLOSED) {
+    loop_->Remove(connection);
+    connection->Close();
+    connection->state = Connection::CLOSED;
+    open_connections_--;
+  }
+  connection->output.clear();
+  connection->written = 0;
+  connection->write_interest = false;
+  connection->pending = 0;
+  connection->response.Reset();
+}
+
+bool LoadGenerator::Flush(Connection* connection) {
+  while (connection->written < connection->output.size()) {
+    int sent = send(connection->socket(),
+                    connection->output.data() + connection->written,
+                    static_cast<int>(connection->output.size() -
+                                     connection->written),
+                    kSendFlags);
+    if (sent == SOCKET_ERROR) {
+      if (!IsBlockingError())
+        return false;
+      SetWriteInterest(connection, true);
+      return true;
+    }
+    connection->written += sent;
+  }
+  connection->output.clear();
+  connection->written = 0;
+  SetWriteInterest(connection, false);
+  return true;
+}
+
+void LoadGenerator::SetWriteInterest(Connection* connection, bool enabled) {
+  if (connection->write_interest == enabled)
+    return;
+  connection->write_interest = enabled;
+  loop_->SetWriteInterest(connection, enabled);
+}
+
+void LoadGenerator::OnEvent(Connection* connection,
+                            bool readable,
+                            bool writable) {
+  if (connection->state == Connection::CLOSED)
+    return;  // Closed while handling an earlier event of this round.
+  if (writable) {
+    if (connection->state == Connection::CONNECTING &&
+        !connection->FinishConnect()) {
+      OnConnectionLost(connection);
+      return;
+    }
+    if (!Flush(connection)) {
+      OnConnectionLost(connection);
+      return;
+    }
+  }
+  if (readable && connection->state == Connection::OPEN)
+    OnReadable(connection);
+}
+
+void LoadGenerator::OnReadable(Connection* connection) {
+  size_t available = 0;
+  char* buffer = connection->response.PrepareRead(&available);
+  int bytes = recv(connection->socket(), buffer,
+                   static_cast<int>(std::min<size_t>(available, INT_MAX)), 0);
+  if (bytes == SOCKET_ERROR && IsBlockingError())
+    return;
+  if (bytes == SOCKET_ERROR || bytes == 0) {
+    OnConnectionLost(connection);
+    return;
+  }
+
+  HttpResponseParser::Status status = connection->response.OnRead(bytes);
+  while (status == HttpResponseParser::COMPLETE) {
+    bool keep_alive = connection->response.keep_alive();
+    connection->pending--;
+    OnResponse(connection);
+    if (connection->state == Connection::CLOSED)
+      return;
+    if (!keep_alive) {
+      // The requests queued behind the response go with the connection.
+      OnConnectionLost(connection);
+      return;
+    }
+    status = connection->response.NextResponse();
+  }
+  if (status == HttpResponseParser::PARSE_ERROR) {
+    printf("Malformed response from the server\n");
+    OnConnectionLost(connection);
+  }
+}
+
+void LoadGenerator::OnResponse(Connection* connection) {
+  Member* member = connection->member;
+  if (connection->hanging) {
+    OnWaitResponse(member, connection->response);
+  } else {
+    OnControlResponse(member, connection->response);
+  }
+}
+
+void LoadGenerator::OnControlResponse(Member* member,
+                                      const HttpResponseParser& response) {
+  bool ok = response.status_code() == 200;
+  switch (member->state) {
+    case Member::SIGNING_IN: {
+      int id = -1;
+      if (!ok || !absl::SimpleAtoi(response.GetHeader("Pragma"), &id)) {
+        report_.sign_in_failures++;
+        CloseConnection(&member->control);
+        member->state = Member::SIGNED_OUT;
+        Schedule(Clock::now() + kSignInRetryDelay, Timer::SIGN_IN, member);
+        return;
+      }
+      member->id = id;
+      member->state = Member::SIGNED_IN;
+      signed_in_++;
+      report_.sign_ins++;
+      Wait(member);
+      // Spread the first messages over the interval.
+      std::uniform_int_distribution<int64_t> offset(
+          0, options_.message_interval.count());
+      Schedule(Clock::now() + Clock::duration(offset(random_)), Timer::SEND,
+               member);
+      break;
+    }
+    case Member::SIGNED_IN:
+      if (ok) {
+        report_.messages_sent++;
+      } else {
+        report_.send_errors++;
+      }
+      Schedule(Clock::now() + options_.message_interval, Timer::SEND, member);
+      break;
+    case Member::SIGNING_OUT:
+      if (member->control.pending > 0) {
+        // A message sent before the sign out.
+        if (ok) {
+          report_.messages_sent++;
+        } else {
+          report_.send_errors++;
+        }
+        return;
+      }
+      report_.sign_outs++;
+      CloseConnection(&member->control);
+      member->state = Member::SIGNED_OUT;
+      Schedule(Clock::now(), Timer::SIGN_IN, member);
+      break;
+    case Member::SIGNED_OUT:
+      break;
+  }
+}
+
+void LoadGenerator::OnWaitResponse(Member* member,
+                                   const HttpResponseParser& response) {
+  if (member->state != Member::SIGNED_IN)
+    return;
+  if (response.status_code() == 200) {
+    int own_id = member->id;
+    bool parsed = ForEachMessage(
+        response, [this, own_id](int peer_id, absl::string_view data) {
+          if (peer_id == own_id) {
+            report_.notifications++;
+          } else {
+            OnDelivery(data);
+          }
+        });
+    if (!parsed)
+      printf("Malformed /wait response from the server\n");
+  }
+  Wait(member);
+}
+
+void LoadGenerator::OnDelivery(absl::string_view message) {
+  // Only messages sent during the measurement count, not the backlog of
+  // those sent before.
+  int64_t sent_us = 0;
+  if (!measuring_ ||
+      !absl::SimpleAtoi(message.substr(0, message.find(' ')), &sent_us) ||
+      sent_us < measure_start_us_) {
+    return;
+  }
+  report_.relays++;
+  report_.latencies_us.push_back(SinceEpochUs() - sent_us);
+}
+
+int64_t LoadGenerator::SinceEpochUs() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                               epoch_)
+      .count();
+}
+
+void LoadGenerator::OnConnectionLost(Connection* connection) {
+  Member* member = connection->member;
+  int pending = connection->pending;
+  // A connect that failed was refused rather than dropped.
+  bool established = connection->state == Connection::OPEN;
+  CloseConnection(connection);
+  if (connection->hanging) {
+    if (member->state == Member::SIGNED_IN)
+      Schedule(Clock::now() + kWaitRetryDelay, Timer::WAIT, member);
+    return;
+  }
+
+  switch (member->state) {
+    case Member::SIGNING_IN:
+      // The server drops connections beyond its limit without a word.
+      if (established && pending > 0 && !connection_limit_)
+        connection_limit_ = open_connections_;
+      report_.sign_in_failures++;
+      member->state = Member::SIGNED_OUT;
+      Schedule(Clock::now() + kSignInRetryDelay, Timer::SIGN_IN, member);
+      break;
+    case Member::SIGNED_IN:
+      // A message in flight was lost; an idle connection is reopened by the
+      // next one.
+      if (pending > 0) {
+        report_.send_errors += pending;
+        Schedule(Clock::now() + options_.message_interval, Timer::SEND,
+                 member);
+      }
+      break;
+    case Member::SIGNING_OUT:
+      member->state = Member::SIGNED_OUT;
+      Schedule(Clock::now(), Timer::SIGN_IN, member);
+      break;
+    case Member::SIGNED_OUT:
+      break;
+  }
+}
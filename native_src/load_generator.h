@@ -0,0 +1,219 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_SERVER_LOAD_GENERATOR_H_
+#define EXAMPLES_PEERCONNECTION_SERVER_LOAD_GENERATOR_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "examples/peerconnection/client/http_response_parser.h"
+#include "examples/peerconnection/server/data_socket.h"
+#include "examples/peerconnection/server/event_loop.h"
+
+#if defined(WEBRTC_POSIX)
+#include <netinet/in.h>
+#endif
+
+// Drives a signaling server with many simulated members that behave like
+// PeerConnectionClient: each signs in on a control connection, keeps a
+// hanging /wait?batch=1 open on a second one and sends its partner the
+// messages of a call, an offer or answer followed by its candidates, one
+// after the other.  Everything runs on the calling thread on one EventLoop.
+class LoadGenerator {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Options {
+    Options();
+
+    // Host name or IPv4 address, and port, of the server.
+    std::string server;
+    int port;
+    // Members are paired up; each sends to its partner only.
+    int members;
+    // Members are spread over this many rooms, partners sharing one.  0
+    // puts everyone in the default room, so that every sign in is reported
+    // to every member.
+    int rooms;
+    int sign_ins_per_second;
+    // Pause between a message being accepted and the next being sent.
+    Clock::duration message_interval;
+    // Sizes of the descriptions and candidates, and candidates per call.
+    size_t description_size;
+    size_t candidate_size;
+    int candidates_per_call;
+    // Members that sign out and right back in per second.
+    double churn_per_second;
+  };
+
+  struct Report {
+    Report();
+
+    double seconds;
+    // Messages sent and delivered to their recipient in the time measured.
+    uint64_t relays;
+    // Messages the server accepted, and those it refused or lost with the
+    // connection.
+    uint64_t messages_sent;
+    uint64_t send_errors;
+    uint64_t notifications;
+    uint64_t sign_ins;
+    uint64_t sign_in_failures;
+    uint64_t sign_outs;
+    // Microseconds from sending to delivery, sorted.
+    std::vector<int64_t> latencies_us;
+    // The most connections open at once since the start.
+    size_t peak_connections;
+  };
+
+  explicit LoadGenerator(const Options& options);
+  LoadGenerator(const LoadGenerator&) = delete;
+  LoadGenerator& operator=(const LoadGenerator&) = delete;
+  ~LoadGenerator();
+
+  // Resolves the server and sets up the event loop.
+  bool Init();
+
+  // Signs in every member at the configured rate.  Members start sending
+  // as soon as they and their partner are signed in.  Returns false if not
+  // all are signed in after `timeout`.
+  bool SignInAll(Clock::duration timeout);
+
+  // Keeps the traffic, and the churn, going for `duration` and returns
+  // what happened in that time.
+  Report Measure(Clock::duration duration);
+
+  int signed_in() const { return signed_in_; }
+
+  // The number of connections that were open when the server first closed
+  // a new one without answering, as it does once it has reached its
+  // connection limit, or 0 if that never happened.
+  size_t connection_limit() const { return connection_limit_; }
+
+ private:
+  struct Member;
+
+  class Connection : public SocketBase {
+   public:
+    enum State {
+      CLOSED,
+      CONNECTING,
+      OPEN,
+    };
+
+    Connection(Member* member, bool hanging);
+
+    bool Connect(const sockaddr_in& address);
+    // Completes a connect; false if it failed.
+    bool FinishConnect();
+
+    Member* const member;
+    // The /wait connection rather than the control one.
+    const bool hanging;
+    State state;
+    // Requests not yet written, and how much of them was.
+    std::string output;
+    size_t written;
+    bool write_interest;
+    // Requests sent and not yet answered.
+    int pending;
+    HttpResponseParser response;
+  };
+
+  struct Member {
+    enum State {
+      SIGNED_OUT,
+      SIGNING_IN,
+      SIGNED_IN,
+      SIGNING_OUT,
+    };
+
+    explicit Member(int index);
+
+    const int index;
+    int id;
+    int partner;
+    State state;
+    // Bumped on every sign out, which cancels the member's timers.
+    uint64_t generation;
+    // Position in the messages of a call.
+    int step;
+    Connection control;
+    Connection wait;
+  };
+
+  struct Timer {
+    enum Kind {
+      SIGN_IN,
+      SEND,
+      WAIT,
+      CHURN,
+    };
+
+    Kind kind;
+    int member;
+    uint64_t generation;
+  };
+
+  // Runs the event loop until `deadline` or until `done` returns true.
+  template <typename Done>
+  void Run(Clock::time_point deadline, Done done);
+  void RunTimers(Clock::time_point now);
+  void Schedule(Clock::time_point when, Timer::Kind kind, Member* member);
+
+  void SignIn(Member* member);
+  void SignOut(Member* member);
+  void SendMessage(Member* member);
+  void Wait(Member* member);
+  void Churn();
+
+  // Queues `request` on `connection`, connecting first if needed.
+  bool Request(Connection* connection, const std::string& request);
+  bool Open(Connection* connection);
+  void CloseConnection(Connection* connection);
+  bool Flush(Connection* connection);
+  void SetWriteInterest(Connection* connection, bool enabled);
+
+  void OnEvent(Connection* connection, bool readable, bool writable);
+  void OnReadable(Connection* connection);
+  void OnResponse(Connection* connection);
+  void OnControlResponse(Member* member, const HttpResponseParser& response);
+  void OnWaitResponse(Member* member, const HttpResponseParser& response);
+  void OnDelivery(absl::string_view message);
+  int64_t SinceEpochUs() const;
+  void OnConnectionLost(Connection* connection);
+
+  const Options options_;
+  const Clock::time_point epoch_;
+  const std::string host_header_;
+  sockaddr_in address_;
+  std::unique_ptr<EventLoop> loop_;
+  std::vector<std::unique_ptr<Member>> members_;
+  std::multimap<Clock::time_point, Timer> timers_;
+  std::mt19937 random_;
+  std::string padding_;
+  int signed_in_;
+  size_t open_connections_;
+  size_t peak_connections_;
+  size_t connection_limit_;
+  bool measuring_;
+  int64_t measure_start_us_;
+  Report report_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_SERVER_LOAD_GENERATOR_H_
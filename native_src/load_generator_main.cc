@@ -0,0 +1,196 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "examples/peerconnection/server/load_generator.h"
+
+#if defined(WEBRTC_POSIX)
+#include <sys/resource.h>
+#endif
+
+ABSL_FLAG(std::string, server, "localhost", "The server to load.");
+ABSL_FLAG(int, port, 8888, "The port on which the server is listening.");
+ABSL_FLAG(int,
+          members,
+          1000,
+          "Number of members to sign in.  Each holds two connections.");
+ABSL_FLAG(int,
+          rooms,
+          0,
+          "Number of rooms to spread the members over.  0 puts them all in "
+          "the default room.");
+ABSL_FLAG(int, sign_ins_per_second, 500, "Rate at which members sign in.");
+ABSL_FLAG(int,
+          message_interval_ms,
+          100,
+          "Milliseconds between the server accepting a member's message and "
+          "the member sending the next.");
+ABSL_FLAG(int, description_bytes, 4000, "Size of a description message.");
+ABSL_FLAG(int, candidate_bytes, 250, "Size of a candidate message.");
+ABSL_FLAG(int,
+          candidates_per_call,
+          10,
+          "Candidate messages sent after each description.");
+ABSL_FLAG(double,
+          churn_per_second,
+          0,
+          "Members per second that sign out and right back in.");
+ABSL_FLAG(int,
+          sign_in_timeout,
+          60,
+          "Seconds to wait for all members to sign in before measuring "
+          "anyway.");
+ABSL_FLAG(int, duration, 30, "Seconds to measure for.");
+ABSL_FLAG(int,
+          server_pid,
+          0,
+          "Process id of a server on this machine.  If set, its resident "
+          "memory is reported before and after the members signed in.");
+
+namespace {
+
+int64_t Percentile(const std::vector<int64_t>& sorted, double percent) {
+  if (sorted.empty())
+    return 0;
+  size_t index = static_cast<size_t>((sorted.size() - 1) * percent / 100);
+  return sorted[index];
+}
+
+// Resident memory of process `pid` in kilobytes, or -1 if unknown.
+int64_t ResidentKilobytes(int pid) {
+  std::ifstream status(absl::StrCat("/proc/", pid, "/status"));
+  std::string line;
+  while (std::getline(status, line)) {
+    absl::string_view value(line);
+    if (!value.starts_with("VmRSS:"))
+      continue;
+    value.remove_prefix(6);
+    size_t start = value.find_first_not_of(" \t");
+    if (start == absl::string_view::npos)
+      return -1;
+    value = value.substr(start, value.find(" kB") - start);
+    int64_t kilobytes = 0;
+    if (absl::SimpleAtoi(value, &kilobytes))
+      return kilobytes;
+  }
+  return -1;
+}
+
+// Lifts the descriptor limit of this process as far as it goes, since every
+// member holds two connections.
+void RaiseDescriptorLimit() {
+#if defined(WEBRTC_POSIX)
+  rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+#endif
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(
+      "Example usage: ./peerconnection_server_load --port=8888 "
+      "--members=5000 --churn_per_second=50\n");
+  absl::ParseCommandLine(argc, argv);
+
+  LoadGenerator::Options options;
+  options.server = absl::GetFlag(FLAGS_server);
+  options.port = absl::GetFlag(FLAGS_port);
+  options.members = std::max(absl::GetFlag(FLAGS_members), 1);
+  options.rooms = std::max(absl::GetFlag(FLAGS_rooms), 0);
+  options.sign_ins_per_second = absl::GetFlag(FLAGS_sign_ins_per_second);
+  options.message_interval = std::chrono::milliseconds(
+      std::max(absl::GetFlag(FLAGS_message_interval_ms), 0));
+  options.description_size =
+      static_cast<size_t>(std::max(absl::GetFlag(FLAGS_description_bytes), 0));
+  options.candidate_size =
+      static_cast<size_t>(std::max(absl::GetFlag(FLAGS_candidate_bytes), 0));
+  options.candidates_per_call =
+      std::max(absl::GetFlag(FLAGS_candidates_per_call), 0);
+  options.churn_per_second = absl::GetFlag(FLAGS_churn_per_second);
+  const int server_pid = absl::GetFlag(FLAGS_server_pid);
+
+  RaiseDescriptorLimit();
+  LoadGenerator generator(options);
+  if (!generator.Init())
+    return 1;
+
+  int64_t idle_kilobytes = server_pid ? ResidentKilobytes(server_pid) : -1;
+  auto sign_in_start = LoadGenerator::Clock::now();
+  if (!generator.SignInAll(
+          std::chrono::seconds(absl::GetFlag(FLAGS_sign_in_timeout)))) {
+    printf("Only %i of %i members signed in\n", generator.signed_in(),
+           options.members);
+  }
+  double sign_in_seconds = std::chrono::duration<double>(
+                               LoadGenerator::Clock::now() - sign_in_start)
+                               .count();
+  printf("%i members signed in in %.1f s\n", generator.signed_in(),
+         sign_in_seconds);
+  if (idle_kilobytes >= 0) {
+    int64_t loaded_kilobytes = ResidentKilobytes(server_pid);
+    printf("server memory: %lli kB idle, %lli kB loaded",
+           static_cast<long long>(idle_kilobytes),
+           static_cast<long long>(loaded_kilobytes));
+    if (generator.signed_in() > 0 && loaded_kilobytes >= 0) {
+      printf(", %.0f bytes per member",
+             (loaded_kilobytes - idle_kilobytes) * 1024.0 /
+                 generator.signed_in());
+    }
+    printf("\n");
+  }
+
+  LoadGenerator::Report report =
+      generator.Measure(std::chrono::seconds(
+          std::max(absl::GetFlag(FLAGS_duration), 1)));
+
+  printf("%.1f s: %.0f relays/s, %llu relayed, %llu accepted, %llu send "
+         "errors, %llu notifications\n",
+         report.seconds, report.relays / report.seconds,
+         static_cast<unsigned long long>(report.relays),
+         static_cast<unsigned long long>(report.messages_sent),
+         static_cast<unsigned long long>(report.send_errors),
+         static_cast<unsigned long long>(report.notifications));
+  printf("relay latency us: p50 %lli, p99 %lli, p999 %lli, max %lli\n",
+         static_cast<long long>(Percentile(report.latencies_us, 50)),
+         static_cast<long long>(Percentile(report.latencies_us, 99)),
+         static_cast<long long>(Percentile(report.latencies_us, 99.9)),
+         static_cast<long long>(
+             report.latencies_us.empty() ? 0 : report.latencies_us.back()));
+  printf("churn: %llu sign outs, %llu sign ins, %llu failed sign ins\n",
+         static_cast<unsigned long long>(report.sign_outs),
+         static_cast<unsigned long long>(report.sign_ins),
+         static_cast<unsigned long long>(report.sign_in_failures));
+  printf("connections: %zu at most", report.peak_connections);
+  if (generator.connection_limit()) {
+    printf(", server limit reached at %zu", generator.connection_limit());
+  } else {
+    printf(", server limit not reached");
+  }
+  printf("\n");
+  return 0;
+}
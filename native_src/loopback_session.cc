@@ -0,0 +1,365 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/client/loopback_session.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "api/environment/environment.h"
+#include "api/jsep.h"
+#include "api/make_ref_counted.h"
+#include "api/media_stream_interface.h"
+#include "api/media_types.h"
+#include "api/peer_connection_interface.h"
+#include "api/rtc_error.h"
+#include "api/rtp_parameters.h"
+#include "api/rtp_receiver_interface.h"
+#include "api/rtp_transceiver_direction.h"
+#include "api/rtp_transceiver_interface.h"
+#include "api/scoped_refptr.h"
+#include "api/stats/rtc_stats_collector_callback.h"
+#include "api/stats/rtc_stats_report.h"
+#include "api/stats/rtcstats_objects.h"
+#include "api/test/create_frame_generator.h"
+#include "api/units/time_delta.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "api/video/video_source_interface.h"
+#include "pc/video_track_source.h"
+#include "rtc_base/event.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/synchronization/mutex.h"
+#include "system_wrappers/include/clock.h"
+#include "test/frame_generator_capturer.h"
+
+namespace {
+
+constexpr char kStreamId[] = "loopback_stream";
+constexpr char kTrackId[] = "loopback_video";
+constexpr webrtc::TimeDelta kStatsTimeout = webrtc::TimeDelta::Seconds(5);
+
+class GeneratorTrackSource : public webrtc::VideoTrackSource {
+ protected:
+  explicit GeneratorTrackSource(
+      std::unique_ptr<webrtc::test::FrameGeneratorCapturer> capturer)
+      : VideoTrackSource(/*remote=*/false), capturer_(std::move(capturer)) {}
+
+ private:
+  webrtc::VideoSourceInterface<webrtc::VideoFrame>* source() override {
+    return capturer_.get();
+  }
+
+  std::unique_ptr<webrtc::test::FrameGeneratorCapturer> capturer_;
+};
+
+class CreateObserver : public webrtc::CreateSessionDescriptionObserver {
+ public:
+  explicit CreateObserver(
+      std::function<void(webrtc::SessionDescriptionInterface*)> on_success)
+      : on_success_(std::move(on_success)) {}
+
+  void OnSuccess(webrtc::SessionDescriptionInterface* desc) override {
+    on_success_(desc);
+  }
+  void OnFailure(webrtc::RTCError error) override {
+    RTC_LOG(LS_ERROR) << "Failed to create a description: "
+                      << error.message();
+  }
+
+ private:
+  const std::function<void(webrtc::SessionDescriptionInterface*)> on_success_;
+};
+
+class SetObserver : public webrtc::SetSessionDescriptionObserver {
+ public:
+  void OnSuccess() override {}
+  void OnFailure(webrtc::RTCError error) override {
+    RTC_LOG(LS_ERROR) << "Failed to set a description: " << error.message();
+  }
+};
+
+class StatsCallback : public webrtc::RTCStatsCollectorCallback {
+ public:
+  void OnStatsDelivered(
+      const webrtc::scoped_refptr<const webrtc::RTCStatsReport>& report)
+      override {
+    report_ = report;
+    done_.Set();
+  }
+
+  // The report, or null if it didn't come in time.
+  webrtc::scoped_refptr<const webrtc::RTCStatsReport> Wait() {
+    if (!done_.Wait(kStatsTimeout))
+      return nullptr;
+    return report_;
+  }
+
+ private:
+  webrtc::Event done_;
+  webrtc::scoped_refptr<const webrtc::RTCStatsReport> report_;
+};
+
+std::unique_ptr<webrtc::SessionDescriptionInterface> Copy(
+    const webrtc::SessionDescriptionInterface* desc) {
+  std::string sdp;
+  desc->ToString(&sdp);
+  return webrtc::CreateSessionDescription(desc->GetType(), sdp);
+}
+
+webrtc::scoped_refptr<const webrtc::RTCStatsReport> RequestStats(
+    webrtc::PeerConnectionInterface* pc) {
+  auto callback = webrtc::make_ref_counted<StatsCallback>();
+  pc->GetStats(callback.get());
+  return callback->Wait();
+}
+
+}  // namespace
+
+//
+// LoopbackSession::Endpoint
+//
+
+LoopbackSession::Endpoint::Endpoint(LoopbackSession* session,
+                                    const char* name)
+    : session_(session), name_(name), remote_(nullptr) {}
+
+void LoopbackSession::Endpoint::Close() {
+  if (pc_) {
+    pc_->Close();
+    pc_ = nullptr;
+  }
+}
+
+void LoopbackSession::Endpoint::OnAddTrack(
+    webrtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver,
+    const std::vector<webrtc::scoped_refptr<webrtc::MediaStreamInterface>>&
+        streams) {
+  webrtc::scoped_refptr<webrtc::MediaStreamTrackInterface> track =
+      receiver->track();
+  if (track->kind() == webrtc::MediaStreamTrackInterface::kVideoKind) {
+    session_->OnRemoteTrack(
+        static_cast<webrtc::VideoTrackInterface*>(track.get()));
+  }
+}
+
+void LoopbackSession::Endpoint::OnIceCandidate(
+    const webrtc::IceCandidate* candidate) {
+  if (!remote_->pc()->AddIceCandidate(candidate))
+    RTC_LOG(LS_WARNING) << name_ << ": the other end rejected a candidate";
+}
+
+//
+// LoopbackSession::RenderSink
+//
+
+LoopbackSession::RenderSink::RenderSink(webrtc::Clock& clock)
+    : clock_(clock), frames_(0) {}
+
+void LoopbackSession::RenderSink::OnFrame(const webrtc::VideoFrame& frame) {
+  ++frames_;
+  // The receiver estimates the capture time from the sender reports, in the
+  // sender's NTP time.  Both ends share the clock, so the difference to now
+  // is the time the frame took through the whole pipeline.
+  if (frame.ntp_time_ms() <= 0)
+    return;
+  int64_t latency_ms = clock_.CurrentNtpInMilliseconds() - frame.ntp_time_ms();
+  webrtc::MutexLock lock(&lock_);
+  latencies_.push_back(latency_ms);
+}
+
+void LoopbackSession::RenderSink::Reset() {
+  webrtc::MutexLock lock(&lock_);
+  frames_ = 0;
+  latencies_.clear();
+}
+
+std::vector<int64_t> LoopbackSession::RenderSink::Latencies() const {
+  webrtc::MutexLock lock(&lock_);
+  return latencies_;
+}
+
+//
+// LoopbackSession
+//
+
+LoopbackSession::LoopbackSession(
+    const webrtc::Environment& env,
+    webrtc::PeerConnectionFactoryInterface* factory,
+    int width,
+    int height,
+    int fps,
+    const std::string& codec)
+    : env_(env),
+      factory_(factory),
+      width_(width),
+      height_(height),
+      fps_(fps),
+      codec_(codec),
+      sender_(this, "sender"),
+      receiver_(this, "receiver"),
+      sink_(env.clock()) {
+  sender_.set_remote(&receiver_);
+  receiver_.set_remote(&sender_);
+}
+
+LoopbackSession::~LoopbackSession() {
+  if (remote_track_)
+    remote_track_->RemoveSink(&sink_);
+  sender_.Close();
+  receiver_.Close();
+}
+
+bool LoopbackSession::Start() {
+  if (!CreateEndpoint(&sender_) || !CreateEndpoint(&receiver_) ||
+      !AddVideo()) {
+    return false;
+  }
+  sender_.pc()->CreateOffer(
+      webrtc::make_ref_counted<CreateObserver>(
+          [this](webrtc::SessionDescriptionInterface* offer) {
+            OnOffer(offer);
+          })
+          .get(),
+      webrtc::PeerConnectionInterface::RTCOfferAnswerOptions());
+  return true;
+}
+
+uint64_t LoopbackSession::frames_rendered() const {
+  return sink_.frames();
+}
+
+void LoopbackSession::ResetMeasurements() {
+  sink_.Reset();
+}
+
+std::vector<int64_t> LoopbackSession::Latencies() const {
+  return sink_.Latencies();
+}
+
+LoopbackSession::CodecStats LoopbackSession::GetCodecStats() {
+  CodecStats stats;
+  webrtc::scoped_refptr<const webrtc::RTCStatsReport> sent =
+      RequestStats(sender_.pc());
+  if (sent) {
+    for (const webrtc::RTCOutboundRtpStreamStats* stream :
+         sent->GetStatsOfType<webrtc::RTCOutboundRtpStreamStats>()) {
+      if (stream->kind != "video")
+        continue;
+      stats.frames_encoded += stream->frames_encoded.value_or(0);
+      stats.encode_time_s += stream->total_encode_time.value_or(0);
+    }
+  }
+  webrtc::scoped_refptr<const webrtc::RTCStatsReport> received =
+      RequestStats(receiver_.pc());
+  if (received) {
+    for (const webrtc::RTCInboundRtpStreamStats* stream :
+         received->GetStatsOfType<webrtc::RTCInboundRtpStreamStats>()) {
+      if (stream->kind != "video")
+        continue;
+      stats.frames_decoded += stream->frames_decoded.value_or(0);
+      stats.decode_time_s += stream->total_decode_time.value_or(0);
+    }
+  }
+  return stats;
+}
+
+void LoopbackSession::OnOffer(webrtc::SessionDescriptionInterface* offer) {
+  std::unique_ptr<webrtc::SessionDescriptionInterface> copy = Copy(offer);
+  sender_.pc()->SetLocalDescription(
+      webrtc::make_ref_counted<SetObserver>().get(), offer);
+  receiver_.pc()->SetRemoteDescription(
+      webrtc::make_ref_counted<SetObserver>().get(), copy.release());
+  receiver_.pc()->CreateAnswer(
+      webrtc::make_ref_counted<CreateObserver>(
+          [this](webrtc::SessionDescriptionInterface* answer) {
+            OnAnswer(answer);
+          })
+          .get(),
+      webrtc::PeerConnectionInterface::RTCOfferAnswerOptions());
+}
+
+void LoopbackSession::OnAnswer(webrtc::SessionDescriptionInterface* answer) {
+  std::unique_ptr<webrtc::SessionDescriptionInterface> copy = Copy(answer);
+  receiver_.pc()->SetLocalDescription(
+      webrtc::make_ref_counted<SetObserver>().get(), answer);
+  sender_.pc()->SetRemoteDescription(
+      webrtc::make_ref_counted<SetObserver>().get(), copy.release());
+}
+
+void LoopbackSession::OnRemoteTrack(webrtc::VideoTrackInterface* track) {
+  remote_track_ = webrtc::scoped_refptr<webrtc::VideoTrackInterface>(track);
+  remote_track_->AddOrUpdateSink(&sink_, webrtc::VideoSinkWants());
+}
+
+bool LoopbackSession::CreateEndpoint(Endpoint* endpoint) {
+  webrtc::PeerConnectionInterface::RTCConfiguration config;
+  config.sdp_semantics = webrtc::SdpSemantics::kUnifiedPlan;
+  webrtc::PeerConnectionDependencies dependencies(endpoint);
+  auto error_or_peer_connection =
+      factory_->CreatePeerConnectionOrError(config, std::move(dependencies));
+  if (!error_or_peer_connection.ok()) {
+    RTC_LOG(LS_ERROR) << "Failed to create a PeerConnection: "
+                      << error_or_peer_connection.error().message();
+    return false;
+  }
+  endpoint->set_pc(error_or_peer_connection.MoveValue());
+  return true;
+}
+
+bool LoopbackSession::AddVideo() {
+  auto capturer = std::make_unique<webrtc::test::FrameGeneratorCapturer>(
+      &env_.clock(),
+      webrtc::test::CreateSquareFrameGenerator(width_, height_, std::nullopt,
+                                               std::nullopt),
+      fps_, env_.task_queue_factory());
+  capturer->Start();
+  webrtc::scoped_refptr<webrtc::VideoTrackInterface> track =
+      factory_->CreateVideoTrack(
+          webrtc::make_ref_counted<GeneratorTrackSource>(std::move(capturer)),
+          kTrackId);
+
+  webrtc::RtpTransceiverInit init;
+  init.direction = webrtc::RtpTransceiverDirection::kSendOnly;
+  init.stream_ids = {kStreamId};
+  auto result_or_error = sender_.pc()->AddTransceiver(track, init);
+  if (!result_or_error.ok()) {
+    RTC_LOG(LS_ERROR) << "Failed to add the video track: "
+                      << result_or_error.error().message();
+    return false;
+  }
+
+  // The codec goes first so that it wins the negotiation.
+  std::vector<webrtc::RtpCodecCapability> codecs =
+      factory_->GetRtpReceiverCapabilities(webrtc::MediaType::VIDEO).codecs;
+  auto others = std::stable_partition(
+      codecs.begin(), codecs.end(),
+      [this](const webrtc::RtpCodecCapability& capability) {
+        return absl::EqualsIgnoreCase(capability.name, codec_);
+      });
+  if (others == codecs.begin()) {
+    RTC_LOG(LS_ERROR) << "No codec named " << codec_;
+    return false;
+  }
+  webrtc::RTCError error = result_or_error.value()->SetCodecPreferences(codecs);
+  if (!error.ok()) {
+    RTC_LOG(LS_ERROR) << "Failed to prefer " << codec_ << ": "
+                      << error.message();
+    return false;
+  }
+  return true;
+}
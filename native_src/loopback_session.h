@@ -0,0 +1,159 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_CLIENT_LOOPBACK_SESSION_H_
+#define EXAMPLES_PEERCONNECTION_CLIENT_LOOPBACK_SESSION_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "api/environment/environment.h"
+#include "api/jsep.h"
+#include "api/media_stream_interface.h"
+#include "api/peer_connection_interface.h"
+#include "api/rtp_receiver_interface.h"
+#include "api/scoped_refptr.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "rtc_base/synchronization/mutex.h"
+#include "rtc_base/thread_annotations.h"
+#include "system_wrappers/include/clock.h"
+
+// Sends generated video from one PeerConnection to another in the same
+// process and measures what arrives.  The two ends hand each other their
+// descriptions and candidates directly, so no signaling server is involved,
+// and the factory is expected to have encryption disabled, as for the
+// loopback calls of the Conductor.  Created and used on one thread; the
+// PeerConnections call back on the signaling thread of the factory.
+class LoopbackSession {
+ public:
+  // The time spent in the codecs, as reported by the stats.
+  struct CodecStats {
+    CodecStats()
+        : frames_encoded(0),
+          encode_time_s(0),
+          frames_decoded(0),
+          decode_time_s(0) {}
+
+    uint64_t frames_encoded;
+    double encode_time_s;
+    uint64_t frames_decoded;
+    double decode_time_s;
+  };
+
+  // Sends `width` x `height` at `fps` with the codec named `codec`, e.g.
+  // "VP8".
+  LoopbackSession(const webrtc::Environment& env,
+                  webrtc::PeerConnectionFactoryInterface* factory,
+                  int width,
+                  int height,
+                  int fps,
+                  const std::string& codec);
+  LoopbackSession(const LoopbackSession&) = delete;
+  LoopbackSession& operator=(const LoopbackSession&) = delete;
+  ~LoopbackSession();
+
+  // Connects the two ends and starts sending.  Returns false if they could
+  // not be created or the factory doesn't have the codec.
+  bool Start();
+
+  // The frames delivered to the receiving end since the last
+  // ResetMeasurements().
+  uint64_t frames_rendered() const;
+
+  // Starts a new measurement, dropping the latencies measured so far.
+  void ResetMeasurements();
+
+  // The milliseconds from capture to delivery to the receiving end of the
+  // frames since the last ResetMeasurements().  Frames that arrive before
+  // the receiver could map their capture time to its clock are left out.
+  std::vector<int64_t> Latencies() const;
+
+  // Blocks until both ends have reported their stats.
+  CodecStats GetCodecStats();
+
+ private:
+  // One of the two PeerConnections.
+  class Endpoint : public webrtc::PeerConnectionObserver {
+   public:
+    Endpoint(LoopbackSession* session, const char* name);
+
+    webrtc::PeerConnectionInterface* pc() { return pc_.get(); }
+    void set_pc(webrtc::scoped_refptr<webrtc::PeerConnectionInterface> pc) {
+      pc_ = std::move(pc);
+    }
+    void set_remote(Endpoint* remote) { remote_ = remote; }
+    void Close();
+
+    // PeerConnectionObserver implementation.
+    void OnSignalingChange(
+        webrtc::PeerConnectionInterface::SignalingState new_state) override {}
+    void OnAddTrack(
+        webrtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver,
+        const std::vector<webrtc::scoped_refptr<webrtc::MediaStreamInterface>>&
+            streams) override;
+    void OnDataChannel(
+        webrtc::scoped_refptr<webrtc::DataChannelInterface> channel) override {}
+    void OnIceGatheringChange(
+        webrtc::PeerConnectionInterface::IceGatheringState new_state)
+        override {}
+    void OnIceCandidate(const webrtc::IceCandidate* candidate) override;
+
+   private:
+    LoopbackSession* const session_;
+    const char* const name_;
+    webrtc::scoped_refptr<webrtc::PeerConnectionInterface> pc_;
+    Endpoint* remote_;
+  };
+
+  // Counts the received frames and measures their latency.  Called on the
+  // decoding thread.
+  class RenderSink : public webrtc::VideoSinkInterface<webrtc::VideoFrame> {
+   public:
+    explicit RenderSink(webrtc::Clock& clock);
+
+    void OnFrame(const webrtc::VideoFrame& frame) override;
+
+    uint64_t frames() const { return frames_.load(); }
+    void Reset();
+    std::vector<int64_t> Latencies() const;
+
+   private:
+    webrtc::Clock& clock_;
+    std::atomic<uint64_t> frames_;
+    mutable webrtc::Mutex lock_;
+    std::vector<int64_t> latencies_ RTC_GUARDED_BY(lock_);
+  };
+
+  // Runs on the signaling thread.
+  void OnOffer(webrtc::SessionDescriptionInterface* offer);
+  void OnAnswer(webrtc::SessionDescriptionInterface* answer);
+  void OnRemoteTrack(webrtc::VideoTrackInterface* track);
+
+  bool CreateEndpoint(Endpoint* endpoint);
+  bool AddVideo();
+
+  const webrtc::Environment env_;
+  webrtc::PeerConnectionFactoryInterface* const factory_;
+  const int width_;
+  const int height_;
+  const int fps_;
+  const std::string codec_;
+  Endpoint sender_;
+  Endpoint receiver_;
+  RenderSink sink_;
+  webrtc::scoped_refptr<webrtc::VideoTrackInterface> remote_track_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_CLIENT_LOOPBACK_SESSION_H_
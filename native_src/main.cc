@@ -8,22 +8,24 @@
  *  be found in the AUTHORS file in the root of the source tree.
  */
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl/flags/usage.h"
-#include "examples/peerconnection/server/data_socket.h"
-#include "examples/peerconnection/server/peer_channel.h"
-#include "rtc_base/checks.h"
-
-#if defined(WEBRTC_POSIX)
-#include <sys/select.h>
-#endif
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "examples/peerconnection/server/cluster_link.h"
+#include "examples/peerconnection/server/server_log.h"
+#include "examples/peerconnection/server/server_worker.h"
 
 // As of now, no components in peerconnection_server rely on WebRTC components
 // that change its behavior based on a field trial, so this flag is currently
@@ -39,33 +41,63 @@ ABSL_FLAG(
     "will assign the group Enabled to field trial WebRTC-FooFeature. Multiple "
     "trials are separated by \"/\"");
 ABSL_FLAG(int, port, 8888, "default: 8888");
-
-static const size_t kMaxConnections = (FD_SETSIZE - 2);
-
-void HandleBrowserRequest(DataSocket* ds, bool* quit) {
-  RTC_DCHECK(ds && ds->valid());
-  RTC_DCHECK(quit);
-
-  const std::string& path = ds->request_path();
-
-  *quit = (path.compare("/quit") == 0);
-
-  if (*quit) {
-    ds->Send("200 OK", true, "text/html", "",
-             "<html><body>Quitting...</body></html>");
-  } else if (ds->method() == DataSocket::OPTIONS) {
-    // We'll get this when a browsers do cross-resource-sharing requests.
-    // The headers to allow cross-origin script support will be set inside
-    // Send.
-    ds->Send("200 OK", true, "", "", "");
-  } else {
-    // Here we could write some useful output back to the browser depending on
-    // the path.
-    printf("Received an invalid request: %s\n", ds->request_path().c_str());
-    ds->Send("500 Sorry", true, "text/html", "",
-             "<html><body>Sorry, not yet implemented</body></html>");
-  }
-}
+ABSL_FLAG(int,
+          max_connections,
+          0,
+          "Maximum number of simultaneous connections.  0 means no limit "
+          "other than the process file descriptor limit.");
+ABSL_FLAG(int,
+          workers,
+          1,
+          "Number of event loop threads.  Each one accepts connections on the "
+          "port (using SO_REUSEPORT) and owns a shard of the members.");
+ABSL_FLAG(int,
+          member_timeout,
+          30,
+          "Seconds after which a peer that is not waiting for messages is "
+          "considered gone.  Until then, a peer that lost its connections "
+          "can resume its session and keep its id and queued messages.");
+ABSL_FLAG(int,
+          max_queued_messages,
+          1000,
+          "Maximum number of messages held for a peer that is not waiting for "
+          "them.  0 means no limit.");
+ABSL_FLAG(int,
+          max_queued_bytes,
+          4 * 1024 * 1024,
+          "Maximum number of bytes held for a peer that is not waiting for "
+          "messages or not reading them fast enough.  0 means no limit.");
+ABSL_FLAG(std::string,
+          queue_overflow,
+          "coalesce_presence",
+          "What to do when the messages for a peer exceed the limits: "
+          "drop_oldest, coalesce_presence (drop superseded presence updates "
+          "first, then the oldest messages) or disconnect.");
+ABSL_FLAG(int,
+          presence_batch_ms,
+          0,
+          "Milliseconds to collect sign ins and sign outs for before telling "
+          "the other peers about them in one notification, which may list "
+          "several peers.  0 sends each change right away, one peer per "
+          "notification.");
+ABSL_FLAG(std::string,
+          cluster_nodes,
+          "",
+          "Comma separated host:port cluster addresses of all servers of a "
+          "cluster, in the same order on every server.  Each server links "
+          "to the others on these ports so that peers on different servers "
+          "can see and message each other.  A peer's own requests must "
+          "reach the server it signed in to.  Empty runs a single server.");
+ABSL_FLAG(int,
+          node_index,
+          0,
+          "Position of this server in --cluster_nodes.");
+ABSL_FLAG(std::string,
+          log_level,
+          "info",
+          "Least severe events that are logged: error, warning, info "
+          "(sign ins, sign outs and timeouts) or verbose (every connection "
+          "and message).  Lines are written on a thread of their own.");
 
 int main(int argc, char* argv[]) {
   absl::SetProgramUsageMessage(
@@ -81,111 +113,130 @@ int main(int argc, char* argv[]) {
     return -1;
   }
 
-  ListeningSocket listener;
-  if (!listener.Create()) {
-    printf("Failed to create server socket\n");
+  int num_workers = absl::GetFlag(FLAGS_workers);
+  if (num_workers < 1) {
+    printf("Error: %i is not a valid number of workers.\n", num_workers);
     return -1;
-  } else if (!listener.Listen(port)) {
-    printf("Failed to listen on server socket\n");
+  }
+
+  int member_timeout = absl::GetFlag(FLAGS_member_timeout);
+  if (member_timeout < 1) {
+    printf("Error: %i is not a valid member timeout.\n", member_timeout);
     return -1;
   }
 
-  printf("Server listening on port %i\n", port);
+  MemberQueueLimits queue_limits;
+  int max_queued_messages = absl::GetFlag(FLAGS_max_queued_messages);
+  int max_queued_bytes = absl::GetFlag(FLAGS_max_queued_bytes);
+  if (max_queued_messages < 0 || max_queued_bytes < 0) {
+    printf("Error: queue limits must not be negative.\n");
+    return -1;
+  }
+  queue_limits.max_messages = static_cast<size_t>(max_queued_messages);
+  queue_limits.max_bytes = static_cast<size_t>(max_queued_bytes);
+
+  std::string queue_overflow = absl::GetFlag(FLAGS_queue_overflow);
+  if (queue_overflow == "drop_oldest") {
+    queue_limits.policy = MemberQueueLimits::DROP_OLDEST;
+  } else if (queue_overflow == "coalesce_presence") {
+    queue_limits.policy = MemberQueueLimits::COALESCE_PRESENCE;
+  } else if (queue_overflow == "disconnect") {
+    queue_limits.policy = MemberQueueLimits::DISCONNECT;
+  } else {
+    printf("Error: %s is not a valid queue overflow policy.\n",
+           queue_overflow.c_str());
+    return -1;
+  }
 
-  PeerChannel clients;
-  typedef std::vector<DataSocket*> SocketArray;
-  SocketArray sockets;
-  bool quit = false;
-  while (!quit) {
-    fd_set socket_set;
-    FD_ZERO(&socket_set);
-    if (listener.valid())
-      FD_SET(listener.socket(), &socket_set);
-
-    for (SocketArray::iterator i = sockets.begin(); i != sockets.end(); ++i)
-      FD_SET((*i)->socket(), &socket_set);
-
-    struct timeval timeout = {10, 0};
-    if (select(FD_SETSIZE, &socket_set, nullptr, nullptr, &timeout) ==
-        SOCKET_ERROR) {
-      printf("select failed\n");
-      break;
-    }
+  ServerLog::Level log_level;
+  std::string log_level_name = absl::GetFlag(FLAGS_log_level);
+  if (!ServerLog::ParseLevel(log_level_name, &log_level)) {
+    printf("Error: %s is not a valid log level.\n", log_level_name.c_str());
+    return -1;
+  }
+  ServerLog::set_level(log_level);
 
-    for (SocketArray::iterator i = sockets.begin(); i != sockets.end(); ++i) {
-      DataSocket* s = *i;
-      bool socket_done = true;
-      if (FD_ISSET(s->socket(), &socket_set)) {
-        if (s->OnDataAvailable(&socket_done) && s->request_received()) {
-          ChannelMember* member = clients.Lookup(s);
-          if (member || PeerChannel::IsPeerConnection(s)) {
-            if (!member) {
-              if (s->PathEquals("/sign_in")) {
-                clients.AddMember(s);
-              } else {
-                printf("No member found for: %s\n", s->request_path().c_str());
-                s->Send("500 Error", true, "text/plain", "",
-                        "Peer most likely gone.");
-              }
-            } else if (member->is_wait_request(s)) {
-              // no need to do anything.
-              socket_done = false;
-            } else {
-              ChannelMember* target = clients.IsTargetedRequest(s);
-              if (target) {
-                member->ForwardRequestToPeer(s, target);
-              } else if (s->PathEquals("/sign_out")) {
-                s->Send("200 OK", true, "text/plain", "", "");
-              } else {
-                printf("Couldn't find target for request: %s\n",
-                       s->request_path().c_str());
-                s->Send("500 Error", true, "text/plain", "",
-                        "Peer most likely gone.");
-              }
-            }
-          } else {
-            HandleBrowserRequest(s, &quit);
-            if (quit) {
-              printf("Quitting...\n");
-              FD_CLR(listener.socket(), &socket_set);
-              listener.Close();
-              clients.CloseAll();
-            }
-          }
-        }
-      } else {
-        socket_done = false;
-      }
+  int presence_batch_ms = absl::GetFlag(FLAGS_presence_batch_ms);
+  if (presence_batch_ms < 0) {
+    printf("Error: %i is not a valid presence batch window.\n",
+           presence_batch_ms);
+    return -1;
+  }
 
-      if (socket_done) {
-        printf("Disconnecting socket\n");
-        clients.OnClosing(s);
-        RTC_DCHECK(s->valid());  // Close must not have been called yet.
-        FD_CLR(s->socket(), &socket_set);
-        delete (*i);
-        i = sockets.erase(i);
-        if (i == sockets.end())
-          break;
+  std::unique_ptr<ClusterLink> cluster;
+  std::string cluster_nodes = absl::GetFlag(FLAGS_cluster_nodes);
+  if (!cluster_nodes.empty()) {
+    std::vector<ClusterLink::Node> nodes;
+    for (absl::string_view address : absl::StrSplit(cluster_nodes, ',')) {
+      size_t colon = address.rfind(':');
+      int node_port = 0;
+      if (colon == absl::string_view::npos ||
+          !absl::SimpleAtoi(address.substr(colon + 1), &node_port) ||
+          node_port < 1 || node_port > 65535) {
+        printf("Error: %.*s is not a valid cluster address.\n",
+               static_cast<int>(address.size()), address.data());
+        return -1;
       }
+      ClusterLink::Node node;
+      node.host = std::string(address.substr(0, colon));
+      node.port = static_cast<unsigned short>(node_port);
+      nodes.push_back(node);
     }
-
-    clients.CheckForTimeout();
-
-    if (FD_ISSET(listener.socket(), &socket_set)) {
-      DataSocket* s = listener.Accept();
-      if (sockets.size() >= kMaxConnections) {
-        delete s;  // sorry, that's all we can take.
-        printf("Connection limit reached\n");
-      } else {
-        sockets.push_back(s);
-        printf("New connection...\n");
-      }
+    int node_index = absl::GetFlag(FLAGS_node_index);
+    if (node_index < 0 || node_index >= static_cast<int>(nodes.size())) {
+      printf("Error: %i is not a valid node index.\n", node_index);
+      return -1;
     }
+    cluster = std::make_unique<ClusterLink>(node_index, nodes);
+    if (!cluster->Init())
+      return -1;
   }
 
-  for (SocketArray::iterator i = sockets.begin(); i != sockets.end(); ++i)
-    delete (*i);
-  sockets.clear();
+  ServerWorker::Options options;
+  // The connection limit applies to the whole process.
+  const size_t max_connections =
+      static_cast<size_t>(std::max(absl::GetFlag(FLAGS_max_connections), 0));
+  options.max_connections =
+      max_connections ? std::max<size_t>(max_connections / num_workers, 1) : 0;
+  options.member_timeout = std::chrono::seconds(member_timeout);
+  options.queue_limits = queue_limits;
+  options.presence_window = std::chrono::milliseconds(presence_batch_ms);
+  options.cluster = cluster.get();
+
+  ServerWorker::Group group(num_workers);
+  std::vector<std::unique_ptr<ServerWorker>> workers;
+  for (int i = 0; i < num_workers; ++i) {
+    workers.push_back(std::make_unique<ServerWorker>(i, &group, options));
+    group[i] = workers.back().get();
+  }
+  for (const auto& worker : workers) {
+    if (!worker->Init(port))
+      return -1;
+  }
+
+  printf("Server listening on port %i\n", port);
+  fflush(stdout);
+  ServerLog::Start();
+
+  // The first worker runs on the main thread, the cluster link on a thread
+  // of its own.
+  std::vector<std::thread> threads;
+  if (cluster) {
+    // Any worker can spread what the link receives over the group.
+    cluster->set_observer(workers[0].get());
+    threads.emplace_back(&ClusterLink::Run, cluster.get());
+  }
+  for (size_t i = 1; i < workers.size(); ++i)
+    threads.emplace_back(&ServerWorker::Run, workers[i].get());
+  workers[0]->Run();
+  for (std::thread& thread : threads)
+    thread.join();
+
+  // Tear down only once all workers have stopped, since they may still be
+  // posting to each other until then.
+  workers.clear();
+  cluster.reset();
+  ServerLog::Stop();
 
   return 0;
 }
@@ -12,11 +12,13 @@
 
 #include <math.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <iterator>
+#include <optional>
 #include <string>
 
 #include "api/media_stream_interface.h"
@@ -25,10 +27,14 @@
 #include "api/video/video_frame.h"
 #include "api/video/video_frame_buffer.h"
 #include "api/video/video_rotation.h"
+#include "api/video/video_sink_interface.h"
 #include "api/video/video_source_interface.h"
+#include "common_video/include/video_frame_buffer_pool.h"
+#include "examples/peerconnection/client/d3d11_renderer.h"
 #include "examples/peerconnection/client/peer_connection_client.h"
 #include "rtc_base/checks.h"
 #include "third_party/libyuv/include/libyuv/convert_argb.h"
+#include "third_party/libyuv/include/libyuv/rotate.h"
 
 ATOM MainWnd::wnd_class_ = 0;
 const wchar_t MainWnd::kClassName[] = L"WebRTC_MainWnd";
@@ -39,6 +45,21 @@ const char kConnecting[] = "Connecting... ";
 const char kNoVideoStreams[] = "(no video streams either way)";
 const char kNoIncomingStream[] = "(no incoming video)";
 
+// Drives the painting while streaming.
+const UINT_PTR kPaintTimerId = 1;
+// For displays that don't report their refresh rate.
+const int kDefaultRefreshRate = 60;
+// The remote video is asked for at least this size, even for tiny windows.
+const int kMinRemotePixelCount = 320 * 180;
+
+int GetRefreshRate(HWND wnd) {
+  HDC dc = ::GetDC(wnd);
+  int rate = ::GetDeviceCaps(dc, VREFRESH);
+  ::ReleaseDC(wnd, dc);
+  // 0 and 1 stand for the default rate of the hardware.
+  return rate > 1 ? rate : kDefaultRefreshRate;
+}
+
 void CalculateWindowSizeForText(HWND wnd,
                                 const wchar_t* text,
                                 size_t* width,
@@ -80,7 +101,8 @@ MainWnd::MainWnd(const char* server,
                  int port,
                  bool auto_connect,
                  bool auto_call)
-    : ui_(CONNECT_TO_SERVER),
+    : refresh_rate_(kDefaultRefreshRate),
+      ui_(CONNECT_TO_SERVER),
       wnd_(NULL),
       edit1_(NULL),
       edit2_(NULL),
@@ -97,6 +119,7 @@ MainWnd::MainWnd(const char* server,
   char buffer[10];
   snprintf(buffer, sizeof(buffer), "%i", port);
   port_ = buffer;
+  ::SetRectEmpty(&thumbnail_rect_);
 }
 
 MainWnd::~MainWnd() {
@@ -121,6 +144,9 @@ bool MainWnd::Create() {
   CreateChildWindows();
   SwitchToConnectUI();
 
+  gpu_renderer_ = D3D11Renderer::Create(wnd_);
+  refresh_rate_ = GetRefreshRate(wnd_);
+
   return wnd_ != NULL;
 }
 
@@ -169,6 +195,7 @@ bool MainWnd::PreTranslateMessage(MSG* msg) {
 
 void MainWnd::SwitchToConnectUI() {
   RTC_DCHECK(IsWindow());
+  ::KillTimer(wnd_, kPaintTimerId);
   LayoutPeerListUI(false);
   ui_ = CONNECT_TO_SERVER;
   LayoutConnectUI(true);
@@ -179,6 +206,7 @@ void MainWnd::SwitchToConnectUI() {
 }
 
 void MainWnd::SwitchToPeerList(const Peers& peers) {
+  ::KillTimer(wnd_, kPaintTimerId);
   LayoutConnectUI(false);
 
   ::SendMessage(listbox_, LB_RESETCONTENT, 0, 0);
@@ -210,6 +238,7 @@ void MainWnd::SwitchToStreamingUI() {
   LayoutConnectUI(false);
   LayoutPeerListUI(false);
   ui_ = STREAMING;
+  ::SetTimer(wnd_, kPaintTimerId, std::max(1000 / refresh_rate_, 1), NULL);
 }
 
 void MainWnd::MessageBox(const char* caption, const char* text, bool is_error) {
@@ -221,7 +250,8 @@ void MainWnd::MessageBox(const char* caption, const char* text, bool is_error) {
 }
 
 void MainWnd::StartLocalRenderer(webrtc::VideoTrackInterface* local_video) {
-  local_renderer_.reset(new VideoRenderer(handle(), 1, 1, local_video));
+  local_renderer_.reset(
+      new VideoRenderer(local_video, !gpu_renderer_));
 }
 
 void MainWnd::StopLocalRenderer() {
@@ -229,7 +259,9 @@ void MainWnd::StopLocalRenderer() {
 }
 
 void MainWnd::StartRemoteRenderer(webrtc::VideoTrackInterface* remote_video) {
-  remote_renderer_.reset(new VideoRenderer(handle(), 1, 1, remote_video));
+  remote_renderer_.reset(
+      new VideoRenderer(remote_video, !gpu_renderer_));
+  UpdateRemoteWants();
 }
 
 void MainWnd::StopRemoteRenderer() {
@@ -243,6 +275,10 @@ void MainWnd::QueueUIThreadCallback(int msg_id, void* data) {
 }
 
 void MainWnd::OnPaint() {
+  ::SetRectEmpty(&thumbnail_rect_);
+  if (PaintWithGpu())
+    return;
+
   PAINTSTRUCT ps;
   ::BeginPaint(handle(), &ps);
 
@@ -252,15 +288,15 @@ void MainWnd::OnPaint() {
   VideoRenderer* local_renderer = local_renderer_.get();
   VideoRenderer* remote_renderer = remote_renderer_.get();
   if (ui_ == STREAMING && remote_renderer && local_renderer) {
-    AutoLock<VideoRenderer> local_lock(local_renderer);
-    AutoLock<VideoRenderer> remote_lock(remote_renderer);
-
-    const BITMAPINFO& bmi = remote_renderer->bmi();
-    int height = abs(bmi.bmiHeader.biHeight);
-    int width = bmi.bmiHeader.biWidth;
+    const VideoRenderer::Frame* remote_frame = remote_renderer->LatestFrame();
+    const VideoRenderer::Frame* local_frame = local_renderer->LatestFrame();
 
-    const uint8_t* image = remote_renderer->image();
+    const uint8_t* image = remote_frame ? remote_frame->image.get() : NULL;
     if (image != NULL) {
+      const BITMAPINFO& bmi = remote_frame->bmi;
+      int height = abs(bmi.bmiHeader.biHeight);
+      int width = bmi.bmiHeader.biWidth;
+
       HDC dc_mem = ::CreateCompatibleDC(ps.hdc);
       ::SetStretchBltMode(dc_mem, HALFTONE);
 
@@ -288,16 +324,24 @@ void MainWnd::OnPaint() {
       StretchDIBits(dc_mem, x, y, width, height, 0, 0, width, height, image,
                     &bmi, DIB_RGB_COLORS, SRCCOPY);
 
-      if ((rc.right - rc.left) > 200 && (rc.bottom - rc.top) > 200) {
-        const BITMAPINFO& local_bmi = local_renderer->bmi();
-        image = local_renderer->image();
+      if ((rc.right - rc.left) > 200 && (rc.bottom - rc.top) > 200 &&
+          local_frame && local_frame->image) {
+        const BITMAPINFO& local_bmi = local_frame->bmi;
+        image = local_frame->image.get();
         int thumb_width = local_bmi.bmiHeader.biWidth / 4;
         int thumb_height = abs(local_bmi.bmiHeader.biHeight) / 4;
-        StretchDIBits(dc_mem, logical_area.x - thumb_width - 10,
-                      logical_area.y - thumb_height - 10, thumb_width,
+        POINT thumb[] = {
+            {logical_area.x - thumb_width - 10,
+             logical_area.y - thumb_height - 10},
+            {logical_area.x - 10, logical_area.y - 10},
+        };
+        StretchDIBits(dc_mem, thumb[0].x, thumb[0].y, thumb_width,
                       thumb_height, 0, 0, local_bmi.bmiHeader.biWidth,
                       -local_bmi.bmiHeader.biHeight, image, &local_bmi,
                       DIB_RGB_COLORS, SRCCOPY);
+        LPtoDP(ps.hdc, thumb, 2);
+        ::SetRect(&thumbnail_rect_, thumb[0].x, thumb[0].y, thumb[1].x + 1,
+                  thumb[1].y + 1);
       }
 
       BitBlt(ps.hdc, 0, 0, logical_area.x, logical_area.y, dc_mem, 0, 0,
@@ -318,7 +362,7 @@ void MainWnd::OnPaint() {
       ::SetBkMode(ps.hdc, TRANSPARENT);
 
       std::string text(kConnecting);
-      if (!local_renderer->image()) {
+      if (!local_frame) {
         text += kNoVideoStreams;
       } else {
         text += kNoIncomingStream;
@@ -336,7 +380,64 @@ void MainWnd::OnPaint() {
   ::EndPaint(handle(), &ps);
 }
 
+bool MainWnd::PaintWithGpu() {
+  VideoRenderer* local_renderer = local_renderer_.get();
+  VideoRenderer* remote_renderer = remote_renderer_.get();
+  if (!gpu_renderer_ || ui_ != STREAMING || !remote_renderer ||
+      !local_renderer) {
+    return false;
+  }
+
+  const VideoRenderer::Frame* remote_frame = remote_renderer->LatestFrame();
+  const VideoRenderer::Frame* local_frame = local_renderer->LatestFrame();
+  // Until the remote video arrives GDI says what is missing.
+  if (!remote_frame || !remote_frame->video)
+    return false;
+
+  bool has_thumbnail = local_frame && local_frame->video;
+  if (!gpu_renderer_->Render(*remote_frame->video,
+                             has_thumbnail ? &*local_frame->video : nullptr,
+                             &thumbnail_rect_)) {
+    // Leave the video to GDI from now on.
+    gpu_renderer_.reset();
+    local_renderer->ConvertToArgb();
+    remote_renderer->ConvertToArgb();
+    return false;
+  }
+  ::ValidateRect(handle(), NULL);
+  return true;
+}
+
+void MainWnd::OnPaintTimer() {
+  bool remote = remote_renderer_ && remote_renderer_->TakeUpdate();
+  bool local = local_renderer_ && local_renderer_->TakeUpdate();
+  if (remote || (local && ::IsRectEmpty(&thumbnail_rect_))) {
+    ::InvalidateRect(wnd_, NULL, FALSE);
+  } else if (local) {
+    // Only the thumbnail changed.
+    ::InvalidateRect(wnd_, &thumbnail_rect_, FALSE);
+  }
+}
+
+void MainWnd::UpdateRemoteWants() {
+  if (!remote_renderer_)
+    return;
+  RECT rc;
+  ::GetClientRect(wnd_, &rc);
+  if (rc.right <= 0 || rc.bottom <= 0)
+    return;  // Minimized; keep asking for what was shown last.
+
+  // Frames larger than the window or faster than the display would only
+  // be scaled down or never painted.
+  webrtc::VideoSinkWants wants;
+  wants.max_pixel_count = std::max(static_cast<int>(rc.right * rc.bottom),
+                                   kMinRemotePixelCount);
+  wants.max_framerate_fps = refresh_rate_;
+  remote_renderer_->SetWants(wants);
+}
+
 void MainWnd::OnDestroyed() {
+  gpu_renderer_.reset();
   PostQuitMessage(0);
 }
 
@@ -384,9 +485,18 @@ bool MainWnd::OnMessage(UINT msg, WPARAM wp, LPARAM lp, LRESULT* result) {
         LayoutConnectUI(true);
       } else if (ui_ == LIST_PEERS) {
         LayoutPeerListUI(true);
+      } else if (ui_ == STREAMING) {
+        UpdateRemoteWants();
+        ::InvalidateRect(wnd_, NULL, FALSE);
       }
       break;
 
+    case WM_TIMER:
+      if (wp != kPaintTimerId)
+        break;
+      OnPaintTimer();
+      return true;
+
     case WM_CTLCOLORSTATIC:
       *result = reinterpret_cast<LRESULT>(GetSysColorBrush(COLOR_WINDOW));
       return true;
@@ -582,62 +692,95 @@ void MainWnd::HandleTabbing() {
 // MainWnd::VideoRenderer
 //
 
+MainWnd::VideoRenderer::Frame::Frame() : capacity(0) {
+  ZeroMemory(&bmi, sizeof(bmi));
+  bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+  bmi.bmiHeader.biPlanes = 1;
+  bmi.bmiHeader.biBitCount = 32;
+  bmi.bmiHeader.biCompression = BI_RGB;
+}
+
 MainWnd::VideoRenderer::VideoRenderer(
-    HWND wnd,
-    int width,
-    int height,
-    webrtc::VideoTrackInterface* track_to_render)
-    : wnd_(wnd), rendered_track_(track_to_render) {
-  ::InitializeCriticalSection(&buffer_lock_);
-  ZeroMemory(&bmi_, sizeof(bmi_));
-  bmi_.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-  bmi_.bmiHeader.biPlanes = 1;
-  bmi_.bmiHeader.biBitCount = 32;
-  bmi_.bmiHeader.biCompression = BI_RGB;
-  bmi_.bmiHeader.biWidth = width;
-  bmi_.bmiHeader.biHeight = -height;
-  bmi_.bmiHeader.biSizeImage =
-      width * height * (bmi_.bmiHeader.biBitCount >> 3);
+    webrtc::VideoTrackInterface* track_to_render,
+    bool convert_to_argb)
+    : convert_to_argb_(convert_to_argb),
+      updated_(false),
+      rendered_track_(track_to_render) {
   rendered_track_->AddOrUpdateSink(this, webrtc::VideoSinkWants());
 }
 
 MainWnd::VideoRenderer::~VideoRenderer() {
   rendered_track_->RemoveSink(this);
-  ::DeleteCriticalSection(&buffer_lock_);
 }
 
-void MainWnd::VideoRenderer::SetSize(int width, int height) {
-  AutoLock<VideoRenderer> lock(this);
-
-  if (width == bmi_.bmiHeader.biWidth && height == bmi_.bmiHeader.biHeight) {
-    return;
-  }
-
-  bmi_.bmiHeader.biWidth = width;
-  bmi_.bmiHeader.biHeight = -height;
-  bmi_.bmiHeader.biSizeImage =
-      width * height * (bmi_.bmiHeader.biBitCount >> 3);
-  image_.reset(new uint8_t[bmi_.bmiHeader.biSizeImage]);
+void MainWnd::VideoRenderer::ConvertToArgb() {
+  convert_to_argb_ = true;
+  // The sink drops the references in the other frames as it reuses them.
+  Frame* frame = frames_.Acquire();
+  if (frame)
+    frame->video.reset();
 }
 
 void MainWnd::VideoRenderer::OnFrame(const webrtc::VideoFrame& video_frame) {
-  {
-    AutoLock<VideoRenderer> lock(this);
-
-    webrtc::scoped_refptr<webrtc::I420BufferInterface> buffer(
-        video_frame.video_frame_buffer()->ToI420());
-    if (video_frame.rotation() != webrtc::kVideoRotation_0) {
+  Frame* frame = frames_.back();
+  if (convert_to_argb_) {
+    Convert(video_frame, frame);
+  } else {
+    // Only a reference; the GPU renderer uploads the planes when painting.
+    frame->video = video_frame;
+  }
+  frames_.Publish();
+  // The paint timer picks the frame up.
+  updated_ = true;
+}
+
+void MainWnd::VideoRenderer::SetWants(const webrtc::VideoSinkWants& wants) {
+  rendered_track_->AddOrUpdateSink(this, wants);
+}
+
+void MainWnd::VideoRenderer::Convert(const webrtc::VideoFrame& video_frame,
+                                     Frame* frame) {
+  webrtc::scoped_refptr<webrtc::I420BufferInterface> buffer(
+      video_frame.video_frame_buffer()->ToI420());
+  if (video_frame.rotation() != webrtc::kVideoRotation_0) {
+    bool sideways = video_frame.rotation() == webrtc::kVideoRotation_90 ||
+                    video_frame.rotation() == webrtc::kVideoRotation_270;
+    webrtc::scoped_refptr<webrtc::I420Buffer> rotated =
+        rotation_pool_.CreateI420Buffer(
+            sideways ? buffer->height() : buffer->width(),
+            sideways ? buffer->width() : buffer->height());
+    if (rotated) {
+      libyuv::I420Rotate(
+          buffer->DataY(), buffer->StrideY(), buffer->DataU(),
+          buffer->StrideU(), buffer->DataV(), buffer->StrideV(),
+          rotated->MutableDataY(), rotated->StrideY(),
+          rotated->MutableDataU(), rotated->StrideU(),
+          rotated->MutableDataV(), rotated->StrideV(), buffer->width(),
+          buffer->height(),
+          static_cast<libyuv::RotationMode>(video_frame.rotation()));
+      buffer = rotated;
+    } else {
       buffer = webrtc::I420Buffer::Rotate(*buffer, video_frame.rotation());
     }
+  }
 
-    SetSize(buffer->width(), buffer->height());
-
-    RTC_DCHECK(image_.get() != NULL);
-    libyuv::I420ToARGB(buffer->DataY(), buffer->StrideY(), buffer->DataU(),
-                       buffer->StrideU(), buffer->DataV(), buffer->StrideV(),
-                       image_.get(),
-                       bmi_.bmiHeader.biWidth * bmi_.bmiHeader.biBitCount / 8,
-                       buffer->width(), buffer->height());
+  // Only a larger frame than any before needs a new image.
+  int width = buffer->width();
+  int height = buffer->height();
+  size_t size = static_cast<size_t>(width) * height *
+                (frame->bmi.bmiHeader.biBitCount >> 3);
+  if (size > frame->capacity) {
+    frame->image.reset(new uint8_t[size]);
+    frame->capacity = size;
   }
-  InvalidateRect(wnd_, NULL, TRUE);
+  frame->bmi.bmiHeader.biWidth = width;
+  frame->bmi.bmiHeader.biHeight = -height;
+  frame->bmi.bmiHeader.biSizeImage = static_cast<DWORD>(size);
+  frame->video.reset();
+
+  libyuv::I420ToARGB(buffer->DataY(), buffer->StrideY(), buffer->DataU(),
+                     buffer->StrideU(), buffer->DataV(), buffer->StrideV(),
+                     frame->image.get(),
+                     width * frame->bmi.bmiHeader.biBitCount / 8, width,
+                     height);
 }
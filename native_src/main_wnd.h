@@ -11,13 +11,19 @@
 #ifndef EXAMPLES_PEERCONNECTION_CLIENT_MAIN_WND_H_
 #define EXAMPLES_PEERCONNECTION_CLIENT_MAIN_WND_H_
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <map>
 #include <memory>
+#include <optional>
 #include <string>
 
 #include "api/media_stream_interface.h"
 #include "api/video/video_frame.h"
+#include "common_video/include/video_frame_buffer_pool.h"
 #include "examples/peerconnection/client/peer_connection_client.h"
+#include "examples/peerconnection/client/triple_buffer.h"
 #include "media/base/media_channel.h"
 #include "media/base/video_common.h"
 #if defined(WEBRTC_WIN)
@@ -72,6 +78,8 @@ class MainWindow {
 
 #ifdef WIN32
 
+class D3D11Renderer;
+
 class MainWnd : public MainWindow {
  public:
   static const wchar_t kClassName[];
@@ -106,47 +114,53 @@ class MainWnd : public MainWindow {
 
   class VideoRenderer : public webrtc::VideoSinkInterface<webrtc::VideoFrame> {
    public:
-    VideoRenderer(HWND wnd,
-                  int width,
-                  int height,
-                  webrtc::VideoTrackInterface* track_to_render);
-    virtual ~VideoRenderer();
-
-    void Lock() { ::EnterCriticalSection(&buffer_lock_); }
+    // A frame as the UI thread paints it.
+    struct Frame {
+      Frame();
+
+      BITMAPINFO bmi;
+      // The frame converted to 32 bit ARGB, or null if it was kept in
+      // `video` instead.  Reused for the next frames that fit into it.
+      std::unique_ptr<uint8_t[]> image;
+      size_t capacity;
+      // The frame itself, for a renderer that does the conversion.
+      std::optional<webrtc::VideoFrame> video;
+    };
 
-    void Unlock() { ::LeaveCriticalSection(&buffer_lock_); }
+    // Frames are converted to ARGB if `convert_to_argb`, and otherwise only
+    // referenced in Frame::video.
+    VideoRenderer(webrtc::VideoTrackInterface* track_to_render,
+                  bool convert_to_argb);
+    virtual ~VideoRenderer();
 
     // VideoSinkInterface implementation
     void OnFrame(const webrtc::VideoFrame& frame) override;
 
-    const BITMAPINFO& bmi() const { return bmi_; }
-    const uint8_t* image() const { return image_.get(); }
+    // Returns the newest frame, or null if none arrived yet.  The frame
+    // stays valid, and the sink leaves it alone, until the next call.
+    // Frames that arrive in between replace each other without waiting for
+    // the UI thread.  UI thread only.
+    const Frame* LatestFrame() { return frames_.Acquire(); }
 
-   protected:
-    void SetSize(int width, int height);
+    // True once per batch of frames that arrived since the last call.  UI
+    // thread only.
+    bool TakeUpdate() { return updated_.exchange(false); }
 
-    enum {
-      SET_SIZE,
-      RENDER_FRAME,
-    };
+    // Converts the next frames to ARGB again.  UI thread only.
+    void ConvertToArgb();
 
-    HWND wnd_;
-    BITMAPINFO bmi_;
-    std::unique_ptr<uint8_t[]> image_;
-    CRITICAL_SECTION buffer_lock_;
-    webrtc::scoped_refptr<webrtc::VideoTrackInterface> rendered_track_;
-  };
-
-  // A little helper class to make sure we always to proper locking and
-  // unlocking when working with VideoRenderer buffers.
-  template <typename T>
-  class AutoLock {
-   public:
-    explicit AutoLock(T* obj) : obj_(obj) { obj_->Lock(); }
-    ~AutoLock() { obj_->Unlock(); }
+    // Tells the track which frames are worth delivering.
+    void SetWants(const webrtc::VideoSinkWants& wants);
 
    protected:
-    T* obj_;
+    void Convert(const webrtc::VideoFrame& video_frame, Frame* frame);
+
+    std::atomic<bool> convert_to_argb_;
+    std::atomic<bool> updated_;
+    TripleBuffer<Frame> frames_;
+    // Buffers for rotating frames before the conversion.  Sink only.
+    webrtc::VideoFrameBufferPool rotation_pool_;
+    webrtc::scoped_refptr<webrtc::VideoTrackInterface> rendered_track_;
   };
 
  protected:
@@ -159,6 +173,14 @@ class MainWnd : public MainWindow {
   };
 
   void OnPaint();
+  // Paints the video with `gpu_renderer_`.  Returns false if GDI has to
+  // paint instead.
+  bool PaintWithGpu();
+  // Invalidates what the frames that arrived since the last tick changed,
+  // so that the window is painted at most once per display refresh.
+  void OnPaintTimer();
+  // Asks for remote video no larger than the window.
+  void UpdateRemoteWants();
   void OnDestroyed();
 
   void OnDefaultAction();
@@ -183,6 +205,13 @@ class MainWnd : public MainWindow {
  private:
   std::unique_ptr<VideoRenderer> local_renderer_;
   std::unique_ptr<VideoRenderer> remote_renderer_;
+  // Null if Direct3D is unavailable or failed, in which case the renderers
+  // convert the frames for GDI.
+  std::unique_ptr<D3D11Renderer> gpu_renderer_;
+  // Where the local video was last painted, empty if it wasn't.
+  RECT thumbnail_rect_;
+  // Of the display, in Hz.
+  int refresh_rate_;
   UI ui_;
   HWND wnd_;
   DWORD ui_thread_id_;
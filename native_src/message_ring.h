@@ -0,0 +1,81 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_CLIENT_MESSAGE_RING_H_
+#define EXAMPLES_PEERCONNECTION_CLIENT_MESSAGE_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "rtc_base/checks.h"
+
+// Bounded lock-free ring of messages between a single producer thread and a
+// single consumer thread.  Each slot owns its buffer, which keeps its
+// capacity when the message is consumed, so once the buffers have grown to
+// the size of the messages nothing is allocated.  The consumer looks at the
+// oldest message with Front() and only removes it with Pop() once it is done
+// with it.
+class MessageRing {
+ public:
+  // `capacity` must be a power of two.
+  explicit MessageRing(size_t capacity)
+      : slots_(capacity), mask_(capacity - 1), head_(0), tail_(0) {
+    RTC_DCHECK_GT(capacity, 0);
+    RTC_DCHECK_EQ(capacity & mask_, 0);
+  }
+  MessageRing(const MessageRing&) = delete;
+  MessageRing& operator=(const MessageRing&) = delete;
+
+  // Copies `message` into the next free slot.  Returns false if the ring is
+  // full.  Producer only.
+  bool Push(absl::string_view message) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == slots_.size())
+      return false;
+    slots_[head & mask_].assign(message.data(), message.size());
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Returns the oldest message, or null if the ring is empty.  The message
+  // stays valid until Pop().  Consumer only.
+  const std::string* Front() const {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire))
+      return nullptr;
+    return &slots_[tail & mask_];
+  }
+
+  // Removes the oldest message, which must exist.  Consumer only.
+  void Pop() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    RTC_DCHECK_NE(tail, head_.load(std::memory_order_acquire));
+    tail_.store(tail + 1, std::memory_order_release);
+  }
+
+  // Removes all messages.  Consumer only.
+  void Clear() {
+    tail_.store(head_.load(std::memory_order_acquire),
+                std::memory_order_release);
+  }
+
+ private:
+  std::vector<std::string> slots_;
+  const size_t mask_;
+  // The producer fills the slot at `head_`, the consumer empties the one at
+  // `tail_`.  Both only ever grow; the slot is the value modulo the size.
+  std::atomic<size_t> head_;
+  std::atomic<size_t> tail_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_CLIENT_MESSAGE_RING_H_
@@ -0,0 +1,66 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_SERVER_MPSC_QUEUE_H_
+#define EXAMPLES_PEERCONNECTION_SERVER_MPSC_QUEUE_H_
+
+#include <atomic>
+#include <utility>
+
+// Unbounded lock-free queue with any number of producers and a single
+// consumer.  Push() is wait-free; Pop() must only be called from the
+// consuming thread.  A Pop() that runs concurrently with a Push() may not see
+// the new element yet, so producers should notify the consumer after pushing.
+template <typename T>
+class MpscQueue {
+ public:
+  MpscQueue() : head_(new Node()), tail_(head_.load()) {}
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  ~MpscQueue() {
+    T value;
+    while (Pop(&value)) {
+    }
+    delete tail_;
+  }
+
+  void Push(T value) {
+    Node* node = new Node();
+    node->value = std::move(value);
+    Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  bool Pop(T* value) {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (!next)
+      return false;
+    *value = std::move(next->value);
+    tail_ = next;
+    delete tail;
+    return true;
+  }
+
+ private:
+  struct Node {
+    Node() : next(nullptr) {}
+    std::atomic<Node*> next;
+    T value;
+  };
+
+  // Producers append at `head_`, the consumer removes at `tail_`.  `tail_`
+  // always points at a node whose value has already been consumed.
+  std::atomic<Node*> head_;
+  Node* tail_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_SERVER_MPSC_QUEUE_H_
@@ -11,16 +11,23 @@
 #include "examples/peerconnection/server/peer_channel.h"
 
 #include <algorithm>
+#include <chrono>
+#include <climits>
 #include <cstdio>
-#include <cstdlib>
-#include <ctime>
+#include <functional>
 #include <iterator>
+#include <memory>
 #include <string>
+#include <unordered_set>
+#include <utility>
 
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "examples/peerconnection/server/data_socket.h"
+#include "examples/peerconnection/server/server_log.h"
+#include "examples/peerconnection/server/server_metrics.h"
 #include "rtc_base/checks.h"
+#include "rtc_base/crypto_random.h"
 
 // Set to the peer id of the originator when messages are being
 // exchanged between peers, but set to the id of the receiving peer
@@ -35,61 +42,164 @@
 // at this point it is not working correctly in some popular browsers.
 static const char kPeerIdHeader[] = "Pragma: ";
 
+// Carries the resume token of a new member in its sign in response.
+static const char kResumeTokenHeader[] = "Resume-Token: ";
+
 static const char* kRequestPaths[] = {
     "/wait",
     "/sign_out",
     "/message",
+    "/ws",
+    "/stats",
+    "/resume",
 };
 
 enum RequestPathIndex {
   kWait,
   kSignOut,
   kMessage,
+  kWebSocket,
+  kStats,
+  kResume,
 };
 
+// Content type of /wait responses that carry several messages at once.  The
+// body is a sequence of records in the form "<peer id>,<size>\n<data>",
+// where <peer id> has the meaning of the Pragma header and <size> is the
+// length of <data> in bytes.
+static const char kBatchContentType[] = "application/x-peerconnection-batch";
+
 const size_t kMaxNameLength = 512;
 
+const size_t kMaxRoomNameLength = 64;
+
+const int kDefaultMemberTimeoutSeconds = 30;
+
+namespace {
+
+// Hex digits of a resume token, which are drawn from the cryptographically
+// secure generator, 128 random bits in all.
+constexpr size_t kResumeTokenLength = 32;
+constexpr absl::string_view kResumeTokenDigits = "0123456789abcdef";
+
+// Compares in a time that depends on the lengths only, so that timing the
+// answers to guesses doesn't tell how much of a token was right.
+bool TokensEqual(absl::string_view a, absl::string_view b) {
+  if (a.size() != b.size())
+    return false;
+  unsigned char difference = 0;
+  for (size_t i = 0; i < a.size(); ++i)
+    difference |= static_cast<unsigned char>(a[i] ^ b[i]);
+  return difference == 0;
+}
+
+// Parses the decimal number at the start of `value` like atoi() does, but
+// without reading past the end of the view.  Returns -1 on overflow.
+int ParseLeadingInt(absl::string_view value) {
+  int result = 0;
+  for (char c : value) {
+    if (c < '0' || c > '9')
+      break;
+    if (result > (INT_MAX - (c - '0')) / 10)
+      return -1;
+    result = result * 10 + (c - '0');
+  }
+  return result;
+}
+
+std::string PeerIdHeader(int id) {
+  return kPeerIdHeader + absl::StrCat(id) + "\r\n";
+}
+
+void AppendBatchRecord(int peer_id, absl::string_view data, std::string* body) {
+  absl::StrAppend(body, peer_id, ",", data.size(), "\n");
+  body->append(data.data(), data.size());
+}
+
+// Splits the arguments of a /sign_in request into the "room" parameter and
+// the peer's name, which is made of everything else.
+void ParseSignInArguments(absl::string_view args,
+                          std::string* name,
+                          std::string* room) {
+  static constexpr absl::string_view kRoom = "room=";
+  while (!args.empty()) {
+    size_t end = args.find('&');
+    absl::string_view param = args.substr(0, end);
+    if (param.starts_with(kRoom)) {
+      room->assign(param.substr(kRoom.size()));
+    } else {
+      if (!name->empty())
+        *name += '&';
+      name->append(param.data(), param.size());
+    }
+    if (end == absl::string_view::npos)
+      break;
+    args.remove_prefix(end + 1);
+  }
+}
+
+}  // namespace
+
 //
 // ChannelMember
 //
 
-int ChannelMember::s_member_id_ = 0;
-
-ChannelMember::ChannelMember(DataSocket* socket)
+ChannelMember::ChannelMember(DataSocket* socket,
+                             int id,
+                             TimeoutQueue* timeouts,
+                             const MemberQueueLimits* limits)
     : waiting_socket_(nullptr),
-      id_(++s_member_id_),
+      id_(id),
       connected_(true),
-      timestamp_(time(nullptr)) {
+      timeouts_(timeouts),
+      limits_(limits),
+      roster_version_(0),
+      stats_(nullptr),
+      metrics_(nullptr),
+      queued_bytes_(0) {
   RTC_DCHECK(socket);
+  RTC_DCHECK(timeouts);
+  RTC_DCHECK(limits);
   RTC_DCHECK_EQ(socket->method(), DataSocket::GET);
   RTC_DCHECK(socket->PathEquals("/sign_in"));
-  name_ = socket->request_arguments();
+  ParseSignInArguments(socket->request_arguments(), &name_, &room_);
   if (name_.empty())
     name_ = "peer_" + absl::StrCat(id_);
   else if (name_.length() > kMaxNameLength)
     name_.resize(kMaxNameLength);
+  if (room_.length() > kMaxRoomNameLength)
+    room_.resize(kMaxRoomNameLength);
 
   std::replace(name_.begin(), name_.end(), ',', '_');
+  std::replace(room_.begin(), room_.end(), ',', '_');
+  timeouts_->Touch(id_);
 }
 
-ChannelMember::~ChannelMember() {}
+ChannelMember::~ChannelMember() {
+  timeouts_->Cancel(id_);
+}
 
 bool ChannelMember::is_wait_request(DataSocket* ds) const {
-  return ds && ds->PathEquals(kRequestPaths[kWait]);
+  return ds && (ds->PathEquals(kRequestPaths[kWait]) ||
+                ds->PathEquals(kRequestPaths[kWebSocket]));
 }
 
-bool ChannelMember::TimedOut() {
-  return waiting_socket_ == nullptr && (time(nullptr) - timestamp_) > 30;
+std::string ChannelMember::GetPeerIdHeader() const {
+  return PeerIdHeader(id_);
 }
 
-std::string ChannelMember::GetPeerIdHeader() const {
-  return kPeerIdHeader + absl::StrCat(id_) + "\r\n";
+void ChannelMember::OnResumed() {
+  DropWaitingSocket();
+  timeouts_->Touch(id_);
 }
 
-bool ChannelMember::NotifyOfOtherMember(const ChannelMember& other) {
-  RTC_DCHECK_NE(&other, this);
-  QueueResponse("200 OK", "text/plain", GetPeerIdHeader(), other.GetEntry());
-  return true;
+bool ChannelMember::NotifyOfOtherMember(int other_id,
+                                        const SharedPayload& entry) {
+  RTC_DCHECK_NE(other_id, id_);
+  RTC_DCHECK(entry);
+  if (stats_)
+    ++stats_->notifications;
+  return Enqueue("text/plain", id_, other_id, *entry, entry);
 }
 
 // Returns a string in the form "name,id,connected\n".
@@ -107,78 +217,310 @@ void ChannelMember::ForwardRequestToPeer(DataSocket* ds, ChannelMember* peer) {
   RTC_DCHECK(peer);
   RTC_DCHECK(ds);
 
-  std::string extra_headers(GetPeerIdHeader());
-
   if (peer == this) {
-    ds->Send("200 OK", true, ds->content_type(), extra_headers, ds->data());
+    ds->Send("200 OK", false, ds->content_type(), GetPeerIdHeader(),
+             ds->data());
   } else {
-    printf("Client %s sending to %s\n", name_.c_str(), peer->name().c_str());
-    peer->QueueResponse("200 OK", ds->content_type(), extra_headers,
-                        ds->data());
-    ds->Send("200 OK", true, "text/plain", "", "");
+    SERVER_LOG(LS_VERBOSE, "Client %s sending to %s\n", name_.c_str(),
+               peer->name().c_str());
+    peer->QueueResponse(ds->content_type(), id_, ds->data());
+    ds->Send("200 OK", false, "text/plain", "", "");
   }
 }
 
 void ChannelMember::OnClosing(DataSocket* ds) {
   if (ds == waiting_socket_) {
     waiting_socket_ = nullptr;
-    timestamp_ = time(nullptr);
+    timeouts_->Touch(id_);
   }
 }
 
-void ChannelMember::QueueResponse(const std::string& status,
-                                  const std::string& content_type,
-                                  const std::string& extra_headers,
-                                  const std::string& data) {
-  if (waiting_socket_) {
-    RTC_DCHECK(queue_.empty());
+void ChannelMember::OnSocketDrained(DataSocket* ds) {
+  if (ds == waiting_socket_ && ds->is_websocket())
+    FlushToWebSocket();
+}
+
+bool ChannelMember::QueueResponse(absl::string_view content_type,
+                                  int peer_id,
+                                  absl::string_view data) {
+  if (stats_)
+    ++stats_->messages;
+  return Enqueue(content_type, peer_id, -1, data, nullptr);
+}
+
+bool ChannelMember::QueueResponse(absl::string_view content_type,
+                                  int peer_id,
+                                  const SharedPayload& data) {
+  RTC_DCHECK(data);
+  if (stats_)
+    ++stats_->messages;
+  return Enqueue(content_type, peer_id, -1, *data, data);
+}
+
+bool ChannelMember::Enqueue(absl::string_view content_type,
+                            int peer_id,
+                            int presence_of,
+                            absl::string_view data,
+                            const SharedPayload& shared) {
+  if (!connected_)
+    return false;
+
+  if (CanDeliverNow()) {
     RTC_DCHECK_EQ(waiting_socket_->method(), DataSocket::GET);
-    bool ok =
-        waiting_socket_->Send(status, true, content_type, extra_headers, data);
+    bool ok = Deliver(waiting_socket_, content_type, peer_id, data);
     if (!ok) {
-      printf("Failed to deliver data to waiting socket\n");
+      SERVER_LOG(LS_WARNING, "Failed to deliver data to waiting socket\n");
     }
-    waiting_socket_ = nullptr;
-    timestamp_ = time(nullptr);
-  } else {
-    QueuedResponse qr;
-    qr.status = status;
-    qr.content_type = content_type;
-    qr.extra_headers = extra_headers;
-    qr.data = data;
-    queue_.push(qr);
+    if (metrics_) {
+      metrics_->queue_depth.Record(0);
+      TimeoutQueue::Clock::time_point now = TimeoutQueue::Clock::now();
+      RecordDelivery(peer_id, now, now);
+    }
+    // A WebSocket stays with the member until it closes.
+    if (!waiting_socket_->is_websocket()) {
+      waiting_socket_ = nullptr;
+      timeouts_->Touch(id_);
+    }
+    return true;
+  }
+
+  QueuedResponse qr;
+  qr.content_type = std::string(content_type);
+  qr.peer_id = peer_id;
+  qr.presence_of = presence_of;
+  // Only copy the data if nobody shares it yet.
+  qr.data = shared ? shared : std::make_shared<const std::string>(data);
+  if (metrics_)
+    qr.queued_at = TimeoutQueue::Clock::now();
+  queued_bytes_ += qr.data->size();
+  queue_.push_back(std::move(qr));
+  if (metrics_)
+    metrics_->queue_depth.Record(queue_.size());
+  return EnforceQueueLimits();
+}
+
+bool ChannelMember::CanDeliverNow() const {
+  if (!waiting_socket_)
+    return false;
+  if (!waiting_socket_->is_websocket()) {
+    RTC_DCHECK(queue_.empty());
+    return true;
+  }
+  // Keep the order, and stop writing to a WebSocket that falls behind.
+  return queue_.empty() && (!limits_->max_bytes ||
+                            waiting_socket_->pending_output_size() <
+                                limits_->max_bytes);
+}
+
+bool ChannelMember::QueueExceedsLimits() const {
+  return (limits_->max_messages && queue_.size() > limits_->max_messages) ||
+         (limits_->max_bytes && queued_bytes_ > limits_->max_bytes);
+}
+
+bool ChannelMember::EnforceQueueLimits() {
+  if (!QueueExceedsLimits())
+    return true;
+
+  if (limits_->policy == MemberQueueLimits::DISCONNECT) {
+    SERVER_LOG(LS_WARNING, "Queue limit reached, disconnecting: %s\n",
+               name_.c_str());
+    connected_ = false;
+    queue_.clear();
+    queued_bytes_ = 0;
+    DropWaitingSocket();
+    // The channel removes the member and tells the others.
+    timeouts_->Expire(id_);
+    return false;
+  }
+
+  if (limits_->policy == MemberQueueLimits::COALESCE_PRESENCE) {
+    CoalescePresenceUpdates();
+    if (!QueueExceedsLimits())
+      return true;
+  }
+
+  // The newest message is always kept, even if it exceeds the byte limit on
+  // its own.
+  size_t dropped = 0;
+  while (QueueExceedsLimits() && queue_.size() > 1) {
+    PopQueuedResponse();
+    ++dropped;
+  }
+  if (dropped) {
+    SERVER_LOG(LS_WARNING, "Queue limit reached, dropped %zu messages for %s\n",
+               dropped, name_.c_str());
+  }
+  return true;
+}
+
+void ChannelMember::CoalescePresenceUpdates() {
+  // Walk from the newest entry to the oldest and keep only the latest
+  // presence update about each peer.
+  std::unordered_set<int> updated;
+  std::deque<QueuedResponse> kept;
+  for (auto it = queue_.rbegin(); it != queue_.rend(); ++it) {
+    if (it->presence_of != -1 && !updated.insert(it->presence_of).second) {
+      queued_bytes_ -= it->data->size();
+      continue;
+    }
+    kept.push_front(std::move(*it));
+  }
+  queue_.swap(kept);
+}
+
+void ChannelMember::PopQueuedResponse() {
+  RTC_DCHECK(!queue_.empty());
+  queued_bytes_ -= queue_.front().data->size();
+  queue_.pop_front();
+}
+
+void ChannelMember::RecordDelivery(int peer_id,
+                                   TimeoutQueue::Clock::time_point queued_at,
+                                   TimeoutQueue::Clock::time_point now) {
+  // Notifications from the server carry the member's own id.
+  if (!metrics_ || peer_id == id_)
+    return;
+  metrics_->messages_relayed.Add(1);
+  metrics_->relay_latency_ns.Record(static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(now - queued_at)
+          .count()));
+}
+
+void ChannelMember::FlushToWebSocket() {
+  RTC_DCHECK(waiting_socket_ && waiting_socket_->is_websocket());
+  // Everything that piled up goes out at once, without a round trip per
+  // message, unless the peer does not keep up with reading it.
+  TimeoutQueue::Clock::time_point now;
+  if (metrics_ && !queue_.empty())
+    now = TimeoutQueue::Clock::now();
+  while (!queue_.empty() &&
+         (!limits_->max_bytes ||
+          waiting_socket_->pending_output_size() < limits_->max_bytes)) {
+    const QueuedResponse& response = queue_.front();
+    Deliver(waiting_socket_, response.content_type, response.peer_id,
+            *response.data);
+    RecordDelivery(response.peer_id, response.queued_at, now);
+    PopQueuedResponse();
   }
 }
 
 void ChannelMember::SetWaitingSocket(DataSocket* ds) {
   RTC_DCHECK_EQ(ds->method(), DataSocket::GET);
-  if (ds && !queue_.empty()) {
-    RTC_DCHECK(!waiting_socket_);
-    const QueuedResponse& response = queue_.front();
-    ds->Send(response.status, true, response.content_type,
-             response.extra_headers, response.data);
-    queue_.pop();
+  // Data that a WebSocket could not take yet may still be queued.  The
+  // client moved on to `ds`, so the old transport is not used any more.
+  DropWaitingSocket();
+  if (ds->is_websocket()) {
+    waiting_socket_ = ds;
+    timeouts_->Cancel(id_);
+    FlushToWebSocket();
+  } else if (!queue_.empty()) {
+    if (PeerChannel::IsBatchRequest(ds)) {
+      DeliverBatch(ds);
+    } else {
+      const QueuedResponse& response = queue_.front();
+      Deliver(ds, response.content_type, response.peer_id, *response.data);
+      if (metrics_) {
+        RecordDelivery(response.peer_id, response.queued_at,
+                       TimeoutQueue::Clock::now());
+      }
+      PopQueuedResponse();
+    }
+    // The peer is expected to poll again right away.
+    timeouts_->Touch(id_);
   } else {
     waiting_socket_ = ds;
+    timeouts_->Cancel(id_);
   }
 }
 
+void ChannelMember::DropWaitingSocket() {
+  if (!waiting_socket_)
+    return;
+  if (waiting_socket_->is_websocket())
+    waiting_socket_->SendWebSocketClose(kWebSocketGoingAway);
+  waiting_socket_ = nullptr;
+}
+
+bool ChannelMember::Deliver(DataSocket* ds,
+                            absl::string_view content_type,
+                            int peer_id,
+                            absl::string_view data) {
+  if (ds->is_websocket()) {
+    // The peer id takes the place of the header, on a line of its own.
+    std::string prefix = peer_id != -1 ? absl::StrCat(peer_id) : "";
+    prefix += '\n';
+    return ds->SendWebSocketMessage(prefix, data);
+  }
+  if (PeerChannel::IsBatchRequest(ds)) {
+    std::string body;
+    AppendBatchRecord(peer_id, data, &body);
+    return ds->Send("200 OK", false, kBatchContentType, GetPeerIdHeader(),
+                    body);
+  }
+  return ds->Send("200 OK", false, content_type,
+                  peer_id != -1 ? PeerIdHeader(peer_id) : "", data);
+}
+
+bool ChannelMember::DeliverBatch(DataSocket* ds) {
+  std::string body;
+  body.reserve(queued_bytes_ + queue_.size() * 16);
+  TimeoutQueue::Clock::time_point now;
+  if (metrics_)
+    now = TimeoutQueue::Clock::now();
+  while (!queue_.empty()) {
+    const QueuedResponse& response = queue_.front();
+    AppendBatchRecord(response.peer_id, *response.data, &body);
+    RecordDelivery(response.peer_id, response.queued_at, now);
+    PopQueuedResponse();
+  }
+  return ds->Send("200 OK", false, kBatchContentType, GetPeerIdHeader(), body);
+}
+
 //
 // PeerChannel
 //
 
+PeerChannel::Room::Room(const std::string& name)
+    : name(name), roster_stale(false), roster_version(0) {}
+
+PeerChannel::PeerChannel()
+    : PeerChannel(1,
+                  1,
+                  std::chrono::seconds(kDefaultMemberTimeoutSeconds),
+                  MemberQueueLimits(),
+                  TimeoutQueue::Clock::duration::zero()) {}
+
+PeerChannel::PeerChannel(int first_member_id,
+                         int member_id_stride,
+                         TimeoutQueue::Clock::duration member_timeout,
+                         const MemberQueueLimits& queue_limits,
+                         TimeoutQueue::Clock::duration presence_window)
+    : observer_(nullptr),
+      metrics_(nullptr),
+      timeouts_(member_timeout),
+      queue_limits_(queue_limits),
+      presence_window_(presence_window),
+      next_member_id_(first_member_id),
+      member_id_stride_(member_id_stride) {
+  RTC_DCHECK_GT(first_member_id, 0);
+  RTC_DCHECK_GT(member_id_stride, 0);
+}
+
 // static
 bool PeerChannel::IsPeerConnection(const DataSocket* ds) {
   RTC_DCHECK(ds);
   return (ds->method() == DataSocket::POST && ds->content_length() > 0) ||
-         (ds->method() == DataSocket::GET && ds->PathEquals("/sign_in"));
+         (ds->method() == DataSocket::GET &&
+          (ds->PathEquals("/sign_in") ||
+           ds->PathEquals(kRequestPaths[kResume])));
 }
 
-ChannelMember* PeerChannel::Lookup(DataSocket* ds) const {
+// static
+int PeerChannel::GetPeerId(const DataSocket* ds) {
   RTC_DCHECK(ds);
 
   if (ds->method() != DataSocket::GET && ds->method() != DataSocket::POST)
-    return nullptr;
+    return -1;
 
   size_t i = 0;
   for (; i < std::size(kRequestPaths); ++i) {
@@ -187,124 +529,292 @@ ChannelMember* PeerChannel::Lookup(DataSocket* ds) const {
   }
 
   if (i == std::size(kRequestPaths))
-    return nullptr;
+    return -1;
 
-  std::string args(ds->request_arguments());
+  absl::string_view args = ds->request_arguments();
   static constexpr absl::string_view kPeerId = "peer_id=";
   size_t found = args.find(kPeerId);
-  if (found == std::string::npos)
-    return nullptr;
+  if (found == absl::string_view::npos)
+    return -1;
 
-  int id = atoi(&args[found + kPeerId.size()]);
-  Members::const_iterator iter = members_.begin();
-  for (; iter != members_.end(); ++iter) {
-    if (id == (*iter)->id()) {
-      if (i == kWait)
-        (*iter)->SetWaitingSocket(ds);
-      if (i == kSignOut)
-        (*iter)->set_disconnected();
-      return *iter;
-    }
-  }
+  return ParseLeadingInt(args.substr(found + kPeerId.size()));
+}
 
-  return nullptr;
+// static
+bool PeerChannel::IsBatchRequest(const DataSocket* ds) {
+  RTC_DCHECK(ds);
+  return ds->PathEquals(kRequestPaths[kWait]) &&
+         ds->request().GetQueryParameter("batch") == "1";
 }
 
-ChannelMember* PeerChannel::IsTargetedRequest(const DataSocket* ds) const {
+// static
+int PeerChannel::GetTargetPeerId(const DataSocket* ds) {
   RTC_DCHECK(ds);
   // Regardless of GET or POST, we look for the peer_id parameter
   // only in the request_path.
-  const std::string& path = ds->request_path();
+  absl::string_view path = ds->request_path();
   size_t args = path.find('?');
-  if (args == std::string::npos)
-    return nullptr;
+  if (args == absl::string_view::npos)
+    return -1;
   size_t found;
   static constexpr absl::string_view kTargetPeerIdParam = "to=";
   do {
     found = path.find(kTargetPeerIdParam, args);
-    if (found == std::string::npos)
-      return nullptr;
+    if (found == absl::string_view::npos)
+      return -1;
     if (found == (args + 1) || path[found - 1] == '&') {
       found += kTargetPeerIdParam.size();
       break;
     }
     args = found + kTargetPeerIdParam.size();
   } while (true);
-  int id = atoi(&path[found]);
-  Members::const_iterator i = members_.begin();
-  for (; i != members_.end(); ++i) {
-    if ((*i)->id() == id) {
-      return *i;
+  return ParseLeadingInt(path.substr(found));
+}
+
+ChannelMember* PeerChannel::Find(int id) const {
+  std::unordered_map<int, MemberPosition>::const_iterator found =
+      index_.find(id);
+  return found != index_.end() ? *found->second.position : nullptr;
+}
+
+ChannelMember* PeerChannel::Lookup(DataSocket* ds) {
+  RTC_DCHECK(ds);
+
+  int id = GetPeerId(ds);
+  if (id == -1)
+    return nullptr;
+
+  ChannelMember* member = Find(id);
+  // Members that are about to be removed are gone for their peer.
+  if (member && !member->connected())
+    return nullptr;
+  if (member) {
+    if (ds->PathEquals(kRequestPaths[kWait]) ||
+        (ds->PathEquals(kRequestPaths[kWebSocket]) && ds->AcceptWebSocket())) {
+      member->SetWaitingSocket(ds);
+      waiting_sockets_[ds] = id;
+    }
+    if (ds->PathEquals(kRequestPaths[kSignOut])) {
+      member->set_disconnected();
+      signed_out_.push_back(id);
     }
   }
-  return nullptr;
+  return member;
+}
+
+ChannelMember* PeerChannel::IsTargetedRequest(const DataSocket* ds,
+                                              const ChannelMember& from) const {
+  RTC_DCHECK(ds);
+  int id = GetTargetPeerId(ds);
+  if (id == -1)
+    return nullptr;
+  ChannelMember* member = Find(id);
+  return member && member->connected() && member->room() == from.room()
+             ? member
+             : nullptr;
 }
 
 bool PeerChannel::AddMember(DataSocket* ds) {
   RTC_DCHECK(IsPeerConnection(ds));
-  ChannelMember* new_guy = new ChannelMember(ds);
+  ChannelMember* new_guy =
+      new ChannelMember(ds, next_member_id_, &timeouts_, &queue_limits_);
+  next_member_id_ += member_id_stride_;
+  Room* room = GetOrCreateRoom(new_guy->room());
+  new_guy->set_stats(&room->stats);
+  new_guy->set_metrics(metrics_);
+  std::string token;
+  RTC_CHECK(webrtc::CreateRandomString(kResumeTokenLength, kResumeTokenDigits,
+                                       &token));
+  new_guy->set_resume_token(token);
+  ++room->stats.sign_ins;
+
+  // Let the newly connected peer know about other members of the room.
+  std::string content_type;
+  std::string response =
+      BuildResponseForNewMember(room, *new_guy, &content_type);
+
   Members failures;
   BroadcastChangedState(*new_guy, &failures);
+  // The response reflects all changes so far, and the member is told about
+  // the ones that follow, including the removal of `failures`.
+  new_guy->set_roster_version(room->roster_version);
+  MemberPosition position;
+  position.room = room;
+  position.position = room->members.insert(room->members.end(), new_guy);
+  index_[new_guy->id()] = position;
+  if (metrics_)
+    metrics_->members.Set(index_.size());
   HandleDeliveryFailures(&failures);
-  members_.push_back(new_guy);
 
-  printf("New member added (total=%zu): %s\n", members_.size(),
-         new_guy->name().c_str());
+  SERVER_LOG(LS_INFO, "New member added (total=%zu, room=%zu): %s\n",
+             index_.size(), room->members.size(), new_guy->name().c_str());
 
-  // Let the newly connected peer know about other members of the channel.
-  std::string content_type;
-  std::string response = BuildResponseForNewMember(*new_guy, &content_type);
-  ds->Send("200 Added", true, content_type, new_guy->GetPeerIdHeader(),
+  ds->Send("200 Added", false, content_type,
+           new_guy->GetPeerIdHeader() + kResumeTokenHeader +
+               new_guy->resume_token() + "\r\n",
            response);
   return true;
 }
 
+void PeerChannel::ResumeMember(DataSocket* ds, ChannelMember* member) {
+  RTC_DCHECK(ds->PathEquals(kRequestPaths[kResume]));
+  RTC_DCHECK(member->connected());
+  if (!TokensEqual(ds->request().GetQueryParameter("token"),
+                   member->resume_token())) {
+    SERVER_LOG(LS_WARNING, "Rejected resume of %s with a wrong token\n",
+               member->name().c_str());
+    ds->Send("403 Forbidden", false, "text/plain", "", "Wrong resume token.");
+    return;
+  }
+  member->OnResumed();
+  SERVER_LOG(LS_INFO, "Member resumed: %s\n", member->name().c_str());
+  ds->Send("200 OK", false, "text/plain", member->GetPeerIdHeader(), "");
+}
+
 void PeerChannel::CloseAll() {
-  Members::const_iterator i = members_.begin();
-  for (; i != members_.end(); ++i) {
-    (*i)->QueueResponse("200 OK", "text/plain", "", "Server shutting down");
+  for (const auto& room : rooms_) {
+    for (ChannelMember* member : room.second->members)
+      member->QueueResponse("text/plain", -1, "Server shutting down");
   }
   DeleteAll();
 }
 
 void PeerChannel::OnClosing(DataSocket* ds) {
-  for (Members::iterator i = members_.begin(); i != members_.end(); ++i) {
-    ChannelMember* m = (*i);
-    m->OnClosing(ds);
-    if (!m->connected()) {
-      i = members_.erase(i);
-      Members failures;
-      BroadcastChangedState(*m, &failures);
-      HandleDeliveryFailures(&failures);
-      delete m;
-      if (i == members_.end())
-        break;
-    }
+  std::unordered_map<DataSocket*, int>::iterator waiting =
+      waiting_sockets_.find(ds);
+  if (waiting != waiting_sockets_.end()) {
+    // The member may have been answered on this socket already, in which
+    // case OnClosing() is a no-op for it.
+    ChannelMember* m = Find(waiting->second);
+    waiting_sockets_.erase(waiting);
+    if (m)
+      m->OnClosing(ds);
+  }
+
+  RemoveSignedOutMembers();
+  SERVER_LOG(LS_VERBOSE, "Total connected: %zu\n", index_.size());
+}
+
+void PeerChannel::OnSocketDrained(DataSocket* ds) {
+  std::unordered_map<DataSocket*, int>::iterator waiting =
+      waiting_sockets_.find(ds);
+  if (waiting == waiting_sockets_.end())
+    return;
+  ChannelMember* m = Find(waiting->second);
+  if (m)
+    m->OnSocketDrained(ds);
+}
+
+void PeerChannel::RemoveSignedOutMembers() {
+  while (!signed_out_.empty()) {
+    ChannelMember* m = Find(signed_out_.back());
+    signed_out_.pop_back();
+    if (!m)
+      continue;
+    RTC_DCHECK(!m->connected());
+    Room* room = Unlink(m);
+    Members failures;
+    BroadcastChangedState(*m, &failures);
+    HandleDeliveryFailures(&failures);
+    delete m;
+    RemoveRoomIfEmpty(room);
   }
-  printf("Total connected: %zu\n", members_.size());
 }
 
 void PeerChannel::CheckForTimeout() {
-  for (Members::iterator i = members_.begin(); i != members_.end(); ++i) {
-    ChannelMember* m = (*i);
-    if (m->TimedOut()) {
-      printf("Timeout: %s\n", m->name().c_str());
-      m->set_disconnected();
-      i = members_.erase(i);
-      Members failures;
-      BroadcastChangedState(*m, &failures);
-      HandleDeliveryFailures(&failures);
-      delete m;
-      if (i == members_.end())
-        break;
+  TimeoutQueue::Clock::time_point now = TimeoutQueue::Clock::now();
+  std::vector<int> timed_out;
+  timeouts_.PopExpired(now, &timed_out);
+
+  for (int id : timed_out) {
+    // Delivery failures of an earlier removal may have taken this one too.
+    ChannelMember* m = Find(id);
+    if (!m)
+      continue;
+    SERVER_LOG(LS_INFO, "Timeout: %s\n", m->name().c_str());
+    m->set_disconnected();
+    Room* room = Unlink(m);
+    Members failures;
+    BroadcastChangedState(*m, &failures);
+    HandleDeliveryFailures(&failures);
+    delete m;
+    RemoveRoomIfEmpty(room);
+  }
+
+  std::vector<Room*> expired;
+  for (Room* room : rooms_with_changes_) {
+    if (room->presence_deadline <= now)
+      expired.push_back(room);
+  }
+  for (Room* room : expired) {
+    rooms_with_changes_.erase(room);
+    FlushPresenceChanges(room);
+    RemoveRoomIfEmpty(room);
+  }
+}
+
+int PeerChannel::MillisecondsUntilNextTimeout() const {
+  TimeoutQueue::Clock::time_point now = TimeoutQueue::Clock::now();
+  int timeout = timeouts_.MillisecondsUntilNextDeadline(now);
+  for (const Room* room : rooms_with_changes_) {
+    int presence = 0;
+    if (room->presence_deadline > now) {
+      presence = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(
+                                      room->presence_deadline - now)
+                                      .count());
     }
+    if (timeout == -1 || presence < timeout)
+      timeout = presence;
   }
+  return timeout;
 }
 
 void PeerChannel::DeleteAll() {
-  for (Members::iterator i = members_.begin(); i != members_.end(); ++i)
-    delete (*i);
-  members_.clear();
+  for (const auto& room : rooms_) {
+    for (ChannelMember* member : room.second->members)
+      delete member;
+  }
+  rooms_.clear();
+  index_.clear();
+  remote_index_.clear();
+  rooms_with_changes_.clear();
+  waiting_sockets_.clear();
+  signed_out_.clear();
+  if (metrics_)
+    metrics_->members.Set(0);
+}
+
+PeerChannel::Room* PeerChannel::FindRoom(const std::string& name) const {
+  auto found = rooms_.find(name);
+  return found != rooms_.end() ? found->second.get() : nullptr;
+}
+
+PeerChannel::Room* PeerChannel::GetOrCreateRoom(const std::string& name) {
+  std::unique_ptr<Room>& room = rooms_[name];
+  if (!room)
+    room = std::make_unique<Room>(name);
+  return room.get();
+}
+
+void PeerChannel::RemoveRoomIfEmpty(Room* room) {
+  RTC_DCHECK(room);
+  if (!room->members.empty() || !room->remote_members.empty())
+    return;
+  // Nobody is left to tell about the pending changes.
+  rooms_with_changes_.erase(room);
+  rooms_.erase(room->name);
+}
+
+PeerChannel::Room* PeerChannel::Unlink(ChannelMember* member) {
+  std::unordered_map<int, MemberPosition>::iterator found =
+      index_.find(member->id());
+  RTC_DCHECK(found != index_.end());
+  Room* room = found->second.room;
+  room->members.erase(found->second.position);
+  index_.erase(found);
+  if (metrics_)
+    metrics_->members.Set(index_.size());
+  return room;
 }
 
 void PeerChannel::BroadcastChangedState(const ChannelMember& member,
@@ -313,21 +823,18 @@ void PeerChannel::BroadcastChangedState(const ChannelMember& member,
   RTC_DCHECK(delivery_failures);
 
   if (!member.connected()) {
-    printf("Member disconnected: %s\n", member.name().c_str());
-  }
-
-  Members::iterator i = members_.begin();
-  for (; i != members_.end(); ++i) {
-    if (&member != (*i)) {
-      if (!(*i)->NotifyOfOtherMember(member)) {
-        (*i)->set_disconnected();
-        delivery_failures->push_back(*i);
-        i = members_.erase(i);
-        if (i == members_.end())
-          break;
-      }
-    }
+    SERVER_LOG(LS_INFO, "Member disconnected: %s\n", member.name().c_str());
   }
+
+  if (observer_)
+    observer_->OnMemberChanged(member);
+
+  Room* room = FindRoom(member.room());
+  RTC_DCHECK(room);
+  // All members share the one copy of the entry.
+  SharedPayload entry = std::make_shared<const std::string>(member.GetEntry());
+  OnPresenceChange(room, member.id(), entry, member.connected(),
+                   delivery_failures);
 }
 
 void PeerChannel::HandleDeliveryFailures(Members* failures) {
@@ -343,20 +850,222 @@ void PeerChannel::HandleDeliveryFailures(Members* failures) {
   }
 }
 
-// Builds a simple list of "name,id\n" entries for each member.
-std::string PeerChannel::BuildResponseForNewMember(const ChannelMember& member,
+void PeerChannel::OnRemoteMemberChanged(int id,
+                                        const std::string& room_name,
+                                        const SharedPayload& entry,
+                                        bool connected) {
+  RTC_DCHECK(!Find(id));
+  Room* room;
+  if (connected) {
+    room = GetOrCreateRoom(room_name);
+    // Nodes that (re)connect repeat what may already be known.
+    SharedPayload& known = room->remote_members[id];
+    bool repeated = known != nullptr;
+    known = entry;
+    remote_index_[id] = room;
+    if (repeated)
+      return;
+  } else {
+    room = FindRoom(room_name);
+    if (!room || !room->remote_members.erase(id))
+      return;
+    remote_index_.erase(id);
+  }
+
+  // Members that overflow under the disconnect policy are removed when
+  // their timeout fires.
+  OnPresenceChange(room, id, entry, connected, nullptr);
+  RemoveRoomIfEmpty(room);
+}
+
+bool PeerChannel::HasRemoteMember(int id, const ChannelMember& from) const {
+  std::unordered_map<int, Room*>::const_iterator found =
+      remote_index_.find(id);
+  return found != remote_index_.end() && found->second->name == from.room();
+}
+
+void PeerChannel::DropRemoteMembers(const std::function<bool(int)>& filter) {
+  // Rooms go away with their last peer, so they are kept by name.
+  std::vector<std::pair<int, std::string>> dropped;
+  for (const auto& remote : remote_index_) {
+    if (filter(remote.first))
+      dropped.emplace_back(remote.first, remote.second->name);
+  }
+  for (const auto& remote : dropped) {
+    Room* room = FindRoom(remote.second);
+    RTC_DCHECK(room);
+    // Turn the "name,id,1\n" entry into a disconnect.
+    std::string entry = *room->remote_members[remote.first];
+    RTC_DCHECK(entry.size() > 2 && entry[entry.size() - 2] == '1');
+    entry[entry.size() - 2] = '0';
+    OnRemoteMemberChanged(remote.first, remote.second,
+                          std::make_shared<const std::string>(entry), false);
+  }
+}
+
+void PeerChannel::GetMembers(std::vector<const ChannelMember*>* members) const {
+  RTC_DCHECK(members);
+  for (const auto& index : index_) {
+    const ChannelMember* member = *index.second.position;
+    if (member->connected())
+      members->push_back(member);
+  }
+}
+
+void PeerChannel::GetRoomStats(RoomStatsMap* stats) const {
+  RTC_DCHECK(stats);
+  for (const auto& entry : rooms_) {
+    const Room& room = *entry.second;
+    if (room.members.empty())
+      continue;
+    RoomStats local = room.stats;
+    local.members = static_cast<size_t>(
+        std::count_if(room.members.begin(), room.members.end(),
+                      [](const ChannelMember* m) { return m->connected(); }));
+    (*stats)[room.name].Add(local);
+  }
+}
+
+void PeerChannel::OnPresenceChange(Room* room,
+                                   int id,
+                                   const SharedPayload& entry,
+                                   bool connected,
+                                   Members* delivery_failures) {
+  ++room->roster_version;
+  if (connected)
+    room->roster += *entry;
+  else
+    room->roster_stale = true;
+
+  if (presence_window_ == TimeoutQueue::Clock::duration::zero()) {
+    uint64_t notified = 0;
+    Members::iterator i = room->members.begin();
+    while (i != room->members.end()) {
+      ChannelMember* m = *i;
+      ++i;
+      if (m->id() == id)
+        continue;
+      ++notified;
+      if (!m->NotifyOfOtherMember(id, entry) && delivery_failures) {
+        m->set_disconnected();
+        delivery_failures->push_back(m);
+        Unlink(m);
+      }
+    }
+    if (metrics_)
+      metrics_->broadcast_fanout.Record(notified);
+    return;
+  }
+
+  std::unordered_map<int, size_t>::iterator found =
+      room->presence_index.find(id);
+  if (found != room->presence_index.end()) {
+    PresenceChange& change = room->presence_changes[found->second];
+    change.entry = entry;
+    change.connected = connected;
+    change.last_version = room->roster_version;
+    return;
+  }
+
+  if (room->presence_changes.empty()) {
+    room->presence_deadline = TimeoutQueue::Clock::now() + presence_window_;
+    rooms_with_changes_.insert(room);
+  }
+  PresenceChange change;
+  change.id = id;
+  change.entry = entry;
+  change.connected = connected;
+  change.joined = connected;
+  change.first_version = room->roster_version;
+  change.last_version = room->roster_version;
+  room->presence_index[id] = room->presence_changes.size();
+  room->presence_changes.push_back(std::move(change));
+}
+
+void PeerChannel::FlushPresenceChanges(Room* room) {
+  std::vector<PresenceChange> changes;
+  changes.swap(room->presence_changes);
+  room->presence_index.clear();
+  if (changes.empty())
+    return;
+
+  // Everybody who signed in before the window started gets the same delta,
+  // so it is built once and shared.
+  const uint64_t window_start = changes.front().first_version;
+  SharedPayload common;
+  Members failures;
+  uint64_t notified = 0;
+  Members::iterator i = room->members.begin();
+  while (i != room->members.end()) {
+    ChannelMember* m = *i;
+    ++i;
+    SharedPayload delta = common;
+    if (!delta || m->roster_version() >= window_start) {
+      delta =
+          std::make_shared<const std::string>(BuildPresenceDelta(changes, *m));
+      if (m->roster_version() < window_start)
+        common = delta;
+    }
+    if (delta->empty())
+      continue;
+    ++notified;
+    // A delta about a single peer can still be coalesced in the queue.
+    int other_id = -1;
+    if (std::count(delta->begin(), delta->end(), '\n') == 1) {
+      other_id = ParseLeadingInt(
+          absl::string_view(*delta).substr(delta->find(',') + 1));
+    }
+    if (!m->NotifyOfOtherMember(other_id, delta)) {
+      m->set_disconnected();
+      failures.push_back(m);
+      Unlink(m);
+    }
+  }
+  if (metrics_)
+    metrics_->broadcast_fanout.Record(notified);
+  HandleDeliveryFailures(&failures);
+}
+
+// static
+std::string PeerChannel::BuildPresenceDelta(
+    const std::vector<PresenceChange>& changes,
+    const ChannelMember& member) {
+  std::string delta;
+  for (const PresenceChange& change : changes) {
+    // Leave out what the member's sign in response already showed, and
+    // peers that came and went without the member ever seeing them.
+    if (change.id == member.id() ||
+        change.last_version <= member.roster_version() ||
+        (change.joined && !change.connected &&
+         change.first_version > member.roster_version())) {
+      continue;
+    }
+    delta += *change.entry;
+  }
+  return delta;
+}
+
+std::string PeerChannel::BuildResponseForNewMember(Room* room,
+                                                   const ChannelMember& member,
                                                    std::string* content_type) {
+  RTC_DCHECK(room);
   RTC_DCHECK(content_type);
 
-  *content_type = "text/plain";
-  // The peer itself will always be the first entry.
-  std::string response(member.GetEntry());
-  for (Members::iterator i = members_.begin(); i != members_.end(); ++i) {
-    if (member.id() != (*i)->id()) {
-      RTC_DCHECK((*i)->connected());
-      response += (*i)->GetEntry();
+  // Rebuilding once after peers left keeps a storm of sign ins linear.
+  if (room->roster_stale) {
+    room->roster.clear();
+    for (const ChannelMember* m : room->members) {
+      if (m->connected() && member.id() != m->id())
+        room->roster += m->GetEntry();
     }
+    for (const auto& remote : room->remote_members)
+      room->roster += *remote.second;
+    room->roster_stale = false;
   }
 
+  *content_type = "text/plain";
+  // The peer itself will always be the first entry.
+  std::string response(member.GetEntry());
+  response += room->roster;
   return response;
 }
@@ -11,18 +11,81 @@
 #ifndef EXAMPLES_PEERCONNECTION_SERVER_PEER_CHANNEL_H_
 #define EXAMPLES_PEERCONNECTION_SERVER_PEER_CHANNEL_H_
 
-#include <time.h>
-
-#include <queue>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "absl/strings/string_view.h"
+#include "examples/peerconnection/server/timeout_queue.h"
+
 class DataSocket;
+struct ServerMetrics;
+
+// A message body that is shared by all the members it is queued for, e.g.
+// a presence update that is broadcast to every member.
+typedef std::shared_ptr<const std::string> SharedPayload;
+
+// Bounds the messages that are queued for a member while it is not waiting
+// for them, or while its WebSocket is not taking them fast enough.
+struct MemberQueueLimits {
+  enum OverflowPolicy {
+    // Drop the oldest messages until the queue is within its limits.
+    DROP_OLDEST,
+    // Drop presence updates that a later update about the same peer
+    // supersedes first, then the oldest messages.
+    COALESCE_PRESENCE,
+    // Disconnect the member, as if it had timed out.
+    DISCONNECT,
+  };
+
+  MemberQueueLimits()
+      : max_messages(0), max_bytes(0), policy(COALESCE_PRESENCE) {}
+
+  // Zero means no limit.
+  size_t max_messages;
+  size_t max_bytes;
+  OverflowPolicy policy;
+};
+
+// Counters of a room, for the /rooms page.
+struct RoomStats {
+  RoomStats() : members(0), sign_ins(0), messages(0), notifications(0) {}
+
+  void Add(const RoomStats& other) {
+    members += other.members;
+    sign_ins += other.sign_ins;
+    messages += other.messages;
+    notifications += other.notifications;
+  }
+
+  // Connected members.
+  size_t members;
+  uint64_t sign_ins;
+  // Messages from peers and presence notifications queued for members.
+  uint64_t messages;
+  uint64_t notifications;
+};
+
+// Room statistics keyed by room name.
+typedef std::map<std::string, RoomStats> RoomStatsMap;
 
 // Represents a single peer connected to the server.
 class ChannelMember {
  public:
-  explicit ChannelMember(DataSocket* socket);
+  // The member's timeout is tracked in `timeouts`, which must outlive it,
+  // as must `limits`.
+  ChannelMember(DataSocket* socket,
+                int id,
+                TimeoutQueue* timeouts,
+                const MemberQueueLimits* limits);
   ~ChannelMember();
 
   bool connected() const { return connected_; }
@@ -31,11 +94,38 @@ class ChannelMember {
   bool is_wait_request(DataSocket* ds) const;
   const std::string& name() const { return name_; }
 
-  bool TimedOut();
+  // The room the member signed in to, empty for the default room.
+  const std::string& room() const { return room_; }
+
+  // Counts what is queued for the member in `stats`, which must outlive it.
+  void set_stats(RoomStats* stats) { stats_ = stats; }
+
+  // Records the queueing and delivery of messages in `metrics`, which must
+  // outlive the member, or nowhere if null.
+  void set_metrics(ServerMetrics* metrics) { metrics_ = metrics; }
 
   std::string GetPeerIdHeader() const;
 
-  bool NotifyOfOtherMember(const ChannelMember& other);
+  // The secret that lets the peer resume its session after it lost its
+  // connections, which it learns from its sign in response.
+  const std::string& resume_token() const { return resume_token_; }
+  void set_resume_token(const std::string& token) { resume_token_ = token; }
+
+  // Called when the peer resumed its session.  The socket it was waiting on,
+  // if the server still has one, is gone for the peer; what is queued stays
+  // for the next one it waits on.
+  void OnResumed();
+
+  // Tells the member that the peer `other_id` changed, where `entry` is the
+  // peer's GetEntry().  `entry` may also hold the entries of several peers,
+  // in which case `other_id` is -1.  Returns false if the member has to be
+  // disconnected.
+  bool NotifyOfOtherMember(int other_id, const SharedPayload& entry);
+
+  // The roster version of the channel that the member's sign in response
+  // reflected.  Presence changes up to that version are not sent to it.
+  uint64_t roster_version() const { return roster_version_; }
+  void set_roster_version(uint64_t version) { roster_version_ = version; }
 
   // Returns a string in the form "name,id\n".
   std::string GetEntry() const;
@@ -44,53 +134,180 @@ class ChannelMember {
 
   void OnClosing(DataSocket* ds);
 
-  void QueueResponse(const std::string& status,
-                     const std::string& content_type,
-                     const std::string& extra_headers,
-                     const std::string& data);
+  // Called when the WebSocket `ds` has written all its output.
+  void OnSocketDrained(DataSocket* ds);
+
+  // Delivers `data` to the peer, or queues a copy of it until the peer waits
+  // for it.  `peer_id` is the id of the peer the data comes from, or of this
+  // member for notifications from the server, and is sent in the peer id
+  // header.  It may be -1 to leave out the header.  Returns false if the
+  // data was not accepted because the member is disconnected.
+  bool QueueResponse(absl::string_view content_type,
+                     int peer_id,
+                     absl::string_view data);
 
+  // Like above, but queues a reference to `data` instead of a copy.
+  bool QueueResponse(absl::string_view content_type,
+                     int peer_id,
+                     const SharedPayload& data);
+
+  // Hands `ds` to the member to deliver queued data on.  A hanging /wait
+  // request receives a single response; a WebSocket receives everything
+  // that is queued, and later data too, until it closes.  A socket that
+  // was waiting before is let go, and a WebSocket among them is closed.
   void SetWaitingSocket(DataSocket* ds);
 
  protected:
   struct QueuedResponse {
-    std::string status, content_type, extra_headers, data;
+    std::string content_type;
+    int peer_id;
+    // The id of the peer that a presence update is about, or -1 for
+    // messages.
+    int presence_of;
+    SharedPayload data;
+    // Only set if the member has metrics.
+    TimeoutQueue::Clock::time_point queued_at;
   };
 
+  // Delivers or queues a response.  `shared` is either null or holds
+  // `data`.
+  bool Enqueue(absl::string_view content_type,
+               int peer_id,
+               int presence_of,
+               absl::string_view data,
+               const SharedPayload& shared);
+
+  // True if data can be written to `waiting_socket_` right away.
+  bool CanDeliverNow() const;
+
+  // Applies the overflow policy if the queue exceeds its limits.  Returns
+  // false if the member got disconnected.
+  bool EnforceQueueLimits();
+  bool QueueExceedsLimits() const;
+  void CoalescePresenceUpdates();
+  void PopQueuedResponse();
+
+  // Records that a response with `peer_id` queued at `queued_at` was
+  // delivered at `now`, if it is a message from another peer.
+  void RecordDelivery(int peer_id,
+                      TimeoutQueue::Clock::time_point queued_at,
+                      TimeoutQueue::Clock::time_point now);
+
+  // Writes queued data to the WebSocket until it is either empty or the
+  // socket's backlog reaches the byte limit.
+  void FlushToWebSocket();
+
+  // Sends a response on the hanging /wait request or WebSocket `ds`.
+  bool Deliver(DataSocket* ds,
+               absl::string_view content_type,
+               int peer_id,
+               absl::string_view data);
+
+  // Sends everything that is queued to the batch request `ds` in one
+  // response.
+  bool DeliverBatch(DataSocket* ds);
+
+  // Forgets `waiting_socket_`, and closes it if it is a WebSocket.
+  void DropWaitingSocket();
+
   DataSocket* waiting_socket_;
   int id_;
   bool connected_;
-  time_t timestamp_;
+  // The member times out if it is not waiting on a socket for longer than
+  // the timeout of this queue.
+  TimeoutQueue* timeouts_;
+  const MemberQueueLimits* limits_;
+  uint64_t roster_version_;
+  RoomStats* stats_;
+  ServerMetrics* metrics_;
   std::string name_;
-  std::queue<QueuedResponse> queue_;
-  static int s_member_id_;
+  std::string room_;
+  std::string resume_token_;
+  std::deque<QueuedResponse> queue_;
+  // Total size of the data in `queue_`.
+  size_t queued_bytes_;
 };
 
-// Manages all currently connected peers.
+// Manages all currently connected peers.  Peers sign in to a room, which
+// is chosen by the "room" parameter of /sign_in, and only see the presence
+// of and exchange messages with the members of their room.
 class PeerChannel {
  public:
-  typedef std::vector<ChannelMember*> Members;
+  // Members are kept in the order they signed in.  Iterators into the list
+  // stay valid until the member is removed, which lets `index_` map ids to
+  // list positions for constant time lookup and removal.
+  typedef std::list<ChannelMember*> Members;
+
+  // Receives membership changes of this channel so that they can be
+  // propagated to other channels serving the same set of peers.
+  class Observer {
+   public:
+    virtual void OnMemberChanged(const ChannelMember& member) = 0;
 
-  PeerChannel() {}
+   protected:
+    virtual ~Observer() {}
+  };
+
+  PeerChannel();
+
+  // Assigns member ids `first_member_id`, `first_member_id + member_id_stride`
+  // and so on, so that several channels can hand out ids that never collide.
+  // Members that are not waiting for a message are dropped after
+  // `member_timeout`, and the messages queued for them are bounded by
+  // `queue_limits`.  Presence changes are collected for `presence_window`
+  // and then sent as one notification per member; a zero window sends each
+  // change right away.
+  PeerChannel(int first_member_id,
+              int member_id_stride,
+              TimeoutQueue::Clock::duration member_timeout,
+              const MemberQueueLimits& queue_limits,
+              TimeoutQueue::Clock::duration presence_window);
 
   ~PeerChannel() { DeleteAll(); }
 
-  const Members& members() const { return members_; }
+  void set_observer(Observer* observer) { observer_ = observer; }
+
+  // Where the members and presence broadcasts of the channel are counted.
+  // Must outlive the channel.
+  void set_metrics(ServerMetrics* metrics) { metrics_ = metrics; }
 
   // Returns true if the request should be treated as a new ChannelMember
   // request.  Otherwise the request is not peerconnection related.
   static bool IsPeerConnection(const DataSocket* ds);
 
+  // Returns the value of the "peer_id" parameter of a /wait, /sign_out,
+  // /message or /resume request, or -1 if there is none.
+  static int GetPeerId(const DataSocket* ds);
+
+  // Returns true for a /wait request with a "batch=1" parameter, which asks
+  // for all queued messages in one response instead of one per request.
+  static bool IsBatchRequest(const DataSocket* ds);
+
+  // Returns the value of the "to" parameter of a request, or -1 if there is
+  // none.
+  static int GetTargetPeerId(const DataSocket* ds);
+
+  // Returns the connected peer with the given id, or nullptr.
+  ChannelMember* Find(int id) const;
+
   // Finds a connected peer that's associated with the `ds` socket.
-  ChannelMember* Lookup(DataSocket* ds) const;
+  ChannelMember* Lookup(DataSocket* ds);
 
-  // Checks if the request has a "peer_id" parameter and if so, looks up the
-  // peer for which the request is targeted at.
-  ChannelMember* IsTargetedRequest(const DataSocket* ds) const;
+  // Checks if the request has a "to" parameter and if so, looks up the
+  // peer in the room of `from` that the request is targeted at.
+  ChannelMember* IsTargetedRequest(const DataSocket* ds,
+                                   const ChannelMember& from) const;
 
   // Adds a new ChannelMember instance to the list of connected peers and
   // associates it with the socket.
   bool AddMember(DataSocket* ds);
 
+  // Answers the /resume request `ds` of `member`.  If it carries the
+  // member's resume token, the member continues on new connections with its
+  // id and the messages queued for it, and the other peers never see it
+  // leave.  Members can resume until they time out.
+  void ResumeMember(DataSocket* ds, ChannelMember* member);
+
   // Closes all connections and sends a "shutting down" message to all
   // connected peers.
   void CloseAll();
@@ -99,20 +316,142 @@ class PeerChannel {
   // connection went dead).
   void OnClosing(DataSocket* ds);
 
+  // Called when a socket has written all of its buffered output.
+  void OnSocketDrained(DataSocket* ds);
+
+  // Removes the members that signed out and tells the others about it.
+  // Called once the sign out request has been answered.
+  void RemoveSignedOutMembers();
+
+  // Removes the members whose timeout expired and sends the presence
+  // changes whose window has ended.
   void CheckForTimeout();
 
+  // Returns how long the event loop may sleep before CheckForTimeout() has
+  // to be called again, in milliseconds, or -1 if nothing is pending.
+  int MillisecondsUntilNextTimeout() const;
+
+  // Records a membership change of a peer in `room` that is owned by
+  // another channel and notifies the local members of the room about it.
+  // `entry` is the value of ChannelMember::GetEntry() for that peer.
+  void OnRemoteMemberChanged(int id,
+                             const std::string& room,
+                             const SharedPayload& entry,
+                             bool connected);
+
+  // Returns true if a peer owned by another channel is known under `id`
+  // in the room of `from`.
+  bool HasRemoteMember(int id, const ChannelMember& from) const;
+
+  // Forgets the peers owned by other channels whose id passes `filter`, as
+  // if they had disconnected, e.g. because the node serving them is gone.
+  void DropRemoteMembers(const std::function<bool(int)>& filter);
+
+  // Appends all connected local members to `members`.
+  void GetMembers(std::vector<const ChannelMember*>* members) const;
+
+  // Adds the counters of the rooms with local members to `stats`.
+  void GetRoomStats(RoomStatsMap* stats) const;
+
  protected:
+  // A change of a peer's presence that is waiting for the end of the
+  // presence window.  Later changes of the same peer replace `entry`.
+  struct PresenceChange {
+    int id;
+    SharedPayload entry;
+    bool connected;
+    // True if the first change in the window was the peer joining.
+    bool joined;
+    // Roster versions of the first and the latest change.
+    uint64_t first_version;
+    uint64_t last_version;
+  };
+
+  // The peers of one room, local and remote, and the presence changes
+  // that are waiting to be sent to its members.  A room exists while it
+  // has any peers.
+  struct Room {
+    explicit Room(const std::string& name);
+
+    const std::string name;
+    Members members;
+    // Entries of the peers owned by other channels, keyed by member id.
+    std::unordered_map<int, SharedPayload> remote_members;
+    // The entries of all connected peers, for sign in responses.  New peers
+    // are appended; it is rebuilt on the next sign in after a peer left.
+    std::string roster;
+    bool roster_stale;
+    // Incremented with every presence change.
+    uint64_t roster_version;
+    // Changes of the current presence window, in the order of their first
+    // change, and the index of each peer's change.
+    std::vector<PresenceChange> presence_changes;
+    std::unordered_map<int, size_t> presence_index;
+    TimeoutQueue::Clock::time_point presence_deadline;
+    RoomStats stats;
+  };
+
+  struct MemberPosition {
+    Room* room;
+    Members::iterator position;
+  };
+
   void DeleteAll();
+
+  Room* FindRoom(const std::string& name) const;
+  Room* GetOrCreateRoom(const std::string& name);
+  void RemoveRoomIfEmpty(Room* room);
+
+  // Removes `member` from its room and `index_` without deleting it, and
+  // returns the room.
+  Room* Unlink(ChannelMember* member);
+
   void BroadcastChangedState(const ChannelMember& member,
                              Members* delivery_failures);
   void HandleDeliveryFailures(Members* failures);
 
-  // Builds a simple list of "name,id\n" entries for each member.
-  std::string BuildResponseForNewMember(const ChannelMember& member,
+  // Updates the roster of `room` and either notifies its members of the
+  // change right away or records it for the end of the presence window.
+  void OnPresenceChange(Room* room,
+                        int id,
+                        const SharedPayload& entry,
+                        bool connected,
+                        Members* delivery_failures);
+
+  // Sends each member of `room` one notification with the changes it has
+  // not seen.
+  void FlushPresenceChanges(Room* room);
+
+  // Returns the entries of `changes` that `member` needs to be told about.
+  static std::string BuildPresenceDelta(
+      const std::vector<PresenceChange>& changes,
+      const ChannelMember& member);
+
+  // Returns the member's entry followed by the entries of all other
+  // connected peers in `room`.
+  std::string BuildResponseForNewMember(Room* room,
+                                        const ChannelMember& member,
                                         std::string* content_type);
 
  protected:
-  Members members_;
+  std::unordered_map<std::string, std::unique_ptr<Room>> rooms_;
+  std::unordered_map<int, MemberPosition> index_;
+  // The rooms of the peers owned by other channels, keyed by member id.
+  std::unordered_map<int, Room*> remote_index_;
+  // Rooms with changes in their presence window.
+  std::unordered_set<Room*> rooms_with_changes_;
+  // Sockets that were handed to a member as its hanging /wait, mapped to the
+  // id of that member.  Entries are removed when the socket closes.
+  std::unordered_map<DataSocket*, int> waiting_sockets_;
+  // Ids of members that signed out and are removed once their socket closes.
+  std::vector<int> signed_out_;
+  Observer* observer_;
+  ServerMetrics* metrics_;
+  TimeoutQueue timeouts_;
+  const MemberQueueLimits queue_limits_;
+  const TimeoutQueue::Clock::duration presence_window_;
+  int next_member_id_;
+  const int member_id_stride_;
 };
 
 #endif  // EXAMPLES_PEERCONNECTION_SERVER_PEER_CHANNEL_H_
@@ -0,0 +1,228 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+// Signs members in to a PeerChannel, routes messages between them and signs
+// them out and back in, and reports what a request costs for channels of
+// different sizes.  The requests are made over one socket pair and handled
+// as ServerWorker handles them, without an event loop in between, so that
+// only the channel is measured.
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "examples/peerconnection/server/data_socket.h"
+#include "examples/peerconnection/server/peer_channel.h"
+#include "examples/peerconnection/server/server_log.h"
+#include "rtc_base/checks.h"
+
+ABSL_FLAG(std::string,
+          members,
+          "10,100,1000,10000,100000",
+          "Comma separated sizes of the channels to measure.");
+ABSL_FLAG(int, room_size, 10, "Members per room.");
+ABSL_FLAG(int,
+          messages,
+          100000,
+          "Messages to route in each channel.  Each is followed by a /wait "
+          "of its receiver, and a tenth as many members sign out and back "
+          "in.");
+ABSL_FLAG(int, message_bytes, 250, "Size of a message.");
+
+namespace {
+
+// The server end of a connection whose client end is written to and read
+// from right here.
+class Connection {
+ public:
+  Connection() : client_(-1) {
+    int fds[2];
+    RTC_CHECK_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    server_ = std::make_unique<DataSocket>(fds[0]);
+    RTC_CHECK(server_->SetNonBlocking());
+    client_ = fds[1];
+    RTC_CHECK_EQ(fcntl(client_, F_SETFL, O_NONBLOCK), 0);
+  }
+  ~Connection() { close(client_); }
+
+  // Sends `request` and handles it on `channel`.
+  void Request(PeerChannel* channel, absl::string_view request) {
+    RTC_CHECK_EQ(send(client_, request.data(), request.size(), 0),
+                 static_cast<ssize_t>(request.size()));
+    bool socket_done = false;
+    while (!server_->request_received()) {
+      server_->OnDataAvailable(&socket_done);
+      RTC_CHECK(!socket_done);
+    }
+    Handle(channel);
+    channel->RemoveSignedOutMembers();
+    RTC_CHECK(server_->response_sent());
+    server_->Clear();
+
+    char response[64 * 1024];
+    while (recv(client_, response, sizeof(response), 0) > 0) {
+    }
+  }
+
+ private:
+  // The part of ServerWorker::HandleRequest() that members see.
+  void Handle(PeerChannel* channel) {
+    DataSocket* s = server_.get();
+    ChannelMember* member = channel->Lookup(s);
+    if (!member) {
+      RTC_CHECK(s->PathEquals("/sign_in"));
+      channel->AddMember(s);
+    } else if (member->is_wait_request(s)) {
+      // Answered from the queue of the member, which the message before
+      // filled.
+    } else if (ChannelMember* target = channel->IsTargetedRequest(s, *member)) {
+      member->ForwardRequestToPeer(s, target);
+    } else {
+      RTC_CHECK(s->PathEquals("/sign_out"));
+      s->Send("200 OK", false, "text/plain", "", "");
+    }
+  }
+
+  std::unique_ptr<DataSocket> server_;
+  int client_;
+};
+
+// Members are in rooms of `room_size`, except for the last room, which also
+// takes the ones that are left over.
+struct Rooms {
+  int Of(int slot) const {
+    return std::min(slot / room_size, std::max(num_members / room_size, 1) - 1);
+  }
+  int Start(int room) const { return room * room_size; }
+  int End(int room) const {
+    return Of(num_members - 1) == room ? num_members : Start(room + 1);
+  }
+
+  int num_members;
+  int room_size;
+};
+
+std::string SignIn(int slot, const Rooms& rooms) {
+  return absl::StrCat("GET /sign_in?member", slot, "&room=room",
+                      rooms.Of(slot), " HTTP/1.1\r\n\r\n");
+}
+
+double Microseconds(std::chrono::steady_clock::duration elapsed, int count) {
+  return std::chrono::duration<double, std::micro>(elapsed).count() / count;
+}
+
+void Run(int num_members, int room_size, int num_messages,
+         const std::string& message) {
+  const Rooms rooms = {num_members, room_size};
+  Connection connection;
+  PeerChannel channel;
+  // The channel numbers its members from 1 in the order they sign in.
+  std::vector<int> ids(num_members);
+  int next_id = 1;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int slot = 0; slot < num_members; ++slot) {
+    connection.Request(&channel, SignIn(slot, rooms));
+    ids[slot] = next_id++;
+  }
+  auto sign_in_time = std::chrono::steady_clock::now() - start;
+  RTC_CHECK(channel.Find(ids.back()));
+
+  // Members write to the next member of their room, who picks the message
+  // up right away.
+  std::mt19937 random(1);
+  std::uniform_int_distribution<int> slots(0, num_members - 1);
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_messages; ++i) {
+    int from = slots(random);
+    int room = rooms.Of(from);
+    int to = from + 1 < rooms.End(room) ? from + 1 : rooms.Start(room);
+    connection.Request(
+        &channel,
+        absl::StrCat("POST /message?peer_id=", ids[from], "&to=", ids[to],
+                     " HTTP/1.1\r\nContent-Type: text/plain\r\n"
+                     "Content-Length: ",
+                     message.size(), "\r\n\r\n", message));
+    connection.Request(&channel, absl::StrCat("GET /wait?peer_id=", ids[to],
+                                              " HTTP/1.1\r\n\r\n"));
+  }
+  auto message_time = std::chrono::steady_clock::now() - start;
+
+  const int num_churns = std::max(num_messages / 10, 1);
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_churns; ++i) {
+    int slot = slots(random);
+    connection.Request(&channel, absl::StrCat("GET /sign_out?peer_id=",
+                                              ids[slot], " HTTP/1.1\r\n\r\n"));
+    RTC_CHECK(!channel.Find(ids[slot]));
+    connection.Request(&channel, SignIn(slot, rooms));
+    ids[slot] = next_id++;
+  }
+  auto churn_time = std::chrono::steady_clock::now() - start;
+  RTC_CHECK(channel.Find(next_id - 1));
+
+  printf("%7i members: sign_in %6.2f us, message and wait %6.2f us, "
+         "sign_out and sign_in %6.2f us per request\n",
+         num_members, Microseconds(sign_in_time, num_members),
+         Microseconds(message_time, 2 * num_messages),
+         Microseconds(churn_time, 2 * num_churns));
+  fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(
+      "Example usage: ./peer_channel_benchmark --members=10,100000\n");
+  absl::ParseCommandLine(argc, argv);
+
+  const int room_size = absl::GetFlag(FLAGS_room_size);
+  const int num_messages = absl::GetFlag(FLAGS_messages);
+  if (room_size < 2 || num_messages < 1) {
+    fprintf(stderr, "--room_size must be at least 2 and --messages "
+                    "positive\n");
+    return 1;
+  }
+  const std::string message(std::max(absl::GetFlag(FLAGS_message_bytes), 1),
+                            'x');
+
+  const std::string members = absl::GetFlag(FLAGS_members);
+  std::vector<int> sizes;
+  for (absl::string_view size : absl::StrSplit(members, ',')) {
+    int num_members = 0;
+    if (!absl::SimpleAtoi(size, &num_members) || num_members < 2) {
+      fprintf(stderr, "%.*s is not a channel size of at least 2\n",
+              static_cast<int>(size.size()), size.data());
+      return 1;
+    }
+    sizes.push_back(num_members);
+  }
+
+  ServerLog::set_level(ServerLog::LS_WARNING);
+  for (int num_members : sizes)
+    Run(num_members, room_size, num_messages, message);
+  return 0;
+}
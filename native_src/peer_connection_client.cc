@@ -11,30 +11,107 @@
 #include "examples/peerconnection/client/peer_connection_client.h"
 
 #include <cerrno>
+#include <charconv>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
-#include <cstdlib>
 #include <cstring>
 #include <memory>
 #include <string>
+#include <utility>
 
+#include "absl/strings/string_view.h"
 #include "api/async_dns_resolver.h"
 #include "api/task_queue/pending_task_safety_flag.h"
 #include "api/units/time_delta.h"
 #include "examples/peerconnection/client/defaults.h"
+#include "examples/peerconnection/client/http_response_parser.h"
+#include "examples/peerconnection/client/signaling_codec.h"
 #include "rtc_base/async_dns_resolver.h"
+#include "rtc_base/base64.h"
 #include "rtc_base/checks.h"
+#include "rtc_base/crypto_random.h"
 #include "rtc_base/logging.h"
+#include "rtc_base/message_digest.h"
 #include "rtc_base/net_helpers.h"
 #include "rtc_base/socket.h"
 #include "rtc_base/thread.h"
 
 namespace {
 
-// This is our magical hangup signal.
-constexpr char kByeMessage[] = "BYE";
 // Delay between server connection retries, in milliseconds
 constexpr webrtc::TimeDelta kReconnectDelay = webrtc::TimeDelta::Seconds(2);
+// Attempts to resume a session, kReconnectDelay apart, before giving up.
+// Together they last about as long as servers keep a session by default.
+constexpr int kMaxResumeAttempts = 15;
+// Maximum number of requests sent ahead on a persistent control connection.
+constexpr size_t kMaxPipelinedRequests = 8;
+
+// WebSocket opcodes that the client deals with, see RFC 6455.
+constexpr int kWebSocketContinuation = 0x0;
+constexpr int kWebSocketText = 0x1;
+constexpr int kWebSocketBinary = 0x2;
+constexpr int kWebSocketClose = 0x8;
+constexpr int kWebSocketPing = 0x9;
+constexpr int kWebSocketPong = 0xA;
+// Content type of /wait responses that carry several messages, see
+// peer_channel.cc.
+constexpr char kBatchContentType[] = "application/x-peerconnection-batch";
+constexpr char kWebSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// The Sec-WebSocket-Accept value the server must answer `key` with.
+std::string ComputeWebSocketAccept(const std::string& key) {
+  std::string input = key + kWebSocketGuid;
+  char digest[20];
+  size_t size = webrtc::ComputeDigest(webrtc::DIGEST_SHA_1, input.data(),
+                                      input.size(), digest, sizeof(digest));
+  return webrtc::Base64Encode(absl::string_view(digest, size));
+}
+
+// Parses the number at the start of `value` like atoi() would, without
+// needing a terminated string.  Returns 0 if there is no number.
+template <typename T>
+T ParseLeadingNumber(absl::string_view value) {
+  T result = 0;
+  std::from_chars(value.data(), value.data() + value.size(), result);
+  return result;
+}
+
+// Returns true if `data` holds a whole frame from the server at `pos`.
+bool GetWebSocketFrame(absl::string_view data,
+                       size_t pos,
+                       bool* fin,
+                       int* opcode,
+                       size_t* header_size,
+                       size_t* payload_size) {
+  if (data.size() < pos + 2)
+    return false;
+  const unsigned char* bytes =
+      reinterpret_cast<const unsigned char*>(data.data() + pos);
+  size_t available = data.size() - pos;
+  *fin = (bytes[0] & 0x80) != 0;
+  *opcode = bytes[0] & 0x0F;
+  // The server does not mask its frames.
+  uint64_t size = bytes[1] & 0x7F;
+  *header_size = 2;
+  if (size == 126) {
+    *header_size = 4;
+    if (available < *header_size)
+      return false;
+    size = (bytes[2] << 8) | bytes[3];
+  } else if (size == 127) {
+    *header_size = 10;
+    if (available < *header_size)
+      return false;
+    size = 0;
+    for (int i = 0; i < 8; ++i)
+      size = (size << 8) | bytes[2 + i];
+  }
+  if (available - *header_size < size)
+    return false;
+  *payload_size = static_cast<size_t>(size);
+  return true;
+}
 
 webrtc::Socket* CreateClientSocket(int family) {
   webrtc::Thread* thread = webrtc::Thread::Current();
@@ -47,6 +124,13 @@ webrtc::Socket* CreateClientSocket(int family) {
 PeerConnectionClient::PeerConnectionClient()
     : callback_(nullptr),
       resolver_(nullptr),
+      control_requests_sent_(0),
+      control_request_offset_(0),
+      server_keep_alive_(false),
+      websocket_supported_(true),
+      websocket_open_(false),
+      session_resume_(false),
+      resume_attempts_(0),
       state_(NOT_CONNECTED),
       my_id_(-1) {}
 
@@ -60,6 +144,8 @@ void PeerConnectionClient::InitSocketSignals() {
   hanging_get_->SignalCloseEvent.connect(this, &PeerConnectionClient::OnClose);
   control_socket_->SignalConnectEvent.connect(this,
                                               &PeerConnectionClient::OnConnect);
+  control_socket_->SignalWriteEvent.connect(this,
+                                            &PeerConnectionClient::OnWrite);
   hanging_get_->SignalConnectEvent.connect(
       this, &PeerConnectionClient::OnHangingGetConnect);
   control_socket_->SignalReadEvent.connect(this, &PeerConnectionClient::OnRead);
@@ -79,6 +165,10 @@ const Peers& PeerConnectionClient::peers() const {
   return peers_;
 }
 
+void PeerConnectionClient::EnableSessionResume(bool enable) {
+  session_resume_ = enable;
+}
+
 void PeerConnectionClient::RegisterObserver(
     PeerConnectionClientObserver* callback) {
   RTC_DCHECK(!callback_);
@@ -143,12 +233,23 @@ void PeerConnectionClient::DoConnect() {
   control_socket_.reset(CreateClientSocket(server_address_.ipaddr().family()));
   hanging_get_.reset(CreateClientSocket(server_address_.ipaddr().family()));
   InitSocketSignals();
+  control_requests_.clear();
+  control_requests_sent_ = 0;
+  control_request_offset_ = 0;
+  control_response_.Reset();
+  notification_response_.Reset();
+  server_keep_alive_ = false;
+  websocket_supported_ = true;
+  websocket_open_ = false;
+
   char buffer[1024];
-  snprintf(buffer, sizeof(buffer), "GET /sign_in?%s HTTP/1.0\r\n\r\n",
-           client_name_.c_str());
-  onconnect_data_ = buffer;
+  snprintf(buffer, sizeof(buffer),
+           "GET /sign_in?%s HTTP/1.1\r\n"
+           "Host: %s\r\n"
+           "\r\n",
+           client_name_.c_str(), server_address_.ToString().c_str());
 
-  bool ret = ConnectControlSocket();
+  bool ret = SendControlRequest(buffer);
   if (ret)
     state_ = SIGNING_IN;
   if (!ret) {
@@ -161,64 +262,93 @@ bool PeerConnectionClient::SendToPeer(int peer_id, const std::string& message) {
     return false;
 
   RTC_DCHECK(is_connected());
-  RTC_DCHECK(control_socket_->GetState() == webrtc::Socket::CS_CLOSED);
   if (!is_connected() || peer_id == -1)
     return false;
 
   char headers[1024];
   snprintf(headers, sizeof(headers),
-           "POST /message?peer_id=%i&to=%i HTTP/1.0\r\n"
+           "POST /message?peer_id=%i&to=%i HTTP/1.1\r\n"
+           "Host: %s\r\n"
            "Content-Length: %zu\r\n"
            "Content-Type: text/plain\r\n"
            "\r\n",
-           my_id_, peer_id, message.length());
-  onconnect_data_ = headers;
-  onconnect_data_ += message;
-  return ConnectControlSocket();
+           my_id_, peer_id, server_address_.ToString().c_str(),
+           message.length());
+  std::string request(headers);
+  request += message;
+  return SendControlRequest(std::move(request));
 }
 
 bool PeerConnectionClient::SendHangUp(int peer_id) {
-  return SendToPeer(peer_id, kByeMessage);
+  return SendToPeer(peer_id, std::string(SignalingCodec::EncodeBye()));
+}
+
+bool PeerConnectionClient::SendStats(const std::string& report) {
+  if (state_ != CONNECTED)
+    return false;
+
+  char headers[1024];
+  snprintf(headers, sizeof(headers),
+           "POST /stats?peer_id=%i HTTP/1.1\r\n"
+           "Host: %s\r\n"
+           "Content-Length: %zu\r\n"
+           "Content-Type: application/json\r\n"
+           "\r\n",
+           my_id_, server_address_.ToString().c_str(), report.length());
+  std::string request(headers);
+  request += report;
+  return SendControlRequest(std::move(request));
 }
 
 bool PeerConnectionClient::IsSendingMessage() {
-  return state_ == CONNECTED &&
-         control_socket_->GetState() != webrtc::Socket::CS_CLOSED;
+  return state_ == RESUMING ||
+         (state_ == CONNECTED &&
+          control_requests_.size() >= MaxRequestsInFlight());
 }
 
 bool PeerConnectionClient::SignOut() {
   if (state_ == NOT_CONNECTED || state_ == SIGNING_OUT)
     return true;
 
+  if (state_ == RESUMING) {
+    // The server is out of reach and forgets the session by itself.
+    Close();
+    callback_->OnDisconnected();
+    return true;
+  }
+
   if (hanging_get_->GetState() != webrtc::Socket::CS_CLOSED)
     hanging_get_->Close();
 
-  if (control_socket_->GetState() == webrtc::Socket::CS_CLOSED) {
-    state_ = SIGNING_OUT;
-
-    if (my_id_ != -1) {
-      char buffer[1024];
-      snprintf(buffer, sizeof(buffer),
-               "GET /sign_out?peer_id=%i HTTP/1.0\r\n\r\n", my_id_);
-      onconnect_data_ = buffer;
-      return ConnectControlSocket();
-    } else {
-      // Can occur if the app is closed before we finish connecting.
-      return true;
-    }
-  } else {
-    state_ = SIGNING_OUT_WAITING;
+  state_ = SIGNING_OUT;
+
+  if (my_id_ != -1) {
+    // Queued behind the messages that are still being sent.
+    char buffer[1024];
+    snprintf(buffer, sizeof(buffer),
+             "GET /sign_out?peer_id=%i HTTP/1.1\r\n"
+             "Host: %s\r\n"
+             "\r\n",
+             my_id_, server_address_.ToString().c_str());
+    return SendControlRequest(buffer);
   }
 
+  // Can occur if the app is closed before we finish connecting.  If the sign
+  // in is still pending we sign out once it completes.
   return true;
 }
 
 void PeerConnectionClient::Close() {
   control_socket_->Close();
   hanging_get_->Close();
-  onconnect_data_.clear();
+  control_requests_.clear();
+  control_requests_sent_ = 0;
+  control_request_offset_ = 0;
+  control_response_.Reset();
+  notification_response_.Reset();
   peers_.clear();
   resolver_.reset();
+  resume_token_.clear();
   my_id_ = -1;
   state_ = NOT_CONNECTED;
 }
@@ -233,187 +363,349 @@ bool PeerConnectionClient::ConnectControlSocket() {
   return true;
 }
 
+bool PeerConnectionClient::SendControlRequest(std::string request) {
+  control_requests_.push_back(std::move(request));
+  switch (control_socket_->GetState()) {
+    case webrtc::Socket::CS_CLOSED:
+      return ConnectControlSocket();
+    case webrtc::Socket::CS_CONNECTED:
+      FlushControlRequests(control_socket_.get());
+      return true;
+    default:
+      // Sent from OnConnect().
+      return true;
+  }
+}
+
+void PeerConnectionClient::FlushControlRequests(webrtc::Socket* socket) {
+  size_t max_in_flight = MaxRequestsInFlight();
+  while (control_requests_sent_ < control_requests_.size() &&
+         control_requests_sent_ < max_in_flight) {
+    const std::string& request = control_requests_[control_requests_sent_];
+    int sent = socket->Send(request.data() + control_request_offset_,
+                            request.length() - control_request_offset_);
+    if (sent <= 0) {
+      // Continued from OnWrite(), or given up in OnClose().
+      return;
+    }
+    control_request_offset_ += sent;
+    if (control_request_offset_ == request.length()) {
+      ++control_requests_sent_;
+      control_request_offset_ = 0;
+    }
+  }
+}
+
+size_t PeerConnectionClient::MaxRequestsInFlight() const {
+  // Servers that close the connection after each response handle a single
+  // request per connection.
+  return server_keep_alive_ ? kMaxPipelinedRequests : 1;
+}
+
+void PeerConnectionClient::OnControlConnectionClosed(
+    int err,
+    bool handled_requests_lost) {
+  control_response_.Reset();
+  control_request_offset_ = 0;
+  if (handled_requests_lost) {
+    // These may have been handled; don't risk delivering them twice.
+    for (; control_requests_sent_ > 0; --control_requests_sent_) {
+      control_requests_.pop_front();
+      callback_->OnMessageSent(err);
+    }
+  }
+  control_requests_sent_ = 0;
+  if (!control_requests_.empty())
+    ConnectControlSocket();
+}
+
 void PeerConnectionClient::OnConnect(webrtc::Socket* socket) {
-  RTC_DCHECK(!onconnect_data_.empty());
-  size_t sent = socket->Send(onconnect_data_.c_str(), onconnect_data_.length());
-  RTC_DCHECK(sent == onconnect_data_.length());
-  onconnect_data_.clear();
+  RTC_DCHECK(!control_requests_.empty());
+  FlushControlRequests(socket);
+}
+
+void PeerConnectionClient::OnWrite(webrtc::Socket* socket) {
+  if (socket->GetState() == webrtc::Socket::CS_CONNECTED)
+    FlushControlRequests(socket);
 }
 
 void PeerConnectionClient::OnHangingGetConnect(webrtc::Socket* socket) {
+  websocket_open_ = false;
+  notification_response_.Reset();
+  if (websocket_supported_)
+    SendWebSocketRequest(socket);
+  else
+    SendWaitRequest(socket);
+}
+
+void PeerConnectionClient::SendWaitRequest(webrtc::Socket* socket) {
   char buffer[1024];
-  snprintf(buffer, sizeof(buffer), "GET /wait?peer_id=%i HTTP/1.0\r\n\r\n",
-           my_id_);
+  snprintf(buffer, sizeof(buffer),
+           "GET /wait?peer_id=%i&batch=1 HTTP/1.1\r\n"
+           "Host: %s\r\n"
+           "\r\n",
+           my_id_, server_address_.ToString().c_str());
   int len = static_cast<int>(strlen(buffer));
   int sent = socket->Send(buffer, len);
   RTC_DCHECK(sent == len);
 }
 
-void PeerConnectionClient::OnMessageFromPeer(int peer_id,
-                                             const std::string& message) {
-  if (message.length() == (sizeof(kByeMessage) - 1) &&
-      message.compare(kByeMessage) == 0) {
-    callback_->OnPeerDisconnected(peer_id);
+void PeerConnectionClient::SendWebSocketRequest(webrtc::Socket* socket) {
+  std::string nonce;
+  webrtc::CreateRandomData(16, &nonce);
+  websocket_key_ = webrtc::Base64Encode(nonce);
+
+  char buffer[1024];
+  snprintf(buffer, sizeof(buffer),
+           "GET /ws?peer_id=%i HTTP/1.1\r\n"
+           "Host: %s\r\n"
+           "Upgrade: websocket\r\n"
+           "Connection: Upgrade\r\n"
+           "Sec-WebSocket-Key: %s\r\n"
+           "Sec-WebSocket-Version: 13\r\n"
+           "\r\n",
+           my_id_, server_address_.ToString().c_str(), websocket_key_.c_str());
+  int len = static_cast<int>(strlen(buffer));
+  int sent = socket->Send(buffer, len);
+  RTC_DCHECK(sent == len);
+}
+
+void PeerConnectionClient::SendWebSocketFrame(webrtc::Socket* socket,
+                                              int opcode,
+                                              absl::string_view payload) {
+  // Only used for control frames, whose size fits the first length byte.
+  RTC_DCHECK_LE(payload.size(), 125);
+  std::string mask;
+  webrtc::CreateRandomData(4, &mask);
+  std::string frame;
+  frame += static_cast<char>(0x80 | opcode);
+  frame += static_cast<char>(0x80 | payload.size());
+  frame += mask;
+  for (size_t i = 0; i < payload.size(); ++i)
+    frame += static_cast<char>(payload[i] ^ mask[i % 4]);
+  socket->Send(frame.data(), frame.size());
+}
+
+void PeerConnectionClient::OnNotification(int peer_id,
+                                          absl::string_view body) {
+  if (my_id_ == peer_id) {
+    // A notification about new members or members that just disconnected,
+    // one entry per line.
+    size_t pos = 0;
+    while (pos < body.size() && state_ == CONNECTED) {
+      size_t eol = body.find('\n', pos);
+      if (eol == absl::string_view::npos)
+        eol = body.size();
+      int id = 0;
+      std::string name;
+      bool connected = false;
+      if (eol > pos &&
+          ParseEntry(body.substr(pos, eol - pos), &name, &id, &connected)) {
+        if (connected) {
+          peers_[id] = name;
+          callback_->OnPeerConnected(id, name);
+        } else {
+          peers_.erase(id);
+          callback_->OnPeerDisconnected(id);
+        }
+      }
+      pos = eol + 1;
+    }
   } else {
-    callback_->OnMessageFromPeer(peer_id, message);
+    OnMessageFromPeer(peer_id, body);
   }
 }
 
-bool PeerConnectionClient::GetHeaderValue(const std::string& data,
-                                          size_t eoh,
-                                          const char* header_pattern,
-                                          size_t* value) {
-  RTC_DCHECK(value != nullptr);
-  size_t found = data.find(header_pattern);
-  if (found != std::string::npos && found < eoh) {
-    *value = atoi(&data[found + strlen(header_pattern)]);
-    return true;
+bool PeerConnectionClient::OnBatchNotification(absl::string_view body) {
+  size_t pos = 0;
+  while (pos < body.size()) {
+    size_t eol = body.find('\n', pos);
+    size_t comma = body.find(',', pos);
+    if (eol == absl::string_view::npos || comma == absl::string_view::npos ||
+        comma > eol) {
+      RTC_LOG(LS_ERROR) << "Malformed batch from the server.";
+      break;
+    }
+    int peer_id = ParseLeadingNumber<int>(body.substr(pos, comma - pos));
+    size_t size =
+        ParseLeadingNumber<size_t>(body.substr(comma + 1, eol - comma - 1));
+    pos = eol + 1;
+    if (size > body.size() - pos) {
+      RTC_LOG(LS_ERROR) << "Truncated batch from the server.";
+      break;
+    }
+    OnNotification(peer_id, body.substr(pos, size));
+    pos += size;
+    if (state_ != CONNECTED ||
+        hanging_get_->GetState() != webrtc::Socket::CS_CONNECTED) {
+      return false;
+    }
   }
-  return false;
-}
-
-bool PeerConnectionClient::GetHeaderValue(const std::string& data,
-                                          size_t eoh,
-                                          const char* header_pattern,
-                                          std::string* value) {
-  RTC_DCHECK(value != nullptr);
-  size_t found = data.find(header_pattern);
-  if (found != std::string::npos && found < eoh) {
-    size_t begin = found + strlen(header_pattern);
-    size_t end = data.find("\r\n", begin);
-    if (end == std::string::npos)
-      end = eoh;
-    value->assign(data.substr(begin, end - begin));
-    return true;
+  return true;
+}
+
+void PeerConnectionClient::OnMessageFromPeer(int peer_id,
+                                             absl::string_view message) {
+  if (SignalingCodec::IsBye(message)) {
+    callback_->OnPeerDisconnected(peer_id);
+  } else {
+    callback_->OnMessageFromPeer(peer_id, message);
   }
-  return false;
 }
 
-bool PeerConnectionClient::ReadIntoBuffer(webrtc::Socket* socket,
-                                          std::string* data,
-                                          size_t* content_length) {
-  char buffer[0xffff];
+void PeerConnectionClient::ReadIntoBuffer(webrtc::Socket* socket,
+                                          HttpResponseParser* response) {
   do {
-    int bytes = socket->Recv(buffer, sizeof(buffer), nullptr);
+    size_t available = 0;
+    char* buffer = response->PrepareRead(&available);
+    int bytes = socket->Recv(buffer, available, nullptr);
     if (bytes <= 0)
       break;
-    data->append(buffer, bytes);
+    response->OnRead(bytes);
   } while (true);
+}
 
-  bool ret = false;
-  size_t i = data->find("\r\n\r\n");
-  if (i != std::string::npos) {
-    RTC_LOG(LS_INFO) << "Headers received";
-    if (GetHeaderValue(*data, i, "\r\nContent-Length: ", content_length)) {
-      size_t total_response_size = (i + 4) + *content_length;
-      if (data->length() >= total_response_size) {
-        ret = true;
-        std::string should_close;
-        const char kConnection[] = "\r\nConnection: ";
-        if (GetHeaderValue(*data, i, kConnection, &should_close) &&
-            should_close.compare("close") == 0) {
-          socket->Close();
-          // Since we closed the socket, there was no notification delivered
-          // to us.  Compensate by letting ourselves know.
-          OnClose(socket, 0);
-        }
-      } else {
-        // We haven't received everything.  Just continue to accept data.
-      }
-    } else {
-      RTC_LOG(LS_ERROR) << "No content length field specified by the server.";
+void PeerConnectionClient::OnRead(webrtc::Socket* socket) {
+  ReadIntoBuffer(socket, &control_response_);
+
+  while (control_response_.status() != HttpResponseParser::INCOMPLETE) {
+    if (control_response_.status() == HttpResponseParser::PARSE_ERROR ||
+        control_requests_sent_ == 0) {
+      RTC_LOG(LS_ERROR) << "Unexpected response from the server.";
+      Close();
+      callback_->OnDisconnected();
+      return;
+    }
+    control_requests_.pop_front();
+    --control_requests_sent_;
+    bool keep_alive = control_response_.keep_alive();
+    server_keep_alive_ = keep_alive;
+
+    if (!OnControlResponse())
+      return;
+
+    if (!keep_alive) {
+      socket->Close();
+      // Since we closed the socket, there was no notification delivered
+      // to us.  Compensate by letting ourselves know.  Requests sent after
+      // this response were not handled and go out on a new connection.
+      OnControlConnectionClosed(0, false);
+      return;
     }
+
+    control_response_.NextResponse();
   }
-  return ret;
+
+  FlushControlRequests(socket);
 }
 
-void PeerConnectionClient::OnRead(webrtc::Socket* socket) {
-  size_t content_length = 0;
-  if (ReadIntoBuffer(socket, &control_data_, &content_length)) {
-    size_t peer_id = 0, eoh = 0;
-    bool ok =
-        ParseServerResponse(control_data_, content_length, &peer_id, &eoh);
-    if (ok) {
-      if (my_id_ == -1) {
-        // First response.  Let's store our server assigned ID.
-        RTC_DCHECK(state_ == SIGNING_IN);
-        my_id_ = static_cast<int>(peer_id);
-        RTC_DCHECK(my_id_ != -1);
-
-        // The body of the response will be a list of already connected peers.
-        if (content_length) {
-          size_t pos = eoh + 4;
-          while (pos < control_data_.size()) {
-            size_t eol = control_data_.find('\n', pos);
-            if (eol == std::string::npos)
-              break;
-            int id = 0;
-            std::string name;
-            bool connected;
-            if (ParseEntry(control_data_.substr(pos, eol - pos), &name, &id,
-                           &connected) &&
-                id != my_id_) {
-              peers_[id] = name;
-              callback_->OnPeerConnected(id, name);
-            }
-            pos = eol + 1;
-          }
-        }
-        RTC_DCHECK(is_connected());
-        callback_->OnSignedIn();
-      } else if (state_ == SIGNING_OUT) {
-        Close();
-        callback_->OnDisconnected();
-      } else if (state_ == SIGNING_OUT_WAITING) {
-        SignOut();
+bool PeerConnectionClient::OnControlResponse() {
+  int peer_id = -1;
+  if (!ParseServerResponse(control_response_, &peer_id))
+    return false;
+
+  if (my_id_ == -1) {
+    // First response.  Let's store our server assigned ID.
+    RTC_DCHECK(state_ == SIGNING_IN || state_ == SIGNING_OUT);
+    my_id_ = peer_id;
+    RTC_DCHECK(my_id_ != -1);
+    resume_token_ = std::string(control_response_.GetHeader("Resume-Token"));
+
+    // The body of the response will be a list of already connected peers.
+    absl::string_view body = control_response_.body();
+    size_t pos = 0;
+    while (pos < body.size()) {
+      size_t eol = body.find('\n', pos);
+      if (eol == absl::string_view::npos)
+        break;
+      int id = 0;
+      std::string name;
+      bool connected;
+      if (eol > pos &&
+          ParseEntry(body.substr(pos, eol - pos), &name, &id, &connected) &&
+          id != my_id_) {
+        peers_[id] = name;
+        callback_->OnPeerConnected(id, name);
       }
+      pos = eol + 1;
     }
-
-    control_data_.clear();
+    RTC_DCHECK(is_connected());
+    callback_->OnSignedIn();
 
     if (state_ == SIGNING_IN) {
       RTC_DCHECK(hanging_get_->GetState() == webrtc::Socket::CS_CLOSED);
       state_ = CONNECTED;
       hanging_get_->Connect(server_address_);
+    } else if (state_ == SIGNING_OUT) {
+      // SignOut() was called while signing in.
+      state_ = CONNECTED;
+      SignOut();
     }
+  } else if (state_ == RESUMING) {
+    // The response to the /resume request.  The messages queued for us
+    // meanwhile arrive on the new notification connection.
+    RTC_LOG(LS_INFO) << "Resumed the session";
+    state_ = CONNECTED;
+    resume_attempts_ = 0;
+    hanging_get_->Connect(server_address_);
+    callback_->OnSessionResumed();
+  } else if (state_ == SIGNING_OUT && control_requests_.empty()) {
+    // The response to the sign out request.
+    Close();
+    callback_->OnDisconnected();
+    return false;
+  } else {
+    callback_->OnMessageSent(0);
   }
+  return true;
 }
 
 void PeerConnectionClient::OnHangingGetRead(webrtc::Socket* socket) {
   RTC_LOG(LS_INFO) << __FUNCTION__;
-  size_t content_length = 0;
-  if (ReadIntoBuffer(socket, &notification_data_, &content_length)) {
-    size_t peer_id = 0, eoh = 0;
-    bool ok =
-        ParseServerResponse(notification_data_, content_length, &peer_id, &eoh);
-
-    if (ok) {
-      // Store the position where the body begins.
-      size_t pos = eoh + 4;
-
-      if (my_id_ == static_cast<int>(peer_id)) {
-        // A notification about a new member or a member that just
-        // disconnected.
-        int id = 0;
-        std::string name;
-        bool connected = false;
-        if (ParseEntry(notification_data_.substr(pos), &name, &id,
-                       &connected)) {
-          if (connected) {
-            peers_[id] = name;
-            callback_->OnPeerConnected(id, name);
-          } else {
-            peers_.erase(id);
-            callback_->OnPeerDisconnected(id);
-          }
-        }
-      } else {
-        OnMessageFromPeer(static_cast<int>(peer_id),
-                          notification_data_.substr(pos));
-      }
+  ReadIntoBuffer(socket, &notification_response_);
+
+  if (websocket_supported_) {
+    OnWebSocketRead(socket);
+    return;
+  }
+
+  while (notification_response_.status() != HttpResponseParser::INCOMPLETE) {
+    if (notification_response_.status() == HttpResponseParser::PARSE_ERROR) {
+      RTC_LOG(LS_ERROR) << "Malformed notification from the server.";
+      hanging_get_->Close();
+      notification_response_.Reset();
+      break;
+    }
+
+    int peer_id = -1;
+    if (!ParseServerResponse(notification_response_, &peer_id))
+      return;
+
+    bool keep_alive = notification_response_.keep_alive();
+    if (notification_response_.content_type() == kBatchContentType) {
+      // Servers that know about batches send everything that was queued
+      // for us at once; older ones ignore the parameter.
+      if (!OnBatchNotification(notification_response_.body()))
+        return;
+    } else {
+      OnNotification(peer_id, notification_response_.body());
+    }
+
+    // The observer may have signed out in the meantime.
+    if (state_ != CONNECTED ||
+        hanging_get_->GetState() != webrtc::Socket::CS_CONNECTED) {
+      return;
     }
 
-    notification_data_.clear();
+    if (!keep_alive) {
+      hanging_get_->Close();
+      notification_response_.Reset();
+      break;
+    }
+
+    // Wait for the next notification on the same connection.
+    notification_response_.NextResponse();
+    SendWaitRequest(socket);
   }
 
   if (hanging_get_->GetState() == webrtc::Socket::CS_CLOSED &&
@@ -422,7 +714,73 @@ void PeerConnectionClient::OnHangingGetRead(webrtc::Socket* socket) {
   }
 }
 
-bool PeerConnectionClient::ParseEntry(const std::string& entry,
+void PeerConnectionClient::OnWebSocketRead(webrtc::Socket* socket) {
+  if (!websocket_open_) {
+    HttpResponseParser::Status status = notification_response_.status();
+    if (status == HttpResponseParser::INCOMPLETE)
+      return;
+    if (status == HttpResponseParser::PARSE_ERROR ||
+        notification_response_.status_code() != 101 ||
+        notification_response_.GetHeader("Sec-WebSocket-Accept") !=
+            ComputeWebSocketAccept(websocket_key_)) {
+      RTC_LOG(LS_INFO) << "WebSocket refused by the server, using long polls.";
+      websocket_supported_ = false;
+      notification_response_.Reset();
+      socket->Close();
+      if (state_ == CONNECTED)
+        socket->Connect(server_address_);
+      return;
+    }
+    notification_response_.SwitchProtocols();
+    websocket_open_ = true;
+  }
+
+  absl::string_view data = notification_response_.raw_data();
+  size_t pos = 0;
+  bool fin = false;
+  int opcode = 0;
+  size_t header_size = 0, payload_size = 0;
+  while (GetWebSocketFrame(data, pos, &fin, &opcode, &header_size,
+                           &payload_size)) {
+    absl::string_view payload = data.substr(pos + header_size, payload_size);
+    pos += header_size + payload_size;
+
+    if (!fin || opcode == kWebSocketContinuation) {
+      RTC_LOG(LS_ERROR) << "Fragmented WebSocket messages are not supported.";
+      opcode = kWebSocketClose;
+      payload = absl::string_view();
+    }
+
+    if (opcode == kWebSocketText || opcode == kWebSocketBinary) {
+      // The id that the Pragma header carries for long polls comes first,
+      // on a line of its own.
+      size_t eol = payload.find('\n');
+      if (eol == absl::string_view::npos)
+        continue;
+      int peer_id = eol ? ParseLeadingNumber<int>(payload.substr(0, eol)) : -1;
+      OnNotification(peer_id, payload.substr(eol + 1));
+      // The observer may have signed out in the meantime.
+      if (state_ != CONNECTED ||
+          hanging_get_->GetState() != webrtc::Socket::CS_CONNECTED) {
+        return;
+      }
+    } else if (opcode == kWebSocketPing) {
+      SendWebSocketFrame(socket, kWebSocketPong, payload);
+    } else if (opcode == kWebSocketClose) {
+      // Answer the closing handshake and open a new connection, like when a
+      // long poll is closed by the server.
+      SendWebSocketFrame(socket, kWebSocketClose, payload.substr(0, 2));
+      socket->Close();
+      notification_response_.Reset();
+      if (state_ == CONNECTED)
+        socket->Connect(server_address_);
+      return;
+    }
+  }
+  notification_response_.ConsumeRawData(pos);
+}
+
+bool PeerConnectionClient::ParseEntry(absl::string_view entry,
                                       std::string* name,
                                       int* id,
                                       bool* connected) {
@@ -433,46 +791,32 @@ bool PeerConnectionClient::ParseEntry(const std::string& entry,
 
   *connected = false;
   size_t separator = entry.find(',');
-  if (separator != std::string::npos) {
-    *id = atoi(&entry[separator + 1]);
-    name->assign(entry.substr(0, separator));
-    separator = entry.find(',', separator + 1);
-    if (separator != std::string::npos) {
-      *connected = atoi(&entry[separator + 1]) ? true : false;
+  if (separator != absl::string_view::npos) {
+    name->assign(entry.data(), separator);
+    absl::string_view rest = entry.substr(separator + 1);
+    separator = rest.find(',');
+    *id = ParseLeadingNumber<int>(rest.substr(0, separator));
+    if (separator != absl::string_view::npos) {
+      *connected =
+          ParseLeadingNumber<int>(rest.substr(separator + 1)) ? true : false;
     }
   }
   return !name->empty();
 }
 
-int PeerConnectionClient::GetResponseStatus(const std::string& response) {
-  int status = -1;
-  size_t pos = response.find(' ');
-  if (pos != std::string::npos)
-    status = atoi(&response[pos + 1]);
-  return status;
-}
-
-bool PeerConnectionClient::ParseServerResponse(const std::string& response,
-                                               size_t content_length,
-                                               size_t* peer_id,
-                                               size_t* eoh) {
-  int status = GetResponseStatus(response.c_str());
-  if (status != 200) {
+bool PeerConnectionClient::ParseServerResponse(
+    const HttpResponseParser& response,
+    int* peer_id) {
+  if (response.status_code() != 200) {
     RTC_LOG(LS_ERROR) << "Received error from server";
     Close();
     callback_->OnDisconnected();
     return false;
   }
 
-  *eoh = response.find("\r\n\r\n");
-  RTC_DCHECK(*eoh != std::string::npos);
-  if (*eoh == std::string::npos)
-    return false;
-
-  *peer_id = -1;
-
   // See comment in peer_channel.cc for why we use the Pragma header.
-  GetHeaderValue(response, *eoh, "\r\nPragma: ", peer_id);
+  absl::string_view pragma = response.GetHeader("Pragma");
+  *peer_id = pragma.empty() ? -1 : ParseLeadingNumber<int>(pragma);
 
   return true;
 }
@@ -482,18 +826,44 @@ void PeerConnectionClient::OnClose(webrtc::Socket* socket, int err) {
 
   socket->Close();
 
+  if (state_ == RESUMING) {
+    // Notifications are fetched again once the session is back.
+    if (socket == control_socket_.get())
+      OnResumeFailed();
+    return;
+  }
+
+  // Without the notification connection nothing reaches us, and an error
+  // on the control connection means the server is unreachable.  Either may
+  // be fixed by the network coming back, which the resume waits for.
+  if (CanResume() && (socket == hanging_get_.get() || err != 0)) {
+    StartResume();
+    return;
+  }
+
 #ifdef WIN32
   if (err != WSAECONNREFUSED) {
 #else
   if (err != ECONNREFUSED) {
 #endif
     if (socket == hanging_get_.get()) {
+      notification_response_.Reset();
       if (state_ == CONNECTED) {
+        // Don't reconnect in a tight loop to a server that keeps failing.
         hanging_get_->Close();
-        hanging_get_->Connect(server_address_);
+        webrtc::Thread::Current()->PostDelayedTask(
+            SafeTask(safety_.flag(),
+                     [this] {
+                       if (state_ == CONNECTED &&
+                           hanging_get_->GetState() ==
+                               webrtc::Socket::CS_CLOSED) {
+                         hanging_get_->Connect(server_address_);
+                       }
+                     }),
+            kReconnectDelay);
       }
     } else {
-      callback_->OnMessageSent(err);
+      OnControlConnectionClosed(err, true);
     }
   } else {
     if (socket == control_socket_.get()) {
@@ -506,3 +876,62 @@ void PeerConnectionClient::OnClose(webrtc::Socket* socket, int err) {
     }
   }
 }
+
+bool PeerConnectionClient::CanResume() const {
+  return session_resume_ && state_ == CONNECTED && !resume_token_.empty();
+}
+
+void PeerConnectionClient::StartResume() {
+  RTC_DCHECK(CanResume());
+  RTC_LOG(LS_WARNING) << "Lost the server; resuming the session";
+  state_ = RESUMING;
+  resume_attempts_ = 0;
+  hanging_get_->Close();
+  notification_response_.Reset();
+  websocket_open_ = false;
+  control_socket_->Close();
+  // These may have been handled; don't risk delivering them twice.
+  for (; control_requests_sent_ > 0; --control_requests_sent_) {
+    control_requests_.pop_front();
+    callback_->OnMessageSent(0);
+  }
+  SendResumeRequest();
+}
+
+void PeerConnectionClient::SendResumeRequest() {
+  RTC_DCHECK_EQ(state_, RESUMING);
+  RTC_DCHECK_EQ(control_requests_sent_, 0);
+  control_response_.Reset();
+  control_request_offset_ = 0;
+
+  char buffer[1024];
+  snprintf(buffer, sizeof(buffer),
+           "GET /resume?peer_id=%i&token=%s HTTP/1.1\r\n"
+           "Host: %s\r\n"
+           "\r\n",
+           my_id_, resume_token_.c_str(), server_address_.ToString().c_str());
+  control_requests_.push_front(buffer);
+  if (control_socket_->Connect(server_address_) == SOCKET_ERROR)
+    OnResumeFailed();
+}
+
+void PeerConnectionClient::OnResumeFailed() {
+  RTC_DCHECK_EQ(state_, RESUMING);
+  // The next attempt puts the /resume request first again.
+  control_requests_.pop_front();
+  control_requests_sent_ = 0;
+  control_request_offset_ = 0;
+  if (++resume_attempts_ >= kMaxResumeAttempts) {
+    RTC_LOG(LS_WARNING) << "Failed to resume the session";
+    Close();
+    callback_->OnDisconnected();
+    return;
+  }
+  webrtc::Thread::Current()->PostDelayedTask(
+      SafeTask(safety_.flag(),
+               [this] {
+                 if (state_ == RESUMING)
+                   SendResumeRequest();
+               }),
+      kReconnectDelay);
+}
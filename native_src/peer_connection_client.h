@@ -12,12 +12,15 @@
 #define EXAMPLES_PEERCONNECTION_CLIENT_PEER_CONNECTION_CLIENT_H_
 
 #include <cstddef>
+#include <deque>
 #include <map>
 #include <memory>
 #include <string>
 
+#include "absl/strings/string_view.h"
 #include "api/async_dns_resolver.h"
 #include "api/task_queue/pending_task_safety_flag.h"
+#include "examples/peerconnection/client/http_response_parser.h"
 #include "rtc_base/socket.h"
 #include "rtc_base/socket_address.h"
 #include "rtc_base/third_party/sigslot/sigslot.h"
@@ -29,9 +32,13 @@ struct PeerConnectionClientObserver {
   virtual void OnDisconnected() = 0;
   virtual void OnPeerConnected(int id, const std::string& name) = 0;
   virtual void OnPeerDisconnected(int peer_id) = 0;
-  virtual void OnMessageFromPeer(int peer_id, const std::string& message) = 0;
+  // `message` is only valid during the call.
+  virtual void OnMessageFromPeer(int peer_id, absl::string_view message) = 0;
   virtual void OnMessageSent(int err) = 0;
   virtual void OnServerConnectionFailure() = 0;
+  // Called when the session was resumed after the connection to the server
+  // was lost, see PeerConnectionClient::EnableSessionResume().
+  virtual void OnSessionResumed() = 0;
 
  protected:
   virtual ~PeerConnectionClientObserver() {}
@@ -44,8 +51,9 @@ class PeerConnectionClient : public sigslot::has_slots<> {
     RESOLVING,
     SIGNING_IN,
     CONNECTED,
-    SIGNING_OUT_WAITING,
     SIGNING_OUT,
+    // Connected, but the server is out of reach.
+    RESUMING,
   };
 
   PeerConnectionClient();
@@ -61,8 +69,26 @@ class PeerConnectionClient : public sigslot::has_slots<> {
                int port,
                const std::string& client_name);
 
+  // When enabled, losing the connection to the server does not disconnect
+  // right away.  The client reconnects and resumes its session with the
+  // token that the server handed out at sign in, which keeps its id, its
+  // peers and the messages queued on both ends, and calls
+  // OnSessionResumed().  If the server has forgotten the session, or stays
+  // out of reach, OnDisconnected() is called as before.
+  void EnableSessionResume(bool enable);
+
+  // Messages are sent over a persistent connection.  When the server keeps
+  // connections alive, several messages may be in flight at once and
+  // OnMessageSent() is called as each of them is acknowledged.
   bool SendToPeer(int peer_id, const std::string& message);
   bool SendHangUp(int peer_id);
+
+  // Reports the statistics of a call, as JSON, to the server rather than to
+  // a peer.  Shares the connection with the messages.
+  bool SendStats(const std::string& report);
+
+  // True if no more messages can be sent until OnMessageSent() is called,
+  // or OnSessionResumed() while the session is being resumed.
   bool IsSendingMessage();
 
   bool SignOut();
@@ -72,56 +98,120 @@ class PeerConnectionClient : public sigslot::has_slots<> {
   void Close();
   void InitSocketSignals();
   bool ConnectControlSocket();
+
+  // Queues a request for the control connection and sends it as soon as the
+  // connection allows.
+  bool SendControlRequest(std::string request);
+
+  // Writes as many of the queued requests as may be in flight.
+  void FlushControlRequests(webrtc::Socket* socket);
+
+  // Number of requests that may be waiting for a response at the same time.
+  size_t MaxRequestsInFlight() const;
+
+  // Called when the control connection is gone.  Requests that the server
+  // may have handled are dropped if `handled_requests_lost` is set, the
+  // others are sent again on a new connection.
+  void OnControlConnectionClosed(int err, bool handled_requests_lost);
+
   void OnConnect(webrtc::Socket* socket);
+  void OnWrite(webrtc::Socket* socket);
   void OnHangingGetConnect(webrtc::Socket* socket);
-  void OnMessageFromPeer(int peer_id, const std::string& message);
+  void SendWaitRequest(webrtc::Socket* socket);
+
+  // Asks the server to upgrade the notification connection to a WebSocket,
+  // on which all notifications are pushed without a request per message.
+  void SendWebSocketRequest(webrtc::Socket* socket);
 
-  // Quick and dirty support for parsing HTTP header values.
-  bool GetHeaderValue(const std::string& data,
-                      size_t eoh,
-                      const char* header_pattern,
-                      size_t* value);
+  // Sends a masked control frame, as clients must.
+  void SendWebSocketFrame(webrtc::Socket* socket,
+                          int opcode,
+                          absl::string_view payload);
 
-  bool GetHeaderValue(const std::string& data,
-                      size_t eoh,
-                      const char* header_pattern,
-                      std::string* value);
+  // Handles a notification from the server (if `peer_id` is our own id)
+  // or a message from another peer.
+  void OnNotification(int peer_id, absl::string_view body);
 
-  // Returns true if the whole response has been read.
-  bool ReadIntoBuffer(webrtc::Socket* socket,
-                      std::string* data,
-                      size_t* content_length);
+  // Handles each record of a batched /wait response.  Returns false if the
+  // observer signed out meanwhile.
+  bool OnBatchNotification(absl::string_view body);
+  void OnMessageFromPeer(int peer_id, absl::string_view message);
+
+  // Receives all data that is available on `socket` into `response`, which
+  // parses as much of it as it can.
+  void ReadIntoBuffer(webrtc::Socket* socket, HttpResponseParser* response);
 
   void OnRead(webrtc::Socket* socket);
 
+  // Handles the complete response in `control_response_`.  Returns false if
+  // the client got disconnected.
+  bool OnControlResponse();
+
   void OnHangingGetRead(webrtc::Socket* socket);
 
+  // Handles the handshake response and the frames on the WebSocket.  Falls
+  // back to long polling if the server refuses the upgrade.
+  void OnWebSocketRead(webrtc::Socket* socket);
+
   // Parses a single line entry in the form "<name>,<id>,<connected>"
-  bool ParseEntry(const std::string& entry,
+  bool ParseEntry(absl::string_view entry,
                   std::string* name,
                   int* id,
                   bool* connected);
 
-  int GetResponseStatus(const std::string& response);
-
-  bool ParseServerResponse(const std::string& response,
-                           size_t content_length,
-                           size_t* peer_id,
-                           size_t* eoh);
+  // Checks the status of a complete `response` and sets `peer_id` to the id
+  // that it carries.  Disconnects and returns false on an error response.
+  bool ParseServerResponse(const HttpResponseParser& response, int* peer_id);
 
   void OnClose(webrtc::Socket* socket, int err);
 
   void OnResolveResult(const webrtc::AsyncDnsResolverResult& result);
 
+  // True if the session can be resumed when the server becomes unreachable.
+  bool CanResume() const;
+
+  // Drops the connections to the server and starts resuming the session.
+  void StartResume();
+
+  // Connects to the server with a /resume request ahead of the requests
+  // that are still queued.
+  void SendResumeRequest();
+
+  // Tries again later, or disconnects once the server stayed out of reach
+  // for too long.
+  void OnResumeFailed();
+
   PeerConnectionClientObserver* callback_;
   webrtc::SocketAddress server_address_;
   std::unique_ptr<webrtc::AsyncDnsResolverInterface> resolver_;
   std::unique_ptr<webrtc::Socket> control_socket_;
   std::unique_ptr<webrtc::Socket> hanging_get_;
-  std::string onconnect_data_;
-  std::string control_data_;
-  std::string notification_data_;
+  // Requests on the control connection that have not been answered yet,
+  // oldest first.  The first `control_requests_sent_` were written
+  // completely, and `control_request_offset_` bytes of the next one.
+  std::deque<std::string> control_requests_;
+  size_t control_requests_sent_;
+  size_t control_request_offset_;
+  // Whether the server kept the control connection open after its last
+  // response, which allows pipelining requests.
+  bool server_keep_alive_;
+  // The responses are received into these and parsed as they arrive.  The
+  // notification connection carries WebSocket frames once upgraded.
+  HttpResponseParser control_response_;
+  HttpResponseParser notification_response_;
+  // Cleared when the server refuses the WebSocket upgrade, after which
+  // notifications are fetched with hanging /wait requests.
+  bool websocket_supported_;
+  // Whether `hanging_get_` has been upgraded to a WebSocket.
+  bool websocket_open_;
+  std::string websocket_key_;
   std::string client_name_;
+  bool session_resume_;
+  // From the sign in response, empty if the server does not resume
+  // sessions.
+  std::string resume_token_;
+  // Failed attempts to resume the current session.
+  int resume_attempts_;
   Peers peers_;
   State state_;
   int my_id_;
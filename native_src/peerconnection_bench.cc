@@ -0,0 +1,211 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+// Runs looped-back calls without a window and reports how the media
+// pipeline keeps up, so that changes to it can be compared run against run.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "api/audio/create_audio_device_module.h"
+#include "api/audio_codecs/builtin_audio_decoder_factory.h"
+#include "api/audio_codecs/builtin_audio_encoder_factory.h"
+#include "api/create_modular_peer_connection_factory.h"
+#include "api/enable_media.h"
+#include "api/environment/environment.h"
+#include "api/environment/environment_factory.h"
+#include "api/peer_connection_interface.h"
+#include "api/scoped_refptr.h"
+#include "examples/peerconnection/client/codec_factory.h"
+#include "examples/peerconnection/client/loopback_session.h"
+#include "modules/audio_device/include/audio_device.h"
+#include "rtc_base/cpu_time.h"
+#include "rtc_base/thread.h"
+
+ABSL_FLAG(int, sessions, 1, "Number of calls to run at once.");
+ABSL_FLAG(int, width, 1280, "Width of the generated video.");
+ABSL_FLAG(int, height, 720, "Height of the generated video.");
+ABSL_FLAG(int, fps, 30, "Frame rate of the generated video.");
+ABSL_FLAG(std::string,
+          codec,
+          "VP8",
+          "Video codec to send with: VP8, VP9, H264 or AV1.");
+ABSL_FLAG(int,
+          warmup,
+          5,
+          "Seconds to run before measuring, for the bandwidth estimate and "
+          "the encoders to settle.");
+ABSL_FLAG(int, duration, 20, "Seconds to measure for.");
+
+namespace {
+
+// How long the calls may take to deliver their first frames.
+constexpr std::chrono::seconds kConnectTimeout(10);
+
+int64_t Percentile(const std::vector<int64_t>& sorted, int percent) {
+  if (sorted.empty())
+    return 0;
+  size_t index = (sorted.size() - 1) * percent / 100;
+  return sorted[index];
+}
+
+bool AllRendering(
+    const std::vector<std::unique_ptr<LoopbackSession>>& sessions) {
+  for (const auto& session : sessions) {
+    if (session->frames_rendered() == 0)
+      return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(
+      "Example usage: ./peerconnection_bench --sessions=4 --codec=VP9 "
+      "--width=640 --height=360\n");
+  absl::ParseCommandLine(argc, argv);
+
+  const int num_sessions = std::max(absl::GetFlag(FLAGS_sessions), 1);
+  const int width = absl::GetFlag(FLAGS_width);
+  const int height = absl::GetFlag(FLAGS_height);
+  const int fps = absl::GetFlag(FLAGS_fps);
+  const std::string codec = absl::GetFlag(FLAGS_codec);
+  const std::chrono::seconds warmup(std::max(absl::GetFlag(FLAGS_warmup), 0));
+  const std::chrono::seconds duration(
+      std::max(absl::GetFlag(FLAGS_duration), 1));
+  if (width <= 0 || height <= 0 || fps <= 0) {
+    fprintf(stderr, "--width, --height and --fps must be positive\n");
+    return 1;
+  }
+
+  webrtc::AutoThread main_thread;
+  const webrtc::Environment env = webrtc::CreateEnvironment();
+  std::unique_ptr<webrtc::Thread> signaling_thread =
+      webrtc::Thread::CreateWithSocketServer();
+  signaling_thread->Start();
+
+  // The same factory and codecs as the client, with no audio device, since
+  // only the video is measured.
+  webrtc::PeerConnectionFactoryDependencies deps;
+  deps.signaling_thread = signaling_thread.get();
+  deps.env = env;
+  deps.adm = webrtc::CreateAudioDeviceModule(
+      env, webrtc::AudioDeviceModule::kDummyAudio);
+  deps.audio_encoder_factory = webrtc::CreateBuiltinAudioEncoderFactory();
+  deps.audio_decoder_factory = webrtc::CreateBuiltinAudioDecoderFactory();
+  deps.video_encoder_factory = CreateVideoEncoderFactory();
+  deps.video_decoder_factory = CreateVideoDecoderFactory();
+  webrtc::EnableMedia(deps);
+  webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory =
+      webrtc::CreateModularPeerConnectionFactory(std::move(deps));
+  if (!factory) {
+    fprintf(stderr, "Failed to create the PeerConnectionFactory\n");
+    return 1;
+  }
+  // As for the loopback calls of the client, which keeps DTLS out of the
+  // measurements too.
+  webrtc::PeerConnectionFactoryInterface::Options options;
+  options.disable_encryption = true;
+  factory->SetOptions(options);
+
+  std::vector<std::unique_ptr<LoopbackSession>> sessions;
+  for (int i = 0; i < num_sessions; ++i) {
+    sessions.push_back(std::make_unique<LoopbackSession>(
+        env, factory.get(), width, height, fps, codec));
+    if (!sessions.back()->Start()) {
+      fprintf(stderr, "Failed to start call %i\n", i);
+      return 1;
+    }
+  }
+
+  auto connect_deadline = std::chrono::steady_clock::now() + kConnectTimeout;
+  while (!AllRendering(sessions)) {
+    if (std::chrono::steady_clock::now() > connect_deadline) {
+      fprintf(stderr, "Not all calls delivered video within %lli s\n",
+              static_cast<long long>(kConnectTimeout.count()));
+      return 1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  std::this_thread::sleep_for(warmup);
+
+  std::vector<LoopbackSession::CodecStats> start_stats;
+  for (const auto& session : sessions)
+    start_stats.push_back(session->GetCodecStats());
+  for (const auto& session : sessions)
+    session->ResetMeasurements();
+  const int64_t start_cpu_ns = webrtc::GetProcessCpuTimeNanos();
+  const auto start_time = std::chrono::steady_clock::now();
+
+  std::this_thread::sleep_for(duration);
+
+  const int64_t cpu_ns = webrtc::GetProcessCpuTimeNanos() - start_cpu_ns;
+  const double elapsed_s = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start_time)
+                               .count();
+  std::vector<int64_t> latencies;
+  std::vector<double> session_fps;
+  uint64_t frames_encoded = 0;
+  double encode_time_s = 0;
+  uint64_t frames_decoded = 0;
+  double decode_time_s = 0;
+  for (size_t i = 0; i < sessions.size(); ++i) {
+    session_fps.push_back(sessions[i]->frames_rendered() / elapsed_s);
+    std::vector<int64_t> session_latencies = sessions[i]->Latencies();
+    latencies.insert(latencies.end(), session_latencies.begin(),
+                     session_latencies.end());
+    LoopbackSession::CodecStats stats = sessions[i]->GetCodecStats();
+    frames_encoded += stats.frames_encoded - start_stats[i].frames_encoded;
+    encode_time_s += stats.encode_time_s - start_stats[i].encode_time_s;
+    frames_decoded += stats.frames_decoded - start_stats[i].frames_decoded;
+    decode_time_s += stats.decode_time_s - start_stats[i].decode_time_s;
+  }
+  sessions.clear();
+  factory = nullptr;
+
+  std::sort(latencies.begin(), latencies.end());
+  std::sort(session_fps.begin(), session_fps.end());
+  double total_fps = 0;
+  for (double value : session_fps)
+    total_fps += value;
+
+  printf("calls %i, %ix%i at %i fps, %s, %.1f s\n", num_sessions, width,
+         height, fps, codec.c_str(), elapsed_s);
+  printf("capture to render ms: p50 %lli, p90 %lli, p99 %lli, max %lli "
+         "(%zu frames)\n",
+         static_cast<long long>(Percentile(latencies, 50)),
+         static_cast<long long>(Percentile(latencies, 90)),
+         static_cast<long long>(Percentile(latencies, 99)),
+         static_cast<long long>(latencies.empty() ? 0 : latencies.back()),
+         latencies.size());
+  printf("encode ms per frame: %.2f (%llu frames)\n",
+         frames_encoded ? encode_time_s * 1000 / frames_encoded : 0.0,
+         static_cast<unsigned long long>(frames_encoded));
+  printf("decode ms per frame: %.2f (%llu frames)\n",
+         frames_decoded ? decode_time_s * 1000 / frames_decoded : 0.0,
+         static_cast<unsigned long long>(frames_decoded));
+  // Each call both sends and receives in this process.
+  printf("cpu per call: %.1f%% of a core\n",
+         cpu_ns / 1e9 / elapsed_s * 100 / num_sessions);
+  printf("rendered fps per call: mean %.1f, min %.1f\n",
+         total_fps / num_sessions, session_fps.front());
+  return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/server/server_log.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "absl/strings/string_view.h"
+#include "examples/peerconnection/server/mpsc_queue.h"
+#include "rtc_base/checks.h"
+
+namespace {
+
+// Lines that may be waiting for the writer before new ones are dropped.
+constexpr size_t kMaxQueuedLines = 10000;
+
+// Writes the queued lines on its own thread.  Producers wake it up the same
+// way ServerWorker::PostTask() wakes up a worker: only the first line after
+// the queue was drained signals it.
+class LogWriter {
+ public:
+  LogWriter()
+      : queued_(0),
+        dropped_(0),
+        pushing_(0),
+        wakeup_pending_(false),
+        running_(false),
+        stop_(false) {}
+
+  void Start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    RTC_DCHECK(!running_);
+    stop_ = false;
+    thread_ = std::thread(&LogWriter::Run, this);
+    running_.store(true, std::memory_order_release);
+  }
+
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!running_)
+        return;
+      // Lines from now on are written by their callers.
+      running_.store(false);
+      stop_ = true;
+      wakeup_.notify_one();
+    }
+    thread_.join();
+    // Lines queued while the writer was stopping, including those of
+    // callers that are still pushing them.
+    while (pushing_.load())
+      std::this_thread::yield();
+    WriteQueued();
+  }
+
+  // Takes `line` and returns true if the writer is running.
+  bool Push(std::string&& line) {
+    // Stop() waits for the lines of callers that saw the writer running.
+    pushing_.fetch_add(1);
+    if (!running_.load()) {
+      pushing_.fetch_sub(1, std::memory_order_release);
+      return false;
+    }
+    if (queued_.fetch_add(1, std::memory_order_relaxed) >= kMaxQueuedLines) {
+      queued_.fetch_sub(1, std::memory_order_relaxed);
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      lines_.Push(std::move(line));
+      if (!wakeup_pending_.exchange(true)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wakeup_.notify_one();
+      }
+    }
+    pushing_.fetch_sub(1, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      wakeup_.wait(lock, [this] { return wakeup_pending_ || stop_; });
+      bool stop = stop_;
+      lock.unlock();
+      wakeup_pending_.exchange(false);
+      WriteQueued();
+      lock.lock();
+      if (stop)
+        break;
+    }
+  }
+
+  void WriteQueued() {
+    std::string line;
+    while (lines_.Pop(&line)) {
+      queued_.fetch_sub(1, std::memory_order_relaxed);
+      fwrite(line.data(), 1, line.size(), stdout);
+    }
+    uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+    if (dropped) {
+      fprintf(stdout, "%llu log lines dropped\n",
+              static_cast<unsigned long long>(dropped));
+    }
+    fflush(stdout);
+  }
+
+  MpscQueue<std::string> lines_;
+  std::atomic<size_t> queued_;
+  std::atomic<uint64_t> dropped_;
+  // Callers of Push() that have not returned yet.
+  std::atomic<int> pushing_;
+  std::atomic<bool> wakeup_pending_;
+  std::atomic<bool> running_;
+  bool stop_;
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  std::thread thread_;
+};
+
+LogWriter& GetWriter() {
+  static LogWriter* writer = new LogWriter();
+  return *writer;
+}
+
+}  // namespace
+
+std::atomic<int> ServerLog::level_(ServerLog::LS_INFO);
+
+// static
+bool ServerLog::ParseLevel(absl::string_view name, Level* level) {
+  RTC_DCHECK(level);
+  if (name == "error") {
+    *level = LS_ERROR;
+  } else if (name == "warning") {
+    *level = LS_WARNING;
+  } else if (name == "info") {
+    *level = LS_INFO;
+  } else if (name == "verbose") {
+    *level = LS_VERBOSE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// static
+void ServerLog::Start() {
+  GetWriter().Start();
+}
+
+// static
+void ServerLog::Stop() {
+  GetWriter().Stop();
+}
+
+// static
+void ServerLog::Write(Level level, const char* format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  int size = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (size < 0)
+    return;
+
+  // Info and verbose lines are the server's normal output.
+  std::string line = level == LS_ERROR     ? "Error: "
+                     : level == LS_WARNING ? "Warning: "
+                                           : "";
+  if (static_cast<size_t>(size) < sizeof(buffer)) {
+    line.append(buffer, size);
+  } else {
+    size_t prefix = line.size();
+    line.resize(prefix + size);
+    va_start(args, format);
+    vsnprintf(&line[prefix], size + 1, format, args);
+    va_end(args);
+  }
+
+  if (!GetWriter().Push(std::move(line)))
+    fwrite(line.data(), 1, line.size(), stdout);
+}
@@ -0,0 +1,68 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_SERVER_SERVER_LOG_H_
+#define EXAMPLES_PEERCONNECTION_SERVER_SERVER_LOG_H_
+
+#include <atomic>
+
+#include "absl/base/attributes.h"
+#include "absl/strings/string_view.h"
+
+// Log lines of the server's events.  Lines below the configured level cost
+// one relaxed load; the others are formatted on the calling thread and
+// written to stdout by a thread of their own once Start() has been called,
+// so that the event loops never wait for the terminal.  If the writer falls
+// too far behind, lines are dropped and the number dropped is logged.
+class ServerLog {
+ public:
+  enum Level {
+    LS_ERROR,
+    LS_WARNING,
+    LS_INFO,
+    LS_VERBOSE,
+  };
+
+  // Parses "error", "warning", "info" or "verbose".
+  static bool ParseLevel(absl::string_view name, Level* level);
+
+  static void set_level(Level level) {
+    level_.store(level, std::memory_order_relaxed);
+  }
+
+  static bool IsEnabled(Level level) {
+    return level <= level_.load(std::memory_order_relaxed);
+  }
+
+  // Starts the writer thread.  Until then, lines are written right away.
+  static void Start();
+
+  // Writes the lines that are still queued and stops the writer thread.
+  static void Stop();
+
+  // Formats a line, which should end in a newline, like printf().  Errors
+  // and warnings start with their severity.
+  static void Write(Level level, const char* format, ...)
+      ABSL_PRINTF_ATTRIBUTE(2, 3);
+
+ private:
+  static std::atomic<int> level_;
+};
+
+// Logs with printf() style arguments if `level` is enabled, without
+// evaluating the arguments otherwise.  E.g.
+//   SERVER_LOG(LS_INFO, "Timeout: %s\n", name.c_str());
+#define SERVER_LOG(level, ...)                         \
+  do {                                                 \
+    if (ServerLog::IsEnabled(ServerLog::level))        \
+      ServerLog::Write(ServerLog::level, __VA_ARGS__); \
+  } while (0)
+
+#endif  // EXAMPLES_PEERCONNECTION_SERVER_SERVER_LOG_H_
@@ -0,0 +1,168 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/server/server_metrics.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+
+namespace {
+
+constexpr absl::string_view kPrefix = "peerconnection_server_";
+
+// Quantiles reported for each histogram.
+constexpr double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+// The histograms of several workers added up.
+struct HistogramSum {
+  HistogramSum() : buckets(MetricHistogram::kBucketCount), count(0), sum(0) {}
+
+  void Add(const MetricHistogram& histogram) {
+    for (size_t i = 0; i < buckets.size(); ++i)
+      buckets[i] += histogram.bucket(i);
+    count += histogram.count();
+    sum += histogram.sum();
+  }
+
+  // Returns the middle of the bucket that holds the value at `quantile`.
+  double Quantile(double quantile) const {
+    if (!count)
+      return 0;
+    uint64_t rank = static_cast<uint64_t>(std::ceil(quantile * count));
+    if (rank == 0)
+      rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+      seen += buckets[i];
+      if (seen >= rank) {
+        return MetricHistogram::BucketStart(i) +
+               (MetricHistogram::BucketWidth(i) - 1) / 2.0;
+      }
+    }
+    return MetricHistogram::BucketStart(buckets.size() - 1);
+  }
+
+  std::vector<uint64_t> buckets;
+  uint64_t count;
+  uint64_t sum;
+};
+
+void AppendHeader(absl::string_view name,
+                  absl::string_view type,
+                  absl::string_view help,
+                  std::string* out) {
+  absl::StrAppend(out, "# HELP ", kPrefix, name, " ", help, "\n", "# TYPE ",
+                  kPrefix, name, " ", type, "\n");
+}
+
+void AppendValue(absl::string_view name,
+                 absl::string_view type,
+                 absl::string_view help,
+                 uint64_t value,
+                 std::string* out) {
+  AppendHeader(name, type, help, out);
+  absl::StrAppend(out, kPrefix, name, " ", value, "\n");
+}
+
+// Writes a histogram as a summary, with its values multiplied by `scale`,
+// e.g. to turn nanoseconds into seconds.
+void AppendSummary(absl::string_view name,
+                   absl::string_view help,
+                   const HistogramSum& histogram,
+                   double scale,
+                   std::string* out) {
+  AppendHeader(name, "summary", help, out);
+  for (double quantile : kQuantiles) {
+    absl::StrAppend(out, kPrefix, name, "{quantile=\"", quantile, "\"} ",
+                    histogram.Quantile(quantile) * scale, "\n");
+  }
+  absl::StrAppend(out, kPrefix, name, "_sum ", histogram.sum * scale, "\n",
+                  kPrefix, name, "_count ", histogram.count, "\n");
+}
+
+}  // namespace
+
+MetricHistogram::MetricHistogram() {
+  for (std::atomic<uint64_t>& bucket : buckets_)
+    bucket.store(0, std::memory_order_relaxed);
+}
+
+// static
+uint64_t MetricHistogram::BucketStart(size_t bucket) {
+  if (bucket < 2 * kSubBuckets)
+    return bucket;
+  int shift = static_cast<int>(bucket / kSubBuckets) - 1;
+  return (bucket - shift * kSubBuckets) << shift;
+}
+
+// static
+uint64_t MetricHistogram::BucketWidth(size_t bucket) {
+  if (bucket < 2 * kSubBuckets)
+    return 1;
+  return uint64_t{1} << (bucket / kSubBuckets - 1);
+}
+
+std::string FormatMetrics(const std::vector<const ServerMetrics*>& workers) {
+  uint64_t bytes_received = 0;
+  uint64_t bytes_sent = 0;
+  uint64_t requests = 0;
+  uint64_t messages_relayed = 0;
+  uint64_t connections = 0;
+  uint64_t members = 0;
+  HistogramSum request_parse;
+  HistogramSum queue_depth;
+  HistogramSum relay_latency;
+  HistogramSum broadcast_fanout;
+  for (const ServerMetrics* metrics : workers) {
+    bytes_received += metrics->bytes_received.value();
+    bytes_sent += metrics->bytes_sent.value();
+    requests += metrics->requests.value();
+    messages_relayed += metrics->messages_relayed.value();
+    connections += metrics->connections.value();
+    members += metrics->members.value();
+    request_parse.Add(metrics->request_parse_ns);
+    queue_depth.Add(metrics->queue_depth);
+    relay_latency.Add(metrics->relay_latency_ns);
+    broadcast_fanout.Add(metrics->broadcast_fanout);
+  }
+
+  std::string out;
+  AppendValue("received_bytes_total", "counter",
+              "Bytes read from client connections.", bytes_received, &out);
+  AppendValue("sent_bytes_total", "counter",
+              "Bytes written to client connections.", bytes_sent, &out);
+  AppendValue("requests_total", "counter", "HTTP requests received.",
+              requests, &out);
+  AppendValue("messages_relayed_total", "counter",
+              "Messages from peers delivered to their recipient.",
+              messages_relayed, &out);
+  AppendValue("connections", "gauge", "Open client connections.",
+              connections, &out);
+  AppendValue("members", "gauge", "Signed in members.", members, &out);
+  AppendSummary("request_parse_seconds", "Time spent parsing a request.",
+                request_parse, 1e-9, &out);
+  AppendSummary("member_queue_depth",
+                "Messages queued for a member when one is added.",
+                queue_depth, 1, &out);
+  AppendSummary("relay_latency_seconds",
+                "Time a message from a peer waited for its recipient, 0 "
+                "if the recipient was waiting for it.",
+                relay_latency, 1e-9, &out);
+  AppendSummary("broadcast_fanout",
+                "Members notified of a presence change.", broadcast_fanout,
+                1, &out);
+  return out;
+}
@@ -0,0 +1,135 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_SERVER_SERVER_METRICS_H_
+#define EXAMPLES_PEERCONNECTION_SERVER_SERVER_METRICS_H_
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The metrics below belong to one thread, which is the only one that updates
+// them.  Updates are relaxed loads and stores rather than read-modify-write
+// operations, so they cost no more than a plain increment, and any thread can
+// read a consistent enough value at any time to report it.
+
+class MetricCounter {
+ public:
+  MetricCounter() : value_(0) {}
+  MetricCounter(const MetricCounter&) = delete;
+  MetricCounter& operator=(const MetricCounter&) = delete;
+
+  void Add(uint64_t amount) {
+    value_.store(value_.load(std::memory_order_relaxed) + amount,
+                 std::memory_order_relaxed);
+  }
+
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint64_t> value_;
+};
+
+class MetricGauge {
+ public:
+  MetricGauge() : value_(0) {}
+  MetricGauge(const MetricGauge&) = delete;
+  MetricGauge& operator=(const MetricGauge&) = delete;
+
+  void Set(uint64_t value) { value_.store(value, std::memory_order_relaxed); }
+
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint64_t> value_;
+};
+
+// Counts values in buckets whose width grows with the value, as
+// HdrHistogram does: values below 2 * kSubBuckets have a bucket each, and
+// every power of two above that is split into kSubBuckets buckets, so that
+// any value is known within 1 / kSubBuckets of itself.  Values from
+// 2^kMaxValueBits on are counted in the last bucket.
+class MetricHistogram {
+ public:
+  static constexpr int kSubBucketBits = 5;
+  static constexpr uint64_t kSubBuckets = uint64_t{1} << kSubBucketBits;
+  static constexpr int kMaxValueBits = 40;
+  static constexpr size_t kBucketCount =
+      (kMaxValueBits - kSubBucketBits + 1) * kSubBuckets;
+
+  MetricHistogram();
+  MetricHistogram(const MetricHistogram&) = delete;
+  MetricHistogram& operator=(const MetricHistogram&) = delete;
+
+  void Record(uint64_t value) {
+    std::atomic<uint64_t>& bucket = buckets_[BucketOf(value)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1,
+                 std::memory_order_relaxed);
+    count_.Add(1);
+    sum_.Add(value);
+  }
+
+  static size_t BucketOf(uint64_t value) {
+    if (value >= (uint64_t{1} << kMaxValueBits))
+      return kBucketCount - 1;
+    int shift = std::bit_width(value) - (kSubBucketBits + 1);
+    if (shift <= 0)
+      return static_cast<size_t>(value);
+    return static_cast<size_t>((value >> shift) + shift * kSubBuckets);
+  }
+
+  // The smallest value that is counted in `bucket`, and the number of values
+  // counted in it.
+  static uint64_t BucketStart(size_t bucket);
+  static uint64_t BucketWidth(size_t bucket);
+
+  uint64_t bucket(size_t index) const {
+    return buckets_[index].load(std::memory_order_relaxed);
+  }
+  uint64_t count() const { return count_.value(); }
+  uint64_t sum() const { return sum_.value(); }
+
+ private:
+  std::atomic<uint64_t> buckets_[kBucketCount];
+  MetricCounter count_;
+  MetricCounter sum_;
+};
+
+// What a worker measures on its hot paths, for the /metrics page.
+struct ServerMetrics {
+  // Bytes read from and written to client connections.
+  MetricCounter bytes_received;
+  MetricCounter bytes_sent;
+  // Complete HTTP requests received.
+  MetricCounter requests;
+  // Messages from peers that were delivered to their recipient.
+  MetricCounter messages_relayed;
+  MetricGauge connections;
+  MetricGauge members;
+  // Nanoseconds spent parsing each request, over all reads it took.
+  MetricHistogram request_parse_ns;
+  // Messages queued for a member, including the new one, each time a
+  // message or notification is added; 0 if it is delivered right away.
+  MetricHistogram queue_depth;
+  // Nanoseconds from a message being queued for a member until it is
+  // written to that member's waiting socket, 0 if it was waiting already.
+  MetricHistogram relay_latency_ns;
+  // Members notified of each presence change, or of each presence window.
+  MetricHistogram broadcast_fanout;
+};
+
+// Returns the sum of the metrics of `workers` in the Prometheus text
+// exposition format.
+std::string FormatMetrics(const std::vector<const ServerMetrics*>& workers);
+
+#endif  // EXAMPLES_PEERCONNECTION_SERVER_SERVER_METRICS_H_
@@ -0,0 +1,560 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/server/server_worker.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "examples/peerconnection/server/data_socket.h"
+#include "examples/peerconnection/server/event_loop.h"
+#include "examples/peerconnection/server/http_request_parser.h"
+#include "examples/peerconnection/server/peer_channel.h"
+#include "examples/peerconnection/server/server_log.h"
+#include "examples/peerconnection/server/server_metrics.h"
+#include "rtc_base/checks.h"
+
+namespace {
+
+void HandleBrowserRequest(DataSocket* ds, bool* quit) {
+  RTC_DCHECK(ds && ds->valid());
+  RTC_DCHECK(quit);
+
+  *quit = ds->request_path() == "/quit";
+
+  if (*quit) {
+    ds->Send("200 OK", true, "text/html", "",
+             "<html><body>Quitting...</body></html>");
+  } else if (ds->method() == DataSocket::OPTIONS) {
+    // We'll get this when a browsers do cross-resource-sharing requests.
+    // The headers to allow cross-origin script support will be set inside
+    // Send.
+    ds->Send("200 OK", false, "", "", "");
+  } else {
+    // Here we could write some useful output back to the browser depending on
+    // the path.
+    absl::string_view path = ds->request_path();
+    SERVER_LOG(LS_WARNING, "Received an invalid request: %.*s\n",
+               static_cast<int>(path.size()), path.data());
+    ds->Send("500 Sorry", true, "text/html", "",
+             "<html><body>Sorry, not yet implemented</body></html>");
+  }
+}
+
+// Returns the first member id of the worker `index`.  In a cluster, ids are
+// striped over the nodes first and then over the workers of each node.
+int FirstMemberId(size_t index, const ClusterLink* cluster) {
+  int node = cluster ? cluster->node_index() : 0;
+  int num_nodes = cluster ? cluster->num_nodes() : 1;
+  return node + num_nodes * static_cast<int>(index) + 1;
+}
+
+}  // namespace
+
+ServerWorker::ServerWorker(size_t index,
+                           const Group* group,
+                           const Options& options)
+    : index_(index),
+      group_(group),
+      max_connections_(options.max_connections),
+      cluster_(options.cluster),
+      clients_(FirstMemberId(index, options.cluster),
+               static_cast<int>(group->size()) *
+                   (options.cluster ? options.cluster->num_nodes() : 1),
+               options.member_timeout,
+               options.queue_limits,
+               options.presence_window),
+      next_report_id_(0),
+      wakeup_pending_(false),
+      quit_(false) {
+  RTC_DCHECK_LT(index_, group_->size());
+  clients_.set_observer(this);
+  clients_.set_metrics(&metrics_);
+}
+
+ServerWorker::~ServerWorker() {
+  // Run whatever the other workers posted before they stopped so that
+  // sockets handed to us are not leaked.
+  RunPendingTasks();
+  for (SocketSet::iterator i = sockets_.begin(); i != sockets_.end(); ++i)
+    delete (*i);
+  sockets_.clear();
+}
+
+bool ServerWorker::Init(unsigned short port) {
+  event_loop_ = EventLoop::Create();
+  if (!event_loop_) {
+    printf("Failed to create event loop\n");
+    return false;
+  }
+
+  if (!listener_.Create()) {
+    printf("Failed to create server socket\n");
+    return false;
+  } else if (!listener_.Listen(port, group_->size() > 1)) {
+    printf("Failed to listen on server socket\n");
+    return false;
+  }
+
+  if (!wakeup_.Create()) {
+    printf("Failed to create wakeup socket\n");
+    return false;
+  }
+
+  return event_loop_->Add(&listener_) && event_loop_->Add(&wakeup_);
+}
+
+void ServerWorker::Run() {
+  std::vector<EventLoop::Event> ready;
+  while (!quit_) {
+    ready.clear();
+    // Sleep until there is socket activity or the next member times out.
+    if (!event_loop_->Wait(clients_.MillisecondsUntilNextTimeout(), &ready)) {
+      SERVER_LOG(LS_ERROR, "wait failed\n");
+      break;
+    }
+
+    bool accept_pending = false;
+    for (const EventLoop::Event& event : ready) {
+      if (event.socket == &listener_) {
+        accept_pending = true;
+      } else if (event.socket == &wakeup_) {
+        RunPendingTasks();
+      } else {
+        DataSocket* s = static_cast<DataSocket*>(event.socket);
+        // Tasks run earlier in this iteration may have closed the socket.
+        if (sockets_.find(s) == sockets_.end())
+          continue;
+        if (event.writable) {
+          OnSocketWritable(s);
+          if (sockets_.find(s) == sockets_.end())
+            continue;
+        }
+        if (event.readable)
+          OnSocketReadable(s);
+      }
+      if (quit_)
+        break;
+    }
+
+    if (quit_)
+      break;
+
+    clients_.CheckForTimeout();
+
+    if (accept_pending && listener_.valid())
+      AcceptConnection();
+  }
+
+  Shutdown();
+}
+
+void ServerWorker::QuitAll() {
+  for (ServerWorker* worker : *group_) {
+    worker->quit_ = true;
+    worker->wakeup_.Signal();
+  }
+  if (cluster_)
+    cluster_->Quit();
+}
+
+void ServerWorker::OnMemberChanged(const ChannelMember& member) {
+  if (group_->size() == 1 && !cluster_)
+    return;
+
+  int id = member.id();
+  const std::string& room = member.room();
+  // Shared by all workers; the payload is never modified.
+  SharedPayload entry = std::make_shared<const std::string>(member.GetEntry());
+  bool connected = member.connected();
+  if (cluster_)
+    cluster_->SendMemberChanged(-1, id, room, entry, connected);
+  for (ServerWorker* worker : *group_) {
+    if (worker == this)
+      continue;
+    worker->PostTask([worker, id, room, entry, connected] {
+      worker->clients_.OnRemoteMemberChanged(id, room, entry, connected);
+    });
+  }
+}
+
+void ServerWorker::OnClusterMemberChanged(int id,
+                                          const std::string& room,
+                                          const SharedPayload& entry,
+                                          bool connected) {
+  RTC_DCHECK_NE(NodeOfMember(id), node_index());
+  for (ServerWorker* worker : *group_) {
+    worker->PostTask([worker, id, room, entry, connected] {
+      worker->clients_.OnRemoteMemberChanged(id, room, entry, connected);
+    });
+  }
+}
+
+void ServerWorker::OnClusterMessage(int from_id,
+                                    int to_id,
+                                    const std::string& content_type,
+                                    const SharedPayload& data) {
+  if (NodeOfMember(to_id) != node_index())
+    return;
+  ServerWorker* owner = OwnerOfMember(to_id);
+  owner->PostTask([owner, from_id, to_id, content_type, data] {
+    ChannelMember* peer = owner->clients_.Find(to_id);
+    if (peer)
+      peer->QueueResponse(content_type, from_id, data);
+  });
+}
+
+void ServerWorker::OnClusterNodeUp(int node) {
+  for (ServerWorker* worker : *group_)
+    worker->PostTask([worker, node] { worker->SendMembersToNode(node); });
+}
+
+void ServerWorker::OnClusterNodeDown(int node) {
+  for (ServerWorker* worker : *group_) {
+    worker->PostTask([worker, node] {
+      worker->clients_.DropRemoteMembers(
+          [worker, node](int id) { return worker->NodeOfMember(id) == node; });
+    });
+  }
+}
+
+void ServerWorker::SendMembersToNode(int node) {
+  RTC_DCHECK(cluster_);
+  std::vector<const ChannelMember*> members;
+  clients_.GetMembers(&members);
+  for (const ChannelMember* member : members) {
+    cluster_->SendMemberChanged(
+        node, member->id(), member->room(),
+        std::make_shared<const std::string>(member->GetEntry()), true);
+  }
+}
+
+void ServerWorker::PostTask(Task task) {
+  mailbox_.Push(std::move(task));
+  // Only the first task posted after the mailbox was drained needs to wake
+  // up the worker.
+  if (!wakeup_pending_.exchange(true))
+    wakeup_.Signal();
+}
+
+void ServerWorker::RunPendingTasks() {
+  if (wakeup_.valid())
+    wakeup_.Drain();
+  wakeup_pending_ = false;
+  Task task;
+  while (mailbox_.Pop(&task))
+    task();
+}
+
+ServerWorker* ServerWorker::OwnerOf(const DataSocket* ds) const {
+  int id = PeerChannel::GetPeerId(ds);
+  if (id <= 0)
+    return (*group_)[index_];
+  return OwnerOfMember(id);
+}
+
+ServerWorker* ServerWorker::OwnerOfMember(int id) const {
+  RTC_DCHECK_GT(id, 0);
+  // Matches the ids handed out by the channel of each worker.  Ids of other
+  // nodes map to some worker, which will not find the member.
+  return (*group_)[((id - 1) / num_nodes()) % group_->size()];
+}
+
+int ServerWorker::NodeOfMember(int id) const {
+  return cluster_ ? cluster_->NodeOfMember(id) : 0;
+}
+
+void ServerWorker::OnSocketReadable(DataSocket* s) {
+  bool socket_done = true;
+  if (closing_.find(s) != closing_.end()) {
+    // Only wait for the peer to go away; further requests are ignored.
+    if (!s->OnDataAvailable(&socket_done) && socket_done &&
+        s->request().status() != HttpRequestParser::PARSE_ERROR) {
+      CloseSocket(s);
+    } else {
+      s->Clear();
+    }
+    return;
+  }
+
+  if (s->OnDataAvailable(&socket_done) && s->request_received()) {
+    HandleReceivedRequests(s);
+    return;
+  }
+
+  if (s->request().status() == HttpRequestParser::PARSE_ERROR)
+    s->Send("400 Bad Request", true, "text/plain", "", "Malformed request.");
+  if (socket_done)
+    CloseSocketWhenFlushed(s);
+}
+
+void ServerWorker::HandleReceivedRequests(DataSocket* s) {
+  while (s->request_received()) {
+    ServerWorker* owner = OwnerOf(s);
+    if (owner != this) {
+      ReleaseSocket(s);
+      owner->PostTask([owner, s] { owner->AdoptSocket(s); });
+      return;
+    }
+
+    bool socket_done = false;
+    HandleRequest(s, &socket_done);
+    clients_.RemoveSignedOutMembers();
+    if (socket_done) {
+      CloseSocketWhenFlushed(s);
+      return;
+    }
+
+    // Hanging gets are answered later, WebSockets no longer carry requests,
+    // and clients that did not ask for a persistent connection close it
+    // after reading the response.
+    if (quit_ || s->is_websocket() || !s->response_sent() || !s->keep_alive())
+      return;
+
+    s->Clear();
+  }
+}
+
+void ServerWorker::OnSocketWritable(DataSocket* s) {
+  if (!s->OnWritable()) {
+    CloseSocket(s);
+  } else if (!s->has_pending_output() && closing_.find(s) != closing_.end()) {
+    CloseSocket(s);
+  } else if (!s->has_pending_output() && s->is_websocket()) {
+    // Messages held back while the peer was not reading can go out now.
+    clients_.OnSocketDrained(s);
+  }
+}
+
+void ServerWorker::AdoptSocket(DataSocket* s) {
+  if (quit_ || !event_loop_->Add(s)) {
+    delete s;
+    return;
+  }
+  sockets_.insert(s);
+  metrics_.connections.Set(sockets_.size());
+  s->set_event_loop(event_loop_.get());
+  s->set_metrics(&metrics_);
+  HandleReceivedRequests(s);
+}
+
+void ServerWorker::ReleaseSocket(DataSocket* s) {
+  s->set_event_loop(nullptr);
+  s->set_metrics(nullptr);
+  event_loop_->Remove(s);
+  sockets_.erase(s);
+  metrics_.connections.Set(sockets_.size());
+}
+
+void ServerWorker::CloseSocketWhenFlushed(DataSocket* s) {
+  if (!s->has_pending_output()) {
+    CloseSocket(s);
+    return;
+  }
+  // The channel must forget about the socket now; it only lingers until the
+  // response has been written.
+  clients_.OnClosing(s);
+  closing_.insert(s);
+}
+
+void ServerWorker::CloseSocket(DataSocket* s) {
+  SERVER_LOG(LS_VERBOSE, "Disconnecting socket\n");
+  clients_.OnClosing(s);
+  for (auto it = rooms_reports_.begin(); it != rooms_reports_.end();) {
+    if (it->second.socket == s)
+      it = rooms_reports_.erase(it);
+    else
+      ++it;
+  }
+  RTC_DCHECK(s->valid());  // Close must not have been called yet.
+  s->set_event_loop(nullptr);
+  event_loop_->Remove(s);
+  sockets_.erase(s);
+  closing_.erase(s);
+  metrics_.connections.Set(sockets_.size());
+  delete s;
+}
+
+void ServerWorker::HandleRequest(DataSocket* s, bool* socket_done) {
+  ChannelMember* member = clients_.Lookup(s);
+  if (member || PeerChannel::IsPeerConnection(s)) {
+    if (!member) {
+      if (s->PathEquals("/sign_in")) {
+        clients_.AddMember(s);
+      } else {
+        absl::string_view path = s->request_path();
+        SERVER_LOG(LS_WARNING, "No member found for: %.*s\n",
+                   static_cast<int>(path.size()), path.data());
+        s->Send("500 Error", false, "text/plain", "", "Peer most likely gone.");
+      }
+    } else if (member->is_wait_request(s)) {
+      // no need to do anything.
+      *socket_done = false;
+    } else {
+      ChannelMember* target = clients_.IsTargetedRequest(s, *member);
+      int target_id = PeerChannel::GetTargetPeerId(s);
+      if (target) {
+        member->ForwardRequestToPeer(s, target);
+      } else if (target_id > 0 &&
+                 clients_.HasRemoteMember(target_id, *member)) {
+        ForwardToRemotePeer(*member, s, target_id);
+      } else if (s->PathEquals("/sign_out")) {
+        s->Send("200 OK", false, "text/plain", "", "");
+      } else if (s->PathEquals("/resume")) {
+        clients_.ResumeMember(s, member);
+      } else if (s->PathEquals("/stats")) {
+        // Call statistics reported by the client, kept in the log.
+        absl::string_view report = s->data();
+        SERVER_LOG(LS_INFO, "Call stats from %s: %.*s\n",
+                   member->name().c_str(), static_cast<int>(report.size()),
+                   report.data());
+        s->Send("200 OK", false, "text/plain", "", "");
+      } else {
+        absl::string_view path = s->request_path();
+        SERVER_LOG(LS_WARNING, "Couldn't find target for request: %.*s\n",
+                   static_cast<int>(path.size()), path.data());
+        s->Send("500 Error", false, "text/plain", "", "Peer most likely gone.");
+      }
+    }
+  } else if (s->PathEquals("/rooms")) {
+    // Answered once every worker has reported its rooms.
+    StartRoomsReport(s);
+  } else if (s->PathEquals("/metrics")) {
+    SendMetrics(s);
+  } else {
+    bool quit = false;
+    HandleBrowserRequest(s, &quit);
+    if (quit) {
+      SERVER_LOG(LS_INFO, "Quitting...\n");
+      QuitAll();
+    }
+  }
+}
+
+void ServerWorker::ForwardToRemotePeer(const ChannelMember& member,
+                                       DataSocket* ds,
+                                       int peer_id) {
+  SERVER_LOG(LS_VERBOSE, "Client %s sending to remote peer %d\n",
+             member.name().c_str(), peer_id);
+  int from_id = member.id();
+  std::string content_type(ds->content_type());
+  SharedPayload data = std::make_shared<const std::string>(ds->data());
+  if (NodeOfMember(peer_id) != node_index()) {
+    cluster_->SendMessage(from_id, peer_id, content_type, data);
+    ds->Send("200 OK", false, "text/plain", "", "");
+    return;
+  }
+
+  ServerWorker* owner = OwnerOfMember(peer_id);
+  RTC_DCHECK_NE(owner, this);
+  owner->PostTask([owner, peer_id, from_id,
+                   content_type = std::move(content_type),
+                   data = std::move(data)] {
+    ChannelMember* peer = owner->clients_.Find(peer_id);
+    if (peer)
+      peer->QueueResponse(content_type, from_id, data);
+  });
+  ds->Send("200 OK", false, "text/plain", "", "");
+}
+
+void ServerWorker::StartRoomsReport(DataSocket* s) {
+  uint64_t report_id = next_report_id_++;
+  RoomsReport& report = rooms_reports_[report_id];
+  report.socket = s;
+  clients_.GetRoomStats(&report.stats);
+  report.pending = group_->size() - 1;
+  if (!report.pending) {
+    FinishRoomsReport(report_id);
+    return;
+  }
+
+  for (ServerWorker* worker : *group_) {
+    if (worker == this)
+      continue;
+    worker->PostTask([worker, self = this, report_id] {
+      RoomStatsMap stats;
+      worker->clients_.GetRoomStats(&stats);
+      self->PostTask([self, report_id, stats = std::move(stats)] {
+        self->OnRoomStats(report_id, stats);
+      });
+    });
+  }
+}
+
+void ServerWorker::OnRoomStats(uint64_t report_id, const RoomStatsMap& stats) {
+  std::unordered_map<uint64_t, RoomsReport>::iterator found =
+      rooms_reports_.find(report_id);
+  // The socket may have closed in the meantime.
+  if (found == rooms_reports_.end())
+    return;
+  RoomsReport& report = found->second;
+  for (const auto& room : stats)
+    report.stats[room.first].Add(room.second);
+  if (--report.pending == 0)
+    FinishRoomsReport(report_id);
+}
+
+void ServerWorker::FinishRoomsReport(uint64_t report_id) {
+  std::unordered_map<uint64_t, RoomsReport>::iterator found =
+      rooms_reports_.find(report_id);
+  RTC_DCHECK(found != rooms_reports_.end());
+  DataSocket* s = found->second.socket;
+  // One line per room: "name,members,sign_ins,messages,notifications".  The
+  // default room has an empty name.
+  std::string body;
+  for (const auto& room : found->second.stats) {
+    absl::StrAppend(&body, room.first, ",", room.second.members, ",",
+                    room.second.sign_ins, ",", room.second.messages, ",",
+                    room.second.notifications, "\n");
+  }
+  rooms_reports_.erase(found);
+  s->Send("200 OK", false, "text/plain", "", body);
+}
+
+void ServerWorker::SendMetrics(DataSocket* s) {
+  std::vector<const ServerMetrics*> metrics;
+  for (const ServerWorker* worker : *group_)
+    metrics.push_back(&worker->metrics());
+  s->Send("200 OK", false, "text/plain; version=0.0.4", "",
+          FormatMetrics(metrics));
+}
+
+void ServerWorker::AcceptConnection() {
+  DataSocket* s = listener_.Accept();
+  if (!s) {
+    SERVER_LOG(LS_WARNING, "Failed to accept connection\n");
+  } else if (max_connections_ && sockets_.size() >= max_connections_) {
+    delete s;  // sorry, that's all we can take.
+    SERVER_LOG(LS_WARNING, "Connection limit reached\n");
+  } else if (!event_loop_->Add(s)) {
+    delete s;
+    SERVER_LOG(LS_ERROR, "Failed to watch new connection\n");
+  } else {
+    sockets_.insert(s);
+    metrics_.connections.Set(sockets_.size());
+    s->set_event_loop(event_loop_.get());
+    s->set_metrics(&metrics_);
+    SERVER_LOG(LS_VERBOSE, "New connection...\n");
+  }
+}
+
+void ServerWorker::Shutdown() {
+  if (listener_.valid()) {
+    event_loop_->Remove(&listener_);
+    listener_.Close();
+  }
+  clients_.CloseAll();
+}
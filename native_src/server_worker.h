@@ -0,0 +1,185 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_SERVER_SERVER_WORKER_H_
+#define EXAMPLES_PEERCONNECTION_SERVER_SERVER_WORKER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "examples/peerconnection/server/cluster_link.h"
+#include "examples/peerconnection/server/data_socket.h"
+#include "examples/peerconnection/server/event_loop.h"
+#include "examples/peerconnection/server/mpsc_queue.h"
+#include "examples/peerconnection/server/peer_channel.h"
+#include "examples/peerconnection/server/server_metrics.h"
+#include "examples/peerconnection/server/timeout_queue.h"
+
+// Runs one accept/event loop together with the shard of the channel that
+// owns the members whose ids map to this worker.  When several workers serve
+// the same port, requests for a member owned by another worker are handed to
+// that worker together with their socket, and messages and presence changes
+// that cross shards are delivered through the workers' mailboxes.  In a
+// cluster, the same happens between nodes over a ClusterLink, and member ids
+// are striped over the nodes first and then over the workers of each node.
+class ServerWorker : public PeerChannel::Observer,
+                     public ClusterLink::Observer {
+ public:
+  typedef std::vector<ServerWorker*> Group;
+
+  // Settings shared by the workers of a group.
+  struct Options {
+    Options()
+        : max_connections(0),
+          member_timeout(std::chrono::seconds(30)),
+          presence_window(TimeoutQueue::Clock::duration::zero()),
+          cluster(nullptr) {}
+
+    // Connections this worker accepts at most, 0 means no limit.
+    size_t max_connections;
+    TimeoutQueue::Clock::duration member_timeout;
+    MemberQueueLimits queue_limits;
+    TimeoutQueue::Clock::duration presence_window;
+    // The link to the other nodes of the cluster, or null if this server
+    // runs on its own.  Must outlive the worker.
+    ClusterLink* cluster;
+  };
+
+  // `group` lists all workers serving the port, including this one, ordered
+  // by index.  It must outlive the worker.
+  ServerWorker(size_t index, const Group* group, const Options& options);
+  ~ServerWorker() override;
+
+  // Sets up the listening socket, event loop and mailbox.
+  bool Init(unsigned short port);
+
+  // Runs the event loop until one of the workers receives a /quit request.
+  void Run();
+
+  // Stops all workers of the group.  May be called from any thread.
+  void QuitAll();
+
+  // What this worker measured.  Only the worker's thread updates it, but it
+  // can be read on any thread.
+  const ServerMetrics& metrics() const { return metrics_; }
+
+  // PeerChannel::Observer implementation.
+  void OnMemberChanged(const ChannelMember& member) override;
+
+  // ClusterLink::Observer implementation.  The calls are handed to the
+  // workers they concern, so they may be made on any thread.
+  void OnClusterMemberChanged(int id,
+                              const std::string& room,
+                              const SharedPayload& entry,
+                              bool connected) override;
+  void OnClusterMessage(int from_id,
+                        int to_id,
+                        const std::string& content_type,
+                        const SharedPayload& data) override;
+  void OnClusterNodeUp(int node) override;
+  void OnClusterNodeDown(int node) override;
+
+ protected:
+  typedef std::unordered_set<DataSocket*> SocketSet;
+  typedef std::function<void()> Task;
+
+  // A /rooms request that waits for the statistics of other workers.
+  struct RoomsReport {
+    DataSocket* socket;
+    RoomStatsMap stats;
+    // Number of workers that have not reported yet.
+    size_t pending;
+  };
+
+  // Runs `task` on this worker's thread.  May be called from any thread.
+  void PostTask(Task task);
+  void RunPendingTasks();
+
+  // Returns the worker that owns the member that `ds` is a request for.
+  ServerWorker* OwnerOf(const DataSocket* ds) const;
+  ServerWorker* OwnerOfMember(int id) const;
+
+  // Returns the cluster node that `id` belongs to; 0 without a cluster.
+  int NodeOfMember(int id) const;
+  int node_index() const { return cluster_ ? cluster_->node_index() : 0; }
+  int num_nodes() const { return cluster_ ? cluster_->num_nodes() : 1; }
+
+  // Tells `node` about every peer of this worker.
+  void SendMembersToNode(int node);
+
+  void OnSocketReadable(DataSocket* s);
+
+  // Handles the request received on `s` and the requests pipelined after
+  // it, until one has to wait for an answer or belongs to another worker.
+  void HandleReceivedRequests(DataSocket* s);
+  void OnSocketWritable(DataSocket* s);
+
+  // Takes over a socket with a complete request from another worker.
+  void AdoptSocket(DataSocket* s);
+
+  // Stops watching `s` and gives up ownership without closing it.
+  void ReleaseSocket(DataSocket* s);
+
+  // Closes `s` once its buffered output has been written.
+  void CloseSocketWhenFlushed(DataSocket* s);
+  void CloseSocket(DataSocket* s);
+
+  // Handles a fully received request.  Sets `socket_done` to false if the
+  // socket has to be kept open.
+  void HandleRequest(DataSocket* s, bool* socket_done);
+
+  // Relays a /message request to a peer that is owned by another worker or
+  // node.
+  void ForwardToRemotePeer(const ChannelMember& member,
+                           DataSocket* ds,
+                           int peer_id);
+
+  // Collects the room statistics of all workers for the /rooms request on
+  // `s` and answers it once the last one arrived.
+  void StartRoomsReport(DataSocket* s);
+  void OnRoomStats(uint64_t report_id, const RoomStatsMap& stats);
+  void FinishRoomsReport(uint64_t report_id);
+
+  // Answers a /metrics request with the metrics of all workers, which are
+  // read without involving them.
+  void SendMetrics(DataSocket* s);
+
+  void AcceptConnection();
+  void Shutdown();
+
+  const size_t index_;
+  const Group* const group_;
+  const size_t max_connections_;
+  ClusterLink* const cluster_;
+  ListeningSocket listener_;
+  SignalSocket wakeup_;
+  std::unique_ptr<EventLoop> event_loop_;
+  // Declared before the channel and the sockets that refer to it.
+  ServerMetrics metrics_;
+  PeerChannel clients_;
+  SocketSet sockets_;
+  // Sockets that are done but still have output to write.
+  SocketSet closing_;
+  std::unordered_map<uint64_t, RoomsReport> rooms_reports_;
+  uint64_t next_report_id_;
+  MpscQueue<Task> mailbox_;
+  std::atomic<bool> wakeup_pending_;
+  std::atomic<bool> quit_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_SERVER_SERVER_WORKER_H_
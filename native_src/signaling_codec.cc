@@ -0,0 +1,617 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/client/signaling_codec.h"
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "rtc_base/checks.h"
+
+namespace {
+
+// Names used for a IceCandidate JSON object.
+constexpr char kCandidateSdpMidName[] = "sdpMid";
+constexpr char kCandidateSdpMlineIndexName[] = "sdpMLineIndex";
+constexpr char kCandidateSdpName[] = "candidate";
+
+// Name of the array of IceCandidate JSON objects in a batch.
+constexpr char kCandidatesName[] = "candidates";
+
+// Names used for a SessionDescription JSON object.
+constexpr char kSessionDescriptionTypeName[] = "type";
+constexpr char kSessionDescriptionSdpName[] = "sdp";
+
+// Added to the JSON messages of peers that can decode the compact encoding.
+constexpr char kCompactSupportedName[] = "compactSignaling";
+
+// This is our magical hangup signal.
+constexpr char kByeMessage[] = "BYE";
+
+// Prefixes of the compact encoding: a marker that cannot start a JSON text,
+// the version, and the kind of message.
+constexpr char kCompactPrefix[] = "~1";
+constexpr char kCompactSessionDescription = 'd';
+constexpr char kCompactCandidate = 'c';
+constexpr char kCompactCandidateBatch = 'b';
+
+// Unknown JSON values are skipped, up to this nesting depth.
+constexpr int kMaxJsonDepth = 16;
+
+// Parses an integer that makes up all of `value`.
+bool ParseInt(absl::string_view value, int* result) {
+  const char* end = value.data() + value.size();
+  std::from_chars_result parsed = std::from_chars(value.data(), end, *result);
+  return !value.empty() && parsed.ec == std::errc() && parsed.ptr == end;
+}
+
+void AppendUtf8(uint32_t code_point, std::string* out) {
+  if (code_point < 0x80) {
+    *out += static_cast<char>(code_point);
+  } else if (code_point < 0x800) {
+    *out += static_cast<char>(0xC0 | (code_point >> 6));
+    *out += static_cast<char>(0x80 | (code_point & 0x3F));
+  } else if (code_point < 0x10000) {
+    *out += static_cast<char>(0xE0 | (code_point >> 12));
+    *out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+    *out += static_cast<char>(0x80 | (code_point & 0x3F));
+  } else {
+    *out += static_cast<char>(0xF0 | (code_point >> 18));
+    *out += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+    *out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+    *out += static_cast<char>(0x80 | (code_point & 0x3F));
+  }
+}
+
+// Reads the flat JSON objects of the signaling messages.  Strings without
+// escapes are returned as views into the data, others are unescaped into
+// `scratch`, which never needs more room than the data itself.
+class JsonReader {
+ public:
+  JsonReader(absl::string_view data, std::string* scratch)
+      : data_(data), pos_(0), scratch_(scratch) {
+    scratch_->clear();
+    scratch_->reserve(data.size());
+  }
+
+  // Consumes `c` after optional whitespace, if it comes next.
+  bool Consume(char c) {
+    SkipWhitespace();
+    if (pos_ == data_.size() || data_[pos_] != c)
+      return false;
+    ++pos_;
+    return true;
+  }
+
+  bool AtEnd() {
+    SkipWhitespace();
+    return pos_ == data_.size();
+  }
+
+  bool ReadString(absl::string_view* value) {
+    if (!Consume('"'))
+      return false;
+    size_t start = pos_;
+    while (pos_ < data_.size() && data_[pos_] != '"' && data_[pos_] != '\\')
+      ++pos_;
+    if (pos_ == data_.size())
+      return false;
+    if (data_[pos_] == '"') {
+      *value = data_.substr(start, pos_++ - start);
+      return true;
+    }
+    return ReadEscapedString(start, value);
+  }
+
+  // Accepts integral numbers, and strings that hold one.
+  bool ReadInt(int* value) {
+    SkipWhitespace();
+    if (pos_ < data_.size() && data_[pos_] == '"') {
+      absl::string_view text;
+      return ReadString(&text) && ParseInt(text, value);
+    }
+    return ParseInt(ReadLiteral(), value);
+  }
+
+  bool ReadBool(bool* value) {
+    SkipWhitespace();
+    absl::string_view literal = ReadLiteral();
+    *value = literal == "true";
+    return *value || literal == "false";
+  }
+
+  bool SkipValue(int depth) {
+    if (depth > kMaxJsonDepth)
+      return false;
+    SkipWhitespace();
+    if (pos_ == data_.size())
+      return false;
+    char c = data_[pos_];
+    if (c == '"')
+      return SkipString();
+    if (c != '{' && c != '[')
+      return !ReadLiteral().empty();
+
+    ++pos_;
+    char close = c == '{' ? '}' : ']';
+    if (Consume(close))
+      return true;
+    do {
+      if (c == '{' && (!SkipString() || !Consume(':')))
+        return false;
+      if (!SkipValue(depth + 1))
+        return false;
+    } while (Consume(','));
+    return Consume(close);
+  }
+
+ private:
+  void SkipWhitespace() {
+    while (pos_ < data_.size() &&
+           (data_[pos_] == ' ' || data_[pos_] == '\t' || data_[pos_] == '\n' ||
+            data_[pos_] == '\r')) {
+      ++pos_;
+    }
+  }
+
+  // Numbers, true, false and null.
+  absl::string_view ReadLiteral() {
+    size_t start = pos_;
+    while (pos_ < data_.size()) {
+      char c = data_[pos_];
+      if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+            (c >= 'A' && c <= 'Z') || c == '-' || c == '+' || c == '.')) {
+        break;
+      }
+      ++pos_;
+    }
+    return data_.substr(start, pos_ - start);
+  }
+
+  bool SkipString() {
+    if (!Consume('"'))
+      return false;
+    while (pos_ < data_.size() && data_[pos_] != '"')
+      pos_ += data_[pos_] == '\\' ? 2 : 1;
+    if (pos_ >= data_.size())
+      return false;
+    ++pos_;
+    return true;
+  }
+
+  // Continues ReadString() at the first escape of the string at `start`.
+  bool ReadEscapedString(size_t start, absl::string_view* value) {
+    size_t begin = scratch_->size();
+    scratch_->append(data_.data() + start, pos_ - start);
+    while (pos_ < data_.size()) {
+      // Copy the characters up to the next escape or the end in one go.
+      size_t run = pos_;
+      while (pos_ < data_.size() && data_[pos_] != '"' && data_[pos_] != '\\')
+        ++pos_;
+      scratch_->append(data_.data() + run, pos_ - run);
+      if (pos_ == data_.size())
+        return false;
+      if (data_[pos_++] == '"') {
+        RTC_DCHECK_LE(scratch_->size(), scratch_->capacity());
+        *value = absl::string_view(*scratch_).substr(begin);
+        return true;
+      }
+      if (pos_ == data_.size())
+        return false;
+      char c = data_[pos_++];
+      switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+          *scratch_ += c;
+          break;
+        case 'b':
+          *scratch_ += '\b';
+          break;
+        case 'f':
+          *scratch_ += '\f';
+          break;
+        case 'n':
+          *scratch_ += '\n';
+          break;
+        case 'r':
+          *scratch_ += '\r';
+          break;
+        case 't':
+          *scratch_ += '\t';
+          break;
+        case 'u': {
+          uint32_t code_point = 0;
+          if (!ReadHex4(&code_point))
+            return false;
+          if (code_point >= 0xD800 && code_point < 0xDC00) {
+            // The high half of a surrogate pair.
+            uint32_t low = 0;
+            if (pos_ + 2 > data_.size() || data_[pos_] != '\\' ||
+                data_[pos_ + 1] != 'u') {
+              return false;
+            }
+            pos_ += 2;
+            if (!ReadHex4(&low) || low < 0xDC00 || low >= 0xE000)
+              return false;
+            code_point = 0x10000 + ((code_point - 0xD800) << 10) +
+                         (low - 0xDC00);
+          } else if (code_point >= 0xDC00 && code_point < 0xE000) {
+            return false;
+          }
+          AppendUtf8(code_point, scratch_);
+          break;
+        }
+        default:
+          return false;
+      }
+    }
+    return false;
+  }
+
+  bool ReadHex4(uint32_t* value) {
+    if (data_.size() - pos_ < 4)
+      return false;
+    const char* begin = data_.data() + pos_;
+    std::from_chars_result parsed =
+        std::from_chars(begin, begin + 4, *value, 16);
+    if (parsed.ec != std::errc() || parsed.ptr != begin + 4)
+      return false;
+    pos_ += 4;
+    return true;
+  }
+
+  const absl::string_view data_;
+  size_t pos_;
+  std::string* const scratch_;
+};
+
+// Reads an IceCandidate JSON object.
+bool ReadJsonCandidate(JsonReader* reader, SignalingCandidate* candidate) {
+  if (!reader->Consume('{'))
+    return false;
+  bool has_mid = false, has_index = false, has_candidate = false;
+  if (!reader->Consume('}')) {
+    do {
+      absl::string_view key;
+      if (!reader->ReadString(&key) || !reader->Consume(':'))
+        return false;
+      bool ok;
+      if (key == kCandidateSdpMidName) {
+        ok = has_mid = reader->ReadString(&candidate->sdp_mid);
+      } else if (key == kCandidateSdpMlineIndexName) {
+        ok = has_index = reader->ReadInt(&candidate->sdp_mline_index);
+      } else if (key == kCandidateSdpName) {
+        ok = has_candidate = reader->ReadString(&candidate->candidate);
+      } else {
+        ok = reader->SkipValue(1);
+      }
+      if (!ok)
+        return false;
+    } while (reader->Consume(','));
+    if (!reader->Consume('}'))
+      return false;
+  }
+  return has_mid && has_index && has_candidate;
+}
+
+// Reads an array of IceCandidate JSON objects.
+bool ReadJsonCandidates(JsonReader* reader,
+                        std::vector<SignalingCandidate>* candidates) {
+  if (!reader->Consume('['))
+    return false;
+  if (reader->Consume(']'))
+    return true;
+  do {
+    candidates->emplace_back();
+    if (!ReadJsonCandidate(reader, &candidates->back()))
+      return false;
+  } while (reader->Consume(','));
+  return reader->Consume(']');
+}
+
+// Reads a <length> ':' <bytes> field of the compact encoding.
+bool ReadCompactField(absl::string_view* data, absl::string_view* field) {
+  size_t colon = data->find(':');
+  int length = 0;
+  if (colon == absl::string_view::npos ||
+      !ParseInt(data->substr(0, colon), &length) || length < 0 ||
+      static_cast<size_t>(length) > data->size() - colon - 1) {
+    return false;
+  }
+  *field = data->substr(colon + 1, length);
+  data->remove_prefix(colon + 1 + length);
+  return true;
+}
+
+// Reads the <sdp_mid> <sdp_mline_index> <candidate> fields of a candidate.
+bool ReadCompactCandidate(absl::string_view* data,
+                          SignalingCandidate* candidate) {
+  absl::string_view index;
+  return ReadCompactField(data, &candidate->sdp_mid) &&
+         ReadCompactField(data, &index) &&
+         ParseInt(index, &candidate->sdp_mline_index) &&
+         ReadCompactField(data, &candidate->candidate);
+}
+
+}  // namespace
+
+void SignalingMessage::Clear() {
+  kind = INVALID;
+  type = absl::string_view();
+  sdp = absl::string_view();
+  candidates.clear();
+  compact_supported = false;
+}
+
+SignalingCodec::SignalingCodec() {}
+
+SignalingCodec::~SignalingCodec() {}
+
+bool SignalingCodec::Decode(absl::string_view data,
+                            SignalingMessage* message) {
+  RTC_DCHECK(message);
+  message->Clear();
+  bool ok;
+  if (IsBye(data)) {
+    message->kind = SignalingMessage::BYE;
+    ok = true;
+  } else if (data.substr(0, 2) == kCompactPrefix) {
+    ok = DecodeCompact(data, message);
+  } else {
+    ok = DecodeJson(data, message);
+  }
+  if (!ok)
+    message->Clear();
+  return ok;
+}
+
+bool SignalingCodec::DecodeJson(absl::string_view data,
+                                SignalingMessage* message) {
+  JsonReader reader(data, &scratch_);
+  if (!reader.Consume('{'))
+    return false;
+
+  // A single candidate is sent as the members of the message itself.
+  SignalingCandidate candidate;
+  bool has_mid = false, has_index = false, has_candidate = false;
+  bool has_candidates = false;
+  if (!reader.Consume('}')) {
+    do {
+      absl::string_view key;
+      if (!reader.ReadString(&key) || !reader.Consume(':'))
+        return false;
+      bool ok;
+      if (key == kSessionDescriptionTypeName) {
+        ok = reader.ReadString(&message->type);
+      } else if (key == kSessionDescriptionSdpName) {
+        ok = reader.ReadString(&message->sdp);
+      } else if (key == kCandidateSdpMidName) {
+        ok = has_mid = reader.ReadString(&candidate.sdp_mid);
+      } else if (key == kCandidateSdpMlineIndexName) {
+        ok = has_index = reader.ReadInt(&candidate.sdp_mline_index);
+      } else if (key == kCandidateSdpName) {
+        ok = has_candidate = reader.ReadString(&candidate.candidate);
+      } else if (key == kCandidatesName) {
+        ok = has_candidates =
+            ReadJsonCandidates(&reader, &message->candidates);
+      } else if (key == kCompactSupportedName) {
+        ok = reader.ReadBool(&message->compact_supported);
+      } else {
+        ok = reader.SkipValue(0);
+      }
+      if (!ok)
+        return false;
+    } while (reader.Consume(','));
+    if (!reader.Consume('}'))
+      return false;
+  }
+  if (!reader.AtEnd())
+    return false;
+
+  bool single = has_mid && has_index && has_candidate;
+  if (!message->type.empty()) {
+    message->kind = SignalingMessage::SESSION_DESCRIPTION;
+  } else if (single != has_candidates) {
+    if (single)
+      message->candidates.push_back(candidate);
+    if (message->candidates.empty())
+      return false;
+    message->kind = SignalingMessage::CANDIDATES;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool SignalingCodec::DecodeCompact(absl::string_view data,
+                                   SignalingMessage* message) {
+  if (data.size() < 3)
+    return false;
+  char kind = data[2];
+  data.remove_prefix(3);
+  message->compact_supported = true;
+
+  if (kind == kCompactSessionDescription) {
+    message->kind = SignalingMessage::SESSION_DESCRIPTION;
+    return ReadCompactField(&data, &message->type) &&
+           ReadCompactField(&data, &message->sdp) && data.empty() &&
+           !message->type.empty();
+  }
+
+  if (kind == kCompactCandidate) {
+    message->kind = SignalingMessage::CANDIDATES;
+    message->candidates.emplace_back();
+    return ReadCompactCandidate(&data, &message->candidates.back()) &&
+           data.empty();
+  }
+
+  if (kind == kCompactCandidateBatch) {
+    absl::string_view field;
+    int count = 0;
+    if (!ReadCompactField(&data, &field) || !ParseInt(field, &count) ||
+        count <= 0) {
+      return false;
+    }
+    message->kind = SignalingMessage::CANDIDATES;
+    for (int i = 0; i < count; ++i) {
+      message->candidates.emplace_back();
+      if (!ReadCompactCandidate(&data, &message->candidates.back()))
+        return false;
+    }
+    return data.empty();
+  }
+
+  return false;
+}
+
+absl::string_view SignalingCodec::EncodeSessionDescription(
+    Encoding encoding,
+    absl::string_view type,
+    absl::string_view sdp) {
+  output_.clear();
+  if (encoding == COMPACT) {
+    output_ += kCompactPrefix;
+    output_ += kCompactSessionDescription;
+    AppendCompactField(type);
+    AppendCompactField(sdp);
+    return output_;
+  }
+
+  absl::StrAppend(&output_, "{\"", kSessionDescriptionTypeName, "\":");
+  AppendJsonString(type);
+  absl::StrAppend(&output_, ",\"", kSessionDescriptionSdpName, "\":");
+  AppendJsonString(sdp);
+  absl::StrAppend(&output_, ",\"", kCompactSupportedName, "\":true}");
+  return output_;
+}
+
+absl::string_view SignalingCodec::EncodeCandidate(Encoding encoding,
+                                                  absl::string_view sdp_mid,
+                                                  int sdp_mline_index,
+                                                  absl::string_view candidate) {
+  output_.clear();
+  SignalingCandidate value(sdp_mid, sdp_mline_index, candidate);
+  if (encoding == COMPACT) {
+    output_ += kCompactPrefix;
+    output_ += kCompactCandidate;
+    AppendCompactCandidate(value);
+    return output_;
+  }
+
+  output_ += '{';
+  AppendJsonCandidate(value);
+  absl::StrAppend(&output_, ",\"", kCompactSupportedName, "\":true}");
+  return output_;
+}
+
+absl::string_view SignalingCodec::EncodeCandidates(
+    Encoding encoding,
+    const std::vector<SignalingCandidate>& candidates) {
+  RTC_DCHECK(!candidates.empty());
+  output_.clear();
+  if (encoding == COMPACT) {
+    output_ += kCompactPrefix;
+    output_ += kCompactCandidateBatch;
+    char count[16];
+    std::to_chars_result end =
+        std::to_chars(count, count + sizeof(count), candidates.size());
+    AppendCompactField(absl::string_view(count, end.ptr - count));
+    for (const SignalingCandidate& candidate : candidates)
+      AppendCompactCandidate(candidate);
+    return output_;
+  }
+
+  absl::StrAppend(&output_, "{\"", kCandidatesName, "\":[");
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    output_ += i ? ",{" : "{";
+    AppendJsonCandidate(candidates[i]);
+    output_ += '}';
+  }
+  absl::StrAppend(&output_, "],\"", kCompactSupportedName, "\":true}");
+  return output_;
+}
+
+absl::string_view SignalingCodec::EncodeBye() {
+  return kByeMessage;
+}
+
+bool SignalingCodec::IsBye(absl::string_view data) {
+  return data == kByeMessage;
+}
+
+void SignalingCodec::AppendJsonCandidate(
+    const SignalingCandidate& candidate) {
+  // The members only, so that they can be followed by others.
+  absl::StrAppend(&output_, "\"", kCandidateSdpMidName, "\":");
+  AppendJsonString(candidate.sdp_mid);
+  absl::StrAppend(&output_, ",\"", kCandidateSdpMlineIndexName,
+                  "\":", candidate.sdp_mline_index, ",\"", kCandidateSdpName,
+                  "\":");
+  AppendJsonString(candidate.candidate);
+}
+
+void SignalingCodec::AppendJsonString(absl::string_view value) {
+  static const char kHex[] = "0123456789abcdef";
+  output_ += '"';
+  size_t run = 0;
+  for (size_t i = 0; i < value.size(); ++i) {
+    unsigned char c = static_cast<unsigned char>(value[i]);
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    // Copy the characters that need no escaping in one go.
+    output_.append(value.data() + run, i - run);
+    run = i + 1;
+    switch (c) {
+      case '"':
+        output_ += "\\\"";
+        break;
+      case '\\':
+        output_ += "\\\\";
+        break;
+      case '\n':
+        output_ += "\\n";
+        break;
+      case '\r':
+        output_ += "\\r";
+        break;
+      case '\t':
+        output_ += "\\t";
+        break;
+      default:
+        output_ += "\\u00";
+        output_ += kHex[c >> 4];
+        output_ += kHex[c & 0xF];
+        break;
+    }
+  }
+  output_.append(value.data() + run, value.size() - run);
+  output_ += '"';
+}
+
+void SignalingCodec::AppendCompactCandidate(
+    const SignalingCandidate& candidate) {
+  AppendCompactField(candidate.sdp_mid);
+  char index[16];
+  std::to_chars_result end =
+      std::to_chars(index, index + sizeof(index), candidate.sdp_mline_index);
+  AppendCompactField(absl::string_view(index, end.ptr - index));
+  AppendCompactField(candidate.candidate);
+}
+
+void SignalingCodec::AppendCompactField(absl::string_view value) {
+  absl::StrAppend(&output_, value.size(), ":", value);
+}
@@ -0,0 +1,130 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_CLIENT_SIGNALING_CODEC_H_
+#define EXAMPLES_PEERCONNECTION_CLIENT_SIGNALING_CODEC_H_
+
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+// A trickled ICE candidate.
+struct SignalingCandidate {
+  SignalingCandidate() : sdp_mline_index(0) {}
+  SignalingCandidate(absl::string_view sdp_mid,
+                     int sdp_mline_index,
+                     absl::string_view candidate)
+      : sdp_mid(sdp_mid),
+        sdp_mline_index(sdp_mline_index),
+        candidate(candidate) {}
+
+  absl::string_view sdp_mid;
+  int sdp_mline_index;
+  absl::string_view candidate;
+};
+
+// A message exchanged between the peers.  The views point into the decoded
+// data or into the codec that decoded it.  Reusing a message for the next
+// Decode() reuses the memory of `candidates`.
+struct SignalingMessage {
+  enum Kind {
+    INVALID,
+    // An offer or answer; `type` is e.g. "offer" and `sdp` the description.
+    SESSION_DESCRIPTION,
+    // One or more trickled ICE candidates.
+    CANDIDATES,
+    // The peer hung up.
+    BYE,
+  };
+
+  SignalingMessage() : kind(INVALID), compact_supported(false) {}
+
+  // Resets the message, keeping the capacity of `candidates`.
+  void Clear();
+
+  Kind kind;
+  absl::string_view type;
+  absl::string_view sdp;
+  std::vector<SignalingCandidate> candidates;
+  // Set if the sender can decode the compact encoding and candidate
+  // batches, either because it said so or because the message used them.
+  bool compact_supported;
+};
+
+// Encodes and decodes the signaling messages without a JSON library and
+// without allocating once its buffers have grown to the size of the
+// messages.  Two encodings are understood:
+//
+//   JSON, e.g. {"type":"offer","sdp":"v=0\r\n..."} as before, which every
+//   peer can read.  The codec adds "compactSignaling":true to say that it
+//   understands the compact encoding as well.
+//
+//   Compact, "~1d" <type> <sdp> for session descriptions,
+//   "~1c" <sdp_mid> <sdp_mline_index> <candidate> for candidates and
+//   "~1b" <count> followed by the fields of each candidate for batches of
+//   them, where each field is written as <decimal length> ':' <bytes>.
+//   Nothing needs escaping, so decoded fields point straight into the
+//   received data.
+//
+// Batches of candidates, {"candidates":[{...},...]} in JSON, and the compact
+// encoding may only be sent to peers that have announced support.
+//
+// A codec is not thread safe; use one per thread.
+class SignalingCodec {
+ public:
+  enum Encoding {
+    JSON,
+    COMPACT,
+  };
+
+  SignalingCodec();
+  SignalingCodec(const SignalingCodec&) = delete;
+  SignalingCodec& operator=(const SignalingCodec&) = delete;
+  ~SignalingCodec();
+
+  // Decodes `data` into `message`.  Returns false, with `message` left
+  // INVALID, if `data` is none of the known messages.  The views in
+  // `message` stay valid as long as `data` and until the next Decode().
+  bool Decode(absl::string_view data, SignalingMessage* message);
+
+  // The encoders return a view into the codec that stays valid until the
+  // next call of an encoder.
+  absl::string_view EncodeSessionDescription(Encoding encoding,
+                                             absl::string_view type,
+                                             absl::string_view sdp);
+  absl::string_view EncodeCandidate(Encoding encoding,
+                                    absl::string_view sdp_mid,
+                                    int sdp_mline_index,
+                                    absl::string_view candidate);
+  absl::string_view EncodeCandidates(
+      Encoding encoding,
+      const std::vector<SignalingCandidate>& candidates);
+
+  // The hang up message is the same in every encoding.
+  static absl::string_view EncodeBye();
+  static bool IsBye(absl::string_view data);
+
+ protected:
+  bool DecodeJson(absl::string_view data, SignalingMessage* message);
+  bool DecodeCompact(absl::string_view data, SignalingMessage* message);
+
+  void AppendJsonCandidate(const SignalingCandidate& candidate);
+  void AppendJsonString(absl::string_view value);
+  void AppendCompactCandidate(const SignalingCandidate& candidate);
+  void AppendCompactField(absl::string_view value);
+
+  // Unescaped JSON strings.  Reserved to the size of the message before
+  // decoding, so that appending never moves what was decoded already.
+  std::string scratch_;
+  std::string output_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_CLIENT_SIGNALING_CODEC_H_
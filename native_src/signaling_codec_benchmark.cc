@@ -0,0 +1,181 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+// Encodes and decodes session descriptions and candidates with
+// SignalingCodec, in both of its encodings, and with JsonCpp the way
+// Conductor used to, and reports what a round trip costs for each.
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "examples/peerconnection/client/signaling_codec.h"
+#include "json/reader.h"
+#include "json/value.h"
+#include "json/writer.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/strings/json.h"
+
+ABSL_FLAG(int, iterations, 100000, "Round trips of each message.");
+ABSL_FLAG(int,
+          description_bytes,
+          3000,
+          "Size of the session description, which is made of lines of 82 "
+          "bytes.");
+
+namespace {
+
+const char kCandidate[] =
+    "candidate:842163049 1 udp 1677729535 203.0.113.7 46154 typ srflx "
+    "raddr 10.0.0.2 rport 46154 generation 0 ufrag EsAw network-cost 999";
+
+std::string MakeDescription(size_t size) {
+  std::string sdp = "v=0\r\n";
+  for (int i = 1; sdp.size() < size; ++i) {
+    absl::StrAppend(&sdp, "a=fmtp:", 96 + i % 32,
+                    " level-asymmetry-allowed=1;packetization-mode=1;"
+                    "profile-level-id=42e01f\r\n");
+  }
+  return sdp;
+}
+
+// One side of the exchange, which encodes what the other decodes.
+class Codec {
+ public:
+  virtual ~Codec() {}
+  virtual void RoundTripDescription(absl::string_view sdp) = 0;
+  virtual void RoundTripCandidate() = 0;
+};
+
+class SignalingCodecRoundTrip : public Codec {
+ public:
+  explicit SignalingCodecRoundTrip(SignalingCodec::Encoding encoding)
+      : encoding_(encoding) {}
+
+  void RoundTripDescription(absl::string_view sdp) override {
+    absl::string_view data =
+        sender_.EncodeSessionDescription(encoding_, "offer", sdp);
+    RTC_CHECK(receiver_.Decode(data, &message_));
+    RTC_CHECK(message_.sdp.size() == sdp.size());
+  }
+
+  void RoundTripCandidate() override {
+    absl::string_view data =
+        sender_.EncodeCandidate(encoding_, "0", 0, kCandidate);
+    RTC_CHECK(receiver_.Decode(data, &message_));
+    RTC_CHECK_EQ(message_.candidates.size(), 1);
+  }
+
+ private:
+  const SignalingCodec::Encoding encoding_;
+  SignalingCodec sender_;
+  SignalingCodec receiver_;
+  SignalingMessage message_;
+};
+
+// What Conductor did before the codec: a new writer for every message sent
+// and a new reader for every message received.
+class JsonCppRoundTrip : public Codec {
+ public:
+  void RoundTripDescription(absl::string_view sdp) override {
+    Json::Value jmessage;
+    jmessage["type"] = "offer";
+    jmessage["sdp"] = std::string(sdp);
+    Json::Value received = Parse(Write(jmessage));
+    std::string type;
+    std::string received_sdp;
+    RTC_CHECK(webrtc::GetStringFromJsonObject(received, "type", &type));
+    RTC_CHECK(webrtc::GetStringFromJsonObject(received, "sdp", &received_sdp));
+    RTC_CHECK(received_sdp.size() == sdp.size());
+  }
+
+  void RoundTripCandidate() override {
+    Json::Value jmessage;
+    jmessage["sdpMid"] = "0";
+    jmessage["sdpMLineIndex"] = 0;
+    jmessage["candidate"] = kCandidate;
+    Json::Value received = Parse(Write(jmessage));
+    std::string sdp_mid;
+    int sdp_mline_index = 0;
+    std::string candidate;
+    RTC_CHECK(webrtc::GetStringFromJsonObject(received, "sdpMid", &sdp_mid));
+    RTC_CHECK(webrtc::GetIntFromJsonObject(received, "sdpMLineIndex",
+                                           &sdp_mline_index));
+    RTC_CHECK(
+        webrtc::GetStringFromJsonObject(received, "candidate", &candidate));
+  }
+
+ private:
+  static std::string Write(const Json::Value& jmessage) {
+    Json::StreamWriterBuilder factory;
+    return Json::writeString(factory, jmessage);
+  }
+
+  static Json::Value Parse(const std::string& message) {
+    Json::CharReaderBuilder factory;
+    std::unique_ptr<Json::CharReader> reader(factory.newCharReader());
+    Json::Value jmessage;
+    RTC_CHECK(reader->parse(message.data(), message.data() + message.length(),
+                            &jmessage, nullptr));
+    return jmessage;
+  }
+};
+
+template <typename RoundTrip>
+double Microseconds(int iterations, RoundTrip round_trip) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    round_trip();
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+void Run(const char* name,
+         Codec* codec,
+         const std::string& sdp,
+         int iterations) {
+  double description = Microseconds(
+      iterations, [codec, &sdp] { codec->RoundTripDescription(sdp); });
+  double candidate =
+      Microseconds(iterations, [codec] { codec->RoundTripCandidate(); });
+  printf("%-16s description %6.2f us, candidate %6.2f us per round trip\n",
+         name, description, candidate);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(
+      "Example usage: ./signaling_codec_benchmark --iterations=10000\n");
+  absl::ParseCommandLine(argc, argv);
+
+  const int iterations = std::max(absl::GetFlag(FLAGS_iterations), 1);
+  const std::string sdp =
+      MakeDescription(std::max(absl::GetFlag(FLAGS_description_bytes), 0));
+  printf("description of %zu bytes, candidate of %zu bytes\n", sdp.size(),
+         sizeof(kCandidate) - 1);
+
+  JsonCppRoundTrip json_cpp;
+  SignalingCodecRoundTrip codec_json(SignalingCodec::JSON);
+  SignalingCodecRoundTrip codec_compact(SignalingCodec::COMPACT);
+  Run("JsonCpp", &json_cpp, sdp, iterations);
+  Run("codec, JSON", &codec_json, sdp, iterations);
+  Run("codec, compact", &codec_compact, sdp, iterations);
+  return 0;
+}
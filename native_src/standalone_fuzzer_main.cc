@@ -0,0 +1,109 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+// Runs a fuzzer without libFuzzer: over the files named on the command
+// line, or else over a few requests that the server is sent and many
+// mutations of them.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+namespace {
+
+// The same mutations on every run, so that a failure can be repeated.
+constexpr uint64_t kSeed = 1;
+constexpr int kMutationsPerInput = 20000;
+
+const char* const kRequests[] = {
+    "GET /sign_in?alice HTTP/1.1\r\nHost: localhost\r\n\r\n",
+    "GET /wait?peer_id=1 HTTP/1.1\r\nConnection: keep-alive\r\n\r\n"
+    "GET /wait?peer_id=1 HTTP/1.1\r\n\r\n",
+    "POST /message?peer_id=1&to=2 HTTP/1.1\r\nContent-Type: text/plain\r\n"
+    "Content-Length: 5\r\n\r\nhello",
+    "GET /sign_out?peer_id=1 HTTP/1.0\r\n\r\n",
+    "GET /ws HTTP/1.1\r\nConnection: Upgrade\r\nUpgrade: websocket\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n",
+};
+
+std::string Mutate(const std::string& input, std::mt19937_64* random) {
+  std::string mutated = input;
+  int edits = 1 + (*random)() % 8;
+  for (int i = 0; i < edits; ++i) {
+    size_t position = mutated.empty() ? 0 : (*random)() % mutated.size();
+    char c = static_cast<char>((*random)());
+    switch ((*random)() % 4) {
+      case 0:
+        if (!mutated.empty())
+          mutated[position] = c;
+        break;
+      case 1:
+        mutated.insert(position, 1, c);
+        break;
+      case 2:
+        if (!mutated.empty())
+          mutated.erase(position, 1);
+        break;
+      case 3:
+        mutated.insert(position, mutated, position, (*random)() % 64);
+        break;
+    }
+  }
+  return mutated;
+}
+
+void Run(const std::string& input) {
+  LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()),
+                         input.size());
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc > 1) {
+    for (int i = 1; i < argc; ++i) {
+      std::ifstream file(argv[i], std::ios::binary);
+      if (!file) {
+        fprintf(stderr, "Failed to open %s\n", argv[i]);
+        return 1;
+      }
+      Run(std::string(std::istreambuf_iterator<char>(file),
+                      std::istreambuf_iterator<char>()));
+    }
+    printf("Ran %i inputs\n", argc - 1);
+    return 0;
+  }
+
+  std::mt19937_64 random(kSeed);
+  int runs = 0;
+  for (const char* request : kRequests) {
+    // Each request is read a byte at a time, then in one read, and then
+    // mutated, sizes of reads included.
+    std::string sizes_and_data;
+    for (const char* c = request; *c; ++c) {
+      sizes_and_data += static_cast<char>(0);
+      sizes_and_data += *c;
+    }
+    Run(sizes_and_data);
+    Run(std::string(1, static_cast<char>(255)) + request);
+    runs += 2;
+    for (int i = 0; i < kMutationsPerInput; ++i, ++runs)
+      Run(Mutate(sizes_and_data, &random));
+  }
+  printf("Ran %i inputs\n", runs);
+  return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/server/timeout_queue.h"
+
+#include <chrono>
+#include <vector>
+
+#include "rtc_base/checks.h"
+
+void TimeoutQueue::Touch(int id) {
+  Cancel(id);
+  Clock::time_point deadline = Clock::now() + timeout_;
+  deadlines_[id] = deadline;
+  queue_.insert(Entry(deadline, id));
+}
+
+void TimeoutQueue::Cancel(int id) {
+  std::unordered_map<int, Clock::time_point>::iterator found =
+      deadlines_.find(id);
+  if (found == deadlines_.end())
+    return;
+  queue_.erase(Entry(found->second, id));
+  deadlines_.erase(found);
+}
+
+void TimeoutQueue::Expire(int id) {
+  Cancel(id);
+  // Has passed for any `now`.
+  Clock::time_point deadline = Clock::time_point::min();
+  deadlines_[id] = deadline;
+  queue_.insert(Entry(deadline, id));
+}
+
+void TimeoutQueue::PopExpired(Clock::time_point now,
+                              std::vector<int>* expired) {
+  RTC_DCHECK(expired);
+  while (!queue_.empty() && queue_.begin()->first <= now) {
+    int id = queue_.begin()->second;
+    queue_.erase(queue_.begin());
+    deadlines_.erase(id);
+    expired->push_back(id);
+  }
+}
+
+int TimeoutQueue::MillisecondsUntilNextDeadline(Clock::time_point now) const {
+  if (queue_.empty())
+    return -1;
+  Clock::time_point deadline = queue_.begin()->first;
+  if (deadline <= now)
+    return 0;
+  return static_cast<int>(
+      std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count());
+}
@@ -0,0 +1,56 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_SERVER_TIMEOUT_QUEUE_H_
+#define EXAMPLES_PEERCONNECTION_SERVER_TIMEOUT_QUEUE_H_
+
+#include <chrono>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Keeps track of when each member times out, ordered by deadline, so that
+// expiring members costs O(expired) instead of a scan over all members.
+// Deadlines use a monotonic clock.
+class TimeoutQueue {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  explicit TimeoutQueue(Clock::duration timeout) : timeout_(timeout) {}
+
+  Clock::duration timeout() const { return timeout_; }
+
+  // (Re)starts the timeout of the member with the given `id`.
+  void Touch(int id);
+
+  // Stops the timeout of `id`, e.g. while it is waiting on a hanging GET.
+  void Cancel(int id);
+
+  // Makes `id` time out at the next call to PopExpired().
+  void Expire(int id);
+
+  // Removes all members whose deadline is at or before `now` and appends
+  // their ids to `expired`.
+  void PopExpired(Clock::time_point now, std::vector<int>* expired);
+
+  // Returns the number of milliseconds until the next deadline, rounded up,
+  // or -1 if no timeout is pending.
+  int MillisecondsUntilNextDeadline(Clock::time_point now) const;
+
+ private:
+  typedef std::pair<Clock::time_point, int> Entry;
+
+  const Clock::duration timeout_;
+  std::set<Entry> queue_;
+  std::unordered_map<int, Clock::time_point> deadlines_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_SERVER_TIMEOUT_QUEUE_H_
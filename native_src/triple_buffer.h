@@ -0,0 +1,68 @@
+/*
+ *  Copyright 2012 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_CLIENT_TRIPLE_BUFFER_H_
+#define EXAMPLES_PEERCONNECTION_CLIENT_TRIPLE_BUFFER_H_
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free handoff of the newest value from a single producer thread to a
+// single consumer thread through three preallocated slots.  The producer
+// fills its slot and publishes it; the consumer takes the most recently
+// published slot.  Neither ever waits for the other: a slot that was
+// published but not taken before the next one is simply reused, and each
+// side owns its slot until it exchanges it for another.
+template <typename T>
+class TripleBuffer {
+ public:
+  TripleBuffer()
+      : back_(0), middle_(1), front_(2), has_front_(false) {}
+  TripleBuffer(const TripleBuffer&) = delete;
+  TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+  // The slot to fill.  It still holds whatever was last written to it.
+  // Producer only.
+  T* back() { return &slots_[back_]; }
+
+  // Makes back() the newest value and hands the producer another slot.
+  // Producer only.
+  void Publish() {
+    uint8_t previous =
+        middle_.exchange(back_ | kFresh, std::memory_order_acq_rel);
+    back_ = previous & kIndexMask;
+  }
+
+  // Returns the newest published value, which stays untouched by the
+  // producer until the next call, or null if nothing was published yet.
+  // Consumer only.
+  T* Acquire() {
+    if (middle_.load(std::memory_order_relaxed) & kFresh) {
+      uint8_t previous = middle_.exchange(front_, std::memory_order_acq_rel);
+      front_ = previous & kIndexMask;
+      has_front_ = true;
+    }
+    return has_front_ ? &slots_[front_] : nullptr;
+  }
+
+ private:
+  // `middle_` holds the index of the slot between the two sides, and
+  // kFresh while it was published and not yet taken.
+  static constexpr uint8_t kIndexMask = 3;
+  static constexpr uint8_t kFresh = 4;
+
+  T slots_[3];
+  uint8_t back_;
+  std::atomic<uint8_t> middle_;
+  uint8_t front_;
+  bool has_front_;
+};
+
+#endif  // EXAMPLES_PEERCONNECTION_CLIENT_TRIPLE_BUFFER_H_
@@ -0,0 +1,220 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "examples/peerconnection/server/websocket.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "rtc_base/checks.h"
+
+namespace {
+
+// Appended to the client's key before hashing it, see RFC 6455 section 1.3.
+const char kWebSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+const size_t kSha1DigestSize = 20;
+
+uint32_t RotateLeft(uint32_t value, int bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+void Sha1ProcessBlock(const uint8_t* block, uint32_t* state) {
+  uint32_t w[80];
+  for (int i = 0; i < 16; ++i) {
+    w[i] = (static_cast<uint32_t>(block[i * 4]) << 24) |
+           (static_cast<uint32_t>(block[i * 4 + 1]) << 16) |
+           (static_cast<uint32_t>(block[i * 4 + 2]) << 8) |
+           static_cast<uint32_t>(block[i * 4 + 3]);
+  }
+  for (int i = 16; i < 80; ++i)
+    w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+           e = state[4];
+  for (int i = 0; i < 80; ++i) {
+    uint32_t f, k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+    uint32_t temp = RotateLeft(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = RotateLeft(b, 30);
+    b = a;
+    a = temp;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+// SHA-1 is only used for the handshake, where the protocol mandates it; it
+// provides no security here.
+void Sha1(absl::string_view data, uint8_t* digest) {
+  uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+                       0xC3D2E1F0};
+  size_t full_blocks = data.size() / 64;
+  for (size_t i = 0; i < full_blocks; ++i)
+    Sha1ProcessBlock(reinterpret_cast<const uint8_t*>(data.data()) + i * 64,
+                     state);
+
+  // Pad the rest with 0x80, zeros and the length in bits.
+  uint8_t tail[128] = {0};
+  size_t rest = data.size() - full_blocks * 64;
+  memcpy(tail, data.data() + full_blocks * 64, rest);
+  tail[rest] = 0x80;
+  size_t tail_size = rest < 56 ? 64 : 128;
+  uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+  for (int i = 0; i < 8; ++i)
+    tail[tail_size - 1 - i] = static_cast<uint8_t>(bits >> (i * 8));
+  for (size_t i = 0; i < tail_size; i += 64)
+    Sha1ProcessBlock(tail + i, state);
+
+  for (int i = 0; i < 5; ++i) {
+    digest[i * 4] = static_cast<uint8_t>(state[i] >> 24);
+    digest[i * 4 + 1] = static_cast<uint8_t>(state[i] >> 16);
+    digest[i * 4 + 2] = static_cast<uint8_t>(state[i] >> 8);
+    digest[i * 4 + 3] = static_cast<uint8_t>(state[i]);
+  }
+}
+
+std::string Base64Encode(const uint8_t* data, size_t size) {
+  static const char kAlphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string result;
+  result.reserve((size + 2) / 3 * 4);
+  for (size_t i = 0; i < size; i += 3) {
+    uint32_t group = static_cast<uint32_t>(data[i]) << 16;
+    if (i + 1 < size)
+      group |= static_cast<uint32_t>(data[i + 1]) << 8;
+    if (i + 2 < size)
+      group |= data[i + 2];
+    result += kAlphabet[(group >> 18) & 0x3F];
+    result += kAlphabet[(group >> 12) & 0x3F];
+    result += i + 1 < size ? kAlphabet[(group >> 6) & 0x3F] : '=';
+    result += i + 2 < size ? kAlphabet[group & 0x3F] : '=';
+  }
+  return result;
+}
+
+}  // namespace
+
+std::string ComputeWebSocketAccept(absl::string_view key) {
+  std::string input(key);
+  input += kWebSocketGuid;
+  uint8_t digest[kSha1DigestSize];
+  Sha1(input, digest);
+  return Base64Encode(digest, sizeof(digest));
+}
+
+size_t BuildWebSocketFrameHeader(WebSocketOpcode opcode,
+                                 size_t payload_size,
+                                 char* header) {
+  RTC_DCHECK(header);
+  header[0] = static_cast<char>(0x80 | opcode);
+  if (payload_size < 126) {
+    header[1] = static_cast<char>(payload_size);
+    return 2;
+  }
+  if (payload_size <= 0xFFFF) {
+    header[1] = 126;
+    header[2] = static_cast<char>(payload_size >> 8);
+    header[3] = static_cast<char>(payload_size);
+    return 4;
+  }
+  header[1] = 127;
+  uint64_t size = payload_size;
+  for (int i = 0; i < 8; ++i)
+    header[9 - i] = static_cast<char>(size >> (i * 8));
+  return 10;
+}
+
+long ParseWebSocketFrame(absl::string_view data,
+                         size_t max_payload,
+                         WebSocketFrame* frame) {
+  RTC_DCHECK(frame);
+  if (data.size() < 2)
+    return 0;
+
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+  // Reserved bits are only used by extensions, and none were negotiated.
+  if (bytes[0] & 0x70)
+    return -1;
+  // Frames sent by clients must be masked.
+  if (!(bytes[1] & 0x80))
+    return -1;
+
+  bool fin = (bytes[0] & 0x80) != 0;
+  int opcode = bytes[0] & 0x0F;
+  bool control = (opcode & 0x08) != 0;
+  if (control && !fin)
+    return -1;
+
+  size_t header_size = 2;
+  uint64_t payload_size = bytes[1] & 0x7F;
+  if (payload_size == 126) {
+    header_size += 2;
+    if (data.size() < header_size)
+      return 0;
+    payload_size = (static_cast<uint64_t>(bytes[2]) << 8) | bytes[3];
+  } else if (payload_size == 127) {
+    header_size += 8;
+    if (data.size() < header_size)
+      return 0;
+    payload_size = 0;
+    for (int i = 0; i < 8; ++i)
+      payload_size = (payload_size << 8) | bytes[2 + i];
+  }
+  if (payload_size > max_payload ||
+      (control && payload_size > kMaxWebSocketControlPayload)) {
+    return -1;
+  }
+
+  const uint8_t* mask = bytes + header_size;
+  header_size += 4;
+  size_t frame_size = header_size + static_cast<size_t>(payload_size);
+  if (data.size() < frame_size)
+    return 0;
+
+  switch (opcode) {
+    case kWebSocketContinuation:
+    case kWebSocketText:
+    case kWebSocketBinary:
+    case kWebSocketClose:
+    case kWebSocketPing:
+    case kWebSocketPong:
+      break;
+    default:
+      return -1;
+  }
+
+  frame->fin = fin;
+  frame->opcode = static_cast<WebSocketOpcode>(opcode);
+  frame->payload.resize(static_cast<size_t>(payload_size));
+  for (size_t i = 0; i < frame->payload.size(); ++i)
+    frame->payload[i] = static_cast<char>(bytes[header_size + i] ^ mask[i % 4]);
+  return static_cast<long>(frame_size);
+}
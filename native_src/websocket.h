@@ -0,0 +1,73 @@
+/*
+ *  Copyright 2011 The WebRTC Project Authors. All rights reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef EXAMPLES_PEERCONNECTION_SERVER_WEBSOCKET_H_
+#define EXAMPLES_PEERCONNECTION_SERVER_WEBSOCKET_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "absl/strings/string_view.h"
+
+// The parts of the WebSocket protocol (RFC 6455) that the server needs: the
+// opening handshake and the framing of messages.  Messages are never
+// fragmented by the server, and fragmented messages from clients are not
+// supported.
+
+enum WebSocketOpcode {
+  kWebSocketContinuation = 0x0,
+  kWebSocketText = 0x1,
+  kWebSocketBinary = 0x2,
+  kWebSocketClose = 0x8,
+  kWebSocketPing = 0x9,
+  kWebSocketPong = 0xA,
+};
+
+// Status codes sent in close frames.
+enum WebSocketCloseCode {
+  kWebSocketNormalClosure = 1000,
+  kWebSocketGoingAway = 1001,
+  kWebSocketProtocolError = 1002,
+  kWebSocketUnsupportedData = 1003,
+};
+
+// The largest header that BuildWebSocketFrameHeader() writes.
+const size_t kMaxWebSocketFrameHeaderSize = 10;
+
+// Control frames never carry more than this.
+const size_t kMaxWebSocketControlPayload = 125;
+
+struct WebSocketFrame {
+  WebSocketFrame() : fin(false), opcode(kWebSocketContinuation) {}
+  bool fin;
+  WebSocketOpcode opcode;
+  // The unmasked payload.
+  std::string payload;
+};
+
+// Returns the Sec-WebSocket-Accept value that answers the Sec-WebSocket-Key
+// `key` of a handshake request.
+std::string ComputeWebSocketAccept(absl::string_view key);
+
+// Writes the header of a final, unmasked frame to `header`, which must have
+// room for kMaxWebSocketFrameHeaderSize bytes.  Returns the size written.
+size_t BuildWebSocketFrameHeader(WebSocketOpcode opcode,
+                                 size_t payload_size,
+                                 char* header);
+
+// Parses the client frame at the start of `data`.  Returns the number of
+// bytes the frame occupies, 0 if more data is needed, or -1 if the data is
+// not a valid client frame or its payload is longer than `max_payload`.
+long ParseWebSocketFrame(absl::string_view data,
+                         size_t max_payload,
+                         WebSocketFrame* frame);
+
+#endif  // EXAMPLES_PEERCONNECTION_SERVER_WEBSOCKET_H_